@@ -254,6 +254,38 @@ static inline void cl_plock_acquire(IN cl_plock_t * const p_lock)
 *	Passive Lock, cl_plock_release, cl_plock_excl_acquire
 *********/
 
+/****f* Component Library: Passive Lock/cl_plock_try_acquire
+* NAME
+*	cl_plock_try_acquire
+*
+* DESCRIPTION
+*	The cl_plock_try_acquire function acquires a passive lock for
+*	shared access if it can be done without blocking.
+*
+* SYNOPSIS
+*/
+static inline cl_status_t cl_plock_try_acquire(IN cl_plock_t * const p_lock)
+{
+	CL_ASSERT(p_lock);
+	CL_ASSERT(p_lock->state == CL_INITIALIZED);
+
+	return pthread_rwlock_tryrdlock(&p_lock->lock) ? CL_BUSY : CL_SUCCESS;
+}
+
+/*
+* PARAMETERS
+*	p_lock
+*		[in] Pointer to a cl_plock_t structure to acquire.
+*
+* RETURN VALUE
+*	CL_SUCCESS if the lock was acquired for shared access.
+*
+*	CL_BUSY if the lock is held exclusively.
+*
+* SEE ALSO
+*	Passive Lock, cl_plock_acquire, cl_plock_release
+*********/
+
 /****f* Component Library: Passive Lock/cl_plock_excl_acquire
 * NAME
 *	cl_plock_excl_acquire
@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2004-2009 Voltaire, Inc. All rights reserved.
+ * Copyright (c) 2002-2007 Mellanox Technologies LTD. All rights reserved.
+ * Copyright (c) 1996-2003 Intel Corporation. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/*
+ * Abstract:
+ *	Declaration of the CRC-32 helper shared by OpenSM modules.
+ */
+
+#ifndef _OSM_CRC32_H_
+#define _OSM_CRC32_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+#  define BEGIN_C_DECLS extern "C" {
+#  define END_C_DECLS   }
+#else				/* !__cplusplus */
+#  define BEGIN_C_DECLS
+#  define END_C_DECLS
+#endif				/* __cplusplus */
+
+BEGIN_C_DECLS
+/****f* OpenSM: Helper/osm_crc32
+* NAME
+*	osm_crc32
+*
+* DESCRIPTION
+*	Updates a CRC-32 (IEEE 802.3, reflected polynomial 0xEDB88320)
+*	with the given buffer.
+*
+* SYNOPSIS
+*/
+uint32_t osm_crc32(uint32_t crc, const void *buffer, size_t count);
+/*
+* PARAMETERS
+*	crc
+*		[in] CRC of the data preceding buffer; 0 to start a new CRC.
+*
+*	buffer
+*		[in] Pointer to the data.
+*
+*	count
+*		[in] Number of bytes in buffer.
+*
+* RETURN VALUE
+*	The CRC of the data so far.
+*
+* NOTES
+*	The lookup table is constant, so the function is safe to call
+*	from any thread.  A buffer may be fed in pieces:
+*	osm_crc32(osm_crc32(0, a, n), b, m) is the CRC of a followed by b.
+*********/
+
+END_C_DECLS
+#endif				/* _OSM_CRC32_H_ */
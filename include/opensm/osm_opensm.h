@@ -263,6 +263,8 @@ typedef struct osm_opensm {
 	cl_dispatcher_t disp;
 	cl_dispatcher_t sa_set_disp;
 	boolean_t sa_set_disp_initialized;
+	cl_dispatcher_t sa_get_disp;
+	boolean_t sa_get_disp_initialized;
 	cl_plock_t lock;
 	struct osm_routing_engine *routing_engine_list;
 	struct osm_routing_engine *routing_engine_used;
@@ -312,6 +314,12 @@ typedef struct osm_opensm {
 *	sa_set_disp_initialized.
 *		Indicator that sa_set_disp dispatcher was initialized.
 *
+*	sa_get_disp
+*		Dispatcher for SA Get and GetTable requests.
+*
+*	sa_get_disp_initialized.
+*		Indicator that sa_get_disp dispatcher was initialized.
+*
 *	lock
 *		Shared lock guarding most OpenSM structures.
 *
@@ -723,6 +731,7 @@ void osm_dump_qmap_to_file(osm_opensm_t * p_osm, const char *file_name,
 			   cl_qmap_t * map,
 			   void (*func) (cl_map_item_t *, FILE *, void *),
 			   void *cxt);
+int osm_ucast_file_dump_bin(osm_opensm_t * p_osm, const char *file_name);
 
 /****v* OpenSM/osm_exit_flag
 */
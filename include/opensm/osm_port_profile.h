@@ -175,6 +175,34 @@ static inline void osm_port_prof_path_count_inc(IN osm_port_profile_t * p_prof)
 * SEE ALSO
 *********/
 
+/****f* OpenSM: Port Profile/osm_port_prof_path_count_dec
+* NAME
+*	osm_port_prof_path_count_dec
+*
+* DESCRIPTION
+*	Decrements the count of the number of paths going through this port.
+*
+* SYNOPSIS
+*/
+static inline void osm_port_prof_path_count_dec(IN osm_port_profile_t * p_prof)
+{
+	CL_ASSERT(p_prof);
+	if (p_prof->num_paths)
+		p_prof->num_paths--;
+}
+/*
+* PARAMETERS
+*	p_prof
+*		[in] Pointer to the Port Profile object.
+*
+* RETURN VALUE
+*	None.
+*
+* NOTES
+*
+* SEE ALSO
+*********/
+
 /****f* OpenSM: Port Profile/osm_port_prof_path_count_get
 * NAME
 *	osm_port_prof_path_count_get
@@ -45,6 +45,7 @@
 
 #include <iba/ib_types.h>
 #include <complib/cl_passivelock.h>
+#include <complib/cl_spinlock.h>
 #include <complib/cl_event.h>
 #include <complib/cl_thread.h>
 #include <complib/cl_timer.h>
@@ -168,6 +169,351 @@ typedef struct osm_sa_item {
 #define SA_ITEM_RESP_SIZE(_m) offsetof(osm_sa_item_t, resp._m) + \
 			      sizeof(((osm_sa_item_t *)NULL)->resp._m)
 
+/****s* OpenSM: SA/osm_sa_resp_buf_t
+* NAME
+*	osm_sa_resp_buf_t
+*
+* DESCRIPTION
+*	SA response buffer. Records are built in place in a contiguous
+*	buffer which is copied as a whole into the response MAD. Buffers
+*	are taken from a pool and keep their memory between queries, so
+*	building a response normally does not allocate memory.
+*
+* SYNOPSIS
+*/
+typedef struct osm_sa_resp_buf {
+	cl_list_item_t list_item;
+	size_t attr_size;
+	unsigned num_rec;
+	unsigned max_rec;
+	size_t size;
+	uint8_t *data;
+	size_t reserved;
+} osm_sa_resp_buf_t;
+/*
+* FIELDS
+*	list_item
+*		Linkage in the SA response buffer pool.
+*
+*	attr_size
+*		Size of a single record.
+*
+*	num_rec
+*		Number of records in the buffer.
+*
+*	max_rec
+*		Upper bound on the number of records given by the handler.
+*
+*	size
+*		Allocated size of data.
+*
+*	data
+*		The records.
+*
+*	reserved
+*		Memory reserved for this response against sa_max_resp_mem.
+*
+* SEE ALSO
+*	osm_sa_resp_buf_get, osm_sa_resp_buf_new_rec, osm_sa_respond_buf
+*********/
+
+/****s* OpenSM: SA/osm_pr_cache_entry_t
+* NAME
+*	osm_pr_cache_entry_t
+*
+* DESCRIPTION
+*	PathRecord cache entry. Holds the result of walking the forwarding
+*	tables from a source LID to a destination LID.
+*
+* SYNOPSIS
+*/
+typedef struct osm_pr_cache_entry {
+	uint16_t epoch;
+	uint16_t valid_sl_mask;
+	uint8_t mtu;
+	uint8_t rate;
+} osm_pr_cache_entry_t;
+/*
+* FIELDS
+*	epoch
+*		Cache epoch in which the entry was filled. The entry is
+*		valid only while it matches the current cache epoch.
+*
+*	valid_sl_mask
+*		Mask of the SLs which are not mapped to VL15 along the path.
+*
+*	mtu
+*		Minimal MTU along the path.
+*
+*	rate
+*		Minimal rate along the path.
+*
+* SEE ALSO
+*	osm_pr_cache_t
+*********/
+
+/****s* OpenSM: SA/osm_pr_cache_row_t
+* NAME
+*	osm_pr_cache_row_t
+*
+* DESCRIPTION
+*	PathRecord cache entries of a single source LID, indexed by
+*	destination LID.
+*
+* SYNOPSIS
+*/
+typedef struct osm_pr_cache_row {
+	unsigned size;
+	osm_pr_cache_entry_t entry[0];
+} osm_pr_cache_row_t;
+/***********/
+
+/****s* OpenSM: SA/osm_pr_pkey_index_t
+* NAME
+*	osm_pr_pkey_index_t
+*
+* DESCRIPTION
+*	Index of the end ports by the partition keys in their PKey tables,
+*	used to restrict PathRecord queries with a specific PKey to the
+*	ports which can match. The entries are sorted by PKey base and
+*	port GUID.
+*
+*	The index is built on demand and belongs to a single PathRecord
+*	cache epoch. It is reference counted since it may be replaced while
+*	other queries still iterate it.
+*
+* SYNOPSIS
+*/
+typedef struct osm_pr_pkey_ent {
+	ib_net16_t pkey;
+	const osm_port_t *p_port;
+} osm_pr_pkey_ent_t;
+
+typedef struct osm_pr_pkey_index {
+	atomic32_t ref_cnt;
+	uint16_t epoch;
+	unsigned num_ent;
+	osm_pr_pkey_ent_t ent[0];
+} osm_pr_pkey_index_t;
+/*
+* FIELDS
+*	ref_cnt
+*		Number of references held, including the one of the cache.
+*
+*	epoch
+*		PathRecord cache epoch the index was built in.
+*
+*	num_ent
+*		Number of entries.
+*
+*	ent
+*		The (PKey base, port) entries.
+*
+* SEE ALSO
+*	osm_pr_cache_t
+*********/
+
+/****s* OpenSM: SA/osm_pr_cache_t
+* NAME
+*	osm_pr_cache_t
+*
+* DESCRIPTION
+*	PathRecord cache. Keeps the routing dependent part of the
+*	PathRecord parameters (the fabric walk) per SLID and DLID, so that
+*	repeated PathRecord queries are served by a lookup.
+*
+*	The cache is versioned by an epoch which is bumped on every routing,
+*	SL2VL or QoS change, and it is only filled while the subnet is up.
+*
+* SYNOPSIS
+*/
+typedef struct osm_pr_cache {
+	cl_spinlock_t lock;
+	osm_pr_cache_row_t **rows;
+	uint16_t epoch;
+	boolean_t active;
+	uint64_t hits;
+	uint64_t misses;
+	osm_pr_pkey_index_t *p_pkey_idx;
+} osm_pr_cache_t;
+/*
+* FIELDS
+*	lock
+*		Protects the cache, as PathRecord queries are processed
+*		concurrently under the shared subnet lock.
+*
+*	rows
+*		Array of cache rows indexed by source LID, allocated on first
+*		use.
+*
+*	epoch
+*		Current cache epoch.
+*
+*	active
+*		TRUE when the cache may be filled (the subnet is up).
+*
+*	hits, misses
+*		Lookup statistics since the last invalidation.
+*
+*	p_pkey_idx
+*		PKey index of the end ports, NULL until first needed.
+*
+* SEE ALSO
+*	osm_pr_cache_invalidate, osm_pr_cache_activate
+*********/
+
+/****s* OpenSM: SA/osm_sa_snap_port_t
+* NAME
+*	osm_sa_snap_port_t
+*
+* DESCRIPTION
+*	Physical port in a SA subnet snapshot.
+*
+* SYNOPSIS
+*/
+typedef struct osm_sa_snap_port {
+	uint32_t node;
+	uint32_t remote;
+	uint32_t sl_drop;
+	uint8_t port_num;
+	uint8_t num_sl_drop;
+	uint8_t mtu;
+	uint8_t rate;
+	uint8_t sw_rate;
+} osm_sa_snap_port_t;
+/*
+* FIELDS
+*	node
+*		Index of the node owning this port.
+*
+*	remote
+*		Index of the port on the other side of the link or
+*		OSM_SA_SNAP_NONE if there is no link.
+*
+*	sl_drop
+*		Index in the snapshot sl_drop array of the first mask of SLs
+*		mapped to VL15 when this port is the egress port. The masks
+*		are indexed by the ingress port number.
+*
+*	port_num
+*		Port number.
+*
+*	num_sl_drop
+*		Number of SL drop masks (ingress ports) of this port.
+*
+*	mtu
+*		MTU capability.
+*
+*	rate
+*		Rate computed with the port extended speeds capability.
+*
+*	sw_rate
+*		Rate computed with the switch port 0 extended speeds
+*		capability, as used for switch hops.
+*
+* SEE ALSO
+*	osm_sa_snapshot_t
+*********/
+
+/****s* OpenSM: SA/osm_sa_snap_node_t
+* NAME
+*	osm_sa_snap_node_t
+*
+* DESCRIPTION
+*	Node in a SA subnet snapshot.
+*
+* SYNOPSIS
+*/
+typedef struct osm_sa_snap_node {
+	ib_net64_t guid;
+	uint32_t port0;
+	uint8_t num_ports;
+	uint16_t lft_size;
+	uint8_t *lft;
+} osm_sa_snap_node_t;
+/*
+* FIELDS
+*	guid
+*		Node GUID.
+*
+*	port0
+*		Index of port 0 of this node in the snapshot ports array,
+*		the other ports follow by port number.
+*
+*	num_ports
+*		Number of physical ports of this node, including port 0.
+*
+*	lft_size
+*		Number of entries in lft.
+*
+*	lft
+*		Copy of the switch linear forwarding table or NULL for
+*		non switch nodes.
+*
+* SEE ALSO
+*	osm_sa_snapshot_t
+*********/
+
+#define OSM_SA_SNAP_NONE 0xFFFFFFFF
+
+/****s* OpenSM: SA/osm_sa_snapshot_t
+* NAME
+*	osm_sa_snapshot_t
+*
+* DESCRIPTION
+*	Immutable, reference counted image of the subnet routing state
+*	used by the SA to resolve paths without looking at the live subnet
+*	objects, which are modified during sweeps.
+*
+*	A new snapshot is published when the subnet is up. Readers hold a
+*	reference to the snapshot they use, so the previous snapshot is
+*	freed only after the last reader is done with it.
+*
+* SYNOPSIS
+*/
+typedef struct osm_sa_snapshot {
+	atomic32_t ref_cnt;
+	boolean_t qos;
+	uint16_t max_lid_ho;
+	uint32_t num_nodes;
+	uint32_t num_ports;
+	osm_sa_snap_node_t *nodes;
+	osm_sa_snap_port_t *ports;
+	uint16_t *sl_drop;
+	uint32_t *lid_port;
+	ib_net64_t *lid_guid;
+} osm_sa_snapshot_t;
+/*
+* FIELDS
+*	ref_cnt
+*		Number of references to this snapshot, including the one
+*		held while it is the current snapshot.
+*
+*	qos
+*		TRUE if QoS was enabled when the snapshot was taken.
+*
+*	max_lid_ho
+*		Highest LID in the snapshot.
+*
+*	num_nodes, nodes
+*		Nodes array.
+*
+*	num_ports, ports
+*		Physical ports array.
+*
+*	sl_drop
+*		Masks of SLs mapped to VL15, used only when qos is TRUE.
+*
+*	lid_port
+*		Index of the port owning each LID, or OSM_SA_SNAP_NONE.
+*
+*	lid_guid
+*		Port GUID owning each LID.
+*
+* SEE ALSO
+*	osm_sa_snapshot_publish, osm_sa_snapshot_get, osm_sa_snapshot_put
+*********/
+
 /****s* OpenSM: SM/osm_sa_t
 * NAME
 *	osm_sa_t
@@ -218,6 +564,12 @@ typedef struct osm_sa {
 	cl_disp_reg_handle_t gir_set_disp_h;
 	cl_disp_reg_handle_t mcmr_set_disp_h;
 	cl_disp_reg_handle_t sr_set_disp_h;
+	osm_pr_cache_t pr_cache;
+	cl_spinlock_t snap_lock;
+	osm_sa_snapshot_t *p_snapshot;
+	cl_spinlock_t resp_buf_lock;
+	cl_qlist_t resp_buf_pool;
+	size_t resp_mem;
 } osm_sa_t;
 /*
 * FIELDS
@@ -258,6 +610,25 @@ typedef struct osm_sa {
 *		A flag that denotes that SA DB is dirty and needs
 *		to be written to the dump file (if dumping is enabled)
 *
+*	pr_cache
+*		PathRecord cache
+*
+*	snap_lock
+*		Protects the p_snapshot pointer.
+*
+*	p_snapshot
+*		Current subnet snapshot or NULL.
+*
+*	resp_buf_lock
+*		Protects resp_buf_pool.
+*
+*	resp_buf_pool
+*		Pool of free response buffers.
+*
+*	resp_mem
+*		Memory reserved by the responses being built or sent,
+*		protected by resp_buf_lock.
+*
 * SEE ALSO
 *	SM object
 *********/
@@ -498,6 +869,117 @@ void osm_sa_respond(osm_sa_t *sa, osm_madw_t *madw, size_t attr_size,
 *	SA object
 *********/
 
+/****f* OpenSM: SA/osm_sa_resp_buf_get
+* NAME
+*	osm_sa_resp_buf_get
+*
+* DESCRIPTION
+*	Gets an empty response buffer from the SA response buffer pool and
+*	reserves the memory of a response of up to max_rec records against
+*	sa_max_resp_mem. The reservation is held until the response is
+*	sent or the buffer is put back.
+*
+* SYNOPSIS
+*/
+osm_sa_resp_buf_t *osm_sa_resp_buf_get(IN osm_sa_t * sa, IN size_t attr_size,
+				       IN unsigned max_rec);
+/*
+* PARAMETERS
+*	sa
+*		[in] Pointer to an osm_sa_t object.
+*
+*	attr_size
+*		[in] Size of this SA attribute.
+*
+*	max_rec
+*		[in] Upper bound on the number of records of the response.
+*
+* RETURN VALUES
+*	Pointer to the response buffer or NULL if it cannot be allocated
+*	or the response would exceed sa_max_resp_mem.
+*
+* SEE ALSO
+*	osm_sa_resp_buf_new_rec, osm_sa_respond_buf, osm_sa_resp_buf_put
+*********/
+
+/****f* OpenSM: SA/osm_sa_resp_buf_new_rec
+* NAME
+*	osm_sa_resp_buf_new_rec
+*
+* DESCRIPTION
+*	Appends a zeroed record to a response buffer.
+*
+* SYNOPSIS
+*/
+void *osm_sa_resp_buf_new_rec(IN osm_sa_resp_buf_t * p_buf);
+/*
+* PARAMETERS
+*	p_buf
+*		[in] Pointer to the response buffer.
+*
+* RETURN VALUES
+*	Pointer to the new record, valid until the next record is added,
+*	or NULL if the buffer cannot be grown.
+*
+* SEE ALSO
+*	osm_sa_resp_buf_get
+*********/
+
+/****f* OpenSM: SA/osm_sa_resp_buf_put
+* NAME
+*	osm_sa_resp_buf_put
+*
+* DESCRIPTION
+*	Returns a response buffer to the SA response buffer pool without
+*	sending it, and releases its memory reservation.
+*
+* SYNOPSIS
+*/
+void osm_sa_resp_buf_put(IN osm_sa_t * sa, IN osm_sa_resp_buf_t * p_buf);
+/*
+* PARAMETERS
+*	sa
+*		[in] Pointer to an osm_sa_t object.
+*
+*	p_buf
+*		[in] Pointer to the response buffer.
+*
+* RETURN VALUES
+*	None.
+*
+* SEE ALSO
+*	osm_sa_resp_buf_get
+*********/
+
+/****f* OpenSM: SA/osm_sa_respond_buf
+* NAME
+*	osm_sa_respond_buf
+*
+* DESCRIPTION
+*	Sends SA MAD response with the records of a response buffer.
+*
+* SYNOPSIS
+*/
+void osm_sa_respond_buf(IN osm_sa_t * sa, IN osm_madw_t * madw,
+			IN osm_sa_resp_buf_t * p_buf);
+/*
+* PARAMETERS
+*	sa
+*		[in] Pointer to an osm_sa_t object.
+*
+*	madw
+*		[in] Original MAD to which the response must be sent.
+*
+*	p_buf
+*		[in] Response buffer, returned to the pool after sending.
+*
+* RETURN VALUES
+*	None.
+*
+* SEE ALSO
+*	osm_sa_respond, osm_sa_resp_buf_get
+*********/
+
 struct osm_opensm;
 /****f* OpenSM: SA/osm_sa_db_file_dump
 * NAME
@@ -615,6 +1097,202 @@ void osm_pr_process_half(IN osm_sa_t * sa, IN const ib_sa_mad_t * sa_mad,
 				IN const ib_gid_t * p_dgid,
 				IN cl_qlist_t * p_list);
 
+/****f* OpenSM: SA/osm_pr_cache_invalidate
+* NAME
+*	osm_pr_cache_invalidate
+*
+* DESCRIPTION
+*	Invalidates all PathRecord cache entries and stops filling the
+*	cache until osm_pr_cache_activate is called. Should be called
+*	before the subnet routing or QoS configuration is changed.
+*
+* SYNOPSIS
+*/
+void osm_pr_cache_invalidate(IN osm_sa_t * sa);
+/*
+* PARAMETERS
+*	sa
+*		[in] Pointer to a SA object.
+*
+* RETURN VALUE
+*	This function does not return a value.
+*
+* SEE ALSO
+*	osm_pr_cache_activate
+*********/
+
+/****f* OpenSM: SA/osm_pr_cache_activate
+* NAME
+*	osm_pr_cache_activate
+*
+* DESCRIPTION
+*	Starts a new PathRecord cache epoch and allows the cache to be
+*	filled. Should be called once the subnet configuration is complete.
+*
+* SYNOPSIS
+*/
+void osm_pr_cache_activate(IN osm_sa_t * sa);
+/*
+* PARAMETERS
+*	sa
+*		[in] Pointer to a SA object.
+*
+* RETURN VALUE
+*	This function does not return a value.
+*
+* SEE ALSO
+*	osm_pr_cache_invalidate
+*********/
+
+/****f* OpenSM: SA/osm_sa_snapshot_publish
+* NAME
+*	osm_sa_snapshot_publish
+*
+* DESCRIPTION
+*	Takes a new snapshot of the subnet routing state and makes it the
+*	current one. The previous snapshot is released. Should be called
+*	once the subnet configuration is complete, without holding the
+*	subnet lock.
+*
+* SYNOPSIS
+*/
+void osm_sa_snapshot_publish(IN osm_sa_t * sa);
+/*
+* PARAMETERS
+*	sa
+*		[in] Pointer to a SA object.
+*
+* RETURN VALUE
+*	This function does not return a value. The current snapshot is
+*	left unchanged if the new one cannot be allocated.
+*
+* SEE ALSO
+*	osm_sa_snapshot_get, osm_sa_snapshot_put
+*********/
+
+/****f* OpenSM: SA/osm_sa_snapshot_get
+* NAME
+*	osm_sa_snapshot_get
+*
+* DESCRIPTION
+*	Returns a reference to the current subnet snapshot.
+*
+* SYNOPSIS
+*/
+osm_sa_snapshot_t *osm_sa_snapshot_get(IN osm_sa_t * sa);
+/*
+* PARAMETERS
+*	sa
+*		[in] Pointer to a SA object.
+*
+* RETURN VALUE
+*	Pointer to the snapshot, which must be released with
+*	osm_sa_snapshot_put, or NULL if no snapshot was published yet.
+*
+* SEE ALSO
+*	osm_sa_snapshot_put
+*********/
+
+/****f* OpenSM: SA/osm_sa_snapshot_put
+* NAME
+*	osm_sa_snapshot_put
+*
+* DESCRIPTION
+*	Releases a reference to a subnet snapshot. The snapshot is freed
+*	when its last reference is released.
+*
+* SYNOPSIS
+*/
+void osm_sa_snapshot_put(IN osm_sa_snapshot_t * p_snap);
+/*
+* PARAMETERS
+*	p_snap
+*		[in] Pointer to the snapshot, may be NULL.
+*
+* RETURN VALUE
+*	This function does not return a value.
+*
+* SEE ALSO
+*	osm_sa_snapshot_get
+*********/
+
+/****f* OpenSM: SA/osm_sa_snapshot_walk
+* NAME
+*	osm_sa_snapshot_walk
+*
+* DESCRIPTION
+*	Walks the path from a source port to a destination LID in a subnet
+*	snapshot and returns the minimal MTU and rate along the path and
+*	the SLs which are not mapped to VL15.
+*
+* SYNOPSIS
+*/
+ib_api_status_t osm_sa_snapshot_walk(IN const osm_sa_snapshot_t * p_snap,
+				     IN ib_net64_t src_port_guid,
+				     IN uint16_t src_lid_ho,
+				     IN ib_net64_t dest_port_guid,
+				     IN uint16_t dest_lid_ho,
+				     OUT uint8_t * p_mtu, OUT uint8_t * p_rate,
+				     OUT uint16_t * p_valid_sl_mask,
+				     OUT unsigned * p_hops);
+/*
+* PARAMETERS
+*	p_snap
+*		[in] Pointer to the snapshot.
+*
+*	src_port_guid, src_lid_ho
+*		[in] Source port GUID and one of its LIDs.
+*
+*	dest_port_guid, dest_lid_ho
+*		[in] Destination port GUID and LID.
+*
+*	p_mtu, p_rate, p_valid_sl_mask
+*		[out] Path parameters.
+*
+*	p_hops
+*		[out] Number of links traversed.
+*
+* RETURN VALUE
+*	IB_SUCCESS if the path was resolved, IB_NOT_FOUND if the LIDs do
+*	not belong to the ports in the snapshot or no SL can be used on the
+*	path, IB_ERROR if the path is broken or too long.
+*	Errors are not logged, callers are expected to fall back to walking
+*	the live subnet objects.
+*
+* SEE ALSO
+*	osm_sa_snapshot_get
+*********/
+
+/****f* OpenSM: SA/osm_pr_rcv_process_inline
+* NAME
+*	osm_pr_rcv_process_inline
+*
+* DESCRIPTION
+*	Answers a PathRecord request on the calling (MAD receive) thread
+*	instead of going through the SA dispatcher. This is done only when
+*	the subnet is up, paths are resolved from the routing snapshot and
+*	the subnet lock can be taken without blocking.
+*
+* SYNOPSIS
+*/
+boolean_t osm_pr_rcv_process_inline(IN osm_sa_t * sa,
+				    IN osm_madw_t * p_madw);
+/*
+* PARAMETERS
+*	sa
+*		[in] Pointer to an osm_sa_t object.
+*
+*	p_madw
+*		[in] Pointer to the PathRecord request MAD.
+*
+* RETURN VALUE
+*	TRUE if the request was answered; the caller still owns p_madw.
+*	FALSE if it was left untouched and should be dispatched as usual.
+*
+* SEE ALSO
+*	osm_sa_snapshot_walk
+*********/
+
 /****f* OpenSM: SA/osm_sa_limit_rate
  * NAME
  *	osm_sa_limit_rate
@@ -45,6 +45,7 @@
 #define _OSM_SA_MAD_CTRL_H_
 
 #include <complib/cl_dispatcher.h>
+#include <complib/cl_spinlock.h>
 #include <opensm/osm_stats.h>
 #include <opensm/osm_subnet.h>
 #include <opensm/osm_madw.h>
@@ -79,6 +80,46 @@ BEGIN_C_DECLS
 *********/
 
 struct osm_sa;
+/****s* OpenSM: SA MAD Controller/osm_sa_requester_t
+* NAME
+*	osm_sa_requester_t
+*
+* DESCRIPTION
+*	Per requester LID admission state of the SA MAD Controller.
+*
+* SYNOPSIS
+*/
+typedef struct osm_sa_requester {
+	uint64_t last_refill;
+	uint64_t tokens;
+	uint32_t queued;
+	uint32_t dropped;
+	boolean_t throttled;
+} osm_sa_requester_t;
+/*
+* FIELDS
+*	last_refill
+*		Time stamp [usec] the token bucket was last refilled.
+*
+*	tokens
+*		Request cost units currently available to the requester,
+*		in thousandths of a unit.
+*
+*	queued
+*		Number of MADs of the requester waiting in (or being
+*		processed by) the SA dispatcher.
+*
+*	dropped
+*		Number of MADs of the requester dropped by admission control.
+*
+*	throttled
+*		TRUE while the requester is being throttled; used to log
+*		only the start of each throttling episode.
+*
+* SEE ALSO
+*	SA MAD Controller object
+*********/
+
 /****s* OpenSM: SA MAD Controller/osm_sa_mad_ctrl_t
 * NAME
 *	osm_sa_mad_ctrl_t
@@ -103,6 +144,8 @@ typedef struct osm_sa_mad_ctrl {
 	cl_disp_reg_handle_t h_set_disp;
 	osm_stats_t *p_stats;
 	osm_subn_t *p_subn;
+	cl_spinlock_t req_lock;
+	osm_sa_requester_t *requesters;
 } osm_sa_mad_ctrl_t;
 /*
 * FIELDS
@@ -139,6 +182,13 @@ typedef struct osm_sa_mad_ctrl {
 *	p_subn
 *		Pointer to the OpenSM Subnet object.
 *
+*	req_lock
+*		Spinlock guarding the requesters table.
+*
+*	requesters
+*		Admission state indexed by requester LID. Allocated on first
+*		use, when sa_rate_limit or sa_max_queued_per_lid is set.
+*
 * SEE ALSO
 *	SA MAD Controller object
 *********/
@@ -93,6 +93,9 @@ typedef struct osm_stats {
 	atomic32_t sa_mads_sent;
 	atomic32_t sa_mads_rcvd_unknown;
 	atomic32_t sa_mads_ignored;
+	atomic32_t sa_mads_throttled;
+	atomic32_t sa_mads_queue_limited;
+	atomic32_t sa_mads_inline;
 #ifdef HAVE_LIBPTHREAD
 	pthread_mutex_t mutex;
 	pthread_cond_t cond;
@@ -143,6 +146,18 @@ typedef struct osm_stats {
 *		Total number of SA MADs received because SM is not
 *		master or SM is in first time sweep.
 *
+*	sa_mads_throttled
+*		Total number of SA MADs dropped because the requester
+*		exceeded sa_rate_limit.
+*
+*	sa_mads_queue_limited
+*		Total number of SA MADs dropped because the requester already
+*		had sa_max_queued_per_lid MADs waiting in the SA dispatcher.
+*
+*	sa_mads_inline
+*		Total number of SA MADs answered on the receive thread
+*		without going through the dispatcher.
+*
 * SEE ALSO
 ***************/
 
@@ -273,6 +273,13 @@ typedef struct osm_subn_opt {
 	boolean_t reassign_lids;
 	boolean_t ignore_other_sm;
 	boolean_t single_thread;
+	uint32_t sa_threads;
+	uint32_t sa_max_resp_mem;
+	uint32_t sa_rate_limit;
+	uint32_t sa_rate_burst;
+	uint32_t sa_rate_table_cost;
+	uint32_t sa_max_queued_per_lid;
+	boolean_t sa_fast_path;
 	boolean_t disable_multicast;
 	boolean_t force_log_flush;
 	uint8_t subnet_timeout;
@@ -312,10 +319,16 @@ typedef struct osm_subn_opt {
 	boolean_t sweep_on_trap;
 	char *routing_engine_names;
 	boolean_t avoid_throttled_links;
+	uint32_t routing_threads;
+	uint32_t sssp_batch_size;
+	uint32_t ftree_batch_size;
+	boolean_t packed_lid_matrix;
+	boolean_t incremental_reroute;
 	boolean_t use_ucast_cache;
 	boolean_t connect_roots;
 	char *lid_matrix_dump_file;
 	char *lfts_file;
+	boolean_t routing_bin_dump;
 	char *root_guid_file;
 	char *cn_guid_file;
 	char *io_guid_file;
@@ -327,6 +340,9 @@ typedef struct osm_subn_opt {
 	boolean_t guid_routing_order_no_scatter;
 	char *sa_db_file;
 	boolean_t sa_db_dump;
+	boolean_t sa_pr_cache;
+	boolean_t sa_snapshot;
+	boolean_t sa_pr_dest_trees;
 	char *torus_conf_file;
 	boolean_t do_mesh_analysis;
 	boolean_t exit_on_fatal;
@@ -464,6 +480,46 @@ typedef struct osm_subn_opt {
 *	ignore_other_sm_option
 *		This flag is TRUE if other SMs on the subnet should be ignored.
 *
+*	sa_threads
+*		Number of threads in a dedicated dispatcher for SA Get and
+*		GetTable requests. When 0 (the default), these requests are
+*		handled by the central OpenSM dispatcher. Ignored when
+*		single_thread is set.
+*
+*	sa_max_resp_mem
+*		Maximal memory in MB taken by the NodeRecord and
+*		PortInfoRecord responses being built or sent at the same
+*		time, counted from the size of the tables when the query
+*		arrives. A query which would exceed it is failed with the
+*		NO_RESOURCES status, unless no other one is in progress.
+*		0 (the default) means no limit.
+*
+*	sa_rate_limit
+*		Request cost units per second each requester LID may submit
+*		to the SA. A Get, Set or Delete costs one unit, a GetTable
+*		with a component mask two units and a GetTable of a whole
+*		table sa_rate_table_cost units. Requests exceeding the rate
+*		are dropped. 0 (the default) disables rate limiting.
+*
+*	sa_rate_burst
+*		Depth of the per requester token bucket, i.e. the number of
+*		cost units a requester may spend at once after being idle.
+*
+*	sa_rate_table_cost
+*		Cost in units of a GetTable request without a component mask.
+*
+*	sa_max_queued_per_lid
+*		Maximal number of SA MADs from a single requester LID waiting
+*		in the SA dispatcher; further MADs from this requester are
+*		dropped until some are processed, so that one client cannot
+*		occupy the whole queue. 0 (the default) means no limit.
+*
+*	sa_fast_path
+*		When TRUE, PathRecord Get requests are answered directly on
+*		the MAD receive thread while the subnet is up, sa_snapshot is
+*		in use and the subnet lock is free, skipping the dispatcher
+*		queue. Other requests are dispatched as usual.
+*
 *	disable_multicast
 *		This flag is TRUE if OpenSM should disable multicast support.
 *
@@ -553,6 +609,34 @@ typedef struct osm_subn_opt {
 *		(if they support it), and hence no path is assigned to these
 *		underperforming links and a warning is logged instead.
 *
+*	routing_threads
+*		Number of threads computing the min-hop tables and the
+*		unicast forwarding tables. 0 means one per CPU, 1 (the
+*		default) disables parallel routing.
+*
+*	sssp_batch_size
+*		Number of destinations whose (df)sssp shortest paths are
+*		computed on the same link weights, spread over the
+*		routing_threads threads.  1 (the default) updates the
+*		weights after every destination.
+*
+*	ftree_batch_size
+*		Number of leaf switches whose compute nodes ftree routes
+*		on the same port load counters, spread over the
+*		routing_threads threads.  1 (the default) updates the
+*		counters after every compute node.
+*
+*	packed_lid_matrix
+*		Store the switches' LID matrices with 4-bit hop counts,
+*		halving their memory.  A switch whose hop counts do not
+*		fit falls back to one byte per entry.
+*
+*	incremental_reroute
+*		When the subnet only lost links or nodes since the last
+*		min-hop routing, reroute only the destinations whose least
+*		hop paths used them instead of recomputing all the routes.
+*		Not used with lmc > 0 or other routing engines.
+*
 *	connect_roots
 *		The option which will enforce root to root connectivity with
 *		up/down and fat-tree routing engines (even if this violates
@@ -569,6 +653,13 @@ typedef struct osm_subn_opt {
 *		Name of the unicast LFTs routing file from where switch
 *		forwarding tables will be loaded
 *
+*	routing_bin_dump
+*		When TRUE causes OpenSM to write the switch LFTs and lid
+*		matrices to opensm-routing.bin in dump_files_dir at the end
+*		of every sweep, regardless the current verbosity level.
+*		lfts_file and lid_matrix_dump_file accept this binary file
+*		as well as the text dumps.
+*
 *	root_guid_file
 *		Name of the file that contains list of root guids that
 *		will be used by fat-tree or up/dn routing (provided by User)
@@ -599,6 +690,22 @@ typedef struct osm_subn_opt {
 *		When TRUE causes OpenSM to dump SA DB at the end of every
 *		light sweep regardless the current verbosity level.
 *
+*	sa_pr_cache
+*		When TRUE enables the SA PathRecord cache, which keeps
+*		the fabric walk results of PathRecord queries per SLID
+*		and DLID until the routing changes.
+*
+*	sa_snapshot
+*		When TRUE the SA resolves paths from an immutable snapshot
+*		of the routing state published each time the subnet is up,
+*		instead of from the live subnet objects.
+*
+*	sa_pr_dest_trees
+*		When TRUE the unicast manager keeps the path MTU, rate and
+*		hop count from every switch to every LID after routing, and
+*		the SA looks PathRecord parameters up there instead of
+*		walking the forwarding tables (when QoS is disabled).
+*
 *	torus_conf_file
 *		Name of the file with extra configuration info for torus-2QoS
 *		routing engine.
@@ -98,7 +98,12 @@ typedef struct osm_switch {
 	uint16_t max_lid_ho;
 	uint8_t num_ports;
 	uint16_t num_hops;
-	uint8_t **hops;
+	uint16_t *hop_rows;
+	uint16_t num_hop_rows;
+	uint16_t max_hop_rows;
+	uint8_t hop_stride;
+	boolean_t hops_packed;
+	uint8_t *hops;
 	osm_port_profile_t *p_prof;
 	uint8_t *search_ordering_ports;
 	uint8_t *lft;
@@ -132,11 +137,31 @@ typedef struct osm_switch {
 *		Number of ports for this switch.
 *
 *	num_hops
-*		Size of hops table for this switch.
+*		Number of LIDs covered by the hop_rows index.
+*
+*	hop_rows
+*		Row of each LID in the hops table plus one, or 0 when the
+*		LID has no row (no path from any port).
+*
+*	num_hop_rows
+*		Number of rows in use in the hops table.
+*
+*	max_hop_rows
+*		Number of rows allocated for the hops table.
+*
+*	hop_stride
+*		Size in bytes of one LID row of the hops table.
+*
+*	hops_packed
+*		TRUE when the hops table holds two 4-bit hop counts per byte.
 *
 *	hops
 *		LID Matrix for this switch containing the hop count
-*		to every LID from every port.
+*		to every LID from every port.  The matrix is a single
+*		buffer of rows of hop_stride bytes, found through hop_rows;
+*		entry 0 of each row holds the least hop count to that LID.
+*		Only the LIDs that were given a hop count have a row.
+*		It must be accessed through the osm_switch_*_hop* functions.
 *
 *	p_prof
 *		Pointer to array of Port Profile objects for this switch.
@@ -254,6 +279,21 @@ osm_switch_t *osm_switch_new(IN osm_node_t * p_node,
 *	Switch object, osm_switch_delete
 *********/
 
+/****d* OpenSM: Switch/OSM_PACKED_NO_PATH
+* NAME
+*	OSM_PACKED_NO_PATH
+*
+* DESCRIPTION
+*	Value stored in a packed (4-bit) LID matrix entry for which there
+*	is no path.  Hop counts of OSM_PACKED_NO_PATH or more cannot be
+*	stored packed and make osm_switch_set_hops widen the matrix to
+*	one byte per entry.
+*
+* SYNOPSIS
+*/
+#define OSM_PACKED_NO_PATH	0xF
+/***********/
+
 /****f* OpenSM: Switch/osm_switch_get_hop_count
 * NAME
 *	osm_switch_get_hop_count
@@ -267,8 +307,18 @@ static inline uint8_t osm_switch_get_hop_count(IN const osm_switch_t * p_sw,
 					       IN uint16_t lid_ho,
 					       IN uint8_t port_num)
 {
-	return (lid_ho > p_sw->max_lid_ho || !p_sw->hops[lid_ho]) ?
-	    OSM_NO_PATH : p_sw->hops[lid_ho][port_num];
+	const uint8_t *row;
+	uint16_t row_idx;
+	uint8_t hops;
+
+	if (lid_ho > p_sw->max_lid_ho || lid_ho >= p_sw->num_hops ||
+	    !(row_idx = p_sw->hop_rows[lid_ho]))
+		return OSM_NO_PATH;
+	row = p_sw->hops + (row_idx - 1) * p_sw->hop_stride;
+	if (!p_sw->hops_packed)
+		return row[port_num];
+	hops = (row[port_num >> 1] >> ((port_num & 1) << 2)) & 0xf;
+	return hops == OSM_PACKED_NO_PATH ? OSM_NO_PATH : hops;
 }
 /*
 * PARAMETERS
@@ -342,6 +392,30 @@ void osm_switch_clear_hops(IN osm_switch_t * p_sw);
 * SEE ALSO
 *********/
 
+/****f* OpenSM: Switch/osm_switch_clear_lid_hops
+* NAME
+*	osm_switch_clear_lid_hops
+*
+* DESCRIPTION
+*	Resets the hop counts from every port to the specified LID.
+*
+* SYNOPSIS
+*/
+void osm_switch_clear_lid_hops(IN osm_switch_t * p_sw, IN uint16_t lid_ho);
+/*
+* PARAMETERS
+*	p_sw
+*		[in] Pointer to a Switch object.
+*
+*	lid_ho
+*		[in] LID value (host order) whose row to clear.
+*
+* NOTES
+*
+* SEE ALSO
+*	osm_switch_clear_hops
+*********/
+
 /****f* OpenSM: Switch/osm_switch_get_least_hops
 * NAME
 *	osm_switch_get_least_hops
@@ -355,8 +429,7 @@ void osm_switch_clear_hops(IN osm_switch_t * p_sw);
 static inline uint8_t osm_switch_get_least_hops(IN const osm_switch_t * p_sw,
 						IN uint16_t lid_ho)
 {
-	return (lid_ho > p_sw->max_lid_ho || !p_sw->hops[lid_ho]) ?
-	    OSM_NO_PATH : p_sw->hops[lid_ho][0];
+	return osm_switch_get_hop_count(p_sw, lid_ho, 0);
 }
 /*
 * PARAMETERS
@@ -697,6 +770,38 @@ static inline void osm_switch_count_path(IN osm_switch_t * p_sw,
 * SEE ALSO
 *********/
 
+/****f* OpenSM: Switch/osm_switch_uncount_path
+* NAME
+*	osm_switch_uncount_path
+*
+* DESCRIPTION
+*	Removes a path counted by osm_switch_count_path from the port
+*	profile, when it is rerouted.
+*
+* SYNOPSIS
+*/
+static inline void osm_switch_uncount_path(IN osm_switch_t * p_sw,
+					   IN uint8_t port)
+{
+	osm_port_prof_path_count_dec(&p_sw->p_prof[port]);
+}
+/*
+* PARAMETERS
+*	p_sw
+*		[in] Pointer to the switch object.
+*
+*	port
+*		[in] Port the path was counted on.
+*
+* RETURN VALUE
+*	None.
+*
+* NOTES
+*
+* SEE ALSO
+*	osm_switch_count_path
+*********/
+
 /****f* OpenSM: Switch/osm_switch_set_lft_block
 * NAME
 *	osm_switch_set_lft_block
@@ -1103,7 +1208,10 @@ static inline uint32_t osm_switch_path_count_get(IN const osm_switch_t * p_sw,
 * SYNOPSIS
 */
 int osm_switch_prepare_path_rebuild(IN osm_switch_t * p_sw,
-				    IN uint16_t max_lids);
+				    IN uint16_t max_lids,
+				    IN boolean_t packed_hops,
+				    IN const uint16_t * row_lids,
+				    IN uint16_t num_row_lids);
 /*
 * PARAMETERS
 *	p_sw
@@ -1112,10 +1220,25 @@ int osm_switch_prepare_path_rebuild(IN osm_switch_t * p_sw,
 *	max_lids
 *		[in] Max number of lids in the subnet.
 *
+*	packed_hops
+*		[in] Store the LID matrix with 4-bit hop counts.
+*
+*	row_lids
+*		[in] LIDs (host order) which get a LID matrix row up front.
+*
+*	num_row_lids
+*		[in] Number of entries in row_lids.
+*
 * RETURN VALUE
 *	Returns zero on success, or negative value if an error occurred.
 *
 * NOTES
+*	The LID matrix is reallocated only when it has to grow or its
+*	layout changes; otherwise it is reset in place.
+*
+*	Other LIDs get a row when osm_switch_set_hops first stores a hop
+*	count for them, which may move the rows.  Code which sets hop
+*	counts from several threads must only use the row_lids.
 *
 * SEE ALSO
 *********/
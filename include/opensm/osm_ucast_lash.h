@@ -57,22 +57,23 @@ enum {
 typedef struct _cdg_vertex {
 	int from;
 	int to;
-	int seen;
 	int temp;
-	int visiting_number;
-	struct _cdg_vertex *next;
+	unsigned visit;
+	int on_path;
 	int num_temp_depend;
 	int num_using_vertex;
 	int num_deps;
+	int max_deps;
 	struct vertex_deps {
 		struct _cdg_vertex *v;
 		int num_used;
-	} deps[0];
+	} *deps;
 } cdg_vertex_t;
 
 typedef struct _switch {
 	osm_switch_t *p_sw;
 	int id;
+	int first_channel;
 	int used_channels;
 	int *dij_channels;
 	int q_state;
@@ -89,9 +90,15 @@ typedef struct _lash {
 	uint8_t vl_min;
 	int balance_limit;
 	switch_t **switches;
-	cdg_vertex_t ****cdg_vertex_matrix;
+	int num_channels;
+	cdg_vertex_t **cdg_vertex_matrix;
+	struct cdg_dfs_frame {
+		cdg_vertex_t *v;
+		int next_dep;
+	} *cdg_stack;
+	unsigned cdg_visit;
 	int num_mst_in_lane[IB_MAX_NUM_VLS];
-	int ***virtual_location;
+	uint8_t *balance_tried;
 } lash_t;
 
 #endif
@@ -78,6 +78,77 @@ BEGIN_C_DECLS
 *
 *********/
 struct osm_sm;
+/****s* OpenSM: Unicast Manager/osm_ucast_dest_path_t
+* NAME
+*	osm_ucast_dest_path_t
+*
+* DESCRIPTION
+*	Properties of the path from a switch to a destination LID, as
+*	defined by the forwarding tables. The path starts with the link
+*	out of the switch egress port, so the egress port itself is not
+*	accounted.
+*
+* SYNOPSIS
+*/
+typedef struct osm_ucast_dest_path {
+	uint8_t mtu;
+	uint8_t rate;
+	uint8_t hops;
+} osm_ucast_dest_path_t;
+/*
+* FIELDS
+*	mtu
+*		Minimal MTU capability along the path.
+*
+*	rate
+*		Minimal rate along the path.
+*
+*	hops
+*		Number of links to the destination, OSM_NO_PATH when the
+*		destination is not reachable.
+*
+* SEE ALSO
+*	osm_ucast_dest_trees_t
+*********/
+
+/****s* OpenSM: Unicast Manager/osm_ucast_dest_trees_t
+* NAME
+*	osm_ucast_dest_trees_t
+*
+* DESCRIPTION
+*	The forwarding tables define a tree towards every destination LID.
+*	This structure keeps, for every destination LID, the path
+*	properties from each switch in the subnet, so that the properties
+*	of any path are found at the switch the source is attached to.
+*
+* SYNOPSIS
+*/
+typedef struct osm_ucast_dest_trees {
+	uint16_t max_lid_ho;
+	unsigned num_sw;
+	uint16_t *sw_idx;
+	osm_ucast_dest_path_t *paths;
+} osm_ucast_dest_trees_t;
+/*
+* FIELDS
+*	max_lid_ho
+*		Highest destination LID in the trees.
+*
+*	num_sw
+*		Number of switches in the trees.
+*
+*	sw_idx
+*		Index of a switch in the trees by its base LID, 0xFFFF
+*		for LIDs which are not switch LIDs.
+*
+*	paths
+*		Path properties indexed by destination LID * num_sw +
+*		switch index. NULL when the trees are not built.
+*
+* SEE ALSO
+*	osm_ucast_mgr_build_dest_trees, osm_ucast_mgr_get_dest_path
+*********/
+
 /****s* OpenSM: Unicast Manager/osm_ucast_mgr_t
 * NAME
 *	osm_ucast_mgr_t
@@ -98,9 +169,11 @@ typedef struct osm_ucast_mgr {
 	uint16_t max_lid;
 	cl_qlist_t port_order_list;
 	boolean_t is_dor;
-	boolean_t some_hop_count_set;
 	cl_qmap_t cache_sw_tbl;
 	boolean_t cache_valid;
+	cl_qmap_t incr_sw_tbl;
+	boolean_t incr_valid;
+	osm_ucast_dest_trees_t dest_trees;
 } osm_ucast_mgr_t;
 /*
 * FIELDS
@@ -125,17 +198,23 @@ typedef struct osm_ucast_mgr {
 *	is_dor
 *		Dimension Order Routing (DOR) will be done
 *
-*	some_hop_count_set
-*		Initialized to FALSE at the beginning of each the min hop
-*		tables calculation iteration cycle, set to TRUE to indicate
-*		that some hop count changes were done.
-*
 *	cache_sw_tbl
 *		Cached switches table.
 *
 *	cache_valid
 *		TRUE if the unicast cache is valid.
 *
+*	incr_sw_tbl
+*		Links of every switch, by node GUID, as of the last unicast
+*		routing.  Used to find the failed links and switches an
+*		incremental reroute has to route around.
+*
+*	incr_valid
+*		TRUE if the current routing can be updated incrementally.
+*
+*	dest_trees
+*		Per destination LID path properties of the current routing.
+*
 * SEE ALSO
 *	Unicast Manager object
 *********/
@@ -274,6 +353,105 @@ int osm_ucast_mgr_build_lid_matrices(IN osm_ucast_mgr_t * p_mgr);
 *	Unicast Manager
 *********/
 
+/****d* OpenSM: Unicast Manager/osm_ucast_work_fn_t
+* NAME
+*	osm_ucast_work_fn_t
+*
+* DESCRIPTION
+*	Function processing one work item of a parallel routing step.
+*
+* SYNOPSIS
+*/
+typedef void (*osm_ucast_work_fn_t) (IN void *context, IN unsigned item,
+				     IN unsigned worker);
+/*
+* PARAMETERS
+*	context
+*		[in] Context passed to osm_ucast_mgr_parallel_for.
+*
+*	item
+*		[in] Index of the work item, in 0 .. num_items - 1.
+*
+*	worker
+*		[in] Index of the worker processing the item, in
+*		0 .. num_workers - 1. Items processed by the same worker never
+*		run concurrently, so it may select per worker scratch data.
+*
+* SEE ALSO
+*	osm_ucast_mgr_parallel_for
+*********/
+
+/****f* OpenSM: Unicast Manager/osm_ucast_mgr_num_workers
+* NAME
+*	osm_ucast_mgr_num_workers
+*
+* DESCRIPTION
+*	Returns the number of workers used for parallel routing steps,
+*	as configured by the routing_threads option.
+*
+* SYNOPSIS
+*/
+unsigned osm_ucast_mgr_num_workers(IN const osm_ucast_mgr_t * p_mgr);
+/*
+* PARAMETERS
+*	p_mgr
+*		[in] Pointer to an osm_ucast_mgr_t object.
+*
+* RETURN VALUES
+*	Number of workers, at least 1.
+*
+* SEE ALSO
+*	osm_ucast_mgr_parallel_for
+*********/
+
+/****f* OpenSM: Unicast Manager/osm_ucast_mgr_parallel_for
+* NAME
+*	osm_ucast_mgr_parallel_for
+*
+* DESCRIPTION
+*	Calls a function for each of num_items work items, spreading the
+*	items over up to num_workers threads, the calling one included.
+*	Returns when all items are processed.
+*
+* SYNOPSIS
+*/
+void osm_ucast_mgr_parallel_for(IN osm_ucast_mgr_t * p_mgr,
+				IN unsigned num_items,
+				IN unsigned num_workers,
+				IN osm_ucast_work_fn_t pfn_work,
+				IN void *context);
+/*
+* PARAMETERS
+*	p_mgr
+*		[in] Pointer to an osm_ucast_mgr_t object.
+*
+*	num_items
+*		[in] Number of work items.
+*
+*	num_workers
+*		[in] Maximal number of workers, normally as returned by
+*		osm_ucast_mgr_num_workers.
+*
+*	pfn_work
+*		[in] Function called for each work item.
+*
+*	context
+*		[in] Context passed to pfn_work.
+*
+* RETURN VALUES
+*	This function does not return a value.
+*
+* NOTES
+*	The order in which items are processed is not defined, so the work
+*	function must only modify data owned by its item (or by its worker)
+*	for the result to be deterministic.
+*	When fewer worker threads can be created, the remaining items are
+*	processed by the calling thread.
+*
+* SEE ALSO
+*	osm_ucast_work_fn_t, osm_ucast_mgr_num_workers
+*********/
+
 /****f* OpenSM: Unicast Manager/osm_ucast_mgr_process
 * NAME
 *	osm_ucast_mgr_process
@@ -300,6 +478,104 @@ int osm_ucast_mgr_process(IN osm_ucast_mgr_t * p_mgr);
 *	Unicast Manager, Node Info Response Controller
 *********/
 
+/****f* OpenSM: Unicast Manager/osm_ucast_mgr_incr_invalidate
+* NAME
+*	osm_ucast_mgr_incr_invalidate
+*
+* DESCRIPTION
+*	Forces the next unicast routing to be computed from scratch.
+*
+* SYNOPSIS
+*/
+void osm_ucast_mgr_incr_invalidate(IN osm_ucast_mgr_t * p_mgr);
+/*
+* PARAMETERS
+*	p_mgr
+*		[in] Pointer to an osm_ucast_mgr_t object.
+*
+* RETURN VALUES
+*	This function does not return a value.
+*
+* NOTES
+*	When the incremental_reroute option is set, osm_ucast_mgr_process
+*	only reroutes the destinations whose min-hop paths used links or
+*	switches that failed since the last routing, provided nothing
+*	else changed in the subnet.
+*
+* SEE ALSO
+*	Unicast Manager, osm_ucast_mgr_process
+*********/
+
+/****f* OpenSM: Unicast Manager/osm_ucast_mgr_build_dest_trees
+* NAME
+*	osm_ucast_mgr_build_dest_trees
+*
+* DESCRIPTION
+*	Builds the per destination LID path property trees from the
+*	switches' new forwarding tables, when enabled by the
+*	sa_pr_dest_trees option. Otherwise releases them.
+*
+* SYNOPSIS
+*/
+void osm_ucast_mgr_build_dest_trees(IN osm_ucast_mgr_t * p_mgr);
+/*
+* PARAMETERS
+*	p_mgr
+*		[in] Pointer to an osm_ucast_mgr_t object.
+*
+* NOTES
+*	Must be called with the subnet lock held exclusively.
+*
+* SEE ALSO
+*	Unicast Manager, osm_ucast_mgr_get_dest_path
+*********/
+
+/****f* OpenSM: Unicast Manager/osm_ucast_mgr_get_dest_path
+* NAME
+*	osm_ucast_mgr_get_dest_path
+*
+* DESCRIPTION
+*	Finds the properties of the path from a port to a destination LID
+*	in the per destination LID trees.
+*
+* SYNOPSIS
+*/
+ib_api_status_t osm_ucast_mgr_get_dest_path(IN const osm_ucast_mgr_t * p_mgr,
+					    IN const osm_physp_t * p_src_physp,
+					    IN uint16_t dest_lid_ho,
+					    OUT uint8_t * p_mtu,
+					    OUT uint8_t * p_rate,
+					    OUT unsigned *p_hops);
+/*
+* PARAMETERS
+*	p_mgr
+*		[in] Pointer to an osm_ucast_mgr_t object.
+*
+*	p_src_physp
+*		[in] Source port (port 0 for a switch).
+*
+*	dest_lid_ho
+*		[in] Destination LID in host order.
+*
+*	p_mtu, p_rate
+*		[out] Minimal MTU and rate along the path, including the
+*		source and destination ports.
+*
+*	p_hops
+*		[out] Number of links along the path.
+*
+* RETURN VALUES
+*	IB_SUCCESS when the path was found, IB_NOT_FOUND when the trees
+*	are not built or the destination is not reachable from the source.
+*
+* NOTES
+*	The caller must hold the subnet lock. The SL to VL mappings along
+*	the path are not accounted.
+*
+* SEE ALSO
+*	Unicast Manager, osm_ucast_mgr_build_dest_trees
+*********/
+
 int ucast_dummy_build_lid_matrices(void *context);
 END_C_DECLS
 #endif				/* _OSM_UCAST_MGR_H_ */
@@ -491,7 +491,10 @@ static void print_status(osm_opensm_t * p_osm, FILE * out)
 			"   SA MADs rcvd                   : %u\n"
 			"   SA MADs sent                   : %u\n"
 			"   SA unknown MADs rcvd           : %u\n"
-			"   SA MADs ignored                : %u\n",
+			"   SA MADs ignored                : %u\n"
+			"   SA MADs throttled              : %u\n"
+			"   SA MADs queue limited          : %u\n"
+			"   SA MADs answered inline        : %u\n",
 			(uint32_t)p_osm->stats.qp0_mads_outstanding,
 			(uint32_t)p_osm->stats.qp0_mads_outstanding_on_wire,
 			(uint32_t)p_osm->stats.qp0_mads_rcvd,
@@ -502,7 +505,10 @@ static void print_status(osm_opensm_t * p_osm, FILE * out)
 			(uint32_t)p_osm->stats.sa_mads_rcvd,
 			(uint32_t)p_osm->stats.sa_mads_sent,
 			(uint32_t)p_osm->stats.sa_mads_rcvd_unknown,
-			(uint32_t)p_osm->stats.sa_mads_ignored);
+			(uint32_t)p_osm->stats.sa_mads_ignored,
+			(uint32_t)p_osm->stats.sa_mads_throttled,
+			(uint32_t)p_osm->stats.sa_mads_queue_limited,
+			(uint32_t)p_osm->stats.sa_mads_inline);
 		fprintf(out, "\n   Subnet flags\n"
 			"   ------------\n"
 			"   Sweeping enabled               : %d\n"
@@ -744,6 +744,8 @@ void osm_dump_all(osm_opensm_t * osm)
 					      &osm->subn.port_guid_tbl,
 					      dump_sl2vl_tbl, osm);
 	}
+	if (osm->subn.opt.routing_bin_dump)
+		osm_ucast_file_dump_bin(osm, "opensm-routing.bin");
 	osm_dump_qmap_to_file(osm, "opensm-subnet.lst",
 			      &osm->subn.node_guid_tbl, dump_topology_node,
 			      osm);
@@ -656,6 +656,8 @@ void osm_opensm_destroy(IN osm_opensm_t * p_osm)
 	cl_disp_shutdown(&p_osm->disp);
 	if (p_osm->sa_set_disp_initialized)
 		cl_disp_shutdown(&p_osm->sa_set_disp);
+	if (p_osm->sa_get_disp_initialized)
+		cl_disp_shutdown(&p_osm->sa_get_disp);
 
 	/* dump SA DB */
 	if ((p_osm->sm.p_subn->sm_state == IB_SMINFO_STATE_MASTER) &&
@@ -688,6 +690,8 @@ void osm_opensm_destroy_finish(IN osm_opensm_t * p_osm)
 	cl_disp_destroy(&p_osm->disp);
 	if (p_osm->sa_set_disp_initialized)
 		cl_disp_destroy(&p_osm->sa_set_disp);
+	if (p_osm->sa_get_disp_initialized)
+		cl_disp_destroy(&p_osm->sa_get_disp);
 #ifdef HAVE_LIBPTHREAD
 	pthread_cond_destroy(&p_osm->stats.cond);
 	pthread_mutex_destroy(&p_osm->stats.mutex);
@@ -786,6 +790,22 @@ ib_api_status_t osm_opensm_init(IN osm_opensm_t * p_osm,
 		p_osm->sa_set_disp_initialized = TRUE;
 	}
 
+	/* SA Get requests only take the shared lock, so when requested
+	 * give them their own pool of threads. This way SA queries are
+	 * not queued behind SM MADs processed by the central dispatcher.
+	 */
+	p_osm->sa_get_disp_initialized = FALSE;
+	if (!p_opt->single_thread && p_opt->sa_threads) {
+		OSM_LOG(&p_osm->log, OSM_LOG_INFO,
+			"Using %u threads for SA Get requests\n",
+			p_opt->sa_threads);
+		status = cl_disp_init(&p_osm->sa_get_disp, p_opt->sa_threads,
+				      "subnadmin_get");
+		if (status != IB_SUCCESS)
+			goto Exit;
+		p_osm->sa_get_disp_initialized = TRUE;
+	}
+
 	/* the DB is in use by subn so init before */
 	status = osm_db_init(&p_osm->db, &p_osm->log);
 	if (status != IB_SUCCESS)
@@ -834,7 +854,9 @@ ib_api_status_t osm_opensm_init_finish(IN osm_opensm_t * p_osm,
 
 	status = osm_sa_init(&p_osm->sm, &p_osm->sa, &p_osm->subn,
 			     p_osm->p_vendor, &p_osm->mad_pool, &p_osm->log,
-			     &p_osm->stats, &p_osm->disp,
+			     &p_osm->stats,
+			     p_osm->sa_get_disp_initialized ?
+			     &p_osm->sa_get_disp : &p_osm->disp,
 			     p_opt->single_thread ? NULL : &p_osm->sa_set_disp,
 			     &p_osm->lock);
 	if (status != IB_SUCCESS)
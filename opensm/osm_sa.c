@@ -74,6 +74,11 @@
 
 #define  OSM_SA_INITIAL_TID_VALUE 0xabc
 
+/* initial number of records of a response buffer */
+#define SA_RESP_BUF_MIN_RECS 32
+/* larger response buffers are freed rather than kept for reuse */
+#define SA_RESP_BUF_MAX_KEEP (1024 * 1024)
+
 extern void osm_cpi_rcv_process(IN void *context, IN void *data);
 extern void osm_gir_rcv_process(IN void *context, IN void *data);
 extern void osm_infr_rcv_process(IN void *context, IN void *data);
@@ -93,6 +98,9 @@ extern void osm_smir_rcv_process(IN void *context, IN void *data);
 extern void osm_sir_rcv_process(IN void *context, IN void *data);
 extern void osm_vlarb_rec_rcv_process(IN void *context, IN void *data);
 extern void osm_sr_rcv_lease_cb(IN void *context);
+extern ib_api_status_t osm_pr_cache_init(IN osm_pr_cache_t * p_cache);
+extern void osm_pr_cache_destroy(IN osm_pr_cache_t * p_cache);
+static void sa_resp_buf_pool_destroy(IN osm_sa_t * sa);
 
 void osm_sa_construct(IN osm_sa_t * p_sa)
 {
@@ -101,6 +109,10 @@ void osm_sa_construct(IN osm_sa_t * p_sa)
 	p_sa->sa_trans_id = OSM_SA_INITIAL_TID_VALUE;
 
 	cl_timer_construct(&p_sa->sr_timer);
+	cl_spinlock_construct(&p_sa->pr_cache.lock);
+	cl_spinlock_construct(&p_sa->snap_lock);
+	cl_spinlock_construct(&p_sa->resp_buf_lock);
+	cl_qlist_init(&p_sa->resp_buf_pool);
 }
 
 void osm_sa_shutdown(IN osm_sa_t * p_sa)
@@ -153,6 +165,13 @@ void osm_sa_destroy(IN osm_sa_t * p_sa)
 
 	cl_timer_destroy(&p_sa->sr_timer);
 
+	osm_pr_cache_destroy(&p_sa->pr_cache);
+	osm_sa_snapshot_put(p_sa->p_snapshot);
+	p_sa->p_snapshot = NULL;
+	cl_spinlock_destroy(&p_sa->snap_lock);
+	sa_resp_buf_pool_destroy(p_sa);
+	cl_spinlock_destroy(&p_sa->resp_buf_lock);
+
 	OSM_LOG_EXIT(p_sa->p_log);
 }
 
@@ -189,6 +208,18 @@ ib_api_status_t osm_sa_init(IN osm_sm_t * p_sm, IN osm_sa_t * p_sa,
 	if (status != IB_SUCCESS)
 		goto Exit;
 
+	status = osm_pr_cache_init(&p_sa->pr_cache);
+	if (status != IB_SUCCESS)
+		goto Exit;
+
+	status = cl_spinlock_init(&p_sa->snap_lock);
+	if (status != IB_SUCCESS)
+		goto Exit;
+
+	status = cl_spinlock_init(&p_sa->resp_buf_lock);
+	if (status != IB_SUCCESS)
+		goto Exit;
+
 	status = IB_INSUFFICIENT_RESOURCES;
 	p_sa->cpi_disp_h = cl_disp_register(p_disp, OSM_MSG_MAD_CLASS_PORT_INFO,
 					    osm_cpi_rcv_process, p_sa);
@@ -419,20 +450,24 @@ Exit:
 	OSM_LOG_EXIT(sa->p_log);
 }
 
-void osm_sa_respond(osm_sa_t *sa, osm_madw_t *madw, size_t attr_size,
-		    cl_qlist_t *list)
+/*
+ * Allocates the response MAD for num_rec records of attr_size and fills
+ * its header. Sends an error response and returns NULL when there is
+ * nothing to return or the response cannot be allocated.
+ */
+static osm_madw_t *sa_resp_madw_get(IN osm_sa_t * sa, IN osm_madw_t * madw,
+				    IN size_t attr_size,
+				    IN OUT unsigned *p_num_rec,
+				    OUT unsigned char **p_payload)
 {
-	cl_list_item_t *item;
 	osm_madw_t *resp_madw;
 	ib_sa_mad_t *sa_mad, *resp_sa_mad;
-	unsigned num_rec, i;
+	unsigned num_rec = *p_num_rec;
 #ifndef VENDOR_RMPP_SUPPORT
 	unsigned trim_num_rec;
 #endif
-	unsigned char *p;
 
 	sa_mad = osm_madw_get_sa_mad_ptr(madw);
-	num_rec = cl_qlist_count(list);
 
 	/*
 	 * C15-0.1.30:
@@ -446,7 +481,7 @@ void osm_sa_respond(osm_sa_t *sa, osm_madw_t *madw, size_t attr_size,
 			cl_ntoh64(sa_mad->comp_mask),
 			cl_ntoh16(madw->mad_addr.dest_lid));
 		osm_sa_send_error(sa, madw, IB_SA_MAD_STATUS_TOO_MANY_RECORDS);
-		goto Exit;
+		return NULL;
 	}
 
 #ifndef VENDOR_RMPP_SUPPORT
@@ -463,7 +498,7 @@ void osm_sa_respond(osm_sa_t *sa, osm_madw_t *madw, size_t attr_size,
 
 	if (sa_mad->method == IB_MAD_METHOD_GET && num_rec == 0) {
 		osm_sa_send_error(sa, madw, IB_SA_MAD_STATUS_NO_RECORDS);
-		goto Exit;
+		return NULL;
 	}
 
 	/*
@@ -476,7 +511,7 @@ void osm_sa_respond(osm_sa_t *sa, osm_madw_t *madw, size_t attr_size,
 		OSM_LOG(sa->p_log, OSM_LOG_ERROR, "ERR 4C06: "
 			"osm_mad_pool_get failed\n");
 		osm_sa_send_error(sa, madw, IB_SA_MAD_STATUS_NO_RESOURCES);
-		goto Exit;
+		return NULL;
 	}
 
 	resp_sa_mad = osm_madw_get_sa_mad_ptr(resp_madw);
@@ -497,8 +532,6 @@ void osm_sa_respond(osm_sa_t *sa, osm_madw_t *madw, size_t attr_size,
 	/* Fill in the offset (paylen will be done by the rmpp SAR) */
 	resp_sa_mad->attr_offset = num_rec ? ib_get_attr_offset(attr_size) : 0;
 
-	p = ib_sa_mad_get_payload_ptr(resp_sa_mad);
-
 #ifndef VENDOR_RMPP_SUPPORT
 	/* we support only one packet RMPP - so we will set the first and
 	   last flags for gettable */
@@ -514,6 +547,25 @@ void osm_sa_respond(osm_sa_t *sa, osm_madw_t *madw, size_t attr_size,
 		resp_sa_mad->rmpp_flags = IB_RMPP_FLAG_ACTIVE;
 #endif
 
+	*p_num_rec = num_rec;
+	*p_payload = ib_sa_mad_get_payload_ptr(resp_sa_mad);
+	return resp_madw;
+}
+
+void osm_sa_respond(osm_sa_t *sa, osm_madw_t *madw, size_t attr_size,
+		    cl_qlist_t *list)
+{
+	cl_list_item_t *item;
+	osm_madw_t *resp_madw;
+	unsigned num_rec, i;
+	unsigned char *p;
+
+	num_rec = cl_qlist_count(list);
+
+	resp_madw = sa_resp_madw_get(sa, madw, attr_size, &num_rec, &p);
+	if (!resp_madw)
+		goto Exit;
+
 	for (i = 0; i < num_rec; i++) {
 		item = cl_qlist_remove_head(list);
 		memcpy(p, ((osm_sa_item_t *)item)->resp.data, attr_size);
@@ -521,7 +573,8 @@ void osm_sa_respond(osm_sa_t *sa, osm_madw_t *madw, size_t attr_size,
 		free(item);
 	}
 
-	osm_dump_sa_mad_v2(sa->p_log, resp_sa_mad, FILE_ID, OSM_LOG_FRAMES);
+	osm_dump_sa_mad_v2(sa->p_log, osm_madw_get_sa_mad_ptr(resp_madw),
+			   FILE_ID, OSM_LOG_FRAMES);
 	osm_sa_send(sa, resp_madw, FALSE);
 
 Exit:
@@ -533,6 +586,160 @@ Exit:
 	}
 }
 
+/*
+ * Reserves memory against sa_max_resp_mem. A reservation is always granted
+ * when no other one is held, so that a response larger than the limit can
+ * still be built.
+ */
+static boolean_t sa_resp_mem_reserve(IN osm_sa_t * sa, IN size_t size)
+{
+	size_t limit = (size_t) sa->p_subn->opt.sa_max_resp_mem << 20;
+	boolean_t ret = TRUE;
+
+	cl_spinlock_acquire(&sa->resp_buf_lock);
+	if (limit && sa->resp_mem && sa->resp_mem + size > limit)
+		ret = FALSE;
+	else
+		sa->resp_mem += size;
+	cl_spinlock_release(&sa->resp_buf_lock);
+	return ret;
+}
+
+static void sa_resp_mem_release(IN osm_sa_t * sa, IN size_t size)
+{
+	if (!size)
+		return;
+
+	cl_spinlock_acquire(&sa->resp_buf_lock);
+	sa->resp_mem -= size;
+	cl_spinlock_release(&sa->resp_buf_lock);
+}
+
+osm_sa_resp_buf_t *osm_sa_resp_buf_get(IN osm_sa_t * sa, IN size_t attr_size,
+				       IN unsigned max_rec)
+{
+	osm_sa_resp_buf_t *p_buf;
+	size_t reserve = 0;
+
+	/*
+	 * A response holds its records twice at its peak: in the buffer and
+	 * in the response MAD. Single MAD responses are not worth counting.
+	 */
+	if ((size_t) max_rec * attr_size + IB_SA_MAD_HDR_SIZE > MAD_BLOCK_SIZE)
+		reserve = 2 * (size_t) max_rec * attr_size +
+		    IB_SA_MAD_HDR_SIZE;
+	if (reserve && !sa_resp_mem_reserve(sa, reserve)) {
+		OSM_LOG(sa->p_log, OSM_LOG_VERBOSE,
+			"Response of up to %zu bytes exceeds sa_max_resp_mem\n",
+			reserve);
+		return NULL;
+	}
+
+	cl_spinlock_acquire(&sa->resp_buf_lock);
+	p_buf = (osm_sa_resp_buf_t *) cl_qlist_remove_head(&sa->resp_buf_pool);
+	cl_spinlock_release(&sa->resp_buf_lock);
+
+	if (p_buf == (osm_sa_resp_buf_t *) cl_qlist_end(&sa->resp_buf_pool)) {
+		p_buf = calloc(1, sizeof(*p_buf));
+		if (!p_buf) {
+			sa_resp_mem_release(sa, reserve);
+			return NULL;
+		}
+	}
+
+	p_buf->attr_size = attr_size;
+	p_buf->num_rec = 0;
+	p_buf->max_rec = max_rec;
+	p_buf->reserved = reserve;
+	return p_buf;
+}
+
+void *osm_sa_resp_buf_new_rec(IN osm_sa_resp_buf_t * p_buf)
+{
+	size_t used = p_buf->num_rec * p_buf->attr_size;
+	size_t size;
+	uint8_t *data;
+	void *p_rec;
+
+	if (used + p_buf->attr_size > p_buf->size) {
+		size = p_buf->size ? 2 * p_buf->size :
+		    SA_RESP_BUF_MIN_RECS * p_buf->attr_size;
+		/* stay within the records reserved for */
+		if (p_buf->max_rec && size > p_buf->max_rec * p_buf->attr_size)
+			size = p_buf->max_rec * p_buf->attr_size;
+		if (size < used + p_buf->attr_size)
+			size = used + p_buf->attr_size;
+		data = realloc(p_buf->data, size);
+		if (!data)
+			return NULL;
+		p_buf->data = data;
+		p_buf->size = size;
+	}
+
+	p_rec = p_buf->data + used;
+	memset(p_rec, 0, p_buf->attr_size);
+	p_buf->num_rec++;
+	return p_rec;
+}
+
+void osm_sa_resp_buf_put(IN osm_sa_t * sa, IN osm_sa_resp_buf_t * p_buf)
+{
+	sa_resp_mem_release(sa, p_buf->reserved);
+	p_buf->reserved = 0;
+
+	/* don't let a single huge response pin its memory forever */
+	if (p_buf->size > SA_RESP_BUF_MAX_KEEP) {
+		free(p_buf->data);
+		p_buf->data = NULL;
+		p_buf->size = 0;
+	}
+	p_buf->num_rec = 0;
+
+	cl_spinlock_acquire(&sa->resp_buf_lock);
+	cl_qlist_insert_head(&sa->resp_buf_pool, &p_buf->list_item);
+	cl_spinlock_release(&sa->resp_buf_lock);
+}
+
+static void sa_resp_buf_pool_destroy(IN osm_sa_t * sa)
+{
+	osm_sa_resp_buf_t *p_buf;
+
+	while ((p_buf = (osm_sa_resp_buf_t *)
+		cl_qlist_remove_head(&sa->resp_buf_pool)) !=
+	       (osm_sa_resp_buf_t *) cl_qlist_end(&sa->resp_buf_pool)) {
+		free(p_buf->data);
+		free(p_buf);
+	}
+}
+
+void osm_sa_respond_buf(IN osm_sa_t * sa, IN osm_madw_t * madw,
+			IN osm_sa_resp_buf_t * p_buf)
+{
+	osm_madw_t *resp_madw;
+	unsigned num_rec = p_buf->num_rec;
+	size_t reserved = p_buf->reserved;
+	unsigned char *p;
+
+	resp_madw = sa_resp_madw_get(sa, madw, p_buf->attr_size, &num_rec, &p);
+	if (resp_madw && num_rec)
+		memcpy(p, p_buf->data, num_rec * p_buf->attr_size);
+
+	/*
+	 * The records are in the MAD now, recycle the buffer before sending.
+	 * The reservation is kept until the MAD is sent, which frees it.
+	 */
+	p_buf->reserved = 0;
+	osm_sa_resp_buf_put(sa, p_buf);
+
+	if (resp_madw) {
+		osm_dump_sa_mad_v2(sa->p_log,
+				   osm_madw_get_sa_mad_ptr(resp_madw),
+				   FILE_ID, OSM_LOG_FRAMES);
+		osm_sa_send(sa, resp_madw, FALSE);
+	}
+	sa_resp_mem_release(sa, reserved);
+}
+
 /*
  *  SA DB Dumper
  *
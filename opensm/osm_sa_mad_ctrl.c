@@ -45,6 +45,7 @@
 #endif				/* HAVE_CONFIG_H */
 
 #include <string.h>
+#include <stdlib.h>
 #include <complib/cl_debug.h>
 #include <iba/ib_types.h>
 #include <opensm/osm_file_ids.h>
@@ -56,6 +57,167 @@
 #include <opensm/osm_sa.h>
 #include <opensm/osm_opensm.h>
 
+/****f* opensm: SA/sa_mad_ctrl_req_cost
+ * NAME
+ * sa_mad_ctrl_req_cost
+ *
+ * DESCRIPTION
+ * Returns the cost in units charged to the requester's token bucket
+ * for the given SA request. Dumping a whole table is the expensive
+ * class; a GetTable restricted by a component mask is cheaper and any
+ * other method costs a single unit.
+ *
+ * SYNOPSIS
+ */
+static uint32_t sa_mad_ctrl_req_cost(IN const osm_sa_mad_ctrl_t * p_ctrl,
+				     IN const ib_sa_mad_t * p_sa_mad)
+{
+	uint32_t cost;
+
+	switch (p_sa_mad->method) {
+	case IB_MAD_METHOD_GETTABLE:
+#if defined (VENDOR_RMPP_SUPPORT) && defined (DUAL_SIDED_RMPP)
+	case IB_MAD_METHOD_GETMULTI:
+#endif
+		if (p_sa_mad->comp_mask)
+			return 2;
+		cost = p_ctrl->p_subn->opt.sa_rate_table_cost;
+		return cost ? cost : 1;
+	default:
+		return 1;
+	}
+}
+
+/****f* opensm: SA/sa_mad_ctrl_admit
+ * NAME
+ * sa_mad_ctrl_admit
+ *
+ * DESCRIPTION
+ * Per requester admission control. Charges the request cost to the
+ * token bucket of the requester LID and checks the number of its
+ * MADs already waiting in the dispatcher. Returns FALSE when the MAD
+ * must be dropped. An admitted MAD is accounted as queued until
+ * sa_mad_ctrl_release is called for it.
+ *
+ * SYNOPSIS
+ */
+static boolean_t sa_mad_ctrl_admit(IN osm_sa_mad_ctrl_t * p_ctrl,
+				   IN const osm_madw_t * p_madw,
+				   IN const ib_sa_mad_t * p_sa_mad)
+{
+	const osm_subn_opt_t *p_opt = &p_ctrl->p_subn->opt;
+	osm_sa_requester_t *p_req;
+	uint16_t lid_ho = cl_ntoh16(p_madw->mad_addr.dest_lid);
+	uint64_t now, elapsed, burst, cost;
+	boolean_t admit = TRUE;
+
+	if (!lid_ho || lid_ho > IB_LID_UCAST_END_HO)
+		return TRUE;
+
+	cl_spinlock_acquire(&p_ctrl->req_lock);
+
+	if (!p_ctrl->requesters) {
+		if (!p_opt->sa_rate_limit && !p_opt->sa_max_queued_per_lid)
+			goto Exit;
+		p_ctrl->requesters = calloc(IB_LID_UCAST_END_HO + 1,
+					    sizeof(*p_ctrl->requesters));
+		if (!p_ctrl->requesters) {
+			OSM_LOG(p_ctrl->p_log, OSM_LOG_ERROR, "ERR 1A0B: "
+				"Failed to allocate SA requesters table, "
+				"admission control disabled\n");
+			goto Exit;
+		}
+	}
+
+	p_req = &p_ctrl->requesters[lid_ho];
+
+	if (p_opt->sa_max_queued_per_lid &&
+	    p_req->queued >= p_opt->sa_max_queued_per_lid) {
+		cl_atomic_inc(&p_ctrl->p_stats->sa_mads_queue_limited);
+		admit = FALSE;
+		goto Drop;
+	}
+
+	if (p_opt->sa_rate_limit) {
+		/* token amounts are kept in thousandths of a cost unit */
+		cost = (uint64_t) sa_mad_ctrl_req_cost(p_ctrl, p_sa_mad) * 1000;
+		burst = (uint64_t) p_opt->sa_rate_burst * 1000;
+		if (burst < cost)
+			burst = cost;
+
+		now = cl_get_time_stamp();
+		if (!p_req->last_refill)
+			p_req->tokens = burst;
+		else if (now > p_req->last_refill) {
+			elapsed = now - p_req->last_refill;
+			/* a full bucket never takes longer than this */
+			if (elapsed > 1000000000ULL)
+				elapsed = 1000000000ULL;
+			p_req->tokens += elapsed * p_opt->sa_rate_limit / 1000;
+		}
+		if (p_req->tokens > burst)
+			p_req->tokens = burst;
+		p_req->last_refill = now;
+
+		if (p_req->tokens < cost) {
+			cl_atomic_inc(&p_ctrl->p_stats->sa_mads_throttled);
+			admit = FALSE;
+			goto Drop;
+		}
+		p_req->tokens -= cost;
+	}
+
+	p_req->queued++;
+	p_req->throttled = FALSE;
+	goto Exit;
+
+Drop:
+	p_req->dropped++;
+	if (!p_req->throttled) {
+		p_req->throttled = TRUE;
+		OSM_LOG(p_ctrl->p_log, OSM_LOG_INFO,
+			"Throttling SA requests from LID %u "
+			"(%u queued, %u dropped so far)\n",
+			lid_ho, p_req->queued, p_req->dropped);
+	} else
+		OSM_LOG(p_ctrl->p_log, OSM_LOG_DEBUG,
+			"Dropping SA MAD from LID %u, method 0x%X "
+			"attribute 0x%X (%s)\n", lid_ho, p_sa_mad->method,
+			cl_ntoh16(p_sa_mad->attr_id),
+			ib_get_sa_attr_str(p_sa_mad->attr_id));
+
+Exit:
+	cl_spinlock_release(&p_ctrl->req_lock);
+	return admit;
+}
+
+/****f* opensm: SA/sa_mad_ctrl_release
+ * NAME
+ * sa_mad_ctrl_release
+ *
+ * DESCRIPTION
+ * Retires a MAD admitted by sa_mad_ctrl_admit from the queued count
+ * of its requester.
+ *
+ * SYNOPSIS
+ */
+static void sa_mad_ctrl_release(IN osm_sa_mad_ctrl_t * p_ctrl,
+				IN const osm_madw_t * p_madw)
+{
+	uint16_t lid_ho = cl_ntoh16(p_madw->mad_addr.dest_lid);
+
+	if (!lid_ho || lid_ho > IB_LID_UCAST_END_HO)
+		return;
+
+	cl_spinlock_acquire(&p_ctrl->req_lock);
+	/* MADs posted before the table was allocated were not counted */
+	if (p_ctrl->requesters && p_ctrl->requesters[lid_ho].queued)
+		p_ctrl->requesters[lid_ho].queued--;
+	cl_spinlock_release(&p_ctrl->req_lock);
+}
+
+/************/
+
 /****f* opensm: SA/sa_mad_ctrl_disp_done_callback
  * NAME
  * sa_mad_ctrl_disp_done_callback
@@ -74,6 +236,7 @@ static void sa_mad_ctrl_disp_done_callback(IN void *context, IN void *p_data)
 	OSM_LOG_ENTER(p_ctrl->p_log);
 
 	CL_ASSERT(p_madw);
+	sa_mad_ctrl_release(p_ctrl, p_madw);
 	/*
 	   Return the MAD & wrapper to the pool.
 	 */
@@ -235,6 +398,32 @@ SKIP_QUEUE_CHECK:
 	}
 
 	if (msg_id != CL_DISP_MSGID_NONE) {
+		/*
+		   Per requester admission: throttle clients exceeding their
+		   request rate or their share of the dispatcher queue.
+		   As above, we cannot respond BUSY from here so just drop.
+		 */
+		if (!sa_mad_ctrl_admit(p_ctrl, p_madw, p_sa_mad)) {
+			osm_mad_pool_put(p_ctrl->p_mad_pool, p_madw);
+			goto Exit;
+		}
+
+#ifdef OSM_VENDOR_INTF_OPENIB
+		/*
+		   PathRecord Get dominates the SA load. With the ibumad
+		   vendor responses can be sent from the receive callback,
+		   so answer it here when possible and skip the queue hop.
+		 */
+		if (msg_id == OSM_MSG_MAD_PATH_RECORD &&
+		    p_sa_mad->method == IB_MAD_METHOD_GET &&
+		    p_ctrl->p_subn->opt.sa_fast_path &&
+		    osm_pr_rcv_process_inline(p_ctrl->sa, p_madw)) {
+			cl_atomic_inc(&p_ctrl->p_stats->sa_mads_inline);
+			sa_mad_ctrl_disp_done_callback(p_ctrl, p_madw);
+			goto Exit;
+		}
+#endif
+
 		/*
 		   Post this MAD to the dispatcher for asynchronous
 		   processing by the appropriate controller.
@@ -254,6 +443,7 @@ SKIP_QUEUE_CHECK:
 				cl_ntoh16(p_sa_mad->attr_id),
 				ib_get_sa_attr_str(p_sa_mad->attr_id));
 
+			sa_mad_ctrl_release(p_ctrl, p_madw);
 			osm_mad_pool_put(p_ctrl->p_mad_pool, p_madw);
 			goto Exit;
 		}
@@ -493,6 +683,7 @@ void osm_sa_mad_ctrl_construct(IN osm_sa_mad_ctrl_t * p_ctrl)
 	memset(p_ctrl, 0, sizeof(*p_ctrl));
 	p_ctrl->h_disp = CL_DISP_INVALID_HANDLE;
 	p_ctrl->h_set_disp = CL_DISP_INVALID_HANDLE;
+	cl_spinlock_construct(&p_ctrl->req_lock);
 }
 
 void osm_sa_mad_ctrl_destroy(IN osm_sa_mad_ctrl_t * p_ctrl)
@@ -500,6 +691,9 @@ void osm_sa_mad_ctrl_destroy(IN osm_sa_mad_ctrl_t * p_ctrl)
 	CL_ASSERT(p_ctrl);
 	cl_disp_unregister(p_ctrl->h_disp);
 	cl_disp_unregister(p_ctrl->h_set_disp);
+	cl_spinlock_destroy(&p_ctrl->req_lock);
+	free(p_ctrl->requesters);
+	p_ctrl->requesters = NULL;
 }
 
 ib_api_status_t osm_sa_mad_ctrl_init(IN osm_sa_mad_ctrl_t * p_ctrl,
@@ -527,6 +721,13 @@ ib_api_status_t osm_sa_mad_ctrl_init(IN osm_sa_mad_ctrl_t * p_ctrl,
 	p_ctrl->p_stats = p_stats;
 	p_ctrl->p_subn = p_subn;
 
+	if (cl_spinlock_init(&p_ctrl->req_lock) != CL_SUCCESS) {
+		OSM_LOG(p_log, OSM_LOG_ERROR, "ERR 1A0C: "
+			"SA requesters lock initialization failed\n");
+		status = IB_ERROR;
+		goto Exit;
+	}
+
 	p_ctrl->h_disp = cl_disp_register(p_disp, CL_DISP_MSGID_NONE, NULL,
 					  p_ctrl);
 
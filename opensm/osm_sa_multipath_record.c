@@ -50,6 +50,7 @@
 #include <string.h>
 #include <iba/ib_types.h>
 #include <complib/cl_qmap.h>
+#include <complib/cl_fleximap.h>
 #include <complib/cl_passivelock.h>
 #include <complib/cl_debug.h>
 #include <complib/cl_qlist.h>
@@ -69,6 +70,125 @@
 
 #define SA_MPR_RESP_SIZE SA_ITEM_RESP_SIZE(mpr_rec)
 
+/*
+  A MultiPathRecord request evaluates the paths between all its source and
+  destination GIDs. Paths to the same destination LID join at the first
+  common switch and follow the same route from there on, so the path
+  properties from every egress port towards a destination are remembered
+  for the duration of the request and the walks of further sources stop
+  at the first known egress port.
+ */
+typedef struct mpr_walk_key {
+	const osm_physp_t *p_egress;
+	uint16_t dest_lid_ho;
+} mpr_walk_key_t;
+
+typedef struct mpr_walk_ent {
+	cl_fmap_item_t map_item;
+	mpr_walk_key_t key;
+	uint8_t mtu;
+	uint8_t rate;
+	uint16_t valid_sl_mask;
+	int hops;
+} mpr_walk_ent_t;
+
+typedef struct mpr_walk_memo {
+	cl_fmap_t map;
+	unsigned hits;
+	unsigned misses;
+} mpr_walk_memo_t;
+
+static int mpr_walk_key_cmp(IN const void *p_key1, IN const void *p_key2)
+{
+	const mpr_walk_key_t *k1 = p_key1, *k2 = p_key2;
+
+	if (k1->p_egress != k2->p_egress)
+		return (uintptr_t) k1->p_egress < (uintptr_t) k2->p_egress ?
+		    -1 : 1;
+	if (k1->dest_lid_ho != k2->dest_lid_ho)
+		return k1->dest_lid_ho < k2->dest_lid_ho ? -1 : 1;
+	return 0;
+}
+
+static void mpr_walk_memo_init(IN mpr_walk_memo_t * p_memo)
+{
+	cl_fmap_init(&p_memo->map, mpr_walk_key_cmp);
+	p_memo->hits = p_memo->misses = 0;
+}
+
+static void mpr_walk_memo_destroy(IN osm_sa_t * sa,
+				  IN mpr_walk_memo_t * p_memo)
+{
+	cl_fmap_item_t *p_item, *p_next;
+
+	p_item = cl_fmap_head(&p_memo->map);
+	while (p_item != cl_fmap_end(&p_memo->map)) {
+		p_next = cl_fmap_next(p_item);
+		free(p_item);
+		p_item = p_next;
+	}
+	cl_fmap_remove_all(&p_memo->map);
+
+	OSM_LOG(sa->p_log, OSM_LOG_DEBUG,
+		"Path walks: %u joined a known route, %u walked to the end\n",
+		p_memo->hits, p_memo->misses);
+}
+
+static const mpr_walk_ent_t *mpr_walk_memo_get(IN mpr_walk_memo_t * p_memo,
+					       IN const osm_physp_t * p_egress,
+					       IN uint16_t dest_lid_ho)
+{
+	mpr_walk_key_t key;
+	cl_fmap_item_t *p_item;
+
+	key.p_egress = p_egress;
+	key.dest_lid_ho = dest_lid_ho;
+	p_item = cl_fmap_get(&p_memo->map, &key);
+	if (p_item == cl_fmap_end(&p_memo->map))
+		return NULL;
+	return (mpr_walk_ent_t *) p_item;
+}
+
+static void mpr_walk_memo_put(IN mpr_walk_memo_t * p_memo,
+			      IN const osm_physp_t * p_egress,
+			      IN uint16_t dest_lid_ho, IN uint8_t mtu,
+			      IN uint8_t rate, IN uint16_t valid_sl_mask,
+			      IN int hops)
+{
+	mpr_walk_ent_t *p_ent;
+
+	p_ent = malloc(sizeof(*p_ent));
+	if (!p_ent)
+		return;	/* the walk is simply repeated next time */
+
+	p_ent->key.p_egress = p_egress;
+	p_ent->key.dest_lid_ho = dest_lid_ho;
+	p_ent->mtu = mtu;
+	p_ent->rate = rate;
+	p_ent->valid_sl_mask = valid_sl_mask;
+	p_ent->hops = hops;
+	if (cl_fmap_insert(&p_memo->map, &p_ent->key, &p_ent->map_item) !=
+	    &p_ent->map_item)
+		free(p_ent);
+}
+
+/*
+  Path properties of a single link of a walk: the remote port it leads to
+  and, for a switch, the egress port on the way to the destination.
+ */
+typedef struct mpr_walk_step {
+	const osm_physp_t *p_egress;
+	uint8_t mtu;
+	uint8_t rate;
+	uint16_t valid_sl_mask;
+} mpr_walk_step_t;
+
+static inline void mpr_walk_min_rate(IN OUT uint8_t * p_rate, IN uint8_t rate)
+{
+	if (!*p_rate || ib_path_compare_rates(*p_rate, rate) > 0)
+		*p_rate = rate;
+}
+
 static boolean_t sa_multipath_rec_is_tavor_port(IN const osm_port_t * p_port)
 {
 	osm_node_t const *p_node;
@@ -142,8 +262,11 @@ static ib_api_status_t mpr_rcv_get_path_parms(IN osm_sa_t * sa,
 					      IN const uint16_t src_lid_ho,
 					      IN const uint16_t dest_lid_ho,
 					      IN const ib_net64_t comp_mask,
+					      IN mpr_walk_memo_t * p_memo,
 					      OUT osm_path_parms_t * p_parms)
 {
+	mpr_walk_step_t steps[MAX_HOPS + 1], *p_step = NULL;
+	const mpr_walk_ent_t *p_known = NULL;
 	const osm_node_t *p_node;
 	const osm_physp_t *p_physp, *p_physp0;
 	const osm_physp_t *p_src_physp;
@@ -153,7 +276,7 @@ static ib_api_status_t mpr_rcv_get_path_parms(IN osm_sa_t * sa,
 	ib_slvl_table_t *p_slvl_tbl;
 	ib_api_status_t status = IB_SUCCESS;
 	uint8_t mtu;
-	uint8_t rate, p0_extended_rate, dest_rate;
+	uint8_t rate, p0_extended_rate;
 	uint8_t pkt_life;
 	uint8_t required_mtu;
 	uint8_t required_rate;
@@ -165,7 +288,11 @@ static ib_api_status_t mpr_rcv_get_path_parms(IN osm_sa_t * sa,
 	int in_port_num = 0;
 	uint8_t i;
 	osm_qos_level_t *p_qos_level = NULL;
-	uint16_t valid_sl_mask = 0xffff;
+	uint16_t valid_sl_mask = 0xffff, walk_sl_mask;
+	uint8_t suffix_mtu, suffix_rate;
+	uint16_t suffix_sl_mask;
+	int suffix_hops;
+	unsigned nsteps = 0;
 	int extended, p0_extended;
 
 	OSM_LOG_ENTER(sa->p_log);
@@ -276,9 +403,22 @@ static ib_api_status_t mpr_rcv_get_path_parms(IN osm_sa_t * sa,
 	 * Now go through the path step by step
 	 */
 
+	walk_sl_mask = valid_sl_mask;
 	while (p_physp != p_dest_physp) {
 
 		int tmp_pnum = p_physp->port_num;
+
+		/* the rest of the path may be known from another source */
+		if (p_memo && (p_known = mpr_walk_memo_get(p_memo, p_physp,
+							   dest_lid_ho)))
+			break;
+
+		p_step = &steps[nsteps++];
+		p_step->p_egress = p_physp;
+		p_step->mtu = 0xFF;
+		p_step->rate = 0;
+		p_step->valid_sl_mask = 0xffff;
+
 		p_node = osm_physp_get_node_ptr(p_physp);
 		p_physp = osm_physp_get_remote(p_physp);
 
@@ -349,15 +489,14 @@ static ib_api_status_t mpr_rcv_get_path_parms(IN osm_sa_t * sa,
 		 */
 		p_pi = &p_physp->port_info;
 
-		if (mtu > ib_port_info_get_mtu_cap(p_pi))
-			mtu = ib_port_info_get_mtu_cap(p_pi);
+		if (p_step->mtu > ib_port_info_get_mtu_cap(p_pi))
+			p_step->mtu = ib_port_info_get_mtu_cap(p_pi);
 
 		p_physp0 = osm_node_get_physp_ptr((osm_node_t *)p_node, 0);
 		p_pi0 = &p_physp0->port_info;
 		p0_extended = p_pi0->capability_mask & IB_PORT_CAP_HAS_EXT_SPEEDS;
 		p0_extended_rate = ib_port_info_compute_rate(p_pi, p0_extended);
-		if (ib_path_compare_rates(rate, p0_extended_rate) > 0)
-			rate = p0_extended_rate;
+		mpr_walk_min_rate(&p_step->rate, p0_extended_rate);
 
 		/*
 		   Continue with the egress port on this switch.
@@ -376,12 +515,11 @@ static ib_api_status_t mpr_rcv_get_path_parms(IN osm_sa_t * sa,
 
 		p_pi = &p_physp->port_info;
 
-		if (mtu > ib_port_info_get_mtu_cap(p_pi))
-			mtu = ib_port_info_get_mtu_cap(p_pi);
+		if (p_step->mtu > ib_port_info_get_mtu_cap(p_pi))
+			p_step->mtu = ib_port_info_get_mtu_cap(p_pi);
 
 		p0_extended_rate = ib_port_info_compute_rate(p_pi, p0_extended);
-		if (ib_path_compare_rates(rate, p0_extended_rate) > 0)
-			rate = p0_extended_rate;
+		mpr_walk_min_rate(&p_step->rate, p0_extended_rate);
 
 		if (sa->p_subn->opt.qos) {
 			/*
@@ -390,12 +528,13 @@ static ib_api_status_t mpr_rcv_get_path_parms(IN osm_sa_t * sa,
 			p_slvl_tbl =
 			    osm_physp_get_slvl_tbl(p_physp, in_port_num);
 			for (i = 0; i < IB_MAX_NUM_VLS; i++) {
-				if (valid_sl_mask & (1 << i) &&
+				if (p_step->valid_sl_mask & (1 << i) &&
 				    ib_slvl_table_get(p_slvl_tbl,
 						      i) == IB_DROP_VL)
-					valid_sl_mask &= ~(1 << i);
+					p_step->valid_sl_mask &= ~(1 << i);
 			}
-			if (!valid_sl_mask) {
+			walk_sl_mask &= p_step->valid_sl_mask;
+			if (!walk_sl_mask) {
 				OSM_LOG(sa->p_log, OSM_LOG_DEBUG,
 					"All the SLs lead to VL15 "
 					"on this path\n");
@@ -405,18 +544,72 @@ static ib_api_status_t mpr_rcv_get_path_parms(IN osm_sa_t * sa,
 		}
 	}
 
+	if (p_known) {
+		/*
+		   The rest of the path, including the destination port,
+		   was already walked.
+		 */
+		hops += p_known->hops;
+		if (hops > MAX_HOPS) {
+			OSM_LOG(sa->p_log, OSM_LOG_ERROR, "ERR 4521: "
+				"Path from GUID 0x%016" PRIx64 " (%s) to"
+				" lid %u needs more than %d hops,"
+				" max %d hops allowed\n",
+				cl_ntoh64(osm_physp_get_port_guid(p_src_physp)),
+				p_src_physp->p_node->print_desc, dest_lid_ho,
+				hops, MAX_HOPS);
+			status = IB_NOT_FOUND;
+			goto Exit;
+		}
+		suffix_mtu = p_known->mtu;
+		suffix_rate = p_known->rate;
+		suffix_sl_mask = p_known->valid_sl_mask;
+		suffix_hops = p_known->hops;
+		p_memo->hits++;
+	} else {
+		/*
+		   p_physp now points to the destination
+		 */
+		p_pi = &p_physp->port_info;
+
+		suffix_mtu = ib_port_info_get_mtu_cap(p_pi);
+		extended = p_pi->capability_mask & IB_PORT_CAP_HAS_EXT_SPEEDS;
+		suffix_rate = ib_port_info_compute_rate(p_pi, extended);
+		suffix_sl_mask = 0xffff;
+		suffix_hops = 0;
+		if (p_memo)
+			p_memo->misses++;
+	}
+
 	/*
-	   p_physp now points to the destination
+	   Fold the links walked into the path properties, from the
+	   destination backwards, remembering the rest of the path from
+	   each egress port.
 	 */
-	p_pi = &p_physp->port_info;
-
-	if (mtu > ib_port_info_get_mtu_cap(p_pi))
-		mtu = ib_port_info_get_mtu_cap(p_pi);
+	while (nsteps--) {
+		p_step = &steps[nsteps];
+		if (suffix_mtu > p_step->mtu)
+			suffix_mtu = p_step->mtu;
+		if (p_step->rate)
+			mpr_walk_min_rate(&suffix_rate, p_step->rate);
+		suffix_sl_mask &= p_step->valid_sl_mask;
+		suffix_hops++;
+		if (p_memo)
+			mpr_walk_memo_put(p_memo, p_step->p_egress, dest_lid_ho,
+					  suffix_mtu, suffix_rate,
+					  suffix_sl_mask, suffix_hops);
+	}
 
-	extended = p_pi->capability_mask & IB_PORT_CAP_HAS_EXT_SPEEDS;
-	dest_rate = ib_port_info_compute_rate(p_pi, extended);
-	if (ib_path_compare_rates(rate, dest_rate) > 0)
-		rate = dest_rate;
+	if (mtu > suffix_mtu)
+		mtu = suffix_mtu;
+	mpr_walk_min_rate(&rate, suffix_rate);
+	valid_sl_mask &= suffix_sl_mask;
+	if (!valid_sl_mask) {
+		OSM_LOG(sa->p_log, OSM_LOG_DEBUG,
+			"All the SLs lead to VL15 on this path\n");
+		status = IB_NOT_FOUND;
+		goto Exit;
+	}
 
 	OSM_LOG(sa->p_log, OSM_LOG_DEBUG,
 		"Path min MTU = %u, min rate = %u\n", mtu, rate);
@@ -898,7 +1091,8 @@ static osm_sa_item_t *mpr_rcv_get_lid_pair_path(IN osm_sa_t * sa,
 						IN const uint16_t src_lid_ho,
 						IN const uint16_t dest_lid_ho,
 						IN const ib_net64_t comp_mask,
-						IN const uint8_t preference)
+						IN const uint8_t preference,
+						IN mpr_walk_memo_t * p_memo)
 {
 	osm_path_parms_t path_parms;
 	osm_path_parms_t rev_path_parms;
@@ -921,7 +1115,7 @@ static osm_sa_item_t *mpr_rcv_get_lid_pair_path(IN osm_sa_t * sa,
 	status = mpr_rcv_get_path_parms(sa, p_mpr, p_src_alias_guid,
 					p_dest_alias_guid,
 					src_lid_ho, dest_lid_ho,
-					comp_mask, &path_parms);
+					comp_mask, p_memo, &path_parms);
 
 	if (status != IB_SUCCESS) {
 		free(p_pr_item);
@@ -933,7 +1127,8 @@ static osm_sa_item_t *mpr_rcv_get_lid_pair_path(IN osm_sa_t * sa,
 	rev_path_status = mpr_rcv_get_path_parms(sa, p_mpr, p_dest_alias_guid,
 						 p_src_alias_guid,
 						 dest_lid_ho, src_lid_ho,
-						 comp_mask, &rev_path_parms);
+						 comp_mask, p_memo,
+						 &rev_path_parms);
 	path_parms.reversible = (rev_path_status == IB_SUCCESS);
 
 	/* did we get a Reversible Path compmask ? */
@@ -973,6 +1168,7 @@ static uint32_t mpr_rcv_get_port_pair_paths(IN osm_sa_t * sa,
 					    IN const osm_alias_guid_t * p_dest_alias_guid,
 					    IN const uint32_t rem_paths,
 					    IN const ib_net64_t comp_mask,
+					    IN mpr_walk_memo_t * p_memo,
 					    IN cl_qlist_t * p_list)
 {
 	osm_sa_item_t *p_pr_item;
@@ -1077,7 +1273,8 @@ static uint32_t mpr_rcv_get_port_pair_paths(IN osm_sa_t * sa,
 						      p_src_alias_guid,
 						      p_dest_alias_guid,
 						      src_lid_ho, dest_lid_ho,
-						      comp_mask, preference);
+						      comp_mask, preference,
+						      p_memo);
 
 		if (p_pr_item) {
 			cl_qlist_insert_tail(p_list, &p_pr_item->list_item);
@@ -1141,7 +1338,8 @@ static uint32_t mpr_rcv_get_port_pair_paths(IN osm_sa_t * sa,
 						      p_src_alias_guid,
 						      p_dest_alias_guid,
 						      src_lid_ho, dest_lid_ho,
-						      comp_mask, preference);
+						      comp_mask, preference,
+						      p_memo);
 
 		if (p_pr_item) {
 			cl_qlist_insert_tail(p_list, &p_pr_item->list_item);
@@ -1168,6 +1366,8 @@ static osm_sa_item_t *mpr_rcv_get_apm_port_pair_paths(IN osm_sa_t * sa,
 						      IN int base_offs,
 						      IN const ib_net64_t
 						      comp_mask,
+						      IN mpr_walk_memo_t *
+						      p_memo,
 						      IN cl_qlist_t * p_list)
 {
 	osm_sa_item_t *p_pr_item = 0;
@@ -1218,7 +1418,7 @@ static osm_sa_item_t *mpr_rcv_get_apm_port_pair_paths(IN osm_sa_t * sa,
 						      p_src_alias_guid,
 						      p_dest_alias_guid,
 						      src_lid_ho, dest_lid_ho,
-						      comp_mask, 0);
+						      comp_mask, 0, p_memo);
 
 		if (p_pr_item) {
 			OSM_LOG(sa->p_log, OSM_LOG_DEBUG,
@@ -1355,6 +1555,7 @@ static void mpr_rcv_get_apm_paths(IN osm_sa_t * sa,
 				  IN const osm_port_t * p_req_port,
 				  IN osm_alias_guid_t ** _pp_alias_guids,
 				  IN const ib_net64_t comp_mask,
+				  IN mpr_walk_memo_t * p_memo,
 				  IN cl_qlist_t * p_list)
 {
 	osm_alias_guid_t *pp_alias_guids[4];
@@ -1405,19 +1606,19 @@ static void mpr_rcv_get_apm_paths(IN osm_sa_t * sa,
 	matrix[0][0] =
 	    mpr_rcv_get_apm_port_pair_paths(sa, p_mpr, pp_alias_guids[0],
 					    pp_alias_guids[2], base_offs,
-					    comp_mask, p_list);
+					    comp_mask, p_memo, p_list);
 	matrix[0][1] =
 	    mpr_rcv_get_apm_port_pair_paths(sa, p_mpr, pp_alias_guids[0],
 					    pp_alias_guids[3], base_offs,
-					    comp_mask, p_list);
+					    comp_mask, p_memo, p_list);
 	matrix[1][0] =
 	    mpr_rcv_get_apm_port_pair_paths(sa, p_mpr, pp_alias_guids[1],
 					    pp_alias_guids[2], base_offs + 1,
-					    comp_mask, p_list);
+					    comp_mask, p_memo, p_list);
 	matrix[1][1] =
 	    mpr_rcv_get_apm_port_pair_paths(sa, p_mpr, pp_alias_guids[1],
 					    pp_alias_guids[3], base_offs + 1,
-					    comp_mask, p_list);
+					    comp_mask, p_memo, p_list);
 
 	OSM_LOG(sa->p_log, OSM_LOG_DEBUG, "APM matrix:\n"
 		"\t{0,0} 0x%X->0x%X (%d)\t| {0,1} 0x%X->0x%X (%d)\n"
@@ -1509,6 +1710,7 @@ static void mpr_rcv_process_pairs(IN osm_sa_t * sa,
 				  IN osm_alias_guid_t ** pp_alias_guids,
 				  IN const int nsrc, IN int ndest,
 				  IN ib_net64_t comp_mask,
+				  IN mpr_walk_memo_t * p_memo,
 				  IN cl_qlist_t * p_list)
 {
 	osm_alias_guid_t **pp_src_alias_guid, **pp_es;
@@ -1531,7 +1733,8 @@ static void mpr_rcv_process_pairs(IN osm_sa_t * sa,
 							*pp_src_alias_guid,
 							*pp_dest_alias_guid,
 							max_paths - total_paths,
-							comp_mask, p_list);
+							comp_mask, p_memo,
+							p_list);
 			total_paths += num_paths;
 			OSM_LOG(sa->p_log, OSM_LOG_DEBUG,
 				"%d paths %d total paths %d max paths\n",
@@ -1555,6 +1758,7 @@ void osm_mpr_rcv_process(IN void *context, IN void *data)
 	osm_port_t *requester_port;
 	osm_alias_guid_t *pp_alias_guids[IB_MULTIPATH_MAX_GIDS];
 	cl_qlist_t pr_list;
+	mpr_walk_memo_t memo;
 	ib_net16_t sa_status;
 	int nsrc, ndest;
 	uint8_t rate, mtu;
@@ -1663,17 +1867,21 @@ void osm_mpr_rcv_process(IN void *context, IN void *data)
 		goto Exit;
 	}
 
+	mpr_walk_memo_init(&memo);
+
 	/* APM request */
 	if (nsrc == 2 && ndest == 2 && (p_mpr->num_path & 0x7F) == 2)
 		mpr_rcv_get_apm_paths(sa, p_mpr, requester_port, pp_alias_guids,
-				      p_sa_mad->comp_mask, &pr_list);
+				      p_sa_mad->comp_mask, &memo, &pr_list);
 	else
 		mpr_rcv_process_pairs(sa, p_mpr, requester_port, pp_alias_guids,
 				      nsrc, ndest, p_sa_mad->comp_mask,
-				      &pr_list);
+				      &memo, &pr_list);
 
 	cl_plock_release(sa->p_lock);
 
+	mpr_walk_memo_destroy(sa, &memo);
+
 	/* o15-0.2.7: If MultiPath is supported, then SA shall respond to a
 	   SubnAdmGetMulti() containing a valid MultiPathRecord attribute with
 	   a set of zero or more PathRecords satisfying the constraints
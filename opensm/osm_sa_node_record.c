@@ -57,29 +57,27 @@
 #include <opensm/osm_pkey.h>
 #include <opensm/osm_sa.h>
 
-#define SA_NR_RESP_SIZE SA_ITEM_RESP_SIZE(node_rec)
-
 typedef struct osm_nr_search_ctxt {
 	const ib_node_record_t *p_rcvd_rec;
 	ib_net64_t comp_mask;
-	cl_qlist_t *p_list;
+	osm_sa_resp_buf_t *p_buf;
 	osm_sa_t *sa;
 	const osm_physp_t *p_req_physp;
 } osm_nr_search_ctxt_t;
 
 static ib_api_status_t nr_rcv_new_nr(osm_sa_t * sa,
 				     IN const osm_node_t * p_node,
-				     IN cl_qlist_t * p_list,
+				     IN osm_sa_resp_buf_t * p_buf,
 				     IN ib_net64_t port_guid, IN ib_net16_t lid,
 	                             IN unsigned int port_num)
 {
-	osm_sa_item_t *p_rec_item;
+	ib_node_record_t *p_rec;
 	ib_api_status_t status = IB_SUCCESS;
 
 	OSM_LOG_ENTER(sa->p_log);
 
-	p_rec_item = malloc(SA_NR_RESP_SIZE);
-	if (p_rec_item == NULL) {
+	p_rec = osm_sa_resp_buf_new_rec(p_buf);
+	if (p_rec == NULL) {
 		OSM_LOG(sa->p_log, OSM_LOG_ERROR, "ERR 1D02: "
 			"rec_item alloc failed\n");
 		status = IB_INSUFFICIENT_RESOURCES;
@@ -92,18 +90,15 @@ static ib_api_status_t nr_rcv_new_nr(osm_sa_t * sa,
 		cl_ntoh64(osm_node_get_node_guid(p_node)),
 		cl_ntoh64(port_guid), cl_ntoh16(lid));
 
-	memset(p_rec_item, 0, SA_NR_RESP_SIZE);
-
-	p_rec_item->resp.node_rec.lid = lid;
+	p_rec->lid = lid;
 
-	p_rec_item->resp.node_rec.node_info = p_node->node_info;
-	p_rec_item->resp.node_rec.node_info.port_guid = port_guid;
-	p_rec_item->resp.node_rec.node_info.port_num_vendor_id =
-		(p_rec_item->resp.node_rec.node_info.port_num_vendor_id & IB_NODE_INFO_VEND_ID_MASK) |
+	p_rec->node_info = p_node->node_info;
+	p_rec->node_info.port_guid = port_guid;
+	p_rec->node_info.port_num_vendor_id =
+		(p_rec->node_info.port_num_vendor_id & IB_NODE_INFO_VEND_ID_MASK) |
 		((port_num << IB_NODE_INFO_PORT_NUM_SHIFT) & IB_NODE_INFO_PORT_NUM_MASK);
-	memcpy(&(p_rec_item->resp.node_rec.node_desc), &(p_node->node_desc),
+	memcpy(&(p_rec->node_desc), &(p_node->node_desc),
 	       IB_NODE_DESCRIPTION_SIZE);
-	cl_qlist_insert_tail(p_list, &p_rec_item->list_item);
 
 Exit:
 	OSM_LOG_EXIT(sa->p_log);
@@ -111,7 +106,7 @@ Exit:
 }
 
 static void nr_rcv_create_nr(IN osm_sa_t * sa, IN osm_node_t * p_node,
-			     IN cl_qlist_t * p_list,
+			     IN osm_sa_resp_buf_t * p_buf,
 			     IN ib_net64_t const match_port_guid,
 			     IN ib_net16_t const match_lid,
 			     IN unsigned int const match_port_num,
@@ -184,7 +179,7 @@ static void nr_rcv_create_nr(IN osm_sa_t * sa, IN osm_node_t * p_node,
 		    (port_num != match_port_num))
 			continue;
 
-		nr_rcv_new_nr(sa, p_node, p_list, port_guid, base_lid, port_num);
+		nr_rcv_new_nr(sa, p_node, p_buf, port_guid, base_lid, port_num);
 	}
 
 	OSM_LOG_EXIT(sa->p_log);
@@ -274,7 +269,7 @@ static void nr_rcv_by_comp_mask(IN cl_map_item_t * p_map_item, IN void *context)
 		    sizeof(ib_node_desc_t)))
 		goto Exit;
 
-	nr_rcv_create_nr(sa, p_node, p_ctxt->p_list, match_port_guid,
+	nr_rcv_create_nr(sa, p_node, p_ctxt->p_buf, match_port_guid,
 			 match_lid, match_port_num, p_req_physp, comp_mask);
 
 Exit:
@@ -287,7 +282,7 @@ void osm_nr_rcv_process(IN void *ctx, IN void *data)
 	osm_madw_t *p_madw = data;
 	const ib_sa_mad_t *p_rcvd_mad;
 	const ib_node_record_t *p_rcvd_rec;
-	cl_qlist_t rec_list;
+	osm_sa_resp_buf_t *p_buf;
 	osm_nr_search_ctxt_t context;
 	osm_physp_t *p_req_physp;
 
@@ -332,10 +327,19 @@ void osm_nr_rcv_process(IN void *ctx, IN void *data)
 		osm_dump_node_record_v2(sa->p_log, p_rcvd_rec, FILE_ID, OSM_LOG_DEBUG);
 	}
 
-	cl_qlist_init(&rec_list);
+	/* one record per end port at most, switches only report port 0 */
+	p_buf = osm_sa_resp_buf_get(sa, sizeof(ib_node_record_t),
+				    cl_qmap_count(&sa->p_subn->port_guid_tbl));
+	if (p_buf == NULL) {
+		cl_plock_release(sa->p_lock);
+		OSM_LOG(sa->p_log, OSM_LOG_ERROR, "ERR 1D03: "
+			"Cannot get response buffer\n");
+		osm_sa_send_error(sa, p_madw, IB_SA_MAD_STATUS_NO_RESOURCES);
+		goto Exit;
+	}
 
 	context.p_rcvd_rec = p_rcvd_rec;
-	context.p_list = &rec_list;
+	context.p_buf = p_buf;
 	context.comp_mask = p_rcvd_mad->comp_mask;
 	context.sa = sa;
 	context.p_req_physp = p_req_physp;
@@ -345,7 +349,7 @@ void osm_nr_rcv_process(IN void *ctx, IN void *data)
 
 	cl_plock_release(sa->p_lock);
 
-	osm_sa_respond(sa, p_madw, sizeof(ib_node_record_t), &rec_list);
+	osm_sa_respond_buf(sa, p_madw, p_buf);
 
 Exit:
 	OSM_LOG_EXIT(sa->p_log);
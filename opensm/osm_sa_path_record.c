@@ -142,42 +142,421 @@ sa_path_rec_apply_tavor_mtu_limit(IN const ib_path_rec_t * p_pr,
 	return TRUE;
 }
 
-static ib_api_status_t pr_rcv_get_path_parms(IN osm_sa_t * sa,
-					     IN const ib_path_rec_t * p_pr,
-					     IN const osm_alias_guid_t * p_src_alias_guid,
-					     IN const uint16_t src_lid_ho,
-					     IN const osm_alias_guid_t * p_dest_alias_guid,
-					     IN const uint16_t dest_lid_ho,
-					     IN const ib_net64_t comp_mask,
-					     OUT osm_path_parms_t * p_parms)
+ib_api_status_t osm_pr_cache_init(IN osm_pr_cache_t * p_cache)
+{
+	p_cache->rows = NULL;
+	p_cache->epoch = 1;
+	p_cache->active = FALSE;
+	p_cache->hits = p_cache->misses = 0;
+	p_cache->p_pkey_idx = NULL;
+	return cl_spinlock_init(&p_cache->lock);
+}
+
+static void pr_pkey_index_put(IN osm_pr_pkey_index_t * p_idx)
+{
+	if (p_idx && cl_atomic_dec(&p_idx->ref_cnt) == 0)
+		free(p_idx);
+}
+
+static void pr_cache_free_rows(IN osm_pr_cache_t * p_cache)
+{
+	unsigned i;
+
+	if (!p_cache->rows)
+		return;
+
+	for (i = 0; i <= IB_LID_UCAST_END_HO; i++)
+		if (p_cache->rows[i])
+			free(p_cache->rows[i]);
+	free(p_cache->rows);
+	p_cache->rows = NULL;
+}
+
+void osm_pr_cache_destroy(IN osm_pr_cache_t * p_cache)
+{
+	pr_cache_free_rows(p_cache);
+	pr_pkey_index_put(p_cache->p_pkey_idx);
+	p_cache->p_pkey_idx = NULL;
+	cl_spinlock_destroy(&p_cache->lock);
+}
+
+static void pr_cache_new_epoch(IN osm_sa_t * sa, IN boolean_t active)
+{
+	osm_pr_cache_t *p_cache = &sa->pr_cache;
+	uint64_t hits, misses;
+
+	cl_spinlock_acquire(&p_cache->lock);
+	/* on wrap around old entries could look valid again, drop them */
+	if (++p_cache->epoch == 0) {
+		pr_cache_free_rows(p_cache);
+		p_cache->epoch = 1;
+	}
+	p_cache->active = active;
+	hits = p_cache->hits;
+	misses = p_cache->misses;
+	p_cache->hits = p_cache->misses = 0;
+	cl_spinlock_release(&p_cache->lock);
+
+	if (hits || misses)
+		OSM_LOG(sa->p_log, OSM_LOG_VERBOSE,
+			"PathRecord cache epoch ended: "
+			"%" PRIu64 " hits, %" PRIu64 " misses\n", hits, misses);
+}
+
+void osm_pr_cache_invalidate(IN osm_sa_t * sa)
+{
+	pr_cache_new_epoch(sa, FALSE);
+}
+
+void osm_pr_cache_activate(IN osm_sa_t * sa)
+{
+	pr_cache_new_epoch(sa, TRUE);
+}
+
+static int pr_pkey_ent_cmp(const void *p1, const void *p2)
+{
+	const osm_pr_pkey_ent_t *e1 = p1, *e2 = p2;
+	uint16_t pkey1 = cl_ntoh16(e1->pkey), pkey2 = cl_ntoh16(e2->pkey);
+	uint64_t guid1, guid2;
+
+	if (pkey1 != pkey2)
+		return pkey1 < pkey2 ? -1 : 1;
+	guid1 = cl_ntoh64(osm_port_get_guid(e1->p_port));
+	guid2 = cl_ntoh64(osm_port_get_guid(e2->p_port));
+	if (guid1 != guid2)
+		return guid1 < guid2 ? -1 : 1;
+	return 0;
+}
+
+static osm_pr_pkey_index_t *pr_pkey_index_build(IN osm_sa_t * sa,
+						IN uint16_t epoch)
+{
+	const cl_qmap_t *p_tbl = &sa->p_subn->port_guid_tbl;
+	const osm_port_t *p_port;
+	const osm_pkey_tbl_t *p_pkey_tbl;
+	osm_pr_pkey_index_t *p_idx;
+	cl_map_iterator_t map_iter;
+	unsigned num_ent = 0, i, n;
+
+	for (p_port = (osm_port_t *) cl_qmap_head(p_tbl);
+	     p_port != (osm_port_t *) cl_qmap_end(p_tbl);
+	     p_port = (osm_port_t *) cl_qmap_next(&p_port->map_item))
+		num_ent += cl_map_count(&osm_physp_get_pkey_tbl(p_port->p_physp)->keys);
+
+	p_idx = malloc(sizeof(*p_idx) + num_ent * sizeof(p_idx->ent[0]));
+	if (!p_idx)
+		return NULL;
+
+	n = 0;
+	for (p_port = (osm_port_t *) cl_qmap_head(p_tbl);
+	     p_port != (osm_port_t *) cl_qmap_end(p_tbl);
+	     p_port = (osm_port_t *) cl_qmap_next(&p_port->map_item)) {
+		p_pkey_tbl = osm_physp_get_pkey_tbl(p_port->p_physp);
+		for (map_iter = cl_map_head(&p_pkey_tbl->keys);
+		     map_iter != cl_map_end(&p_pkey_tbl->keys);
+		     map_iter = cl_map_next(map_iter)) {
+			p_idx->ent[n].pkey =
+			    ib_pkey_get_base((ib_net16_t) cl_map_key(map_iter));
+			p_idx->ent[n].p_port = p_port;
+			n++;
+		}
+	}
+
+	qsort(p_idx->ent, n, sizeof(p_idx->ent[0]), pr_pkey_ent_cmp);
+
+	/* full and limited membership of the same partition are one entry */
+	for (num_ent = 0, i = 0; i < n; i++)
+		if (!num_ent ||
+		    pr_pkey_ent_cmp(&p_idx->ent[num_ent - 1], &p_idx->ent[i]))
+			p_idx->ent[num_ent++] = p_idx->ent[i];
+
+	p_idx->ref_cnt = 1;
+	p_idx->epoch = epoch;
+	p_idx->num_ent = num_ent;
+	return p_idx;
+}
+
+/*
+  Returns a reference to the PKey index of the current epoch, building it
+  when needed, or NULL when the subnet is not stable and the ports must be
+  scanned. Must be called under the SA lock.
+ */
+static osm_pr_pkey_index_t *pr_pkey_index_get(IN osm_sa_t * sa)
+{
+	osm_pr_cache_t *p_cache = &sa->pr_cache;
+	osm_pr_pkey_index_t *p_idx, *p_old = NULL;
+	uint16_t epoch;
+
+	cl_spinlock_acquire(&p_cache->lock);
+	if (!p_cache->active) {
+		cl_spinlock_release(&p_cache->lock);
+		return NULL;
+	}
+	epoch = p_cache->epoch;
+	p_idx = p_cache->p_pkey_idx;
+	if (p_idx && p_idx->epoch == epoch) {
+		cl_atomic_inc(&p_idx->ref_cnt);
+		cl_spinlock_release(&p_cache->lock);
+		return p_idx;
+	}
+	cl_spinlock_release(&p_cache->lock);
+
+	p_idx = pr_pkey_index_build(sa, epoch);
+	if (!p_idx) {
+		OSM_LOG(sa->p_log, OSM_LOG_ERROR, "ERR 1F27: "
+			"Cannot allocate PathRecord PKey index\n");
+		return NULL;
+	}
+
+	/* another query may have built it meanwhile, keep the newest */
+	cl_spinlock_acquire(&p_cache->lock);
+	if (p_cache->active && p_cache->epoch == epoch) {
+		p_old = p_cache->p_pkey_idx;
+		p_cache->p_pkey_idx = p_idx;
+		cl_atomic_inc(&p_idx->ref_cnt);
+	}
+	cl_spinlock_release(&p_cache->lock);
+
+	pr_pkey_index_put(p_old);
+
+	OSM_LOG(sa->p_log, OSM_LOG_DEBUG,
+		"PathRecord PKey index built with %u entries\n",
+		p_idx->num_ent);
+	return p_idx;
+}
+
+/*
+  Returns the index range of the ports with the given PKey base.
+ */
+static unsigned pr_pkey_index_find(IN const osm_pr_pkey_index_t * p_idx,
+				   IN ib_net16_t pkey, OUT unsigned *p_end)
+{
+	uint16_t pkey_ho = cl_ntoh16(ib_pkey_get_base(pkey));
+	unsigned lo = 0, hi = p_idx->num_ent, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (cl_ntoh16(p_idx->ent[mid].pkey) < pkey_ho)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	for (hi = lo; hi < p_idx->num_ent &&
+	     cl_ntoh16(p_idx->ent[hi].pkey) == pkey_ho; hi++)
+		;
+	*p_end = hi;
+	return lo;
+}
+
+static int pr_alias_guid_cmp(const void *p1, const void *p2)
+{
+	const osm_alias_guid_t *a1 = *(const osm_alias_guid_t * const *)p1;
+	const osm_alias_guid_t *a2 = *(const osm_alias_guid_t * const *)p2;
+
+	/* same order as the alias GUID table */
+	if (a1->alias_guid != a2->alias_guid)
+		return a1->alias_guid < a2->alias_guid ? -1 : 1;
+	return 0;
+}
+
+#define PR_MAX_PORT_ALIASES (256 + 1)
+
+/*
+  Collects the alias GUIDs of a port from its GUIDInfo table instead of
+  scanning the whole alias GUID table. The aliases array must have room
+  for PR_MAX_PORT_ALIASES entries.
+ */
+static unsigned pr_get_port_aliases(IN osm_sa_t * sa,
+				    IN const osm_port_t * p_port,
+				    OUT const osm_alias_guid_t ** aliases)
+{
+	const osm_physp_t *p_physp = p_port->p_physp;
+	const osm_alias_guid_t *p_alias_guid;
+	ib_net64_t guid;
+	unsigned i, j, n = 0, max;
+
+	p_alias_guid = osm_get_alias_guid_by_guid(sa->p_subn,
+						  osm_port_get_guid(p_port));
+	if (p_alias_guid && p_alias_guid->p_base_port == p_port)
+		aliases[n++] = p_alias_guid;
+
+	if (p_physp->p_guids) {
+		max = p_physp->port_info.guid_cap;
+		for (i = 1; i < max; i++) {
+			guid = (*p_physp->p_guids)[i];
+			if (!guid || guid == osm_port_get_guid(p_port))
+				continue;
+			p_alias_guid = osm_get_alias_guid_by_guid(sa->p_subn,
+								  guid);
+			if (p_alias_guid && p_alias_guid->p_base_port == p_port)
+				aliases[n++] = p_alias_guid;
+		}
+	}
+
+	if (n < 2)
+		return n;
+
+	qsort(aliases, n, sizeof(aliases[0]), pr_alias_guid_cmp);
+	for (i = 1, j = 1; i < n; i++)
+		if (aliases[i] != aliases[j - 1])
+			aliases[j++] = aliases[i];
+	return j;
+}
+
+static boolean_t pr_cache_is_active(IN osm_sa_t * sa)
+{
+	boolean_t active;
+
+	cl_spinlock_acquire(&sa->pr_cache.lock);
+	active = sa->pr_cache.active;
+	cl_spinlock_release(&sa->pr_cache.lock);
+	return active;
+}
+
+static boolean_t pr_cache_lookup(IN osm_sa_t * sa, IN uint16_t src_lid_ho,
+				 IN uint16_t dest_lid_ho,
+				 OUT osm_pr_cache_entry_t * p_entry,
+				 OUT uint16_t * p_epoch)
+{
+	osm_pr_cache_t *p_cache = &sa->pr_cache;
+	osm_pr_cache_row_t *p_row;
+	boolean_t found = FALSE;
+
+	if (src_lid_ho > IB_LID_UCAST_END_HO)
+		return FALSE;
+
+	cl_spinlock_acquire(&p_cache->lock);
+	*p_epoch = p_cache->epoch;
+	if (!p_cache->active)
+		goto Exit;
+
+	p_row = p_cache->rows ? p_cache->rows[src_lid_ho] : NULL;
+	if (p_row && dest_lid_ho < p_row->size &&
+	    p_row->entry[dest_lid_ho].epoch == p_cache->epoch) {
+		*p_entry = p_row->entry[dest_lid_ho];
+		p_cache->hits++;
+		found = TRUE;
+	} else
+		p_cache->misses++;
+Exit:
+	cl_spinlock_release(&p_cache->lock);
+	return found;
+}
+
+static void pr_cache_store(IN osm_sa_t * sa, IN uint16_t src_lid_ho,
+			   IN uint16_t dest_lid_ho, IN uint16_t epoch,
+			   IN uint8_t mtu, IN uint8_t rate,
+			   IN uint16_t valid_sl_mask)
+{
+	osm_pr_cache_t *p_cache = &sa->pr_cache;
+	osm_pr_cache_row_t *p_row;
+	osm_pr_cache_entry_t *p_entry;
+	unsigned size;
+
+	if (src_lid_ho > IB_LID_UCAST_END_HO)
+		return;
+
+	/* rows are sized by the highest LID currently assigned */
+	size = cl_ptr_vector_get_size(&sa->p_subn->port_lid_tbl);
+	if (size <= dest_lid_ho)
+		size = dest_lid_ho + 1;
+
+	cl_spinlock_acquire(&p_cache->lock);
+
+	/* the walk result is stale if the epoch changed meanwhile */
+	if (!p_cache->active || epoch != p_cache->epoch)
+		goto Exit;
+
+	if (!p_cache->rows) {
+		p_cache->rows = calloc(IB_LID_UCAST_END_HO + 1,
+				       sizeof(*p_cache->rows));
+		if (!p_cache->rows)
+			goto Exit;
+	}
+
+	p_row = p_cache->rows[src_lid_ho];
+	if (!p_row || p_row->size <= dest_lid_ho) {
+		p_row = realloc(p_row, sizeof(*p_row) +
+				size * sizeof(p_row->entry[0]));
+		if (!p_row)
+			goto Exit;
+		if (!p_cache->rows[src_lid_ho])
+			p_row->size = 0;
+		memset(&p_row->entry[p_row->size], 0,
+		       (size - p_row->size) * sizeof(p_row->entry[0]));
+		p_row->size = size;
+		p_cache->rows[src_lid_ho] = p_row;
+	}
+
+	p_entry = &p_row->entry[dest_lid_ho];
+	p_entry->epoch = epoch;
+	p_entry->valid_sl_mask = valid_sl_mask;
+	p_entry->mtu = mtu;
+	p_entry->rate = rate;
+Exit:
+	cl_spinlock_release(&p_cache->lock);
+}
+
+static ib_api_status_t pr_rcv_walk_path(IN osm_sa_t * sa,
+					IN const osm_alias_guid_t * p_src_alias_guid,
+					IN const uint16_t src_lid_ho,
+					IN const osm_alias_guid_t * p_dest_alias_guid,
+					IN const uint16_t dest_lid_ho,
+					OUT uint8_t * p_mtu, OUT uint8_t * p_rate,
+					OUT uint16_t * p_valid_sl_mask)
 {
 	const osm_node_t *p_node;
 	const osm_physp_t *p_physp, *p_physp0;
 	const osm_physp_t *p_src_physp;
 	const osm_physp_t *p_dest_physp;
-	const osm_prtn_t *p_prtn = NULL;
-	osm_opensm_t *p_osm;
-	struct osm_routing_engine *p_re;
 	const ib_port_info_t *p_pi, *p_pi0;
 	ib_api_status_t status = IB_SUCCESS;
-	ib_net16_t pkey;
 	uint8_t mtu;
 	uint8_t rate, p0_extended_rate, dest_rate;
-	uint8_t pkt_life;
-	uint8_t required_mtu;
-	uint8_t required_rate;
-	uint8_t required_pkt_life;
-	uint8_t sl;
 	uint8_t in_port_num;
 	ib_net16_t dest_lid;
 	uint8_t i;
 	ib_slvl_table_t *p_slvl_tbl = NULL;
-	osm_qos_level_t *p_qos_level = NULL;
 	uint16_t valid_sl_mask = 0xffff;
 	int hops = 0;
 	int extended, p0_extended;
+	osm_sa_snapshot_t *p_snap;
+	unsigned snap_hops, tree_hops;
 
-	OSM_LOG_ENTER(sa->p_log);
+	/*
+	   Without QoS the path does not depend on the SL2VL tables, so
+	   while the subnet is up its properties are looked up in the
+	   trees the unicast manager built from the forwarding tables.
+	 */
+	if (sa->p_subn->opt.sa_pr_dest_trees && !sa->p_subn->opt.qos &&
+	    pr_cache_is_active(sa) &&
+	    osm_ucast_mgr_get_dest_path(&sa->sm->ucast_mgr,
+					p_src_alias_guid->p_base_port->p_physp,
+					dest_lid_ho, p_mtu, p_rate,
+					&tree_hops) == IB_SUCCESS) {
+		*p_valid_sl_mask = 0xffff;
+		goto Exit;
+	}
+
+	/*
+	   Prefer the routing snapshot, which stays consistent while
+	   a sweep modifies the subnet. Fall back to walking the live
+	   subnet objects if it cannot resolve the path.
+	 */
+	if (sa->p_subn->opt.sa_snapshot &&
+	    (p_snap = osm_sa_snapshot_get(sa))) {
+		status = osm_sa_snapshot_walk(p_snap,
+					      osm_port_get_guid(p_src_alias_guid->p_base_port),
+					      src_lid_ho,
+					      osm_port_get_guid(p_dest_alias_guid->p_base_port),
+					      dest_lid_ho, p_mtu, p_rate,
+					      p_valid_sl_mask, &snap_hops);
+		osm_sa_snapshot_put(p_snap);
+		if (status == IB_SUCCESS)
+			goto Exit;
+		status = IB_SUCCESS;
+	}
 
 	dest_lid = cl_hton16(dest_lid_ho);
 
@@ -185,30 +564,10 @@ static ib_api_status_t pr_rcv_get_path_parms(IN osm_sa_t * sa,
 	p_physp = p_src_alias_guid->p_base_port->p_physp;
 	p_src_physp = p_physp;
 	p_pi = &p_physp->port_info;
-	p_osm = sa->p_subn->p_osm;
-	p_re = p_osm->routing_engine_used;
 
 	mtu = ib_port_info_get_mtu_cap(p_pi);
 	extended = p_pi->capability_mask & IB_PORT_CAP_HAS_EXT_SPEEDS;
 	rate = ib_port_info_compute_rate(p_pi, extended);
-
-	/*
-	   Mellanox Tavor device performance is better using 1K MTU.
-	   If required MTU and MTU selector are such that 1K is OK
-	   and at least one end of the path is Tavor we override the
-	   port MTU with 1K.
-	 */
-	if (sa->p_subn->opt.enable_quirks &&
-	    sa_path_rec_apply_tavor_mtu_limit(p_pr,
-					      p_src_alias_guid->p_base_port,
-					      p_dest_alias_guid->p_base_port,
-					      comp_mask))
-		if (mtu > IB_MTU_LEN_1024) {
-			mtu = IB_MTU_LEN_1024;
-			OSM_LOG(sa->p_log, OSM_LOG_DEBUG,
-				"Optimized Path MTU to 1K for Mellanox Tavor device\n");
-		}
-
 	/*
 	   Walk the subnet object from source to destination,
 	   tracking the most restrictive rate and mtu values along the way...
@@ -431,6 +790,86 @@ static ib_api_status_t pr_rcv_get_path_parms(IN osm_sa_t * sa,
 	if (ib_path_compare_rates(rate, dest_rate) > 0)
 		rate = dest_rate;
 
+	*p_mtu = mtu;
+	*p_rate = rate;
+	*p_valid_sl_mask = valid_sl_mask;
+Exit:
+	return status;
+}
+
+static ib_api_status_t pr_rcv_get_path_parms(IN osm_sa_t * sa,
+					     IN const ib_path_rec_t * p_pr,
+					     IN const osm_alias_guid_t * p_src_alias_guid,
+					     IN const uint16_t src_lid_ho,
+					     IN const osm_alias_guid_t * p_dest_alias_guid,
+					     IN const uint16_t dest_lid_ho,
+					     IN const ib_net64_t comp_mask,
+					     OUT osm_path_parms_t * p_parms)
+{
+	const osm_physp_t *p_src_physp;
+	const osm_physp_t *p_dest_physp;
+	const osm_prtn_t *p_prtn = NULL;
+	osm_opensm_t *p_osm;
+	struct osm_routing_engine *p_re;
+	osm_pr_cache_entry_t cached;
+	ib_api_status_t status = IB_SUCCESS;
+	ib_net16_t pkey;
+	uint8_t mtu;
+	uint8_t rate;
+	uint8_t pkt_life;
+	uint8_t required_mtu;
+	uint8_t required_rate;
+	uint8_t required_pkt_life;
+	uint8_t sl;
+	uint8_t i;
+	osm_qos_level_t *p_qos_level = NULL;
+	uint16_t valid_sl_mask;
+	uint16_t epoch = 0;
+
+	OSM_LOG_ENTER(sa->p_log);
+
+	p_dest_physp = p_dest_alias_guid->p_base_port->p_physp;
+	p_src_physp = p_src_alias_guid->p_base_port->p_physp;
+	p_osm = sa->p_subn->p_osm;
+	p_re = p_osm->routing_engine_used;
+
+	/*
+	   The fabric walk only depends on the LIDs and on the routing,
+	   so it is served from the PathRecord cache when possible.
+	 */
+	if (sa->p_subn->opt.sa_pr_cache &&
+	    pr_cache_lookup(sa, src_lid_ho, dest_lid_ho, &cached, &epoch)) {
+		mtu = cached.mtu;
+		rate = cached.rate;
+		valid_sl_mask = cached.valid_sl_mask;
+	} else {
+		status = pr_rcv_walk_path(sa, p_src_alias_guid, src_lid_ho,
+					  p_dest_alias_guid, dest_lid_ho,
+					  &mtu, &rate, &valid_sl_mask);
+		if (status != IB_SUCCESS)
+			goto Exit;
+		if (sa->p_subn->opt.sa_pr_cache)
+			pr_cache_store(sa, src_lid_ho, dest_lid_ho, epoch,
+				       mtu, rate, valid_sl_mask);
+	}
+
+	/*
+	   Mellanox Tavor device performance is better using 1K MTU.
+	   If required MTU and MTU selector are such that 1K is OK
+	   and at least one end of the path is Tavor we override the
+	   port MTU with 1K.
+	 */
+	if (sa->p_subn->opt.enable_quirks &&
+	    sa_path_rec_apply_tavor_mtu_limit(p_pr,
+					      p_src_alias_guid->p_base_port,
+					      p_dest_alias_guid->p_base_port,
+					      comp_mask))
+		if (mtu > IB_MTU_LEN_1024) {
+			mtu = IB_MTU_LEN_1024;
+			OSM_LOG(sa->p_log, OSM_LOG_DEBUG,
+				"Optimized Path MTU to 1K for Mellanox Tavor device\n");
+		}
+
 	OSM_LOG(sa->p_log, OSM_LOG_DEBUG,
 		"Path min MTU = %u, min rate = %u\n", mtu, rate);
 
@@ -1441,6 +1880,75 @@ Exit:
 	return sa_status;
 }
 
+/*
+  Returns the PKey index to restrict the query ports with, or NULL when
+  the query does not select a PKey or the index is not available.
+ */
+static osm_pr_pkey_index_t *pr_pkey_index_for_query(IN osm_sa_t * sa,
+						    IN const ib_sa_mad_t * sa_mad)
+{
+	const ib_path_rec_t *p_pr = ib_sa_mad_get_payload_ptr(sa_mad);
+	ib_net64_t comp_mask = sa_mad->comp_mask;
+
+	if (!(comp_mask & IB_PR_COMPMASK_PKEY))
+		return NULL;
+
+	/* raw traffic paths ignore the requested PKey */
+	if ((comp_mask & IB_PR_COMPMASK_RAWTRAFFIC) &&
+	    (cl_ntoh32(p_pr->hop_flow_raw) & (1 << 31)))
+		return NULL;
+
+	return pr_pkey_index_get(sa);
+}
+
+static void pr_rcv_process_world_indexed(IN osm_sa_t * sa,
+					 IN const ib_sa_mad_t * sa_mad,
+					 IN const osm_pr_pkey_index_t * p_idx,
+					 IN const osm_port_t * requester_port,
+					 IN const ib_gid_t * p_sgid,
+					 IN const ib_gid_t * p_dgid,
+					 IN cl_qlist_t * p_list)
+{
+	const ib_path_rec_t *p_pr = ib_sa_mad_get_payload_ptr(sa_mad);
+	const osm_alias_guid_t *port_aliases[PR_MAX_PORT_ALIASES];
+	const osm_alias_guid_t **aliases;
+	unsigned first, end, num_aliases = 0, i, j;
+
+	first = pr_pkey_index_find(p_idx, p_pr->pkey, &end);
+	for (i = first; i < end; i++)
+		num_aliases += pr_get_port_aliases(sa, p_idx->ent[i].p_port,
+						   port_aliases);
+	if (!num_aliases)
+		return;
+
+	aliases = malloc(num_aliases * sizeof(*aliases));
+	if (!aliases) {
+		OSM_LOG(sa->p_log, OSM_LOG_ERROR, "ERR 1F28: "
+			"Cannot allocate alias GUID array\n");
+		return;
+	}
+
+	for (num_aliases = 0, i = first; i < end; i++) {
+		j = pr_get_port_aliases(sa, p_idx->ent[i].p_port, port_aliases);
+		memcpy(&aliases[num_aliases], port_aliases,
+		       j * sizeof(*aliases));
+		num_aliases += j;
+	}
+
+	for (i = 0; i < num_aliases; i++)
+		for (j = 0; j < num_aliases; j++) {
+			pr_rcv_get_port_pair_paths(sa, sa_mad, requester_port,
+						   aliases[j], aliases[i],
+						   p_sgid, p_dgid, p_list);
+			if (sa_mad->method == IB_MAD_METHOD_GET &&
+			    cl_qlist_count(p_list) > 0)
+				goto Exit;
+		}
+
+Exit:
+	free(aliases);
+}
+
 static void pr_rcv_process_world(IN osm_sa_t * sa, IN const ib_sa_mad_t * sa_mad,
 				 IN const osm_port_t * requester_port,
 				 IN const ib_gid_t * p_sgid,
@@ -1449,9 +1957,22 @@ static void pr_rcv_process_world(IN osm_sa_t * sa, IN const ib_sa_mad_t * sa_mad
 {
 	const cl_qmap_t *p_tbl;
 	const osm_alias_guid_t *p_dest_alias_guid, *p_src_alias_guid;
+	osm_pr_pkey_index_t *p_idx;
 
 	OSM_LOG_ENTER(sa->p_log);
 
+	/*
+	   When a PKey is specified only the ports which are members of
+	   that partition can be on either side of the path.
+	 */
+	p_idx = pr_pkey_index_for_query(sa, sa_mad);
+	if (p_idx) {
+		pr_rcv_process_world_indexed(sa, sa_mad, p_idx, requester_port,
+					     p_sgid, p_dgid, p_list);
+		pr_pkey_index_put(p_idx);
+		goto Exit;
+	}
+
 	/*
 	   Iterate the entire port space over itself.
 	   A path record from a port to itself is legit, so no
@@ -1486,6 +2007,45 @@ Exit:
 	OSM_LOG_EXIT(sa->p_log);
 }
 
+static void pr_process_half_indexed(IN osm_sa_t * sa,
+				    IN const ib_sa_mad_t * sa_mad,
+				    IN const osm_pr_pkey_index_t * p_idx,
+				    IN const osm_port_t * requester_port,
+				    IN const osm_alias_guid_t * p_src_alias_guid,
+				    IN const osm_alias_guid_t * p_dest_alias_guid,
+				    IN const ib_gid_t * p_sgid,
+				    IN const ib_gid_t * p_dgid,
+				    IN cl_qlist_t * p_list)
+{
+	const ib_path_rec_t *p_pr = ib_sa_mad_get_payload_ptr(sa_mad);
+	const osm_alias_guid_t *aliases[PR_MAX_PORT_ALIASES];
+	unsigned first, end, num_aliases, i, j;
+
+	first = pr_pkey_index_find(p_idx, p_pr->pkey, &end);
+	for (i = first; i < end; i++) {
+		num_aliases = pr_get_port_aliases(sa, p_idx->ent[i].p_port,
+						  aliases);
+		for (j = 0; j < num_aliases; j++) {
+			if (p_src_alias_guid)
+				pr_rcv_get_port_pair_paths(sa, sa_mad,
+							   requester_port,
+							   p_src_alias_guid,
+							   aliases[j], p_sgid,
+							   p_dgid, p_list);
+			else
+				pr_rcv_get_port_pair_paths(sa, sa_mad,
+							   requester_port,
+							   aliases[j],
+							   p_dest_alias_guid,
+							   p_sgid, p_dgid,
+							   p_list);
+			if (sa_mad->method == IB_MAD_METHOD_GET &&
+			    cl_qlist_count(p_list) > 0)
+				return;
+		}
+	}
+}
+
 void osm_pr_process_half(IN osm_sa_t * sa, IN const ib_sa_mad_t * sa_mad,
 				IN const osm_port_t * requester_port,
 				IN const osm_alias_guid_t * p_src_alias_guid,
@@ -1496,9 +2056,22 @@ void osm_pr_process_half(IN osm_sa_t * sa, IN const ib_sa_mad_t * sa_mad,
 {
 	const cl_qmap_t *p_tbl;
 	const osm_alias_guid_t *p_alias_guid;
+	osm_pr_pkey_index_t *p_idx;
 
 	OSM_LOG_ENTER(sa->p_log);
 
+	/*
+	   With a PKey specified, only iterate over the partition members.
+	 */
+	p_idx = pr_pkey_index_for_query(sa, sa_mad);
+	if (p_idx) {
+		pr_process_half_indexed(sa, sa_mad, p_idx, requester_port,
+					p_src_alias_guid, p_dest_alias_guid,
+					p_sgid, p_dgid, p_list);
+		pr_pkey_index_put(p_idx);
+		goto Exit;
+	}
+
 	/*
 	   Iterate over every port, looking for matches...
 	   A path record from a port to itself is legit, so no
@@ -1538,6 +2111,7 @@ void osm_pr_process_half(IN osm_sa_t * sa, IN const ib_sa_mad_t * sa_mad,
 		}
 	}
 
+Exit:
 	OSM_LOG_EXIT(sa->p_log);
 }
 
@@ -1735,23 +2309,22 @@ static void pr_process_multicast(osm_sa_t * sa, const ib_sa_mad_t *sa_mad,
 	cl_qlist_insert_tail(list, &pr_item->list_item);
 }
 
-void osm_pr_rcv_process(IN void *context, IN void *data)
+/****f* OpenSM: SA/pr_rcv_check_mad
+ * NAME
+ * pr_rcv_check_mad
+ *
+ * DESCRIPTION
+ * Validates a PathRecord request. Returns FALSE when the request was
+ * answered with an error.
+ *
+ * SYNOPSIS
+ */
+static boolean_t pr_rcv_check_mad(IN osm_sa_t * sa, IN osm_madw_t * p_madw)
 {
-	osm_sa_t *sa = context;
-	osm_madw_t *p_madw = data;
 	const ib_sa_mad_t *p_sa_mad = osm_madw_get_sa_mad_ptr(p_madw);
 	ib_path_rec_t *p_pr = ib_sa_mad_get_payload_ptr(p_sa_mad);
-	cl_qlist_t pr_list;
-	const ib_gid_t *p_sgid = NULL, *p_dgid = NULL;
-	const osm_alias_guid_t *p_src_alias_guid, *p_dest_alias_guid;
-	const osm_port_t *p_src_port, *p_dest_port;
-	osm_port_t *requester_port;
 	uint8_t rate, mtu;
 
-	OSM_LOG_ENTER(sa->p_log);
-
-	CL_ASSERT(p_madw);
-
 	CL_ASSERT(p_sa_mad->attr_id == IB_MAD_ATTR_PATH_RECORD);
 
 	/* we only support SubnAdmGet and SubnAdmGetTable methods */
@@ -1761,7 +2334,7 @@ void osm_pr_rcv_process(IN void *context, IN void *data)
 			"Unsupported Method (%s) for PathRecord request\n",
 			ib_get_sa_method_str(p_sa_mad->method));
 		osm_sa_send_error(sa, p_madw, IB_MAD_STATUS_UNSUP_METHOD_ATTR);
-		goto Exit;
+		return FALSE;
 	}
 
 	/* Validate rate if supplied */
@@ -1771,7 +2344,7 @@ void osm_pr_rcv_process(IN void *context, IN void *data)
 		if (!ib_rate_is_valid(rate)) {
 			osm_sa_send_error(sa, p_madw,
 					  IB_SA_MAD_STATUS_REQ_INVALID);
-			goto Exit;
+			return FALSE;
 		}
 	}
 	/* Validate MTU if supplied */
@@ -1781,7 +2354,7 @@ void osm_pr_rcv_process(IN void *context, IN void *data)
 		if (!ib_mtu_is_valid(mtu)) {
 			osm_sa_send_error(sa, p_madw,
 					  IB_SA_MAD_STATUS_REQ_INVALID);
-			goto Exit;
+			return FALSE;
 		}
 	}
 
@@ -1790,16 +2363,37 @@ void osm_pr_rcv_process(IN void *context, IN void *data)
 	    (p_sa_mad->comp_mask & IB_PR_COMPMASK_SERVICEID) !=
 	     IB_PR_COMPMASK_SERVICEID) {
 		osm_sa_send_error(sa, p_madw, IB_SA_MAD_STATUS_INSUF_COMPS);
-		goto Exit;
+		return FALSE;
 	}
 
-	cl_qlist_init(&pr_list);
+	return TRUE;
+}
 
-	/*
-	   Most SA functions (including this one) are read-only on the
-	   subnet object, so we grab the lock non-exclusively.
-	 */
-	cl_plock_acquire(sa->p_lock);
+/****f* OpenSM: SA/pr_rcv_process_locked
+ * NAME
+ * pr_rcv_process_locked
+ *
+ * DESCRIPTION
+ * Resolves a validated PathRecord request and responds to it.
+ * Called with the subnet lock held for shared access, which is
+ * released before responding.
+ *
+ * SYNOPSIS
+ */
+static void pr_rcv_process_locked(IN osm_sa_t * sa, IN osm_madw_t * p_madw)
+{
+	const ib_sa_mad_t *p_sa_mad = osm_madw_get_sa_mad_ptr(p_madw);
+	ib_path_rec_t *p_pr = ib_sa_mad_get_payload_ptr(p_sa_mad);
+	cl_qlist_t pr_list;
+	const ib_gid_t *p_sgid = NULL, *p_dgid = NULL;
+	const osm_alias_guid_t *p_src_alias_guid, *p_dest_alias_guid;
+	const osm_port_t *p_src_port, *p_dest_port;
+	const osm_alias_guid_t *src_aliases[PR_MAX_PORT_ALIASES];
+	const osm_alias_guid_t *dest_aliases[PR_MAX_PORT_ALIASES];
+	unsigned num_src, num_dest, i, j;
+	osm_port_t *requester_port;
+
+	cl_qlist_init(&pr_list);
 
 	/* update the requester physical port */
 	requester_port = osm_get_port_by_mad_addr(sa->p_log, sa->p_subn,
@@ -1809,7 +2403,7 @@ void osm_pr_rcv_process(IN void *context, IN void *data)
 		cl_plock_release(sa->p_lock);
 		OSM_LOG(sa->p_log, OSM_LOG_ERROR, "ERR 1F16: "
 			"Cannot find requester physical port\n");
-		goto Exit;
+		return;
 	}
 
 	if (OSM_LOG_IS_ACTIVE_V2(sa->p_log, OSM_LOG_DEBUG)) {
@@ -1844,7 +2438,7 @@ void osm_pr_rcv_process(IN void *context, IN void *data)
 			cl_ntoh64(p_pr->sgid.unicast.interface_id),
 			cl_ntoh16(p_pr->slid));
 		osm_sa_send_error(sa, p_madw, IB_SA_MAD_STATUS_REQ_INVALID);
-		goto Exit;
+		return;
 	}
 
 	if (p_dest_alias_guid && p_dest_port &&
@@ -1857,7 +2451,7 @@ void osm_pr_rcv_process(IN void *context, IN void *data)
 			cl_ntoh64(p_pr->dgid.unicast.interface_id),
 			cl_ntoh16(p_pr->dlid));
 		osm_sa_send_error(sa, p_madw, IB_SA_MAD_STATUS_REQ_INVALID);
-		goto Exit;
+		return;
 	}
 
 	/*
@@ -1875,22 +2469,18 @@ void osm_pr_rcv_process(IN void *context, IN void *data)
 					    p_dgid, &pr_list);
 		else {
 			/* Get all alias GUIDs for the dest port */
-			p_dest_alias_guid = (osm_alias_guid_t *) cl_qmap_head(&sa->p_subn->alias_port_guid_tbl);
-			while (p_dest_alias_guid !=
-			       (osm_alias_guid_t *) cl_qmap_end(&sa->p_subn->alias_port_guid_tbl)) {
-				if (osm_get_port_by_alias_guid(sa->p_subn, p_dest_alias_guid->alias_guid) ==
-				    p_dest_port)
-					osm_pr_process_pair(sa, p_sa_mad,
-							    requester_port,
-							    p_src_alias_guid,
-							    p_dest_alias_guid,
-							    p_sgid, p_dgid,
-							    &pr_list);
+			num_dest = pr_get_port_aliases(sa, p_dest_port,
+						       dest_aliases);
+			for (j = 0; j < num_dest; j++) {
+				osm_pr_process_pair(sa, p_sa_mad,
+						    requester_port,
+						    p_src_alias_guid,
+						    dest_aliases[j],
+						    p_sgid, p_dgid,
+						    &pr_list);
 				if (p_sa_mad->method == IB_MAD_METHOD_GET &&
 				    cl_qlist_count(&pr_list) > 0)
 					break;
-
-				p_dest_alias_guid = (osm_alias_guid_t *) cl_qmap_next(&p_dest_alias_guid->map_item);
 			}
 		}
 	} else {
@@ -1906,87 +2496,61 @@ void osm_pr_rcv_process(IN void *context, IN void *data)
 					     p_sgid, p_dgid, &pr_list);
 		else if (p_dest_alias_guid && p_src_port) {
 			/* Get all alias GUIDs for the src port */
-			p_src_alias_guid = (osm_alias_guid_t *) cl_qmap_head(&sa->p_subn->alias_port_guid_tbl);
-			while (p_src_alias_guid !=
-			       (osm_alias_guid_t *) cl_qmap_end(&sa->p_subn->alias_port_guid_tbl)) {
-				if (osm_get_port_by_alias_guid(sa->p_subn,
-							       p_src_alias_guid->alias_guid) ==
-				    p_src_port)
-					osm_pr_process_pair(sa, p_sa_mad,
-							    requester_port,
-							    p_src_alias_guid,
-							    p_dest_alias_guid,
-							    p_sgid, p_dgid,
-							    &pr_list);
+			num_src = pr_get_port_aliases(sa, p_src_port,
+						      src_aliases);
+			for (i = 0; i < num_src; i++) {
+				osm_pr_process_pair(sa, p_sa_mad,
+						    requester_port,
+						    src_aliases[i],
+						    p_dest_alias_guid,
+						    p_sgid, p_dgid,
+						    &pr_list);
 				if (p_sa_mad->method == IB_MAD_METHOD_GET &&
 				    cl_qlist_count(&pr_list) > 0)
 					break;
-				p_src_alias_guid = (osm_alias_guid_t *) cl_qmap_next(&p_src_alias_guid->map_item);
 			}
 		} else if (p_src_port && !p_dest_port) {
 			/* Get all alias GUIDs for the src port */
-			p_src_alias_guid = (osm_alias_guid_t *) cl_qmap_head(&sa->p_subn->alias_port_guid_tbl);
-			while (p_src_alias_guid !=
-			       (osm_alias_guid_t *) cl_qmap_end(&sa->p_subn->alias_port_guid_tbl)) {
-				if (osm_get_port_by_alias_guid(sa->p_subn,
-							       p_src_alias_guid->alias_guid) ==
-				    p_src_port)
-					osm_pr_process_half(sa, p_sa_mad,
-							    requester_port,
-							    p_src_alias_guid,
-							    NULL, p_sgid,
-							    p_dgid, &pr_list);
-				p_src_alias_guid = (osm_alias_guid_t *) cl_qmap_next(&p_src_alias_guid->map_item);
-			}
+			num_src = pr_get_port_aliases(sa, p_src_port,
+						      src_aliases);
+			for (i = 0; i < num_src; i++)
+				osm_pr_process_half(sa, p_sa_mad,
+						    requester_port,
+						    src_aliases[i],
+						    NULL, p_sgid,
+						    p_dgid, &pr_list);
 		} else if (p_dest_port && !p_src_port) {
 			/* Get all alias GUIDs for the dest port */
-			p_dest_alias_guid = (osm_alias_guid_t *) cl_qmap_head(&sa->p_subn->alias_port_guid_tbl);
-			while (p_dest_alias_guid !=
-			       (osm_alias_guid_t *) cl_qmap_end(&sa->p_subn->alias_port_guid_tbl)) {
-				if (osm_get_port_by_alias_guid(sa->p_subn,
-							       p_dest_alias_guid->alias_guid) ==
-				    p_dest_port)
-					osm_pr_process_half(sa, p_sa_mad,
+			num_dest = pr_get_port_aliases(sa, p_dest_port,
+						       dest_aliases);
+			for (j = 0; j < num_dest; j++)
+				osm_pr_process_half(sa, p_sa_mad,
+						    requester_port,
+						    NULL,
+						    dest_aliases[j],
+						    p_sgid, p_dgid,
+						    &pr_list);
+		} else {
+			/* Get all alias GUIDs for the src and dest ports */
+			num_src = pr_get_port_aliases(sa, p_src_port,
+						      src_aliases);
+			num_dest = pr_get_port_aliases(sa, p_dest_port,
+						       dest_aliases);
+			for (i = 0; i < num_src; i++) {
+				for (j = 0; j < num_dest; j++) {
+					osm_pr_process_pair(sa, p_sa_mad,
 							    requester_port,
-							    NULL,
-							    p_dest_alias_guid,
+							    src_aliases[i],
+							    dest_aliases[j],
 							    p_sgid, p_dgid,
 							    &pr_list);
-				p_dest_alias_guid = (osm_alias_guid_t *) cl_qmap_next(&p_dest_alias_guid->map_item);
-			}
-		} else {
-			/* Get all alias GUIDs for the src port */
-			p_src_alias_guid = (osm_alias_guid_t *) cl_qmap_head(&sa->p_subn->alias_port_guid_tbl);
-			while (p_src_alias_guid !=
-			       (osm_alias_guid_t *) cl_qmap_end(&sa->p_subn->alias_port_guid_tbl)) {
-				if (osm_get_port_by_alias_guid(sa->p_subn,
-							       p_src_alias_guid->alias_guid) ==
-				    p_src_port) {
-					/* Get all alias GUIDs for the dest port */
-					p_dest_alias_guid = (osm_alias_guid_t *) cl_qmap_head(&sa->p_subn->alias_port_guid_tbl);
-					while (p_dest_alias_guid !=
-					       (osm_alias_guid_t *) cl_qmap_end(&sa->p_subn->alias_port_guid_tbl)) {
-						if (osm_get_port_by_alias_guid(sa->p_subn,
-									       p_dest_alias_guid->alias_guid) ==
-						    p_dest_port)
-						osm_pr_process_pair(sa,
-								    p_sa_mad,
-								    requester_port,
-								    p_src_alias_guid,
-								    p_dest_alias_guid,
-								    p_sgid,
-								    p_dgid,
-								    &pr_list);
-						if (p_sa_mad->method == IB_MAD_METHOD_GET &&
-						    cl_qlist_count(&pr_list) > 0)
-							break;
-						p_dest_alias_guid = (osm_alias_guid_t *) cl_qmap_next(&p_dest_alias_guid->map_item);
-					}
+					if (p_sa_mad->method == IB_MAD_METHOD_GET &&
+					    cl_qlist_count(&pr_list) > 0)
+						break;
 				}
 				if (p_sa_mad->method == IB_MAD_METHOD_GET &&
 				    cl_qlist_count(&pr_list) > 0)
 					break;
-				p_src_alias_guid = (osm_alias_guid_t *) cl_qmap_next(&p_src_alias_guid->map_item);
 			}
 		}
 	}
@@ -1996,7 +2560,53 @@ Unlock:
 
 	/* Now, (finally) respond to the PathRecord request */
 	osm_sa_respond(sa, p_madw, sizeof(ib_path_rec_t), &pr_list);
+}
+
+void osm_pr_rcv_process(IN void *context, IN void *data)
+{
+	osm_sa_t *sa = context;
+	osm_madw_t *p_madw = data;
+
+	OSM_LOG_ENTER(sa->p_log);
+
+	CL_ASSERT(p_madw);
+
+	if (!pr_rcv_check_mad(sa, p_madw))
+		goto Exit;
+
+	/*
+	   Most SA functions (including this one) are read-only on the
+	   subnet object, so we grab the lock non-exclusively.
+	 */
+	cl_plock_acquire(sa->p_lock);
+	pr_rcv_process_locked(sa, p_madw);
 
 Exit:
 	OSM_LOG_EXIT(sa->p_log);
 }
+
+boolean_t osm_pr_rcv_process_inline(IN osm_sa_t * sa, IN osm_madw_t * p_madw)
+{
+	osm_sa_snapshot_t *p_snap;
+
+	/*
+	   Only worth it (and bounded) while the subnet is stable and paths
+	   are resolved from the routing snapshot rather than the live LFTs.
+	 */
+	if (!sa->p_subn->opt.sa_snapshot || !pr_cache_is_active(sa))
+		return FALSE;
+	p_snap = osm_sa_snapshot_get(sa);
+	if (!p_snap)
+		return FALSE;
+	osm_sa_snapshot_put(p_snap);
+
+	if (!pr_rcv_check_mad(sa, p_madw))
+		return TRUE;
+
+	/* never block the receive thread behind a sweep */
+	if (cl_plock_try_acquire(sa->p_lock) != CL_SUCCESS)
+		return FALSE;
+
+	pr_rcv_process_locked(sa, p_madw);
+	return TRUE;
+}
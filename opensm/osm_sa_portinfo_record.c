@@ -61,12 +61,10 @@
 #include <opensm/osm_pkey.h>
 #include <opensm/osm_sa.h>
 
-#define SA_PIR_RESP_SIZE SA_ITEM_RESP_SIZE(port_rec)
-
 typedef struct osm_pir_search_ctxt {
 	const ib_portinfo_record_t *p_rcvd_rec;
 	ib_net64_t comp_mask;
-	cl_qlist_t *p_list;
+	osm_sa_resp_buf_t *p_buf;
 	osm_sa_t *sa;
 	const osm_physp_t *p_req_physp;
 	boolean_t is_enhanced_comp_mask;
@@ -77,15 +75,15 @@ static ib_api_status_t pir_rcv_new_pir(IN osm_sa_t * sa,
 				       IN osm_pir_search_ctxt_t * p_ctxt,
 				       IN ib_net16_t const lid)
 {
-	osm_sa_item_t *p_rec_item;
+	ib_portinfo_record_t *p_rec;
 	ib_port_info_t *p_pi;
 	osm_physp_t *p_physp0;
 	ib_api_status_t status = IB_SUCCESS;
 
 	OSM_LOG_ENTER(sa->p_log);
 
-	p_rec_item = malloc(SA_PIR_RESP_SIZE);
-	if (p_rec_item == NULL) {
+	p_rec = osm_sa_resp_buf_new_rec(p_ctxt->p_buf);
+	if (p_rec == NULL) {
 		OSM_LOG(sa->p_log, OSM_LOG_ERROR, "ERR 2102: "
 			"rec_item alloc failed\n");
 		status = IB_INSUFFICIENT_RESOURCES;
@@ -98,12 +96,10 @@ static ib_api_status_t pir_rcv_new_pir(IN osm_sa_t * sa,
 		cl_ntoh64(osm_physp_get_port_guid(p_physp)),
 		cl_ntoh16(lid), osm_physp_get_port_num(p_physp));
 
-	memset(p_rec_item, 0, SA_PIR_RESP_SIZE);
-
-	p_rec_item->resp.port_rec.lid = lid;
-	p_rec_item->resp.port_rec.port_info = p_physp->port_info;
+	p_rec->lid = lid;
+	p_rec->port_info = p_physp->port_info;
 	if (p_ctxt->comp_mask & IB_PIR_COMPMASK_OPTIONS)
-		p_rec_item->resp.port_rec.options = p_ctxt->p_rcvd_rec->options;
+		p_rec->options = p_ctxt->p_rcvd_rec->options;
 	if ((p_ctxt->comp_mask & IB_PIR_COMPMASK_OPTIONS) == 0 ||
 	    (p_ctxt->p_rcvd_rec->options & 0x80) == 0) {
 		/* Does requested port have an extended link speed active ? */
@@ -116,7 +112,7 @@ static ib_api_status_t pir_rcv_new_pir(IN osm_sa_t * sa,
 		if ((p_pi->capability_mask & IB_PORT_CAP_HAS_EXT_SPEEDS) > 0) {
 			if (ib_port_info_get_link_speed_ext_active(&p_physp->port_info)) {
 				/* Add QDR bits to original link speed components */
-				p_pi = &p_rec_item->resp.port_rec.port_info;
+				p_pi = &p_rec->port_info;
 				ib_port_info_set_link_speed_enabled(p_pi,
 								    ib_port_info_get_link_speed_enabled(p_pi) | IB_LINK_SPEED_ACTIVE_10);
 				p_pi->state_info1 =
@@ -128,9 +124,7 @@ static ib_api_status_t pir_rcv_new_pir(IN osm_sa_t * sa,
 			}
 		}
 	}
-	p_rec_item->resp.port_rec.port_num = osm_physp_get_port_num(p_physp);
-
-	cl_qlist_insert_tail(p_ctxt->p_list, &p_rec_item->list_item);
+	p_rec->port_num = osm_physp_get_port_num(p_physp);
 
 Exit:
 	OSM_LOG_EXIT(sa->p_log);
@@ -503,6 +497,12 @@ static void sa_pir_by_comp_mask_cb(IN cl_map_item_t * p_map_item, IN void *cxt)
 	sa_pir_by_comp_mask(p_ctxt->sa, p_node, p_ctxt);
 }
 
+static void sa_pir_count_physp_cb(IN cl_map_item_t * p_map_item,
+				  IN void *cxt)
+{
+	*(unsigned *)cxt += osm_node_get_num_physp((osm_node_t *) p_map_item);
+}
+
 void osm_pir_rcv_process(IN void *ctx, IN void *data)
 {
 	osm_sa_t *sa = ctx;
@@ -510,10 +510,11 @@ void osm_pir_rcv_process(IN void *ctx, IN void *data)
 	const ib_sa_mad_t *p_rcvd_mad;
 	const ib_portinfo_record_t *p_rcvd_rec;
 	const osm_port_t *p_port = NULL;
-	cl_qlist_t rec_list;
+	osm_sa_resp_buf_t *p_buf;
 	osm_pir_search_ctxt_t context;
 	ib_net64_t comp_mask;
 	osm_physp_t *p_req_physp;
+	unsigned max_rec = 0;
 
 	CL_ASSERT(sa);
 
@@ -558,22 +559,36 @@ void osm_pir_rcv_process(IN void *ctx, IN void *data)
 		osm_dump_portinfo_record_v2(sa->p_log, p_rcvd_rec, FILE_ID, OSM_LOG_DEBUG);
 	}
 
-	cl_qlist_init(&rec_list);
+	/*
+	   If the user specified a LID, it obviously narrows our
+	   work load, since we don't have to search every port
+	 */
+	if (comp_mask & (IB_PIR_COMPMASK_LID | IB_PIR_COMPMASK_BASELID)) {
+		p_port = osm_get_port_by_lid(sa->p_subn, p_rcvd_rec->lid);
+		if (p_port)
+			max_rec = osm_node_get_num_physp(p_port->p_node);
+	} else
+		cl_qmap_apply_func(&sa->p_subn->node_guid_tbl,
+				   sa_pir_count_physp_cb, &max_rec);
+
+	p_buf = osm_sa_resp_buf_get(sa, sizeof(ib_portinfo_record_t), max_rec);
+	if (p_buf == NULL) {
+		cl_plock_release(sa->p_lock);
+		OSM_LOG(sa->p_log, OSM_LOG_ERROR, "ERR 2103: "
+			"Cannot get response buffer\n");
+		osm_sa_send_error(sa, p_madw, IB_SA_MAD_STATUS_NO_RESOURCES);
+		goto Exit;
+	}
 
 	context.p_rcvd_rec = p_rcvd_rec;
-	context.p_list = &rec_list;
+	context.p_buf = p_buf;
 	context.comp_mask = p_rcvd_mad->comp_mask;
 	context.sa = sa;
 	context.p_req_physp = p_req_physp;
 	context.is_enhanced_comp_mask =
 	    cl_ntoh32(p_rcvd_mad->attr_mod) & (1 << 31);
 
-	/*
-	   If the user specified a LID, it obviously narrows our
-	   work load, since we don't have to search every port
-	 */
 	if (comp_mask & (IB_PIR_COMPMASK_LID | IB_PIR_COMPMASK_BASELID)) {
-		p_port = osm_get_port_by_lid(sa->p_subn, p_rcvd_rec->lid);
 		if (p_port)
 			sa_pir_by_comp_mask(sa, p_port->p_node, &context);
 		else
@@ -594,14 +609,13 @@ void osm_pir_rcv_process(IN void *ctx, IN void *data)
 	   sm_key.
 	 */
 	if (!p_rcvd_mad->sm_key) {
-		osm_sa_item_t *item;
-		for (item = (osm_sa_item_t *) cl_qlist_head(&rec_list);
-		     item != (osm_sa_item_t *) cl_qlist_end(&rec_list);
-		     item = (osm_sa_item_t *) cl_qlist_next(&item->list_item))
-			item->resp.port_rec.port_info.m_key = 0;
+		ib_portinfo_record_t *p_rec = (ib_portinfo_record_t *) p_buf->data;
+		unsigned i;
+		for (i = 0; i < p_buf->num_rec; i++)
+			p_rec[i].port_info.m_key = 0;
 	}
 
-	osm_sa_respond(sa, p_madw, sizeof(ib_portinfo_record_t), &rec_list);
+	osm_sa_respond_buf(sa, p_madw, p_buf);
 
 Exit:
 	OSM_LOG_EXIT(sa->p_log);
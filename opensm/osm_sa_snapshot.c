@@ -0,0 +1,444 @@
+/*
+ * Copyright (c) 2002-2011 Mellanox Technologies LTD. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/*
+ * Abstract:
+ *    Implementation of the SA subnet snapshot.
+ * The snapshot is an immutable copy of the subnet routing state
+ * (forwarding tables, links and SL2VL drops) used to resolve paths
+ * without touching the live subnet objects.
+ */
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif				/* HAVE_CONFIG_H */
+
+#include <stdlib.h>
+#include <string.h>
+#include <iba/ib_types.h>
+#include <complib/cl_qmap.h>
+#include <complib/cl_passivelock.h>
+#include <complib/cl_atomic.h>
+#include <opensm/osm_file_ids.h>
+#define FILE_ID OSM_FILE_SA_SNAPSHOT_C
+#include <opensm/osm_node.h>
+#include <opensm/osm_port.h>
+#include <opensm/osm_switch.h>
+#include <opensm/osm_helper.h>
+#include <opensm/osm_sa.h>
+
+#define MAX_HOPS 64
+
+typedef struct snap_node_idx {
+	cl_map_item_t map_item;
+	uint32_t idx;
+} snap_node_idx_t;
+
+static void snapshot_free(IN osm_sa_snapshot_t * p_snap)
+{
+	uint32_t i;
+
+	if (p_snap->nodes)
+		for (i = 0; i < p_snap->num_nodes; i++)
+			free(p_snap->nodes[i].lft);
+	free(p_snap->nodes);
+	free(p_snap->ports);
+	free(p_snap->sl_drop);
+	free(p_snap->lid_port);
+	free(p_snap->lid_guid);
+	free(p_snap);
+}
+
+static uint32_t snapshot_port_idx(IN cl_qmap_t * p_map,
+				  IN const osm_physp_t * p_physp)
+{
+	cl_map_item_t *p_item;
+
+	p_item = cl_qmap_get(p_map, (uint64_t) (uintptr_t) p_physp->p_node);
+	if (p_item == cl_qmap_end(p_map))
+		return OSM_SA_SNAP_NONE;
+	return ((snap_node_idx_t *) p_item)->idx + p_physp->port_num;
+}
+
+static void snapshot_fill_port(IN osm_sa_snapshot_t * p_snap,
+			       IN cl_qmap_t * p_map, IN uint32_t node_idx,
+			       IN osm_node_t * p_node, IN uint8_t port_num,
+			       IN OUT uint32_t * p_sl_drop)
+{
+	osm_sa_snap_port_t *p_port;
+	osm_physp_t *p_physp, *p_physp0, *p_remote;
+	ib_slvl_table_t *p_slvl_tbl;
+	unsigned num_slvl, i, sl;
+	int extended, p0_extended;
+	uint16_t mask;
+
+	p_port = &p_snap->ports[p_snap->nodes[node_idx].port0 + port_num];
+	p_port->node = node_idx;
+	p_port->port_num = port_num;
+	p_port->remote = OSM_SA_SNAP_NONE;
+
+	p_physp = osm_node_get_physp_ptr(p_node, port_num);
+	if (!osm_physp_is_valid(p_physp))
+		return;
+
+	p_port->mtu = ib_port_info_get_mtu_cap(&p_physp->port_info);
+	extended = p_physp->port_info.capability_mask &
+	    IB_PORT_CAP_HAS_EXT_SPEEDS;
+	p_port->rate = ib_port_info_compute_rate(&p_physp->port_info,
+						 extended);
+	if (p_node->sw) {
+		p_physp0 = osm_node_get_physp_ptr(p_node, 0);
+		p0_extended = p_physp0->port_info.capability_mask &
+		    IB_PORT_CAP_HAS_EXT_SPEEDS;
+		p_port->sw_rate =
+		    ib_port_info_compute_rate(&p_physp->port_info,
+					      p0_extended);
+	} else
+		p_port->sw_rate = p_port->rate;
+
+	p_remote = osm_physp_get_remote(p_physp);
+	if (p_remote)
+		p_port->remote = snapshot_port_idx(p_map, p_remote);
+
+	if (!p_snap->qos)
+		return;
+
+	num_slvl = cl_ptr_vector_get_size(&p_physp->slvl_by_port);
+	if (num_slvl > 255)
+		num_slvl = 255;
+	p_port->sl_drop = *p_sl_drop;
+	p_port->num_sl_drop = num_slvl;
+	for (i = 0; i < num_slvl; i++) {
+		p_slvl_tbl = cl_ptr_vector_get(&p_physp->slvl_by_port, i);
+		mask = 0;
+		if (p_slvl_tbl)
+			for (sl = 0; sl < IB_MAX_NUM_VLS; sl++)
+				if (ib_slvl_table_get(p_slvl_tbl, sl) ==
+				    IB_DROP_VL)
+					mask |= 1 << sl;
+		p_snap->sl_drop[(*p_sl_drop)++] = mask;
+	}
+}
+
+static osm_sa_snapshot_t *snapshot_build(IN osm_subn_t * p_subn)
+{
+	osm_sa_snapshot_t *p_snap;
+	snap_node_idx_t *node_idx = NULL;
+	cl_qmap_t node_map;
+	cl_map_item_t *p_item;
+	osm_node_t *p_node;
+	osm_switch_t *p_sw;
+	osm_port_t *p_port;
+	uint32_t num_lids, num_sl_drop = 0, i, n;
+	uint8_t port_num;
+
+	cl_qmap_init(&node_map);
+
+	p_snap = calloc(1, sizeof(*p_snap));
+	if (!p_snap)
+		return NULL;
+
+	p_snap->qos = p_subn->opt.qos;
+	p_snap->num_nodes = cl_qmap_count(&p_subn->node_guid_tbl);
+	p_snap->nodes = calloc(p_snap->num_nodes + 1,
+			       sizeof(*p_snap->nodes));
+	node_idx = calloc(p_snap->num_nodes + 1, sizeof(*node_idx));
+	if (!p_snap->nodes || !node_idx)
+		goto Error;
+
+	/* first pass: lay out the nodes and their ports */
+	n = 0;
+	for (p_item = cl_qmap_head(&p_subn->node_guid_tbl);
+	     p_item != cl_qmap_end(&p_subn->node_guid_tbl);
+	     p_item = cl_qmap_next(p_item), n++) {
+		p_node = (osm_node_t *) p_item;
+		p_snap->nodes[n].guid = osm_node_get_node_guid(p_node);
+		p_snap->nodes[n].port0 = p_snap->num_ports;
+		p_snap->nodes[n].num_ports = osm_node_get_num_physp(p_node);
+		p_snap->num_ports += p_snap->nodes[n].num_ports;
+		node_idx[n].idx = p_snap->nodes[n].port0;
+		cl_qmap_insert(&node_map, (uint64_t) (uintptr_t) p_node,
+			       &node_idx[n].map_item);
+
+		if (!p_snap->qos)
+			continue;
+		for (port_num = 0; port_num < p_snap->nodes[n].num_ports;
+		     port_num++) {
+			osm_physp_t *p_physp =
+			    osm_node_get_physp_ptr(p_node, port_num);
+			if (osm_physp_is_valid(p_physp))
+				num_sl_drop +=
+				    cl_ptr_vector_get_size(&p_physp->
+							   slvl_by_port);
+		}
+	}
+
+	p_snap->ports = calloc(p_snap->num_ports + 1,
+			       sizeof(*p_snap->ports));
+	p_snap->sl_drop = calloc(num_sl_drop + 1, sizeof(*p_snap->sl_drop));
+	if (!p_snap->ports || !p_snap->sl_drop)
+		goto Error;
+
+	/* second pass: links, port attributes and forwarding tables */
+	num_sl_drop = 0;
+	n = 0;
+	for (p_item = cl_qmap_head(&p_subn->node_guid_tbl);
+	     p_item != cl_qmap_end(&p_subn->node_guid_tbl);
+	     p_item = cl_qmap_next(p_item), n++) {
+		p_node = (osm_node_t *) p_item;
+		for (port_num = 0; port_num < p_snap->nodes[n].num_ports;
+		     port_num++)
+			snapshot_fill_port(p_snap, &node_map, n, p_node,
+					   port_num, &num_sl_drop);
+
+		p_sw = p_node->sw;
+		if (!p_sw || !p_sw->new_lft)
+			continue;
+		p_snap->nodes[n].lft_size = p_sw->max_lid_ho + 1;
+		if (p_snap->nodes[n].lft_size > p_sw->lft_size)
+			p_snap->nodes[n].lft_size = p_sw->lft_size;
+		p_snap->nodes[n].lft = malloc(p_snap->nodes[n].lft_size);
+		if (!p_snap->nodes[n].lft)
+			goto Error;
+		memcpy(p_snap->nodes[n].lft, p_sw->new_lft,
+		       p_snap->nodes[n].lft_size);
+	}
+
+	/* LID to port lookup */
+	num_lids = cl_ptr_vector_get_size(&p_subn->port_lid_tbl);
+	if (!num_lids)
+		num_lids = 1;
+	p_snap->max_lid_ho = num_lids - 1;
+	p_snap->lid_port = malloc(num_lids * sizeof(*p_snap->lid_port));
+	p_snap->lid_guid = calloc(num_lids, sizeof(*p_snap->lid_guid));
+	if (!p_snap->lid_port || !p_snap->lid_guid)
+		goto Error;
+	for (i = 0; i < num_lids; i++) {
+		p_snap->lid_port[i] = OSM_SA_SNAP_NONE;
+		if (i >= cl_ptr_vector_get_size(&p_subn->port_lid_tbl))
+			continue;
+		p_port = cl_ptr_vector_get(&p_subn->port_lid_tbl, i);
+		if (!p_port || !p_port->p_physp)
+			continue;
+		p_snap->lid_port[i] = snapshot_port_idx(&node_map,
+							p_port->p_physp);
+		p_snap->lid_guid[i] = osm_port_get_guid(p_port);
+	}
+
+	free(node_idx);
+	p_snap->ref_cnt = 1;
+	return p_snap;
+
+Error:
+	free(node_idx);
+	snapshot_free(p_snap);
+	return NULL;
+}
+
+void osm_sa_snapshot_publish(IN osm_sa_t * sa)
+{
+	osm_sa_snapshot_t *p_snap, *p_old;
+
+	OSM_LOG_ENTER(sa->p_log);
+
+	cl_plock_acquire(sa->p_lock);
+	p_snap = snapshot_build(sa->p_subn);
+	cl_plock_release(sa->p_lock);
+
+	if (!p_snap) {
+		OSM_LOG(sa->p_log, OSM_LOG_ERROR, "ERR 4C0D: "
+			"Cannot allocate subnet snapshot, "
+			"keeping the previous one\n");
+		goto Exit;
+	}
+
+	cl_spinlock_acquire(&sa->snap_lock);
+	p_old = sa->p_snapshot;
+	sa->p_snapshot = p_snap;
+	cl_spinlock_release(&sa->snap_lock);
+
+	osm_sa_snapshot_put(p_old);
+
+	OSM_LOG(sa->p_log, OSM_LOG_VERBOSE,
+		"Published subnet snapshot: %u nodes, %u ports, max LID %u\n",
+		p_snap->num_nodes, p_snap->num_ports, p_snap->max_lid_ho);
+Exit:
+	OSM_LOG_EXIT(sa->p_log);
+}
+
+osm_sa_snapshot_t *osm_sa_snapshot_get(IN osm_sa_t * sa)
+{
+	osm_sa_snapshot_t *p_snap;
+
+	cl_spinlock_acquire(&sa->snap_lock);
+	p_snap = sa->p_snapshot;
+	if (p_snap)
+		cl_atomic_inc(&p_snap->ref_cnt);
+	cl_spinlock_release(&sa->snap_lock);
+
+	return p_snap;
+}
+
+void osm_sa_snapshot_put(IN osm_sa_snapshot_t * p_snap)
+{
+	if (p_snap && cl_atomic_dec(&p_snap->ref_cnt) == 0)
+		snapshot_free(p_snap);
+}
+
+static uint32_t snapshot_route(IN const osm_sa_snapshot_t * p_snap,
+			       IN uint32_t port_idx, IN uint16_t lid_ho)
+{
+	const osm_sa_snap_node_t *p_node;
+	uint8_t port_num;
+
+	p_node = &p_snap->nodes[p_snap->ports[port_idx].node];
+	if (!p_node->lft || lid_ho == 0 || lid_ho >= p_node->lft_size)
+		return OSM_SA_SNAP_NONE;
+
+	port_num = p_node->lft[lid_ho];
+	if (port_num == OSM_NO_PATH || port_num >= p_node->num_ports)
+		return OSM_SA_SNAP_NONE;
+
+	return p_node->port0 + port_num;
+}
+
+static inline uint16_t snapshot_sl_drop(IN const osm_sa_snapshot_t * p_snap,
+					IN uint32_t port_idx,
+					IN uint8_t in_port_num)
+{
+	const osm_sa_snap_port_t *p_port = &p_snap->ports[port_idx];
+
+	if (in_port_num >= p_port->num_sl_drop)
+		return 0;
+	return p_snap->sl_drop[p_port->sl_drop + in_port_num];
+}
+
+ib_api_status_t osm_sa_snapshot_walk(IN const osm_sa_snapshot_t * p_snap,
+				     IN ib_net64_t src_port_guid,
+				     IN uint16_t src_lid_ho,
+				     IN ib_net64_t dest_port_guid,
+				     IN uint16_t dest_lid_ho,
+				     OUT uint8_t * p_mtu, OUT uint8_t * p_rate,
+				     OUT uint16_t * p_valid_sl_mask,
+				     OUT unsigned * p_hops)
+{
+	const osm_sa_snap_port_t *p_port;
+	uint32_t cur, dest, remote;
+	uint16_t valid_sl_mask = 0xffff;
+	uint8_t mtu, rate, in_port_num;
+	unsigned hops = 0;
+
+	if (src_lid_ho > p_snap->max_lid_ho ||
+	    dest_lid_ho > p_snap->max_lid_ho ||
+	    p_snap->lid_guid[src_lid_ho] != src_port_guid ||
+	    p_snap->lid_guid[dest_lid_ho] != dest_port_guid)
+		return IB_NOT_FOUND;
+
+	cur = p_snap->lid_port[src_lid_ho];
+	dest = p_snap->lid_port[dest_lid_ho];
+	if (cur == OSM_SA_SNAP_NONE || dest == OSM_SA_SNAP_NONE)
+		return IB_NOT_FOUND;
+
+	mtu = p_snap->ports[cur].mtu;
+	rate = p_snap->ports[cur].rate;
+
+	/* a switch source starts at the egress port to the destination */
+	if (p_snap->nodes[p_snap->ports[cur].node].lft) {
+		cur = snapshot_route(p_snap, cur, dest_lid_ho);
+		if (cur == OSM_SA_SNAP_NONE)
+			return IB_NOT_FOUND;
+	}
+
+	if (p_snap->qos) {
+		valid_sl_mask &= ~snapshot_sl_drop(p_snap, cur, 0);
+		if (!valid_sl_mask)
+			return IB_NOT_FOUND;
+	}
+
+	/* a switch destination ends at its port 0 */
+	if (p_snap->nodes[p_snap->ports[dest].node].lft) {
+		dest = snapshot_route(p_snap, dest, dest_lid_ho);
+		if (dest == OSM_SA_SNAP_NONE)
+			return IB_NOT_FOUND;
+	}
+
+	while (cur != dest) {
+		remote = p_snap->ports[cur].remote;
+		if (remote == OSM_SA_SNAP_NONE || ++hops > MAX_HOPS)
+			return IB_ERROR;
+
+		cur = remote;
+		if (cur == dest)
+			break;
+
+		p_port = &p_snap->ports[cur];
+		if (!p_snap->nodes[p_port->node].lft)
+			return IB_ERROR;
+		in_port_num = p_port->port_num;
+
+		/* ingress port of the switch */
+		if (mtu > p_port->mtu)
+			mtu = p_port->mtu;
+		if (ib_path_compare_rates(rate, p_port->sw_rate) > 0)
+			rate = p_port->sw_rate;
+
+		/* egress port of the switch */
+		cur = snapshot_route(p_snap, cur, dest_lid_ho);
+		if (cur == OSM_SA_SNAP_NONE)
+			return IB_ERROR;
+		p_port = &p_snap->ports[cur];
+		if (mtu > p_port->mtu)
+			mtu = p_port->mtu;
+		if (ib_path_compare_rates(rate, p_port->sw_rate) > 0)
+			rate = p_port->sw_rate;
+
+		if (p_snap->qos) {
+			valid_sl_mask &=
+			    ~snapshot_sl_drop(p_snap, cur, in_port_num);
+			if (!valid_sl_mask)
+				return IB_NOT_FOUND;
+		}
+	}
+
+	p_port = &p_snap->ports[cur];
+	if (mtu > p_port->mtu)
+		mtu = p_port->mtu;
+	if (ib_path_compare_rates(rate, p_port->rate) > 0)
+		rate = p_port->rate;
+
+	*p_mtu = mtu;
+	*p_rate = rate;
+	*p_valid_sl_mask = valid_sl_mask;
+	*p_hops = hops;
+	return IB_SUCCESS;
+}
@@ -1349,6 +1349,8 @@ static void do_sweep(osm_sm_t * sm)
 	if (sm->p_subn->opt.use_ucast_cache &&
 	    (sm->p_subn->force_reroute || sm->p_subn->coming_out_of_standby))
 		osm_ucast_cache_invalidate(&sm->ucast_mgr);
+	if (sm->p_subn->force_reroute || sm->p_subn->coming_out_of_standby)
+		osm_ucast_mgr_incr_invalidate(&sm->ucast_mgr);
 
 	/*
 	 * If we don't need to do a heavy sweep and we want to do a reroute,
@@ -1366,6 +1368,8 @@ static void do_sweep(osm_sm_t * sm)
 		/* Re-program the switches fully */
 		sm->p_subn->ignore_existing_lfts = TRUE;
 
+		osm_pr_cache_invalidate(&sm->p_subn->p_osm->sa);
+
 		if (osm_ucast_mgr_process(&sm->ucast_mgr)) {
 			OSM_LOG_MSG_BOX(sm->p_log, OSM_LOG_VERBOSE,
 					"REROUTE FAILED");
@@ -1385,6 +1389,9 @@ static void do_sweep(osm_sm_t * sm)
 			return;
 
 		if (!sm->p_subn->subnet_initialization_error) {
+			if (sm->p_subn->opt.sa_snapshot)
+				osm_sa_snapshot_publish(&sm->p_subn->p_osm->sa);
+			osm_pr_cache_activate(&sm->p_subn->p_osm->sa);
 			OSM_LOG_MSG_BOX(sm->p_log, OSM_LOG_VERBOSE,
 					"REROUTE COMPLETE");
 			osm_opensm_report_event(sm->p_subn->p_osm,
@@ -1394,6 +1401,12 @@ static void do_sweep(osm_sm_t * sm)
 		}
 	}
 
+	/*
+	 * The heavy sweep may change anything PathRecords depend on,
+	 * so don't trust the PathRecord cache until the subnet is up.
+	 */
+	osm_pr_cache_invalidate(&sm->p_subn->p_osm->sa);
+
 	osm_opensm_report_event(sm->p_subn->p_osm,
 				OSM_EVENT_ID_HEAVY_SWEEP_START, NULL);
 
@@ -1674,6 +1687,9 @@ repeat_discovery:
 				"ERRORS DURING INITIALIZATION");
 	} else {
 		sm->p_subn->need_update = 0;
+		if (sm->p_subn->opt.sa_snapshot)
+			osm_sa_snapshot_publish(&sm->p_subn->p_osm->sa);
+		osm_pr_cache_activate(&sm->p_subn->p_osm->sa);
 		osm_dump_all(sm->p_subn->p_osm);
 		state_mgr_up_msg(sm);
 
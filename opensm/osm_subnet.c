@@ -789,6 +789,13 @@ static const opt_rec_t opt_tbl[] = {
 	{ "reassign_lids", OPT_OFFSET(reassign_lids), opts_parse_boolean, NULL, 1 },
 	{ "ignore_other_sm", OPT_OFFSET(ignore_other_sm), opts_parse_boolean, NULL, 1 },
 	{ "single_thread", OPT_OFFSET(single_thread), opts_parse_boolean, NULL, 0 },
+	{ "sa_threads", OPT_OFFSET(sa_threads), opts_parse_uint32, NULL, 0 },
+	{ "sa_max_resp_mem", OPT_OFFSET(sa_max_resp_mem), opts_parse_uint32, NULL, 1 },
+	{ "sa_rate_limit", OPT_OFFSET(sa_rate_limit), opts_parse_uint32, NULL, 1 },
+	{ "sa_rate_burst", OPT_OFFSET(sa_rate_burst), opts_parse_uint32, NULL, 1 },
+	{ "sa_rate_table_cost", OPT_OFFSET(sa_rate_table_cost), opts_parse_uint32, NULL, 1 },
+	{ "sa_max_queued_per_lid", OPT_OFFSET(sa_max_queued_per_lid), opts_parse_uint32, NULL, 1 },
+	{ "sa_fast_path", OPT_OFFSET(sa_fast_path), opts_parse_boolean, NULL, 1 },
 	{ "disable_multicast", OPT_OFFSET(disable_multicast), opts_parse_boolean, NULL, 1 },
 	{ "subnet_timeout", OPT_OFFSET(subnet_timeout), opts_parse_uint8, NULL, 1 },
 	{ "packet_life_time", OPT_OFFSET(packet_life_time), opts_parse_uint8, NULL, 1 },
@@ -810,6 +817,11 @@ static const opt_rec_t opt_tbl[] = {
 	{ "sweep_on_trap", OPT_OFFSET(sweep_on_trap), opts_parse_boolean, NULL, 1 },
 	{ "routing_engine", OPT_OFFSET(routing_engine_names), opts_parse_charp, NULL, 0 },
 	{ "avoid_throttled_links", OPT_OFFSET(avoid_throttled_links), opts_parse_boolean, NULL, 0 },
+	{ "routing_threads", OPT_OFFSET(routing_threads), opts_parse_uint32, NULL, 1 },
+	{ "sssp_batch_size", OPT_OFFSET(sssp_batch_size), opts_parse_uint32, NULL, 1 },
+	{ "ftree_batch_size", OPT_OFFSET(ftree_batch_size), opts_parse_uint32, NULL, 1 },
+	{ "packed_lid_matrix", OPT_OFFSET(packed_lid_matrix), opts_parse_boolean, NULL, 1 },
+	{ "incremental_reroute", OPT_OFFSET(incremental_reroute), opts_parse_boolean, NULL, 1 },
 	{ "connect_roots", OPT_OFFSET(connect_roots), opts_parse_boolean, NULL, 1 },
 	{ "use_ucast_cache", OPT_OFFSET(use_ucast_cache), opts_parse_boolean, NULL, 0 },
 	{ "log_file", OPT_OFFSET(log_file), opts_parse_charp, NULL, 0 },
@@ -829,6 +841,7 @@ static const opt_rec_t opt_tbl[] = {
 	{ "dump_files_dir", OPT_OFFSET(dump_files_dir), opts_parse_charp, NULL, 0 },
 	{ "lid_matrix_dump_file", OPT_OFFSET(lid_matrix_dump_file), opts_parse_charp, NULL, 0 },
 	{ "lfts_file", OPT_OFFSET(lfts_file), opts_parse_charp, NULL, 0 },
+	{ "routing_bin_dump", OPT_OFFSET(routing_bin_dump), opts_parse_boolean, NULL, 1 },
 	{ "root_guid_file", OPT_OFFSET(root_guid_file), opts_parse_charp, NULL, 0 },
 	{ "cn_guid_file", OPT_OFFSET(cn_guid_file), opts_parse_charp, NULL, 0 },
 	{ "io_guid_file", OPT_OFFSET(io_guid_file), opts_parse_charp, NULL, 0 },
@@ -840,6 +853,9 @@ static const opt_rec_t opt_tbl[] = {
 	{ "guid_routing_order_no_scatter", OPT_OFFSET(guid_routing_order_no_scatter), opts_parse_boolean, NULL, 0 },
 	{ "sa_db_file", OPT_OFFSET(sa_db_file), opts_parse_charp, NULL, 0 },
 	{ "sa_db_dump", OPT_OFFSET(sa_db_dump), opts_parse_boolean, NULL, 1 },
+	{ "sa_pr_cache", OPT_OFFSET(sa_pr_cache), opts_parse_boolean, NULL, 1 },
+	{ "sa_snapshot", OPT_OFFSET(sa_snapshot), opts_parse_boolean, NULL, 1 },
+	{ "sa_pr_dest_trees", OPT_OFFSET(sa_pr_dest_trees), opts_parse_boolean, NULL, 1 },
 	{ "torus_config", OPT_OFFSET(torus_conf_file), opts_parse_charp, NULL, 1 },
 	{ "do_mesh_analysis", OPT_OFFSET(do_mesh_analysis), opts_parse_boolean, NULL, 1 },
 	{ "exit_on_fatal", OPT_OFFSET(exit_on_fatal), opts_parse_boolean, NULL, 1 },
@@ -1578,6 +1594,13 @@ void osm_subn_set_default_opt(IN osm_subn_opt_t * p_opt)
 	p_opt->reassign_lids = FALSE;
 	p_opt->ignore_other_sm = FALSE;
 	p_opt->single_thread = FALSE;
+	p_opt->sa_threads = 0;
+	p_opt->sa_max_resp_mem = 0;
+	p_opt->sa_rate_limit = 0;
+	p_opt->sa_rate_burst = 256;
+	p_opt->sa_rate_table_cost = 16;
+	p_opt->sa_max_queued_per_lid = 0;
+	p_opt->sa_fast_path = FALSE;
 	p_opt->disable_multicast = FALSE;
 	p_opt->force_log_flush = FALSE;
 	p_opt->subnet_timeout = OSM_DEFAULT_SUBNET_TIMEOUT;
@@ -1649,9 +1672,15 @@ void osm_subn_set_default_opt(IN osm_subn_opt_t * p_opt)
 	p_opt->use_ucast_cache = FALSE;
 	p_opt->routing_engine_names = NULL;
 	p_opt->avoid_throttled_links = FALSE;
+	p_opt->routing_threads = 1;
+	p_opt->sssp_batch_size = 1;
+	p_opt->ftree_batch_size = 1;
+	p_opt->packed_lid_matrix = FALSE;
+	p_opt->incremental_reroute = FALSE;
 	p_opt->connect_roots = FALSE;
 	p_opt->lid_matrix_dump_file = NULL;
 	p_opt->lfts_file = NULL;
+	p_opt->routing_bin_dump = FALSE;
 	p_opt->root_guid_file = NULL;
 	p_opt->cn_guid_file = NULL;
 	p_opt->io_guid_file = NULL;
@@ -1663,6 +1692,9 @@ void osm_subn_set_default_opt(IN osm_subn_opt_t * p_opt)
 	p_opt->guid_routing_order_no_scatter = FALSE;
 	p_opt->sa_db_file = NULL;
 	p_opt->sa_db_dump = FALSE;
+	p_opt->sa_pr_cache = FALSE;
+	p_opt->sa_snapshot = FALSE;
+	p_opt->sa_pr_dest_trees = FALSE;
 	p_opt->torus_conf_file = strdup(OSM_DEFAULT_TORUS_CONF_FILE);
 	p_opt->do_mesh_analysis = FALSE;
 	p_opt->exit_on_fatal = TRUE;
@@ -2627,6 +2659,37 @@ void osm_subn_output_conf(FILE *out, IN osm_subn_opt_t * p_opts)
 		"avoid_throttled_links %s\n\n",
 		p_opts->avoid_throttled_links ? "TRUE" : "FALSE");
 
+	fprintf(out,
+		"# Number of threads computing min-hop and forwarding tables\n"
+		"# (0 means one per CPU, 1 disables parallel routing)\n"
+		"routing_threads %u\n\n",
+		p_opts->routing_threads);
+
+	fprintf(out,
+		"# Number of destinations routed on the same link weights\n"
+		"# by dfsssp and sssp (1 keeps the sequential balancing)\n"
+		"sssp_batch_size %u\n\n",
+		p_opts->sssp_batch_size);
+
+	fprintf(out,
+		"# Number of leaf switches whose compute nodes are routed\n"
+		"# on the same port counters by ftree (1 keeps the sequential\n"
+		"# balancing)\n"
+		"ftree_batch_size %u\n\n",
+		p_opts->ftree_batch_size);
+
+	fprintf(out,
+		"# Store LID matrices with 4-bit hop counts\n"
+		"# (halves their memory; use FALSE if unsure)\n"
+		"packed_lid_matrix %s\n\n",
+		p_opts->packed_lid_matrix ? "TRUE" : "FALSE");
+
+	fprintf(out,
+		"# Reroute only the destinations affected by failed links\n"
+		"# or switches (minhop routing with lmc 0; use FALSE if unsure)\n"
+		"incremental_reroute %s\n\n",
+		p_opts->incremental_reroute ? "TRUE" : "FALSE");
+
 	fprintf(out,
 		"# Connect roots (use FALSE if unsure)\n"
 		"connect_roots %s\n\n",
@@ -2646,6 +2709,13 @@ void osm_subn_output_conf(FILE *out, IN osm_subn_opt_t * p_opts)
 		"# LFTs file name\nlfts_file %s\n\n",
 		p_opts->lfts_file ? p_opts->lfts_file : null_str);
 
+	fprintf(out,
+		"# If TRUE causes OpenSM to write the LFTs and lid matrices\n"
+		"# to the binary opensm-routing.bin at the end of every sweep,\n"
+		"# regardless of the verbosity level\n"
+		"routing_bin_dump %s\n\n",
+		p_opts->routing_bin_dump ? "TRUE" : "FALSE");
+
 	fprintf(out,
 		"# The file holding the root node guids (for fat-tree or Up/Down)\n"
 		"# One guid in each line\nroot_guid_file %s\n\n",
@@ -2741,6 +2811,28 @@ void osm_subn_output_conf(FILE *out, IN osm_subn_opt_t * p_opts)
 		"sa_db_dump %s\n\n",
 		p_opts->sa_db_dump ? "TRUE" : "FALSE");
 
+	fprintf(out,
+		"# If TRUE enables caching of PathRecord fabric walks per\n"
+		"# SLID/DLID pair until the next routing change\n"
+		"sa_pr_cache %s\n\n",
+		p_opts->sa_pr_cache ? "TRUE" : "FALSE");
+
+	fprintf(out,
+		"# If TRUE the SA resolves paths from a copy of the routing\n"
+		"# state taken when the subnet is up, so queries received during\n"
+		"# a sweep are answered from the last complete routing\n"
+		"sa_snapshot %s\n\n",
+		p_opts->sa_snapshot ? "TRUE" : "FALSE");
+
+	fprintf(out,
+		"# If TRUE the path MTU, rate and hop count from every switch\n"
+		"# to every LID are kept after routing and PathRecord queries\n"
+		"# look them up instead of walking the forwarding tables\n"
+		"# (used only when QoS is disabled; memory grows with\n"
+		"# switches x LIDs)\n"
+		"sa_pr_dest_trees %s\n\n",
+		p_opts->sa_pr_dest_trees ? "TRUE" : "FALSE");
+
 	fprintf(out,
 		"# Torus-2QoS configuration file name\ntorus_config %s\n\n",
 		p_opts->torus_conf_file ? p_opts->torus_conf_file : null_str);
@@ -2788,7 +2880,29 @@ void osm_subn_output_conf(FILE *out, IN osm_subn_opt_t * p_opts)
 		"# immediately be dropped but BUSY status is not currently returned.\n"
 		"max_msg_fifo_timeout %u\n\n"
 		"# Use a single thread for handling SA queries\n"
-		"single_thread %s\n\n",
+		"single_thread %s\n\n"
+		"# Number of threads dedicated to SA Get/GetTable requests\n"
+		"# (0 means these are handled by the common OpenSM dispatcher)\n"
+		"sa_threads %u\n\n"
+		"# Maximal memory in MB for NodeRecord and PortInfoRecord\n"
+		"# responses in progress at the same time; queries which would\n"
+		"# exceed it are failed with NO_RESOURCES unless no other one\n"
+		"# is in progress (0 means no limit)\n"
+		"sa_max_resp_mem %u\n\n"
+		"# SA request cost units per second allowed per requester LID\n"
+		"# (Get/Set/Delete cost 1, GetTable 2, GetTable of a whole\n"
+		"# table sa_rate_table_cost); 0 disables rate limiting\n"
+		"sa_rate_limit %u\n\n"
+		"# Number of cost units a requester may spend in a burst\n"
+		"sa_rate_burst %u\n\n"
+		"# Cost of a GetTable request without a component mask\n"
+		"sa_rate_table_cost %u\n\n"
+		"# Maximal number of SA MADs of a single requester LID waiting\n"
+		"# in the SA dispatcher (0 means no limit)\n"
+		"sa_max_queued_per_lid %u\n\n"
+		"# Answer PathRecord Get requests on the MAD receive thread\n"
+		"# when the subnet is up and sa_snapshot is in use\n"
+		"sa_fast_path %s\n\n",
 		p_opts->max_wire_smps,
 		p_opts->max_wire_smps2,
 		p_opts->max_smps_timeout,
@@ -2796,7 +2910,14 @@ void osm_subn_output_conf(FILE *out, IN osm_subn_opt_t * p_opts)
 		p_opts->transaction_retries,
 		p_opts->long_transaction_timeout,
 		p_opts->max_msg_fifo_timeout,
-		p_opts->single_thread ? "TRUE" : "FALSE");
+		p_opts->single_thread ? "TRUE" : "FALSE",
+		p_opts->sa_threads,
+		p_opts->sa_max_resp_mem,
+		p_opts->sa_rate_limit,
+		p_opts->sa_rate_burst,
+		p_opts->sa_rate_table_cost,
+		p_opts->sa_max_queued_per_lid,
+		p_opts->sa_fast_path ? "TRUE" : "FALSE");
 
 	fprintf(out,
 		"#\n# MISC OPTIONS\n#\n"
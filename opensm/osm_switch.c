@@ -61,23 +61,104 @@ struct switch_port_path {
 	uint32_t forwarded_to;
 };
 
+/*
+ * Packed LID matrices hold the hop count of port n in the low (even n)
+ * or high (odd n) nibble of byte n / 2 of the LID row.
+ */
+static int switch_unpack_hops(IN osm_switch_t * p_sw)
+{
+	const uint8_t *packed;
+	uint8_t *hops, *row;
+	unsigned i, port;
+	uint8_t num_hops;
+
+	hops = NULL;
+	if (p_sw->max_hop_rows &&
+	    !(hops = malloc(p_sw->max_hop_rows * p_sw->num_ports)))
+		return -1;
+
+	for (i = 0; i < p_sw->num_hop_rows; i++) {
+		packed = p_sw->hops + i * p_sw->hop_stride;
+		row = hops + i * p_sw->num_ports;
+		for (port = 0; port < p_sw->num_ports; port++) {
+			num_hops = (packed[port >> 1] >> ((port & 1) << 2)) & 0xf;
+			row[port] = num_hops == OSM_PACKED_NO_PATH ?
+			    OSM_NO_PATH : num_hops;
+		}
+	}
+
+	free(p_sw->hops);
+	p_sw->hops = hops;
+	p_sw->hop_stride = p_sw->num_ports;
+	p_sw->hops_packed = FALSE;
+
+	return 0;
+}
+
+/*
+ * Gives lid_ho the next free row of the LID matrix, growing the matrix
+ * if all the rows are in use.
+ */
+static uint8_t *switch_add_hop_row(IN osm_switch_t * p_sw, IN uint16_t lid_ho)
+{
+	uint8_t *hops, *row;
+	unsigned max_rows;
+
+	if (p_sw->num_hop_rows == p_sw->max_hop_rows) {
+		max_rows = p_sw->max_hop_rows ? 2 * p_sw->max_hop_rows : 64;
+		if (max_rows > p_sw->num_hops)
+			max_rows = p_sw->num_hops;
+		hops = realloc(p_sw->hops, max_rows * p_sw->hop_stride);
+		if (!hops)
+			return NULL;
+		p_sw->hops = hops;
+		p_sw->max_hop_rows = max_rows;
+	}
+
+	row = p_sw->hops + p_sw->num_hop_rows * p_sw->hop_stride;
+	memset(row, OSM_NO_PATH, p_sw->hop_stride);
+	p_sw->hop_rows[lid_ho] = ++p_sw->num_hop_rows;
+	return row;
+}
+
 cl_status_t osm_switch_set_hops(IN osm_switch_t * p_sw, IN uint16_t lid_ho,
 				IN uint8_t port_num, IN uint8_t num_hops)
 {
-	if (!lid_ho || lid_ho > p_sw->max_lid_ho)
+	uint8_t *row;
+	unsigned shift;
+
+	if (!lid_ho || lid_ho > p_sw->max_lid_ho || lid_ho >= p_sw->num_hops)
 		return -1;
 	if (port_num >= p_sw->num_ports)
 		return -1;
-	if (!p_sw->hops[lid_ho]) {
-		p_sw->hops[lid_ho] = malloc(p_sw->num_ports);
-		if (!p_sw->hops[lid_ho])
-			return -1;
-		memset(p_sw->hops[lid_ho], OSM_NO_PATH, p_sw->num_ports);
+
+	/* hop counts that do not fit in a nibble widen the matrix */
+	if (p_sw->hops_packed && num_hops >= OSM_PACKED_NO_PATH &&
+	    num_hops != OSM_NO_PATH && switch_unpack_hops(p_sw))
+		return -1;
+
+	if (p_sw->hop_rows[lid_ho])
+		row = p_sw->hops + (p_sw->hop_rows[lid_ho] - 1) *
+		    p_sw->hop_stride;
+	else if (num_hops == OSM_NO_PATH)
+		/* a LID without a row has no path from any port */
+		return 0;
+	else if (!(row = switch_add_hop_row(p_sw, lid_ho)))
+		return -1;
+
+	if (!p_sw->hops_packed) {
+		row[port_num] = num_hops;
+		if (row[0] > num_hops)
+			row[0] = num_hops;
+		return 0;
 	}
 
-	p_sw->hops[lid_ho][port_num] = num_hops;
-	if (p_sw->hops[lid_ho][0] > num_hops)
-		p_sw->hops[lid_ho][0] = num_hops;
+	num_hops &= OSM_PACKED_NO_PATH;
+	shift = (port_num & 1) << 2;
+	row[port_num >> 1] = (row[port_num >> 1] & ~(0xf << shift)) |
+	    (num_hops << shift);
+	if ((row[0] & 0xf) > num_hops)
+		row[0] = (row[0] & 0xf0) | num_hops;
 
 	return 0;
 }
@@ -85,7 +166,6 @@ cl_status_t osm_switch_set_hops(IN osm_switch_t * p_sw, IN uint16_t lid_ho,
 void osm_switch_delete(IN OUT osm_switch_t ** pp_sw)
 {
 	osm_switch_t *p_sw = *pp_sw;
-	unsigned i;
 
 	osm_mcast_tbl_destroy(&p_sw->mcast_tbl);
 	if (p_sw->p_prof)
@@ -96,12 +176,10 @@ void osm_switch_delete(IN OUT osm_switch_t ** pp_sw)
 		free(p_sw->lft);
 	if (p_sw->new_lft)
 		free(p_sw->new_lft);
-	if (p_sw->hops) {
-		for (i = 0; i < p_sw->num_hops; i++)
-			if (p_sw->hops[i])
-				free(p_sw->hops[i]);
+	if (p_sw->hop_rows)
+		free(p_sw->hop_rows);
+	if (p_sw->hops)
 		free(p_sw->hops);
-	}
 	free(*pp_sw);
 	*pp_sw = NULL;
 }
@@ -592,13 +670,23 @@ uint8_t osm_switch_recommend_path(IN const osm_switch_t * p_sw,
 	return best_port;
 }
 
+/*
+ * OSM_NO_PATH bytes also decode as OSM_PACKED_NO_PATH in both nibbles,
+ * so packed and unpacked matrices are cleared the same way.  The rows
+ * stay assigned to their LIDs.
+ */
 void osm_switch_clear_hops(IN osm_switch_t * p_sw)
 {
-	unsigned i;
+	if (p_sw->hops)
+		memset(p_sw->hops, OSM_NO_PATH,
+		       p_sw->num_hop_rows * p_sw->hop_stride);
+}
 
-	for (i = 0; i < p_sw->num_hops; i++)
-		if (p_sw->hops[i])
-			memset(p_sw->hops[i], OSM_NO_PATH, p_sw->num_ports);
+void osm_switch_clear_lid_hops(IN osm_switch_t * p_sw, IN uint16_t lid_ho)
+{
+	if (lid_ho < p_sw->num_hops && p_sw->hop_rows[lid_ho])
+		memset(p_sw->hops + (p_sw->hop_rows[lid_ho] - 1) *
+		       p_sw->hop_stride, OSM_NO_PATH, p_sw->hop_stride);
 }
 
 static int alloc_lft(IN osm_switch_t * p_sw, uint16_t lids)
@@ -620,10 +708,15 @@ static int alloc_lft(IN osm_switch_t * p_sw, uint16_t lids)
 	return 0;
 }
 
-int osm_switch_prepare_path_rebuild(IN osm_switch_t * p_sw, IN uint16_t max_lids)
+int osm_switch_prepare_path_rebuild(IN osm_switch_t * p_sw, IN uint16_t max_lids,
+				    IN boolean_t packed_hops,
+				    IN const uint16_t * row_lids,
+				    IN uint16_t num_row_lids)
 {
-	uint8_t **hops;
+	uint16_t *hop_rows;
+	uint8_t *hops;
 	uint8_t *new_lft;
+	uint8_t stride;
 	unsigned i;
 
 	if (alloc_lft(p_sw, max_lids))
@@ -632,8 +725,6 @@ int osm_switch_prepare_path_rebuild(IN osm_switch_t * p_sw, IN uint16_t max_lids
 	for (i = 0; i < p_sw->num_ports; i++)
 		osm_port_prof_construct(&p_sw->p_prof[i]);
 
-	osm_switch_clear_hops(p_sw);
-
 	if (!(new_lft = realloc(p_sw->new_lft, p_sw->lft_size)))
 		return -1;
 
@@ -641,23 +732,45 @@ int osm_switch_prepare_path_rebuild(IN osm_switch_t * p_sw, IN uint16_t max_lids
 
 	memset(p_sw->new_lft, OSM_NO_PATH, p_sw->lft_size);
 
-	if (!p_sw->hops) {
-		hops = malloc((max_lids + 1) * sizeof(hops[0]));
-		if (!hops)
+	if (!p_sw->hop_rows || max_lids + 1 > p_sw->num_hops) {
+		hop_rows = malloc((max_lids + 1) * sizeof(hop_rows[0]));
+		if (!hop_rows)
 			return -1;
-		memset(hops, 0, (max_lids + 1) * sizeof(hops[0]));
-		p_sw->hops = hops;
+		if (p_sw->hop_rows)
+			free(p_sw->hop_rows);
+		p_sw->hop_rows = hop_rows;
 		p_sw->num_hops = max_lids + 1;
-	} else if (max_lids + 1 > p_sw->num_hops) {
-		hops = realloc(p_sw->hops, (max_lids + 1) * sizeof(hops[0]));
+	}
+	memset(p_sw->hop_rows, 0, p_sw->num_hops * sizeof(p_sw->hop_rows[0]));
+	p_sw->num_hop_rows = 0;
+
+	packed_hops = packed_hops ? TRUE : FALSE;
+	stride = packed_hops ? (p_sw->num_ports + 1) / 2 : p_sw->num_ports;
+	if (stride != p_sw->hop_stride || packed_hops != p_sw->hops_packed) {
+		if (p_sw->hops)
+			free(p_sw->hops);
+		p_sw->hops = NULL;
+		p_sw->max_hop_rows = 0;
+		p_sw->hop_stride = stride;
+		p_sw->hops_packed = packed_hops;
+	}
+	p_sw->max_lid_ho = max_lids;
+
+	/* rows given up front are filled without reallocating the matrix,
+	   so they can be filled from several threads */
+	if (num_row_lids > p_sw->max_hop_rows) {
+		hops = malloc(num_row_lids * stride);
 		if (!hops)
 			return -1;
-		memset(hops + p_sw->num_hops, 0,
-		       (max_lids + 1 - p_sw->num_hops) * sizeof(hops[0]));
+		if (p_sw->hops)
+			free(p_sw->hops);
 		p_sw->hops = hops;
-		p_sw->num_hops = max_lids + 1;
+		p_sw->max_hop_rows = num_row_lids;
 	}
-	p_sw->max_lid_ho = max_lids;
+	for (i = 0; i < num_row_lids; i++)
+		if (row_lids[i] && row_lids[i] <= max_lids &&
+		    !p_sw->hop_rows[row_lids[i]])
+			switch_add_hop_row(p_sw, row_lids[i]);
 
 	return 0;
 }
@@ -247,6 +247,13 @@ struct fabric {
 
 	struct link **link;
 	struct f_switch **sw;
+	/*
+	 * Open addressed hash of sw[] by GUID, so fabric capture doesn't
+	 * need a linear switch search for every port and link.  Links are
+	 * found through the port arrays of the switches they attach to.
+	 */
+	unsigned sw_hash_sz;
+	struct f_switch **sw_hash;
 };
 
 struct coord_dirs {
@@ -303,6 +310,12 @@ struct torus {
 	struct coord_dirs *seed;
 	struct t_switch ****sw;
 	struct t_switch *master_stree_root;
+	/*
+	 * Path SL loop VL bits, per coordinate direction d, indexed by
+	 * source coordinate * radix + destination coordinate; see
+	 * build_path_sl_tbl().
+	 */
+	uint8_t *path_sl[TORUS_MAX_DIM];
 
 	unsigned flags;
 	unsigned max_changes;
@@ -364,6 +377,8 @@ void teardown_fabric(struct fabric *f)
 
 		free(f->link);
 	}
+	if (f->sw_hash)
+		free(f->sw_hash);
 	memset(f, 0, sizeof(*f));
 }
 
@@ -404,6 +419,9 @@ void teardown_torus(struct torus *t)
 	if (t->seed)
 		free(t->seed);
 
+	if (t->path_sl[0])
+		free(t->path_sl[0]);
+
 	free(t);
 }
 
@@ -453,46 +471,114 @@ bool grow_seed_array(struct torus *t, int new_seeds)
 	return true;
 }
 
+static
+unsigned sw_hash_slot(guid_t sw_guid, unsigned hash_sz)
+{
+	uint64_t h = cl_ntoh64(sw_guid);
+
+	h ^= h >> 32;
+	h *= 0x9e3779b97f4a7c15ULL;
+	return (unsigned)(h >> 32) & (hash_sz - 1);
+}
+
 static
 struct f_switch *find_f_sw(struct fabric *f, guid_t sw_guid)
 {
-	unsigned s;
+	unsigned h;
 	struct f_switch *sw;
 
-	if (f->sw) {
-		for (s = 0; s < f->switch_cnt; s++) {
-			sw = f->sw[s];
+	if (f->sw_hash) {
+		h = sw_hash_slot(sw_guid, f->sw_hash_sz);
+		while ((sw = f->sw_hash[h])) {
 			if (sw->n_id == sw_guid)
 				return sw;
+			h = (h + 1) & (f->sw_hash_sz - 1);
 		}
 	}
 	return NULL;
 }
 
+/*
+ * Keep the hash at most half full; on growth, rehash all of f->sw.
+ */
 static
-struct link *find_f_link(struct fabric *f,
-			 guid_t guid0, int port0, guid_t guid1, int port1)
+bool hash_fswitch(struct fabric *f, struct f_switch *sw)
 {
-	unsigned l;
-	struct link *link;
+	unsigned h, s, hash_sz;
+	struct f_switch **hash;
 
-	if (f->link) {
-		for (l = 0; l < f->link_cnt; l++) {
-			link = f->link[l];
-			if ((link->end[0].n_id == guid0 &&
-			     link->end[0].port == port0 &&
-			     link->end[1].n_id == guid1 &&
-			     link->end[1].port == port1) ||
-			    (link->end[0].n_id == guid1 &&
-			     link->end[0].port == port1 &&
-			     link->end[1].n_id == guid0 &&
-			     link->end[1].port == port0))
-				return link;
+	if (2 * f->switch_cnt > f->sw_hash_sz) {
+		hash_sz = f->sw_hash_sz ? 2 * f->sw_hash_sz : 64;
+		while (2 * f->switch_cnt > hash_sz)
+			hash_sz *= 2;
+		hash = calloc(hash_sz, sizeof(*hash));
+		if (!hash) {
+			OSM_LOG(&f->osm->log, OSM_LOG_ERROR,
+				"ERR 4E49: calloc: %s\n", strerror(errno));
+			return false;
+		}
+		free(f->sw_hash);
+		f->sw_hash = hash;
+		f->sw_hash_sz = hash_sz;
+		for (s = 0; s < f->switch_cnt; s++) {
+			if (f->sw[s] == sw)
+				continue;
+			h = sw_hash_slot(f->sw[s]->n_id, hash_sz);
+			while (hash[h])
+				h = (h + 1) & (hash_sz - 1);
+			hash[h] = f->sw[s];
 		}
 	}
+	h = sw_hash_slot(sw->n_id, f->sw_hash_sz);
+	while (f->sw_hash[h])
+		h = (h + 1) & (f->sw_hash_sz - 1);
+	f->sw_hash[h] = sw;
+	return true;
+}
+
+/*
+ * Every fabric link has at least one switch end, which holds the link
+ * in its port array, so look the link up there rather than searching
+ * all links.
+ */
+static
+struct link *find_f_sw_port_link(struct fabric *f, guid_t guid0, int port0,
+				 guid_t guid1, int port1)
+{
+	struct f_switch *sw;
+	struct link *link;
+
+	sw = find_f_sw(f, guid0);
+	if (!sw || port0 < 0 || (unsigned)port0 >= sw->port_cnt ||
+	    !sw->port[port0] || !sw->port[port0]->link)
+		return NULL;
+
+	link = sw->port[port0]->link;
+	if ((link->end[0].n_id == guid0 &&
+	     link->end[0].port == port0 &&
+	     link->end[1].n_id == guid1 &&
+	     link->end[1].port == port1) ||
+	    (link->end[0].n_id == guid1 &&
+	     link->end[0].port == port1 &&
+	     link->end[1].n_id == guid0 &&
+	     link->end[1].port == port0))
+		return link;
+
 	return NULL;
 }
 
+static
+struct link *find_f_link(struct fabric *f,
+			 guid_t guid0, int port0, guid_t guid1, int port1)
+{
+	struct link *link;
+
+	link = find_f_sw_port_link(f, guid0, port0, guid1, port1);
+	if (!link)
+		link = find_f_sw_port_link(f, guid1, port1, guid0, port0);
+	return link;
+}
+
 static
 struct f_switch *alloc_fswitch(struct fabric *f,
 			       guid_t sw_id, unsigned port_cnt)
@@ -527,6 +613,11 @@ struct f_switch *alloc_fswitch(struct fabric *f,
 	sw->n_id = sw_id;
 	sw->port_cnt = port_cnt;
 	f->sw[f->switch_cnt++] = sw;
+	if (!hash_fswitch(f, sw)) {
+		f->sw[--f->switch_cnt] = NULL;
+		free(sw);
+		sw = NULL;
+	}
 out:
 	return sw;
 }
@@ -9160,6 +9251,39 @@ out:
 	return success;
 }
 
+/*
+ * The loop VL SL bit for a coordinate direction depends only on the
+ * source and destination coordinates in that direction, so a path SL
+ * is the OR of one entry per direction.  A table over all switch pairs
+ * would need switch_cnt^2 entries; these need x_sz^2 + y_sz^2 + z_sz^2.
+ */
+static
+bool build_path_sl_tbl(struct torus *t)
+{
+	unsigned d, src, dst, len = 0;
+	unsigned sz[TORUS_MAX_DIM] = { t->x_sz, t->y_sz, t->z_sz };
+	uint8_t *tbl;
+
+	for (d = 0; d < TORUS_MAX_DIM; d++)
+		len += sz[d] * sz[d];
+
+	tbl = malloc(len);
+	if (!tbl) {
+		OSM_LOG(&t->osm->log, OSM_LOG_ERROR,
+			"ERR 4E4A: allocating path SL table: %s\n",
+			strerror(errno));
+		return false;
+	}
+	for (d = 0; d < TORUS_MAX_DIM; d++) {
+		t->path_sl[d] = tbl;
+		for (src = 0; src < sz[d]; src++)
+			for (dst = 0; dst < sz[d]; dst++)
+				*tbl++ = sl_set_use_loop_vl(use_vl1(src, dst,
+								    sz[d]), d);
+	}
+	return true;
+}
+
 int route_torus(struct torus *t)
 {
 	int s;
@@ -9169,6 +9293,7 @@ int route_torus(struct torus *t)
 		success = torus_lft(t, t->sw_pool[s]) && success;
 
 	success = success && torus_master_stree(t);
+	success = success && build_path_sl_tbl(t);
 
 	return success ? 0 : -1;
 }
@@ -9252,9 +9377,9 @@ uint8_t torus_path_sl(void *context, uint8_t path_sl_hint,
 
 	t = ssw->torus;
 
-	sl  = sl_set_use_loop_vl(use_vl1(ssw->i, dsw->i, t->x_sz), 0);
-	sl |= sl_set_use_loop_vl(use_vl1(ssw->j, dsw->j, t->y_sz), 1);
-	sl |= sl_set_use_loop_vl(use_vl1(ssw->k, dsw->k, t->z_sz), 2);
+	sl  = t->path_sl[0][ssw->i * t->x_sz + dsw->i];
+	sl |= t->path_sl[1][ssw->j * t->y_sz + dsw->j];
+	sl |= t->path_sl[2][ssw->k * t->z_sz + dsw->k];
 	sl |= sl_set_qos(sl_get_qos(path_sl_hint));
 out:
 	return sl;
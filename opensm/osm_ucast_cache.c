@@ -72,7 +72,12 @@ typedef struct cache_switch {
 	boolean_t dropped;
 	uint16_t max_lid_ho;
 	uint16_t num_hops;
-	uint8_t **hops;
+	uint16_t *hop_rows;
+	uint16_t num_hop_rows;
+	uint16_t max_hop_rows;
+	uint8_t hop_stride;
+	boolean_t hops_packed;
+	uint8_t *hops;
 	uint8_t *lft;
 	uint8_t num_ports;
 	cache_port_t ports[0];
@@ -114,19 +119,15 @@ static cache_switch_t *cache_sw_new(uint16_t lid_ho, unsigned num_ports)
 
 static void cache_sw_destroy(cache_switch_t * p_sw)
 {
-	unsigned i;
-
 	if (!p_sw)
 		return;
 
 	if (p_sw->lft)
 		free(p_sw->lft);
-	if (p_sw->hops) {
-		for (i = 0; i < p_sw->num_hops; i++)
-			if (p_sw->hops[i])
-				free(p_sw->hops[i]);
+	if (p_sw->hop_rows)
+		free(p_sw->hop_rows);
+	if (p_sw->hops)
 		free(p_sw->hops);
-	}
 	free(p_sw);
 }
 
@@ -327,6 +328,14 @@ cache_restore_ucast_info(osm_ucast_mgr_t * p_mgr,
 
 	p_sw->num_hops = p_cache_sw->num_hops;
 	p_cache_sw->num_hops = 0;
+	if (p_sw->hop_rows)
+		free(p_sw->hop_rows);
+	p_sw->hop_rows = p_cache_sw->hop_rows;
+	p_cache_sw->hop_rows = NULL;
+	p_sw->num_hop_rows = p_cache_sw->num_hop_rows;
+	p_sw->max_hop_rows = p_cache_sw->max_hop_rows;
+	p_sw->hop_stride = p_cache_sw->hop_stride;
+	p_sw->hops_packed = p_cache_sw->hops_packed;
 	if (p_sw->hops)
 		free(p_sw->hops);
 	p_sw->hops = p_cache_sw->hops;
@@ -981,6 +990,14 @@ void osm_ucast_cache_add_node(osm_ucast_mgr_t * p_mgr, osm_node_t * p_node)
 
 		p_cache_sw->num_hops = p_node->sw->num_hops;
 		p_node->sw->num_hops = 0;
+		p_cache_sw->hop_rows = p_node->sw->hop_rows;
+		p_node->sw->hop_rows = NULL;
+		p_cache_sw->num_hop_rows = p_node->sw->num_hop_rows;
+		p_cache_sw->max_hop_rows = p_node->sw->max_hop_rows;
+		p_node->sw->num_hop_rows = 0;
+		p_node->sw->max_hop_rows = 0;
+		p_cache_sw->hop_stride = p_node->sw->hop_stride;
+		p_cache_sw->hops_packed = p_node->sw->hops_packed;
 		p_cache_sw->hops = p_node->sw->hops;
 		p_node->sw->hops = NULL;
 
@@ -1055,5 +1072,9 @@ int osm_ucast_cache_process(osm_ucast_mgr_t * p_mgr)
 
 	osm_ucast_mgr_set_fwd_tables(p_mgr);
 
+	CL_PLOCK_EXCL_ACQUIRE(p_mgr->p_lock);
+	osm_ucast_mgr_build_dest_trees(p_mgr);
+	CL_PLOCK_RELEASE(p_mgr->p_lock);
+
 	return 0;
 }
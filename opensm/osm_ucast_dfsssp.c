@@ -99,31 +99,55 @@ typedef struct vertex {
 	boolean_t dropped;	/* indicate dropped switches (w/ ucast cache) */
 } vertex_t;
 
+#define VLTABLE_NONE 0xFFFF
+
+/* the channels used by a path only depend on the switch behind the source
+   port and on the destination lid, so the paths from the ports of a switch
+   to a lid always share their virtual lane; row 0 holds the sources which
+   aren't behind a switch (e.g. SP0), their paths never change the lane
+*/
 typedef struct vltable {
-	uint64_t num_lids;	/* size of the lids array */
-	uint16_t *lids;		/* sorted array of all lids in the subnet */
-	uint8_t *vls;		/* matrix form assignment lid X lid -> virtual lane */
+	uint32_t num_rows;	/* number of source switches + 1 */
+	uint32_t num_cols;	/* number of destination lids */
+	uint16_t max_lid;	/* largest lid in the table */
+	uint16_t *rows;		/* row for each source lid, or VLTABLE_NONE */
+	uint16_t *cols;		/* column for each destination lid, or VLTABLE_NONE */
+	uint8_t *vls;		/* matrix form assignment src sw X dest lid -> virtual lane */
 } vltable_t;
 
+#define CDG_NONE 0xFFFFFFFF
+
 typedef struct cdg_link {
-	struct cdg_node *node;
+	uint32_t node;		/* index of the channel the edge leads to */
 	uint32_t num_pairs;	/* number of src->dest pairs incremented in path adding step */
 	uint32_t max_len;	/* length of the srcdest array */
 	uint32_t removed;	/* number of pairs removed in path deletion step */
 	uint32_t *srcdest_pairs;
-	struct cdg_link *next;
 } cdg_link_t;
 
-/* struct for a node of a binary tree with additional parent pointer */
+/* node of the channel dependency graph, i.e. a switch to switch channel */
 typedef struct cdg_node {
-	uint64_t channelID;	/* unique key consist of src lid + port + dest lid + port */
-	cdg_link_t *linklist;	/* edges to adjazent nodes */
-	uint8_t status;		/* node status in cycle search to avoid recursive function */
-	uint8_t visited;	/* needed to traverse the binary tree */
-	struct cdg_node *pre;	/* to save the path in cycle detection algorithm */
-	struct cdg_node *left, *right, *parent;
+	cdg_link_t *links;	/* edges to adjazent nodes */
+	uint16_t num_links;
+	uint16_t max_links;
+	uint16_t next_link;	/* edge followed by the cycle search */
+	uint8_t status;		/* node status in cycle search */
+	uint32_t pre;		/* to save the path in cycle detection algorithm */
 } cdg_node_t;
 
+/* channel dependency graph of one virtual layer; the channel of a switch
+   port is found by adding the port number to the index of the switch's
+   first channel, looked up by the switch LID
+*/
+typedef struct cdg {
+	cdg_node_t *nodes;	/* allocated when the first path is added */
+	uint32_t num_nodes;
+	const uint32_t *chan_base;	/* index of the first channel per switch LID */
+	uint32_t num_lids;
+	uint32_t next_root;	/* nodes before this one are all searched */
+	uint32_t current;	/* top of the cycle search stack, or CDG_NONE */
+} cdg_t;
+
 typedef struct dfsssp_context {
 	osm_routing_engine_type_t routing_type;
 	osm_ucast_mgr_t *p_mgr;
@@ -161,56 +185,25 @@ static inline void set_default_vertex(vertex_t * vertex)
 	vertex->dropped = FALSE;
 }
 
-static inline void set_default_cdg_node(cdg_node_t * node)
-{
-	node->channelID = 0;
-	node->linklist = NULL;
-	node->status = UNKNOWN;
-	node->visited = 0;
-	node->pre = NULL;
-	node->left = NULL;
-	node->right = NULL;
-	node->parent = NULL;
-}
-
 /**********************************************************************
  **********************************************************************/
 
 /************ helper functions to save src/dest X vl combination ******
  **********************************************************************/
-/* compare function of two lids for stdlib qsort */
-static int cmp_lids(const void *l1, const void *l2)
-{
-	ib_net16_t lid1 = *((ib_net16_t *) l1), lid2 = *((ib_net16_t *) l2);
-
-	if (lid1 < lid2)
-		return -1;
-	else if (lid1 > lid2)
-		return 1;
-	else
-		return 0;
-}
-
-/* use stdlib to sort the lid array */
-static inline void vltable_sort_lids(vltable_t * vltable)
-{
-	qsort(vltable->lids, vltable->num_lids, sizeof(ib_net16_t), cmp_lids);
-}
-
-/* use stdlib to get index of key in lid array;
-   return -1 if lid isn't found in lids array
+/* get the cell of the matrix for a src lid X dest lid combination;
+   return NULL for invalid lids
 */
-static inline int64_t vltable_get_lidindex(ib_net16_t * key, vltable_t * vltable)
+static inline uint8_t *vltable_get_cell(vltable_t * vltable, ib_net16_t slid,
+					ib_net16_t dlid)
 {
-	ib_net16_t *found_lid = NULL;
+	uint16_t slid_ho = cl_ntoh16(slid), dlid_ho = cl_ntoh16(dlid);
 
-	found_lid =
-	    (ib_net16_t *) bsearch(key, vltable->lids, vltable->num_lids,
-				   sizeof(ib_net16_t), cmp_lids);
-	if (found_lid)
-		return found_lid - vltable->lids;
-	else
-		return -1;
+	if (slid_ho > vltable->max_lid || dlid_ho > vltable->max_lid
+	    || vltable->rows[slid_ho] == VLTABLE_NONE
+	    || vltable->cols[dlid_ho] == VLTABLE_NONE)
+		return NULL;
+	return &vltable->vls[(uint64_t) vltable->rows[slid_ho] *
+			     vltable->num_cols + vltable->cols[dlid_ho]];
 }
 
 /* get virtual lane from src lid X dest lid combination;
@@ -218,12 +211,10 @@ static inline int64_t vltable_get_lidindex(ib_net16_t * key, vltable_t * vltable
 */
 static int32_t vltable_get_vl(vltable_t * vltable, ib_net16_t slid, ib_net16_t dlid)
 {
-	int64_t ind1 = vltable_get_lidindex(&slid, vltable);
-	int64_t ind2 = vltable_get_lidindex(&dlid, vltable);
+	uint8_t *cell = vltable_get_cell(vltable, slid, dlid);
 
-	if (ind1 > -1 && ind2 > -1)
-		return (int32_t) (vltable->
-				  vls[ind1 + ind2 * vltable->num_lids]);
+	if (cell)
+		return (int32_t) *cell;
 	else
 		return -1;
 }
@@ -232,56 +223,39 @@ static int32_t vltable_get_vl(vltable_t * vltable, ib_net16_t slid, ib_net16_t d
 static inline void vltable_insert(vltable_t * vltable, ib_net16_t slid,
 				  ib_net16_t dlid, uint8_t vl)
 {
-	int64_t ind1 = vltable_get_lidindex(&slid, vltable);
-	int64_t ind2 = vltable_get_lidindex(&dlid, vltable);
+	uint8_t *cell = vltable_get_cell(vltable, slid, dlid);
 
-	if (ind1 > -1 && ind2 > -1)
-		vltable->vls[ind1 + ind2 * vltable->num_lids] = vl;
+	if (cell)
+		*cell = vl;
 }
 
-/* change a number of lanes from lane xy to lane yz */
-static void vltable_change_vl(vltable_t * vltable, uint8_t from, uint8_t to,
-			      uint64_t count)
+/* move all paths from lane xy to lane yz */
+static void vltable_change_vl(vltable_t * vltable, uint8_t from, uint8_t to)
 {
-	uint64_t set = 0, stop = 0;
-	uint64_t ind1 = 0, ind2 = 0;
+	uint64_t ind = 0, size = (uint64_t) vltable->num_rows *
+	    vltable->num_cols;
 
-	for (ind1 = 0; ind1 < vltable->num_lids; ind1++) {
-		for (ind2 = 0; ind2 < vltable->num_lids; ind2++) {
-			if (set == count) {
-				stop = 1;
-				break;
-			}
-			if (ind1 != ind2) {
-				if (vltable->
-				    vls[ind1 + ind2 * vltable->num_lids] ==
-				    from) {
-					vltable->vls[ind1 +
-						     ind2 * vltable->num_lids] =
-					    to;
-					set++;
-				}
-			}
-		}
-		if (stop)
-			break;
-	}
+	for (ind = 0; ind < size; ind++)
+		if (vltable->vls[ind] == from)
+			vltable->vls[ind] = to;
 }
 
 static void vltable_print(osm_ucast_mgr_t * p_mgr, vltable_t * vltable)
 {
-	uint64_t ind1 = 0, ind2 = 0;
+	uint32_t slid = 0, dlid = 0;
 
-	for (ind1 = 0; ind1 < vltable->num_lids; ind1++) {
-		for (ind2 = 0; ind2 < vltable->num_lids; ind2++) {
-			if (ind1 != ind2) {
+	for (slid = 1; slid <= vltable->max_lid; slid++) {
+		if (vltable->rows[slid] == VLTABLE_NONE)
+			continue;
+		for (dlid = 1; dlid <= vltable->max_lid; dlid++) {
+			if (slid != dlid && vltable->cols[dlid] != VLTABLE_NONE) {
 				OSM_LOG(p_mgr->p_log, OSM_LOG_DEBUG,
-					"   route from src_lid=%" PRIu16
-					" to dest_lid=%" PRIu16 " on vl=%" PRIu8
-					"\n", cl_ntoh16(vltable->lids[ind1]),
-					cl_ntoh16(vltable->lids[ind2]),
-					vltable->vls[ind1 +
-						     ind2 * vltable->num_lids]);
+					"   route from src_lid=%" PRIu32
+					" to dest_lid=%" PRIu32 " on vl=%" PRId32
+					"\n", slid, dlid,
+					vltable_get_vl(vltable,
+						       cl_hton16(slid),
+						       cl_hton16(dlid)));
 			}
 		}
 	}
@@ -290,8 +264,10 @@ static void vltable_print(osm_ucast_mgr_t * p_mgr, vltable_t * vltable)
 static void vltable_dealloc(vltable_t ** vltable)
 {
 	if (*vltable) {
-		if ((*vltable)->lids)
-			free((*vltable)->lids);
+		if ((*vltable)->rows)
+			free((*vltable)->rows);
+		if ((*vltable)->cols)
+			free((*vltable)->cols);
 		if ((*vltable)->vls)
 			free((*vltable)->vls);
 		free(*vltable);
@@ -299,29 +275,47 @@ static void vltable_dealloc(vltable_t ** vltable)
 	}
 }
 
-static int vltable_alloc(vltable_t ** vltable, uint64_t size)
+/* allocate a VL table for num_cols destination lids and the sources behind
+   num_rows - 1 switches; the lids are added with vltable_add_lid
+*/
+static int vltable_alloc(vltable_t ** vltable, uint16_t max_lid,
+			 uint32_t num_rows, uint32_t num_cols)
 {
-	/* allocate VL table and indexing array */
-	*vltable = (vltable_t *) malloc(sizeof(vltable_t));
+	/* allocate VL table and indexing arrays */
+	*vltable = (vltable_t *) calloc(1, sizeof(vltable_t));
 	if (!(*vltable))
 		goto ERROR;
-	(*vltable)->num_lids = size;
-	(*vltable)->lids = (ib_net16_t *) malloc(size * sizeof(ib_net16_t));
-	if (!((*vltable)->lids))
-		goto ERROR;
-	(*vltable)->vls = (uint8_t *) malloc(size * size * sizeof(uint8_t));
-	if (!((*vltable)->vls))
+	(*vltable)->num_rows = num_rows;
+	(*vltable)->num_cols = 0;
+	(*vltable)->max_lid = max_lid;
+	(*vltable)->rows =
+	    (uint16_t *) malloc((max_lid + 1) * sizeof(uint16_t));
+	(*vltable)->cols =
+	    (uint16_t *) malloc((max_lid + 1) * sizeof(uint16_t));
+	(*vltable)->vls = (uint8_t *) malloc((uint64_t) num_rows * num_cols);
+	if (!((*vltable)->rows) || !((*vltable)->cols) || !((*vltable)->vls))
 		goto ERROR;
-	memset((*vltable)->vls, OSM_DEFAULT_SL, size * size);
+	memset((*vltable)->rows, 0xFF, (max_lid + 1) * sizeof(uint16_t));
+	memset((*vltable)->cols, 0xFF, (max_lid + 1) * sizeof(uint16_t));
+	memset((*vltable)->vls, OSM_DEFAULT_SL, (uint64_t) num_rows * num_cols);
 
 	return 0;
 
 ERROR:
 	vltable_dealloc(vltable);
-
 	return 1;
 }
 
+/* add a lid of a port to the table, as source from the given row and as
+   destination in the next column
+*/
+static inline void vltable_add_lid(vltable_t * vltable, uint16_t lid,
+				   uint16_t row)
+{
+	vltable->rows[lid] = row;
+	vltable->cols[lid] = vltable->num_cols++;
+}
+
 /**********************************************************************
  **********************************************************************/
 
@@ -330,32 +324,22 @@ ERROR:
 /* update the srcdest array;
    realloc array (double the size) if size is not large enough
 */
-static void set_next_srcdest_pair(cdg_link_t * link, uint32_t srcdest)
+static int set_next_srcdest_pair(cdg_link_t * link, uint32_t srcdest)
 {
 	uint32_t new_size = 0, start_size = 2;
-	uint32_t *tmp = NULL, *tmp2 = NULL;
-
-	if (link->num_pairs == 0) {
-		link->srcdest_pairs =
-		    (uint32_t *) malloc(start_size * sizeof(uint32_t));
-		link->srcdest_pairs[link->num_pairs] = srcdest;
-		link->max_len = start_size;
-		link->removed = 0;
-	} else if (link->num_pairs == link->max_len) {
-		new_size = link->max_len << 1;
-		tmp = (uint32_t *) malloc(new_size * sizeof(uint32_t));
-		tmp =
-		    memcpy(tmp, link->srcdest_pairs,
-			   link->max_len * sizeof(uint32_t));
-		tmp2 = link->srcdest_pairs;
+	uint32_t *tmp = NULL;
+
+	if (link->num_pairs == link->max_len) {
+		new_size = link->max_len ? link->max_len << 1 : start_size;
+		tmp = (uint32_t *) realloc(link->srcdest_pairs,
+					   new_size * sizeof(uint32_t));
+		if (!tmp)
+			return 1;
 		link->srcdest_pairs = tmp;
-		link->srcdest_pairs[link->num_pairs] = srcdest;
-		free(tmp2);
 		link->max_len = new_size;
-	} else {
-		link->srcdest_pairs[link->num_pairs] = srcdest;
 	}
-	link->num_pairs++;
+	link->srcdest_pairs[link->num_pairs++] = srcdest;
+	return 0;
 }
 
 static inline uint32_t get_next_srcdest_pair(cdg_link_t * link, uint32_t index)
@@ -363,280 +347,196 @@ static inline uint32_t get_next_srcdest_pair(cdg_link_t * link, uint32_t index)
 	return link->srcdest_pairs[index];
 }
 
-/* traverse binary tree to find a node */
-static cdg_node_t *cdg_search(cdg_node_t * root, uint64_t channelID)
+/* index of the channel leaving the switch with the given LID thru port */
+static inline uint32_t cdg_channel(const cdg_t * cdg, uint16_t lid,
+				   uint8_t port)
 {
-	while (root) {
-		if (channelID < root->channelID)
-			root = root->left;
-		else if (channelID > root->channelID)
-			root = root->right;
-		else if (channelID == root->channelID)
-			return root;
-	}
-	return NULL;
+	if (lid >= cdg->num_lids || cdg->chan_base[lid] == CDG_NONE)
+		return CDG_NONE;
+	return cdg->chan_base[lid] + port;
 }
 
-/* insert new node into the binary tree */
-static void cdg_insert(cdg_node_t ** root, cdg_node_t * new_node)
+/* search the edge from a node to the channel to_node */
+static cdg_link_t *cdg_get_link(cdg_node_t * node, uint32_t to_node)
 {
-	cdg_node_t *current = *root;
-
-	if (!current) {
-		current = new_node;
-		*root = current;
-		return;
-	}
+	uint16_t i = 0;
 
-	while (current) {
-		if (new_node->channelID < current->channelID) {
-			if (current->left) {
-				current = current->left;
-			} else {
-				current->left = new_node;
-				new_node->parent = current;
-				break;
-			}
-		} else if (new_node->channelID > current->channelID) {
-			if (current->right) {
-				current = current->right;
-			} else {
-				current->right = new_node;
-				new_node->parent = current;
-				break;
-			}
-		} else if (new_node->channelID == current->channelID) {
-			/* not really possible, maybe programming error */
-			break;
-		}
-	}
+	for (i = 0; i < node->num_links; i++)
+		if (node->links[i].node == to_node)
+			return &node->links[i];
+	return NULL;
 }
 
-static void cdg_node_dealloc(cdg_node_t * node)
+/* append a new edge to the edges of a node */
+static cdg_link_t *cdg_add_link(cdg_node_t * node, uint32_t to_node)
 {
-	cdg_link_t *link = node->linklist, *tmp = NULL;
-
-	/* dealloc linklist */
-	while (link) {
-		tmp = link;
-		link = link->next;
-
-		if (tmp->num_pairs)
-			free(tmp->srcdest_pairs);
-		free(tmp);
-	}
-	/* dealloc node */
-	free(node);
+	cdg_link_t *links = NULL, *link = NULL;
+	uint16_t new_size = 0;
+
+	if (node->num_links == node->max_links) {
+		new_size = node->max_links ? node->max_links << 1 : 4;
+		links = (cdg_link_t *) realloc(node->links,
+					       new_size * sizeof(cdg_link_t));
+		if (!links)
+			return NULL;
+		node->links = links;
+		node->max_links = new_size;
+	}
+	link = &node->links[node->num_links++];
+	memset(link, 0, sizeof(cdg_link_t));
+	link->node = to_node;
+	return link;
 }
 
-static void cdg_dealloc(cdg_node_t ** root)
+static void cdg_node_free_links(cdg_node_t * node)
 {
-	cdg_node_t *current = *root;
-
-	while (current) {
-		if (current->left) {
-			current = current->left;
-		} else if (current->right) {
-			current = current->right;
-		} else {
-			if (current->parent == NULL) {
-				cdg_node_dealloc(current);
-				*root = NULL;
-				break;
-			}
-			if (current->parent->left == current) {
-				current = current->parent;
-				cdg_node_dealloc(current->left);
-				current->left = NULL;
-			} else if (current->parent->right == current) {
-				current = current->parent;
-				cdg_node_dealloc(current->right);
-				current->right = NULL;
-			}
-		}
-	}
+	uint16_t i = 0;
+
+	for (i = 0; i < node->num_links; i++)
+		free(node->links[i].srcdest_pairs);
+	free(node->links);
+	node->links = NULL;
+	node->num_links = 0;
+	node->max_links = 0;
 }
 
-/* search for a edge in the cdg which should be removed to break a cycle */
-static cdg_link_t *get_weakest_link_in_cycle(cdg_node_t * cycle)
+static void cdg_dealloc(cdg_t * cdg)
 {
-	cdg_node_t *current = cycle, *node_with_weakest_link = NULL;
-	cdg_link_t *link = NULL, *weakest_link = NULL;
-
-	link = current->linklist;
-	while (link) {
-		if (link->node->status == GRAY) {
-			weakest_link = link;
-			node_with_weakest_link = current;
-			current = link->node;
-			break;
-		}
-		link = link->next;
-	}
-
-	while (1) {
-		current->status = UNKNOWN;
-		link = current->linklist;
-		while (link) {
-			if (link->node->status == GRAY) {
-				if ((link->num_pairs - link->removed) <
-				    (weakest_link->num_pairs -
-				     weakest_link->removed)) {
-					weakest_link = link;
-					node_with_weakest_link = current;
-				}
-				current = link->node;
-				break;
-			}
-			link = link->next;
-		}
-		/* if complete cycle is traversed */
-		if (current == cycle) {
-			current->status = UNKNOWN;
-			break;
-		}
-	}
-
-	if (node_with_weakest_link->linklist == weakest_link) {
-		node_with_weakest_link->linklist = weakest_link->next;
-	} else {
-		link = node_with_weakest_link->linklist;
-		while (link) {
-			if (link->next == weakest_link) {
-				link->next = weakest_link->next;
-				break;
-			}
-			link = link->next;
-		}
-	}
+	uint32_t i = 0;
 
-	return weakest_link;
+	if (!cdg->nodes)
+		return;
+	for (i = 0; i < cdg->num_nodes; i++)
+		cdg_node_free_links(&cdg->nodes[i]);
+	free(cdg->nodes);
+	cdg->nodes = NULL;
 }
 
-/* search for nodes in the cdg not yet reached in the cycle search process;
-   (some nodes are unreachable, e.g. a node is a source or the cdg has not connected parts)
+/* search for a edge in the cycle found by the cycle search, which should be
+   removed to break the cycle; the cycle runs from the node 'cycle' along the
+   followed edges up to the top of the search stack, whose current edge
+   closes it; the search is resumed at the start node of the removed edge
 */
-static cdg_node_t *get_next_cdg_node(cdg_node_t * root)
+static void get_weakest_link_in_cycle(cdg_t * cdg, uint32_t cycle,
+				      cdg_link_t * weakest_link)
 {
-	cdg_node_t *current = root, *res = NULL;
+	uint32_t current = cycle, node_with_weakest_link = CDG_NONE;
+	cdg_node_t *node = NULL;
+	cdg_link_t *link = NULL, *weakest = NULL;
 
-	while (current) {
-		current->visited = 1;
-		if (current->status == UNKNOWN) {
-			res = current;
-			break;
-		}
-		if (current->left && !current->left->visited) {
-			current = current->left;
-		} else if (current->right && !current->right->visited) {
-			current = current->right;
-		} else {
-			if (current->left)
-				current->left->visited = 0;
-			if (current->right)
-				current->right->visited = 0;
-			if (current->parent == NULL)
-				break;
-			else
-				current = current->parent;
+	while (1) {
+		node = &cdg->nodes[current];
+		link = &node->links[node->next_link];
+		if (!weakest || (link->num_pairs - link->removed) <
+		    (weakest->num_pairs - weakest->removed)) {
+			weakest = link;
+			node_with_weakest_link = current;
 		}
+		if (current == cdg->current)
+			break;
+		current = link->node;
 	}
 
-	/* Clean up */
-	while (current) {
-		current->visited = 0;
-		if (current->left)
-			current->left->visited = 0;
-		if (current->right)
-			current->right->visited = 0;
-		current = current->parent;
-	}
+	*weakest_link = *weakest;
+	node = &cdg->nodes[node_with_weakest_link];
+	node->num_links--;
+	memmove(weakest, weakest + 1,
+		(node->num_links - node->next_link) * sizeof(cdg_link_t));
 
-	return res;
+	/* the nodes reached thru the removed edge have to be searched again */
+	for (current = cdg->current; current != node_with_weakest_link;
+	     current = cdg->nodes[current].pre) {
+		cdg->nodes[current].status = UNKNOWN;
+		if (current < cdg->next_root)
+			cdg->next_root = current;
+	}
+	cdg->current = node_with_weakest_link;
 }
 
-/* make a DFS on the cdg to check for a cycle */
-static cdg_node_t *search_cycle_in_channel_dep_graph(cdg_node_t * cdg,
-						     cdg_node_t * start_node)
+/* make a DFS on the cdg to check for a cycle; the search continues where the
+   last call stopped, so that each node is finished only once unless reached
+   thru an edge removed to break a cycle
+*/
+static uint32_t search_cycle_in_channel_dep_graph(cdg_t * cdg)
 {
-	cdg_node_t *cycle = NULL;
-	cdg_node_t *current = start_node, *next_node = NULL, *tmp = NULL;
+	uint32_t current = cdg->current;
+	cdg_node_t *node = NULL, *next_node = NULL;
 	cdg_link_t *link = NULL;
 
-	while (current) {
-		current->status = GRAY;
-		link = current->linklist;
-		next_node = NULL;
-		while (link) {
-			if (link->node->status == UNKNOWN) {
-				next_node = link->node;
-				break;
-			}
-			if (link->node->status == GRAY) {
-				cycle = link->node;
-				goto Exit;
-			}
-			link = link->next;
+	if (!cdg->nodes)
+		return CDG_NONE;
+
+	while (1) {
+		if (current == CDG_NONE) {
+			/* search for other subgraphs in cdg */
+			while (cdg->next_root < cdg->num_nodes &&
+			       cdg->nodes[cdg->next_root].status != UNKNOWN)
+				cdg->next_root++;
+			if (cdg->next_root == cdg->num_nodes)
+				break;	/* all relevant nodes traversed, no more cycles found */
+			current = cdg->next_root;
+			node = &cdg->nodes[current];
+			node->status = GRAY;
+			node->pre = CDG_NONE;
+			node->next_link = 0;
 		}
-		if (next_node) {
-			next_node->pre = current;
-			current = next_node;
-		} else {
-			/* found a sink in the graph, go to last node */
-			current->status = BLACK;
-
-			/* srcdest_pairs of this node aren't relevant, free the allocated memory */
-			link = current->linklist;
-			while (link) {
-				if (link->num_pairs)
-					free(link->srcdest_pairs);
-				link->srcdest_pairs = NULL;
-				link->num_pairs = 0;
-				link->removed = 0;
-				link = link->next;
-			}
 
-			if (current->pre) {
-				tmp = current;
-				current = current->pre;
-				tmp->pre = NULL;
+		node = &cdg->nodes[current];
+		if (node->next_link < node->num_links) {
+			link = &node->links[node->next_link];
+			next_node = &cdg->nodes[link->node];
+			/* edges whose paths all moved to the next layer don't count */
+			if (link->num_pairs == link->removed
+			    || next_node->status == BLACK) {
+				node->next_link++;
+			} else if (next_node->status == GRAY) {
+				cdg->current = current;
+				return link->node;
 			} else {
-				/* search for other subgraphs in cdg */
-				current = get_next_cdg_node(cdg);
-				if (!current)
-					break;	/* all relevant nodes traversed, no more cycles found */
+				next_node->status = GRAY;
+				next_node->pre = current;
+				next_node->next_link = 0;
+				current = link->node;
 			}
+			continue;
 		}
+
+		/* found a sink in the graph, go to last node */
+		node->status = BLACK;
+
+		/* edges of this node aren't relevant, free the allocated memory */
+		cdg_node_free_links(node);
+
+		current = node->pre;
+		if (current != CDG_NONE)
+			cdg->nodes[current].next_link++;
 	}
 
-Exit:
-	return cycle;
+	cdg->current = CDG_NONE;
+	return CDG_NONE;
 }
 
 /* calculate the path from source to destination port;
    new channels are added directly to the cdg
 */
-static int update_channel_dep_graph(cdg_node_t ** cdg_root,
-				    osm_port_t * src_port, uint16_t slid,
-				    osm_port_t * dest_port, uint16_t dlid)
+static int update_channel_dep_graph(cdg_t * cdg, osm_port_t * src_port,
+				    uint16_t slid, osm_port_t * dest_port,
+				    uint16_t dlid)
 {
 	osm_node_t *local_node = NULL, *remote_node = NULL;
-	uint16_t local_lid = 0, remote_lid = 0;
-	uint32_t srcdest = 0;
+	uint32_t srcdest = 0, channel = 0, last_channel = CDG_NONE;
 	uint8_t local_port = 0, remote_port = 0;
-	uint64_t channelID = 0;
-
-	cdg_node_t *channel_head = NULL, *channel = NULL, *last_channel = NULL;
-	cdg_link_t *linklist = NULL;
+	cdg_link_t *link = NULL;
 
 	/* set the identifier for the src/dest pair to save this on each edge of the cdg */
 	srcdest = (((uint32_t) slid) << 16) + ((uint32_t) dlid);
 
-	channel_head = (cdg_node_t *) malloc(sizeof(cdg_node_t));
-	if (!channel_head)
-		goto ERROR;
-	set_default_cdg_node(channel_head);
-	last_channel = channel_head;
+	if (!cdg->nodes) {
+		cdg->nodes =
+		    (cdg_node_t *) calloc(cdg->num_nodes, sizeof(cdg_node_t));
+		if (!cdg->nodes)
+			return 1;
+	}
 
 	/* if src is a Hca, then the channel from Hca to switch would be a source in the graph
 	   sources can't be part of a cycle -> skip this channel
@@ -650,11 +550,7 @@ static int update_channel_dep_graph(cdg_node_t ** cdg_root,
 		local_port = local_node->sw->new_lft[dlid];
 		/* sanity check: local_port must be set or routing is broken */
 		if (local_port == OSM_NO_PATH)
-			goto ERROR;
-		local_lid = cl_ntoh16(osm_node_get_base_lid(local_node, 0));
-		/* each port belonging to a switch has lmc==0 -> get_base_lid is fine
-		   (local/remote port in this function are always part of a switch)
-		 */
+			return 1;
 
 		remote_node =
 		    osm_node_get_remote_node(local_node, local_port,
@@ -662,133 +558,41 @@ static int update_channel_dep_graph(cdg_node_t ** cdg_root,
 		/* if remote_node is a Hca, then the last channel from switch to Hca would be a sink in the cdg -> skip */
 		if (!remote_node || !remote_node->sw)
 			break;
-		remote_lid = cl_ntoh16(osm_node_get_base_lid(remote_node, 0));
-
-		channelID =
-		    (((uint64_t) local_lid) << 48) +
-		    (((uint64_t) local_port) << 32) +
-		    (((uint64_t) remote_lid) << 16) + ((uint64_t) remote_port);
-		channel = cdg_search(*cdg_root, channelID);
-		if (channel) {
-			/* check whether last channel has connection to this channel, i.e. subpath already exists in cdg */
-			linklist = last_channel->linklist;
-			while (linklist && linklist->node != channel
-			       && linklist->next)
-				linklist = linklist->next;
-			/* if there is no connection, add one */
-			if (linklist) {
-				if (linklist->node == channel) {
-					set_next_srcdest_pair(linklist,
-							      srcdest);
-				} else {
-					linklist->next =
-					    (cdg_link_t *)
-					    malloc(sizeof(cdg_link_t));
-					if (!linklist->next)
-						goto ERROR;
-					linklist = linklist->next;
-					linklist->node = channel;
-					linklist->num_pairs = 0;
-					linklist->srcdest_pairs = NULL;
-					set_next_srcdest_pair(linklist,
-							      srcdest);
-					linklist->next = NULL;
-				}
-			} else {
-				/* either this is the first channel of the path, or the last channel was a new channel, or last channel was a sink */
-				last_channel->linklist =
-				    (cdg_link_t *) malloc(sizeof(cdg_link_t));
-				if (!last_channel->linklist)
-					goto ERROR;
-				last_channel->linklist->node = channel;
-				last_channel->linklist->num_pairs = 0;
-				last_channel->linklist->srcdest_pairs = NULL;
-				set_next_srcdest_pair(last_channel->linklist,
-						      srcdest);
-				last_channel->linklist->next = NULL;
-			}
-		} else {
-			/* create new channel */
-			channel = (cdg_node_t *) malloc(sizeof(cdg_node_t));
-			if (!channel)
-				goto ERROR;
-			set_default_cdg_node(channel);
-			channel->channelID = channelID;
-			cdg_insert(cdg_root, channel);
-
-			/* go to end of link list of last channel */
-			linklist = last_channel->linklist;
-			while (linklist && linklist->next)
-				linklist = linklist->next;
-			if (linklist) {
-				/* update last link of an existing channel */
-				linklist->next =
-				    (cdg_link_t *) malloc(sizeof(cdg_link_t));
-				if (!linklist->next)
-					goto ERROR;
-				linklist = linklist->next;
-				linklist->node = channel;
-				linklist->num_pairs = 0;
-				linklist->srcdest_pairs = NULL;
-				set_next_srcdest_pair(linklist, srcdest);
-				linklist->next = NULL;
-			} else {
-				/* either this is the first channel of the path, or the last channel was a new channel, or last channel was a sink */
-				last_channel->linklist =
-				    (cdg_link_t *) malloc(sizeof(cdg_link_t));
-				if (!last_channel->linklist)
-					goto ERROR;
-				last_channel->linklist->node = channel;
-				last_channel->linklist->num_pairs = 0;
-				last_channel->linklist->srcdest_pairs = NULL;
-				set_next_srcdest_pair(last_channel->linklist,
-						      srcdest);
-				last_channel->linklist->next = NULL;
-			}
+
+		/* each port belonging to a switch has lmc==0 -> get_base_lid is fine */
+		channel = cdg_channel(cdg,
+				      cl_ntoh16(osm_node_get_base_lid
+						(local_node, 0)), local_port);
+		if (channel == CDG_NONE)
+			return 1;
+
+		/* the first channel of the path depends on no other channel */
+		if (last_channel != CDG_NONE) {
+			link = cdg_get_link(&cdg->nodes[last_channel],
+					    channel);
+			if (!link)
+				link = cdg_add_link(&cdg->nodes[last_channel],
+						    channel);
+			if (!link || set_next_srcdest_pair(link, srcdest))
+				return 1;
 		}
 		last_channel = channel;
 	}
 
-	if (channel_head->linklist) {
-		if (channel_head->linklist->srcdest_pairs)
-			free(channel_head->linklist->srcdest_pairs);
-		free(channel_head->linklist);
-	}
-	free(channel_head);
-
 	return 0;
-
-ERROR:
-	/* cleanup data and exit */
-	if (channel_head) {
-		if (channel_head->linklist)
-			free(channel_head->linklist);
-		free(channel_head);
-	}
-
-	return 1;
 }
 
 /* calculate the path from source to destination port;
    the links in the cdg representing this path are decremented to simulate the removal
 */
-static int remove_path_from_cdg(cdg_node_t ** cdg_root, osm_port_t * src_port,
+static int remove_path_from_cdg(cdg_t * cdg, osm_port_t * src_port,
 				uint16_t slid, osm_port_t * dest_port,
 				uint16_t dlid)
 {
 	osm_node_t *local_node = NULL, *remote_node = NULL;
-	uint16_t local_lid = 0, remote_lid = 0;
+	uint32_t channel = 0, last_channel = CDG_NONE;
 	uint8_t local_port = 0, remote_port = 0;
-	uint64_t channelID = 0;
-
-	cdg_node_t *channel_head = NULL, *channel = NULL, *last_channel = NULL;
-	cdg_link_t *linklist = NULL;
-
-	channel_head = (cdg_node_t *) malloc(sizeof(cdg_node_t));
-	if (!channel_head)
-		goto ERROR;
-	set_default_cdg_node(channel_head);
-	last_channel = channel_head;
+	cdg_link_t *link = NULL;
 
 	/* if src is a Hca, then the channel from Hca to switch would be a source in the graph
 	   sources can't be part of a cycle -> skip this channel
@@ -802,8 +606,7 @@ static int remove_path_from_cdg(cdg_node_t ** cdg_root, osm_port_t * src_port,
 		local_port = local_node->sw->new_lft[dlid];
 		/* sanity check: local_port must be set or routing is broken */
 		if (local_port == OSM_NO_PATH)
-			goto ERROR;
-		local_lid = cl_ntoh16(osm_node_get_base_lid(local_node, 0));
+			return 1;
 
 		remote_node =
 		    osm_node_get_remote_node(local_node, local_port,
@@ -811,51 +614,27 @@ static int remove_path_from_cdg(cdg_node_t ** cdg_root, osm_port_t * src_port,
 		/* if remote_node is a Hca, then the last channel from switch to Hca would be a sink in the cdg -> skip */
 		if (!remote_node || !remote_node->sw)
 			break;
-		remote_lid = cl_ntoh16(osm_node_get_base_lid(remote_node, 0));
-
-		channelID =
-		    (((uint64_t) local_lid) << 48) +
-		    (((uint64_t) local_port) << 32) +
-		    (((uint64_t) remote_lid) << 16) + ((uint64_t) remote_port);
-		channel = cdg_search(*cdg_root, channelID);
-		if (channel) {
-			/* check whether last channel has connection to this channel, i.e. subpath already exists in cdg */
-			linklist = last_channel->linklist;
-			while (linklist && linklist->node != channel
-			       && linklist->next)
-				linklist = linklist->next;
-			/* remove the srcdest from the link */
-			if (linklist) {
-				if (linklist->node == channel) {
-					linklist->removed++;
-				} else {
-					/* may happen if the link is missing (thru cycle detect algorithm) */
-				}
-			} else {
-				/* may happen if the link is missing (thru cycle detect algorithm or last_channel==channel_head (dummy channel)) */
-			}
-		} else {
-			/* must be an error, channels for the path are added before, so a missing channel would be a corrupt data structure */
-			goto ERROR;
+
+		/* a missing channel would be a corrupt data structure, channels for the path are added before */
+		channel = cdg_channel(cdg,
+				      cl_ntoh16(osm_node_get_base_lid
+						(local_node, 0)), local_port);
+		if (channel == CDG_NONE)
+			return 1;
+
+		/* remove the srcdest from the link; the link may be missing
+		   (removed by the cycle search or freed with a finished node)
+		 */
+		if (last_channel != CDG_NONE) {
+			link = cdg_get_link(&cdg->nodes[last_channel],
+					    channel);
+			if (link)
+				link->removed++;
 		}
 		last_channel = channel;
 	}
 
-	if (channel_head->linklist)
-		free(channel_head->linklist);
-	free(channel_head);
-
 	return 0;
-
-ERROR:
-	/* cleanup data and exit */
-	if (channel_head) {
-		if (channel_head->linklist)
-			free(channel_head->linklist);
-		free(channel_head);
-	}
-
-	return 1;
 }
 
 /**********************************************************************
@@ -1773,13 +1552,19 @@ static int dfsssp_remove_deadlocks(dfsssp_context_t * dfsssp_ctx)
 	cl_qlist_t *port_tbl = &p_mgr->port_order_list;	/* 1 management port per switch + 1 or 2 ports for each Hca */
 	cl_list_item_t *item1 = NULL, *item2 = NULL;
 	osm_port_t *src_port = NULL, *dest_port = NULL;
+	osm_node_t *remote_node = NULL;
 
 	uint32_t i = 0, j = 0, err = 0;
 	uint8_t vl = 0, test_vl = 0, vl_avail = 0, vl_needed = 1;
 	double most_avg_paths = 0.0;
-	cdg_node_t **cdg = NULL, *start_here = NULL, *cycle = NULL;
-	cdg_link_t *weakest_link = NULL;
-	uint32_t srcdest = 0;
+	cdg_t *cdg = NULL;
+	cdg_link_t weakest_link;
+	uint32_t cycle = 0, srcdest = 0;
+	uint32_t *chan_base = NULL, num_lids = 0, num_channels = 0;
+	uint16_t *sw_row = NULL, num_rows = 1, row = 0, max_lid = 0;
+	cl_qmap_t *sw_tbl = &p_mgr->p_subn->sw_guid_tbl;
+	cl_map_item_t *sw_item = NULL;
+	osm_switch_t *sw = NULL;
 
 	vltable_t *srcdest2vl_table = NULL;
 	uint8_t lmc = 0;
@@ -1794,6 +1579,8 @@ static int dfsssp_remove_deadlocks(dfsssp_context_t * dfsssp_ctx)
 	OSM_LOG(p_mgr->p_log, OSM_LOG_VERBOSE,
 		"Assign each src/dest pair a Virtual Lanes, to remove deadlocks in the routing\n");
 
+	memset(&weakest_link, 0, sizeof(weakest_link));
+
 	vl_avail = get_avail_vl_in_subn(p_mgr);
 	OSM_LOG(p_mgr->p_log, OSM_LOG_INFO,
 		"Virtual Lanes available: %" PRIu8 "\n", vl_avail);
@@ -1806,15 +1593,42 @@ static int dfsssp_remove_deadlocks(dfsssp_context_t * dfsssp_ctx)
 	}
 	memset(paths_per_vl, 0, vl_avail * sizeof(uint64_t));
 
-	cdg = (cdg_node_t **) malloc(vl_avail * sizeof(cdg_node_t *));
-	if (!cdg) {
+	/* number the channels (switch ports) for the cdg nodes */
+	for (sw_item = cl_qmap_head(sw_tbl); sw_item != cl_qmap_end(sw_tbl);
+	     sw_item = cl_qmap_next(sw_item)) {
+		sw = (osm_switch_t *) sw_item;
+		slid = cl_ntoh16(osm_node_get_base_lid(sw->p_node, 0));
+		if (slid >= num_lids)
+			num_lids = slid + 1;
+	}
+	chan_base = (uint32_t *) malloc(num_lids * sizeof(uint32_t));
+	sw_row = (uint16_t *) malloc(num_lids * sizeof(uint16_t));
+	cdg = (cdg_t *) calloc(vl_avail, sizeof(cdg_t));
+	if (!chan_base || !sw_row || !cdg) {
 		OSM_LOG(p_mgr->p_log, OSM_LOG_ERROR,
 			"ERR AD23: cannot allocate memory for cdg\n");
+		free(chan_base);
+		free(sw_row);
+		free(cdg);
 		free(paths_per_vl);
 		return 1;
 	}
-	for (i = 0; i < vl_avail; i++)
-		cdg[i] = NULL;
+	memset(chan_base, 0xFF, num_lids * sizeof(uint32_t));
+	for (sw_item = cl_qmap_head(sw_tbl); sw_item != cl_qmap_end(sw_tbl);
+	     sw_item = cl_qmap_next(sw_item)) {
+		sw = (osm_switch_t *) sw_item;
+		slid = cl_ntoh16(osm_node_get_base_lid(sw->p_node, 0));
+		chan_base[slid] = num_channels;
+		num_channels += sw->num_ports;
+		/* VL table row for the ports behind this switch */
+		sw_row[slid] = num_rows++;
+	}
+	for (i = 0; i < vl_avail; i++) {
+		cdg[i].num_nodes = num_channels;
+		cdg[i].chan_base = chan_base;
+		cdg[i].num_lids = num_lids;
+		cdg[i].current = CDG_NONE;
+	}
 
 	count = 0;
 	/* count all ports (also multiple LIDs) of type CA or SP0 for size of VL table */
@@ -1832,18 +1646,21 @@ static int dfsssp_remove_deadlocks(dfsssp_context_t * dfsssp_ctx)
 
 			lmc = osm_port_get_lmc(dest_port);
 			count += (1 << lmc);
+			osm_port_get_lid_range_ho(dest_port, &min_lid_ho,
+						  &max_lid_ho);
+			if (max_lid_ho > max_lid)
+				max_lid = max_lid_ho;
 		}
 	}
-	/* allocate VL table and indexing array */
-	err = vltable_alloc(&srcdest2vl_table, count);
+	/* allocate VL table and indexing arrays */
+	err = vltable_alloc(&srcdest2vl_table, max_lid, num_rows, count);
 	if (err) {
 		OSM_LOG(p_mgr->p_log, OSM_LOG_ERROR,
 			"ERR AD26: cannot allocate memory for srcdest2vl_table\n");
 		goto ERROR;
 	}
 
-	i = 0;
-	/* fill lids into indexing array */
+	/* fill lids into indexing arrays */
 	for (item1 = cl_qlist_head(port_tbl); item1 != cl_qlist_end(port_tbl);
 	     item1 = cl_qlist_next(item1)) {
 		dest_port = (osm_port_t *)cl_item_obj(item1, dest_port,
@@ -1856,14 +1673,29 @@ static int dfsssp_remove_deadlocks(dfsssp_context_t * dfsssp_ctx)
 			    & IB_PORT_CAP_HAS_SL_MAP))
 				continue;
 
+			/* paths from CAs use the row of the switch they are
+			   connected to, all others never leave row 0
+			 */
+			row = 0;
+			remote_node =
+			    osm_node_get_remote_node(dest_port->p_node,
+						     dest_port->p_physp->
+						     port_num, NULL);
+			if (ntype == IB_NODE_TYPE_CA && remote_node
+			    && remote_node->sw)
+				row = sw_row[cl_ntoh16(osm_node_get_base_lid
+						       (remote_node, 0))];
+
 			osm_port_get_lid_range_ho(dest_port, &min_lid_ho,
 						  &max_lid_ho);
-			for (dlid = min_lid_ho; dlid <= max_lid_ho; dlid++, i++)
-				srcdest2vl_table->lids[i] = cl_hton16(dlid);
+			for (dlid = min_lid_ho; dlid <= max_lid_ho; dlid++)
+				vltable_add_lid(srcdest2vl_table, dlid, row);
 		}
 	}
-	/* sort lids */
-	vltable_sort_lids(srcdest2vl_table);
+	OSM_LOG(p_mgr->p_log, OSM_LOG_VERBOSE,
+		"VL table: %" PRIu32 " source switches X %" PRIu32
+		" destination lids\n", srcdest2vl_table->num_rows - 1,
+		srcdest2vl_table->num_cols);
 
 	test_vl = 0;
 	/* fill cdg[0] with routes from each src/dest port combination for all Hca/SP0 in the subnet */
@@ -1934,39 +1766,35 @@ static int dfsssp_remove_deadlocks(dfsssp_context_t * dfsssp_ctx)
 
 	/* test all cdg for cycles and break the cycles by moving paths on the weakest link to the next cdg */
 	for (test_vl = 0; test_vl < vl_avail - 1; test_vl++) {
-		start_here = cdg[test_vl];
-		while (start_here) {
+		while (1) {
 			cycle =
-			    search_cycle_in_channel_dep_graph(cdg[test_vl],
-							      start_here);
+			    search_cycle_in_channel_dep_graph(&cdg[test_vl]);
 
-			if (cycle) {
+			if (cycle != CDG_NONE) {
 				vl_needed = test_vl + 2;
 
 				/* calc weakest link n cycle */
-				weakest_link = get_weakest_link_in_cycle(cycle);
-				if (!weakest_link) {
-					OSM_LOG(p_mgr->p_log, OSM_LOG_ERROR,
-						"ERR AD27: something went wrong in get_weakest_link_in_cycle(...)\n");
-					err = 1;
-					goto ERROR;
-				}
+				get_weakest_link_in_cycle(&cdg[test_vl], cycle,
+							  &weakest_link);
 
 				paths_per_vl[test_vl] -=
-				    weakest_link->num_pairs;
+				    weakest_link.num_pairs;
 				paths_per_vl[test_vl + 1] +=
-				    weakest_link->num_pairs;
+				    weakest_link.num_pairs;
 
-				/* move all <s,d> paths on this link to the next cdg */
-				for (i = 0; i < weakest_link->num_pairs; i++) {
+				/* only move if not moved in a previous step;
+				   check all pairs before moving any, since the
+				   paths from one switch share their VL table
+				   entry
+				 */
+				for (i = 0; i < weakest_link.num_pairs; i++) {
 					srcdest =
-					    get_next_srcdest_pair(weakest_link,
+					    get_next_srcdest_pair(&weakest_link,
 								  i);
 					slid = (uint16_t) (srcdest >> 16);
 					dlid =
 					    (uint16_t) ((srcdest << 16) >> 16);
 
-					/* only move if not moved in a previous step */
 					if (test_vl !=
 					    (uint8_t)
 					    vltable_get_vl(srcdest2vl_table,
@@ -1977,8 +1805,21 @@ static int dfsssp_remove_deadlocks(dfsssp_context_t * dfsssp_ctx)
 						 */
 						paths_per_vl[test_vl]++;
 						paths_per_vl[test_vl + 1]--;
-						continue;
+						weakest_link.srcdest_pairs[i] =
+						    0;
 					}
+				}
+
+				/* move all <s,d> paths on this link to the next cdg */
+				for (i = 0; i < weakest_link.num_pairs; i++) {
+					srcdest =
+					    get_next_srcdest_pair(&weakest_link,
+								  i);
+					if (!srcdest)
+						continue;
+					slid = (uint16_t) (srcdest >> 16);
+					dlid =
+					    (uint16_t) ((srcdest << 16) >> 16);
 
 					src_port =
 					    osm_get_port_by_lid(p_mgr->p_subn,
@@ -2025,27 +1866,19 @@ static int dfsssp_remove_deadlocks(dfsssp_context_t * dfsssp_ctx)
 						       test_vl + 1);
 				}
 
-				if (weakest_link->num_pairs)
-					free(weakest_link->srcdest_pairs);
-				if (weakest_link)
-					free(weakest_link);
-			}
-
-			start_here = cycle;
+				free(weakest_link.srcdest_pairs);
+				weakest_link.srcdest_pairs = NULL;
+			} else
+				break;
 		}
 	}
 
 	/* test the last avail cdg for a cycle;
 	   if there is one, than vl_needed > vl_avail
 	 */
-	start_here = cdg[vl_avail - 1];
-	if (start_here) {
-		cycle =
-		    search_cycle_in_channel_dep_graph(cdg[vl_avail - 1],
-						      start_here);
-		if (cycle) {
-			vl_needed = vl_avail + 1;
-		}
+	cycle = search_cycle_in_channel_dep_graph(&cdg[vl_avail - 1]);
+	if (cycle != CDG_NONE) {
+		vl_needed = vl_avail + 1;
 	}
 
 	OSM_LOG(p_mgr->p_log, OSM_LOG_INFO,
@@ -2104,8 +1937,7 @@ static int dfsssp_remove_deadlocks(dfsssp_context_t * dfsssp_ctx)
 			to = 0;
 			for (i = 0; i < from; i++)
 				to += split_count[i];
-			count = paths_per_vl[from];
-			vltable_change_vl(srcdest2vl_table, from, to, count);
+			vltable_change_vl(srcdest2vl_table, from, to);
 			/* change also the information within the split_count
 			   array; this is important for fast calculation later
 			 */
@@ -2151,6 +1983,8 @@ static int dfsssp_remove_deadlocks(dfsssp_context_t * dfsssp_ctx)
 	for (i = 0; i < vl_avail; i++)
 		cdg_dealloc(&cdg[i]);
 	free(cdg);
+	free(chan_base);
+	free(sw_row);
 
 	OSM_LOG_EXIT(p_mgr->p_log);
 	return 0;
@@ -2158,9 +1992,12 @@ static int dfsssp_remove_deadlocks(dfsssp_context_t * dfsssp_ctx)
 ERROR:
 	free(paths_per_vl);
 
+	free(weakest_link.srcdest_pairs);
 	for (i = 0; i < vl_avail; i++)
 		cdg_dealloc(&cdg[i]);
 	free(cdg);
+	free(chan_base);
+	free(sw_row);
 
 	vltable_dealloc(&srcdest2vl_table);
 	dfsssp_ctx->srcdest2vl_table = NULL;
@@ -2168,6 +2005,208 @@ ERROR:
 	return err;
 }
 
+/* a batch of destinations whose dijkstra steps run on the same link weights;
+   each slot has its own copy of the vertices (sharing the links), so the
+   steps of a batch are independent and can run on several threads
+*/
+typedef struct dfsssp_dest {
+	osm_port_t *port;
+	uint16_t lid;
+} dfsssp_dest_t;
+
+typedef struct dfsssp_batch_slot {
+	osm_port_t *port;
+	uint16_t lid;
+	int err;
+	vertex_t *adj_list;
+} dfsssp_batch_slot_t;
+
+typedef struct dfsssp_batch {
+	osm_ucast_mgr_t *p_mgr;
+	uint32_t adj_list_size;
+	uint32_t num_slots;
+	uint32_t num_workers;
+	dfsssp_batch_slot_t *slots;
+	cl_heap_t *heaps;
+	/* queued destinations of the current priority group */
+	dfsssp_dest_t *dests;
+	uint32_t num_dests;
+	uint32_t max_dests;
+} dfsssp_batch_t;
+
+static void dfsssp_batch_destroy(dfsssp_batch_t * batch)
+{
+	uint32_t i = 0;
+
+	if (batch->slots) {
+		for (i = 0; i < batch->num_slots; i++) {
+			if (!batch->slots[i].adj_list)
+				continue;
+			if (batch->slots[i].adj_list[0].links)
+				free(batch->slots[i].adj_list[0].links);
+			free(batch->slots[i].adj_list);
+		}
+		free(batch->slots);
+		batch->slots = NULL;
+	}
+	if (batch->heaps) {
+		for (i = 0; i < batch->num_workers; i++)
+			if (cl_is_heap_inited(&batch->heaps[i]))
+				cl_heap_destroy(&batch->heaps[i]);
+		free(batch->heaps);
+		batch->heaps = NULL;
+	}
+	if (batch->dests) {
+		free(batch->dests);
+		batch->dests = NULL;
+	}
+}
+
+static int dfsssp_batch_init(dfsssp_batch_t * batch, osm_ucast_mgr_t * p_mgr,
+			     vertex_t * adj_list, uint32_t adj_list_size)
+{
+	uint32_t i = 0;
+
+	memset(batch, 0, sizeof(*batch));
+	batch->p_mgr = p_mgr;
+	batch->adj_list_size = adj_list_size;
+	batch->num_slots = p_mgr->p_subn->opt.sssp_batch_size;
+	if (!batch->num_slots)
+		batch->num_slots = 1;
+	batch->num_workers = osm_ucast_mgr_num_workers(p_mgr);
+	if (batch->num_workers > batch->num_slots)
+		batch->num_workers = batch->num_slots;
+
+	batch->slots = (dfsssp_batch_slot_t *)
+	    calloc(batch->num_slots, sizeof(dfsssp_batch_slot_t));
+	batch->heaps = (cl_heap_t *)
+	    malloc(batch->num_workers * sizeof(cl_heap_t));
+	batch->max_dests = 1024;
+	batch->dests = (dfsssp_dest_t *)
+	    malloc(batch->max_dests * sizeof(dfsssp_dest_t));
+	if (!batch->slots || !batch->heaps || !batch->dests)
+		goto ERROR;
+	for (i = 0; i < batch->num_workers; i++)
+		cl_heap_construct(&batch->heaps[i]);
+
+	for (i = 0; i < batch->num_slots; i++) {
+		batch->slots[i].adj_list =
+		    (vertex_t *) malloc(adj_list_size * sizeof(vertex_t));
+		if (!batch->slots[i].adj_list)
+			goto ERROR;
+		memcpy(batch->slots[i].adj_list, adj_list,
+		       adj_list_size * sizeof(vertex_t));
+		/* adj_list[0] (the Hca source) is private to each slot */
+		set_default_vertex(&batch->slots[i].adj_list[0]);
+	}
+	return 0;
+
+ERROR:
+	OSM_LOG(p_mgr->p_log, OSM_LOG_ERROR,
+		"ERR AD54: cannot allocate memory for the dijkstra batch\n");
+	dfsssp_batch_destroy(batch);
+	return 1;
+}
+
+static void dfsssp_batch_work(void *context, unsigned item, unsigned worker)
+{
+	dfsssp_batch_t *batch = (dfsssp_batch_t *) context;
+	dfsssp_batch_slot_t *slot = &batch->slots[item];
+
+	slot->err = dijkstra(batch->p_mgr, &batch->heaps[worker],
+			     slot->adj_list, batch->adj_list_size,
+			     slot->port, slot->lid);
+}
+
+/* do the dijkstra steps of the first num_used slots in parallel, then update
+   the LFTs and link weights in the order of the slots, which keeps the
+   routing independent of the number of threads
+*/
+static int dfsssp_batch_route(dfsssp_batch_t * batch, uint32_t num_used)
+{
+	osm_ucast_mgr_t *p_mgr = batch->p_mgr;
+	dfsssp_batch_slot_t *slot = NULL;
+	uint32_t i = 0;
+	int err = 0;
+
+	osm_ucast_mgr_parallel_for(p_mgr, num_used, batch->num_workers,
+				   dfsssp_batch_work, batch);
+
+	for (i = 0; i < num_used; i++) {
+		slot = &batch->slots[i];
+		if (slot->err)
+			return slot->err;
+		if (OSM_LOG_IS_ACTIVE_V2(p_mgr->p_log, OSM_LOG_DEBUG))
+			print_routes(p_mgr, slot->adj_list,
+				     batch->adj_list_size, slot->port);
+
+		/* make an update for the linear forwarding tables of the switches */
+		err = update_lft(p_mgr, slot->adj_list, batch->adj_list_size,
+				 slot->port, slot->lid);
+		if (err)
+			return err;
+
+		/* add weights for calculated routes to adjust the weights for the next batch */
+		update_weights(p_mgr, slot->adj_list, batch->adj_list_size);
+
+		if (OSM_LOG_IS_ACTIVE_V2(p_mgr->p_log, OSM_LOG_DEBUG))
+			dfsssp_print_graph(p_mgr, slot->adj_list,
+					   batch->adj_list_size);
+	}
+
+	return 0;
+}
+
+static int dfsssp_batch_add(dfsssp_batch_t * batch, osm_port_t * port,
+			    uint16_t lid)
+{
+	dfsssp_dest_t *dests = NULL;
+
+	if (batch->num_dests == batch->max_dests) {
+		dests = (dfsssp_dest_t *) realloc(batch->dests,
+						  2 * batch->max_dests *
+						  sizeof(dfsssp_dest_t));
+		if (!dests) {
+			OSM_LOG(batch->p_mgr->p_log, OSM_LOG_ERROR,
+				"ERR AD55: cannot allocate memory for the "
+				"dijkstra destinations\n");
+			return 1;
+		}
+		batch->dests = dests;
+		batch->max_dests *= 2;
+	}
+	batch->dests[batch->num_dests].port = port;
+	batch->dests[batch->num_dests++].lid = lid;
+	return 0;
+}
+
+/* route the queued destinations; consecutive destinations are mostly
+   attached to the same switch and would all choose the same paths on the
+   same weights, so batch b takes every n-th destination starting at b
+   (with one slot, this is the order of the port_order_list)
+*/
+static int dfsssp_batch_flush(dfsssp_batch_t * batch)
+{
+	uint32_t num_batches = 0, b = 0, i = 0, num_used = 0;
+	int err = 0;
+
+	num_batches = (batch->num_dests + batch->num_slots - 1) /
+	    batch->num_slots;
+	for (b = 0; b < num_batches; b++) {
+		num_used = 0;
+		for (i = b; i < batch->num_dests; i += num_batches) {
+			batch->slots[num_used].port = batch->dests[i].port;
+			batch->slots[num_used++].lid = batch->dests[i].lid;
+		}
+		err = dfsssp_batch_route(batch, num_used);
+		if (err)
+			break;
+	}
+	batch->num_dests = 0;
+
+	return err;
+}
+
 /* meta function which calls subfunctions for dijkstra, update lft and weights,
    (and remove deadlocks) to calculate the routing for the subnet
 */
@@ -2177,7 +2216,8 @@ static int dfsssp_do_dijkstra_routing(void *context)
 	osm_ucast_mgr_t *p_mgr = (osm_ucast_mgr_t *) dfsssp_ctx->p_mgr;
 	vertex_t *adj_list = (vertex_t *) dfsssp_ctx->adj_list;
 	uint32_t adj_list_size = dfsssp_ctx->adj_list_size;
-	cl_heap_t heap;
+	dfsssp_batch_t batch;
+	uint32_t group_end[3], num_groups = 0, group = 0, pos = 0;
 
 	vertex_t **sw_list = NULL;
 	uint32_t sw_list_size = 0;
@@ -2222,8 +2262,8 @@ static int dfsssp_do_dijkstra_routing(void *context)
 		}
 	}
 
-	/* construct the generic heap opject to use it in dijkstra */
-	cl_heap_construct(&heap);
+	/* per thread heaps and per destination vertex copies for dijkstra */
+	memset(&batch, 0, sizeof(batch));
 
 	/* we need an intermediate array of pointers to switches in adj_list;
 	   this array will be sorted in respect to num_hca (descending)
@@ -2301,6 +2341,8 @@ static int dfsssp_do_dijkstra_routing(void *context)
 				goto ERROR;
 			}
 		}
+		group_end[num_groups++] =
+		    cl_qlist_count(&p_mgr->port_order_list);
 	}
 	/* then: add Tca ports to ensure good Hca->Tca balancing and separate
 	   paths towards I/O nodes on the same switch (if possible)
@@ -2317,6 +2359,8 @@ static int dfsssp_do_dijkstra_routing(void *context)
 				goto ERROR;
 			}
 		}
+		group_end[num_groups++] =
+		    cl_qlist_count(&p_mgr->port_order_list);
 	}
 	/* then: add anything else, such as administration nodes, ... */
 	if (cn_nodes_provided && io_nodes_provided) {
@@ -2335,6 +2379,7 @@ static int dfsssp_do_dijkstra_routing(void *context)
 			goto ERROR;
 		}
 	}
+	group_end[num_groups++] = cl_qlist_count(&p_mgr->port_order_list);
 	/* last: add SP0 afterwards which have lower priority for balancing */
 	for (i = 0; i < sw_list_size; i++) {
 		if (sw_list[i] && sw_list[i]->sw) {
@@ -2357,15 +2402,32 @@ static int dfsssp_do_dijkstra_routing(void *context)
 	destroy_guid_map(&io_tbl);
 	io_nodes_provided = FALSE;
 
+	if (dfsssp_batch_init(&batch, p_mgr, adj_list, adj_list_size))
+		goto ERROR;
+	OSM_LOG(p_mgr->p_log, OSM_LOG_VERBOSE,
+		"Routing batches of %" PRIu32 " destinations on %" PRIu32
+		" threads\n", batch.num_slots, batch.num_workers);
+
+	/* the groups of the port_order_list are routed one after the other,
+	   so the batches do not mix their priorities for the balancing
+	 */
+
 	/* do the routing for the each Hca in the subnet and each switch
 	   in the subnet (to add the routes to base/enhanced SP0)
 	 */
 	qlist = &p_mgr->port_order_list;
 	for (qlist_item = cl_qlist_head(qlist);
 	     qlist_item != cl_qlist_end(qlist);
-	     qlist_item = cl_qlist_next(qlist_item)) {
+	     qlist_item = cl_qlist_next(qlist_item), pos++) {
 		port = (osm_port_t *)cl_item_obj(qlist_item, port, list_item);
 
+		if (group < num_groups && pos == group_end[group]) {
+			group++;
+			err = dfsssp_batch_flush(&batch);
+			if (err)
+				goto ERROR;
+		}
+
 		/* calculate shortest path with dijkstra from node to all switches/Hca */
 		if (osm_node_get_type(port->p_node) == IB_NODE_TYPE_CA) {
 			OSM_LOG(p_mgr->p_log, OSM_LOG_DEBUG,
@@ -2389,30 +2451,15 @@ static int dfsssp_do_dijkstra_routing(void *context)
 		osm_port_get_lid_range_ho(port, &min_lid_ho,
 					  &max_lid_ho);
 		for (lid = min_lid_ho; lid <= max_lid_ho; lid++) {
-			/* do dijkstra from this Hca/LID/SP0 to each switch */
-			err =
-			    dijkstra(p_mgr, &heap, adj_list, adj_list_size,
-				     port, lid);
-			if (err)
-				goto ERROR;
-			if (OSM_LOG_IS_ACTIVE_V2(p_mgr->p_log, OSM_LOG_DEBUG))
-				print_routes(p_mgr, adj_list, adj_list_size,
-					     port);
-
-			/* make an update for the linear forwarding tables of the switches */
-			err =
-			    update_lft(p_mgr, adj_list, adj_list_size, port, lid);
+			/* queue dijkstra from this Hca/LID/SP0 to each switch */
+			err = dfsssp_batch_add(&batch, port, lid);
 			if (err)
 				goto ERROR;
-
-			/* add weights for calculated routes to adjust the weights for the next cycle */
-			update_weights(p_mgr, adj_list, adj_list_size);
-
-			if (OSM_LOG_IS_ACTIVE_V2(p_mgr->p_log, OSM_LOG_DEBUG))
-				dfsssp_print_graph(p_mgr, adj_list,
-						   adj_list_size);
 		}
 	}
+	err = dfsssp_batch_flush(&batch);
+	if (err)
+		goto ERROR;
 
 	/* try deadlock removal only for the dfsssp routing (not for the sssp case, which is a subset of the dfsssp algorithm) */
 	if (dfsssp_ctx->routing_type == OSM_ROUTING_ENGINE_TYPE_DFSSSP) {
@@ -2432,8 +2479,8 @@ static int dfsssp_do_dijkstra_routing(void *context)
 	/* list not needed after the dijkstra steps and deadlock removal */
 	cl_qlist_remove_all(&p_mgr->port_order_list);
 
-	/* delete the heap which is not needed anymore */
-	cl_heap_destroy(&heap);
+	/* delete the heaps and vertex copies which are not needed anymore */
+	dfsssp_batch_destroy(&batch);
 
 	/* print the new_lft for each switch after routing is done */
 	if (OSM_LOG_IS_ACTIVE_V2(p_mgr->p_log, OSM_LOG_DEBUG)) {
@@ -2467,8 +2514,7 @@ ERROR:
 		destroy_guid_map(&io_tbl);
 	if (sw_list)
 		free(sw_list);
-	if (cl_is_heap_inited(&heap))
-		cl_heap_destroy(&heap);
+	dfsssp_batch_destroy(&batch);
 	return -1;
 }
 
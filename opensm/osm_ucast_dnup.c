@@ -74,11 +74,40 @@ typedef struct dnup {
 struct dnup_node {
 	cl_list_item_t list;
 	osm_switch_t *sw;
-	dnup_switch_dir_t dir;
 	unsigned rank;
-	unsigned visited;
+	unsigned index;
 };
 
+/* switch to switch links, grouped by the switch they leave (CSR layout) */
+typedef struct dnup_link {
+	uint32_t node;
+	uint8_t port_num;
+	uint8_t remote_port_num;
+} dnup_link_t;
+
+typedef struct dnup_graph {
+	unsigned num_nodes;
+	struct dnup_node **nodes;
+	uint32_t *link_start;
+	dnup_link_t *links;
+} dnup_graph_t;
+
+/* per thread BFS state */
+typedef struct dnup_bfs_scratch {
+	uint8_t *dir;
+	uint8_t *visited;
+	uint32_t *queue;
+	uint8_t max_hops;
+} dnup_bfs_scratch_t;
+
+typedef struct dnup_bfs_work {
+	osm_log_t *p_log;
+	const dnup_graph_t *g;
+	dnup_bfs_scratch_t *scratch;
+	uint8_t prune_weight;
+	boolean_t track_max_hops;
+} dnup_bfs_work_t;
+
 /* This function returns direction based on rank and guid info of current &
    remote ports */
 static dnup_switch_dir_t dnup_get_dir(unsigned cur_rank, unsigned rem_rank)
@@ -101,66 +130,64 @@ static dnup_switch_dir_t dnup_get_dir(unsigned cur_rank, unsigned rem_rank)
 /**********************************************************************
  * This function does the bfs of min hop table calculation by guid index
  * as a starting point.
+ * Only the LID matrix rows of the starting switch's LID are touched, so
+ * the BFS of different switches can run concurrently.
  **********************************************************************/
-static int dnup_bfs_by_node(IN osm_log_t * p_log, IN osm_subn_t * p_subn,
-			    IN osm_switch_t * p_sw, IN uint8_t prune_weight,
-			    OUT uint8_t * max_hops)
+static int dnup_bfs_by_node(IN osm_log_t * p_log, IN const dnup_graph_t * g,
+			    IN dnup_bfs_scratch_t * s, IN unsigned start,
+			    IN uint8_t prune_weight, OUT uint8_t * max_hops)
 {
-	uint8_t pn, pn_rem;
-	cl_qlist_t list;
+	uint8_t pn_rem;
 	uint16_t lid;
-	struct dnup_node *u;
+	struct dnup_node *u, *rem_u;
 	dnup_switch_dir_t next_dir, current_dir;
+	const dnup_link_t *l;
+	unsigned head = 0, tail, queued, i, j;
 
 	OSM_LOG_ENTER(p_log);
 
-	lid = osm_node_get_base_lid(p_sw->p_node, 0);
+	u = g->nodes[start];
+	lid = osm_node_get_base_lid(u->sw->p_node, 0);
 	lid = cl_ntoh16(lid);
-	osm_switch_set_hops(p_sw, lid, 0, 0);
+	osm_switch_set_hops(u->sw, lid, 0, 0);
 
 	OSM_LOG(p_log, OSM_LOG_DEBUG,
 		"Starting from switch - port GUID 0x%" PRIx64 " lid %u\n",
-		cl_ntoh64(p_sw->p_node->node_info.port_guid), lid);
-
-	u = p_sw->priv;
-	u->dir = DOWN;
-
-	/* Update list with the new element */
-	cl_qlist_init(&list);
-	cl_qlist_insert_tail(&list, &u->list);
-
-	/* BFS the list till no next element */
-	while (!cl_is_qlist_empty(&list)) {
-		u = (struct dnup_node *)cl_qlist_remove_head(&list);
-		u->visited = 0;	/* cleanup */
-		current_dir = u->dir;
-		/* Go over all ports of the switch and find unvisited remote nodes */
-		for (pn = 1; pn < u->sw->num_ports; pn++) {
-			osm_node_t *p_remote_node;
-			struct dnup_node *rem_u;
+		cl_ntoh64(u->sw->p_node->node_info.port_guid), lid);
+
+	s->dir[start] = DOWN;
+
+	/* Update queue with the new element; a switch is queued at most once */
+	s->queue[0] = start;
+	tail = g->num_nodes > 1 ? 1 : 0;
+	queued = 1;
+
+	/* BFS the queue till no next element */
+	while (queued) {
+		i = s->queue[head];
+		if (++head == g->num_nodes)
+			head = 0;
+		queued--;
+		u = g->nodes[i];
+		s->visited[i] = 0;	/* cleanup */
+		current_dir = s->dir[i];
+		/* Go over all the switch links and find unvisited remote nodes */
+		for (j = g->link_start[i]; j < g->link_start[i + 1]; j++) {
 			uint8_t current_min_hop, remote_min_hop,
 			    set_hop_return_value;
-			osm_switch_t *p_remote_sw;
 
-			p_remote_node =
-			    osm_node_get_remote_node(u->sw->p_node, pn,
-						     &pn_rem);
-			/* If no remote node OR remote node is not a SWITCH
-			   continue to next pn */
-			if (!p_remote_node || !p_remote_node->sw)
-				continue;
-			/* Fetch remote guid only after validation of remote node */
-			p_remote_sw = p_remote_node->sw;
-			rem_u = p_remote_sw->priv;
+			l = &g->links[j];
+			rem_u = g->nodes[l->node];
+			pn_rem = l->remote_port_num;
 			/* Decide which direction to mark it (UP/DOWN) */
 			next_dir = dnup_get_dir(u->rank, rem_u->rank);
 
 			/* Set MinHop value for the current lid */
 			current_min_hop = osm_switch_get_least_hops(u->sw, lid);
-			/* Check hop count if better insert into list && update
+			/* Check hop count if better insert into queue && update
 			   the remote node Min Hop Table */
 			remote_min_hop =
-			    osm_switch_get_hop_count(p_remote_sw, lid, pn_rem);
+			    osm_switch_get_hop_count(rem_u->sw, lid, pn_rem);
 
 			/* Check if this is a legal step : the only illegal step is going
 			   from UP to DOWN */
@@ -169,7 +196,7 @@ static int dnup_bfs_by_node(IN osm_log_t * p_log, IN osm_subn_t * p_subn,
 					"Avoiding move from 0x%016" PRIx64
 					" to 0x%016" PRIx64 "\n",
 					cl_ntoh64(osm_node_get_node_guid(u->sw->p_node)),
-					cl_ntoh64(osm_node_get_node_guid(p_remote_node)));
+					cl_ntoh64(osm_node_get_node_guid(rem_u->sw->p_node)));
 				/* Illegal step. If prune_weight is set, allow it with an
 				 * additional weight
 				 */
@@ -179,7 +206,7 @@ static int dnup_bfs_by_node(IN osm_log_t * p_log, IN osm_subn_t * p_subn,
 						OSM_LOG(p_log, OSM_LOG_ERROR,
 							"ERR AE02: Too many hops on subnet,"
 							" can't relax illegal Dn/Up transition.");
-						osm_switch_set_hops(p_remote_sw, lid,
+						osm_switch_set_hops(rem_u->sw, lid,
 								    pn_rem, OSM_NO_PATH);
 					}
 				} else {
@@ -188,7 +215,7 @@ static int dnup_bfs_by_node(IN osm_log_t * p_log, IN osm_subn_t * p_subn,
 			}
 			if (current_min_hop + 1 < remote_min_hop) {
 				set_hop_return_value =
-				    osm_switch_set_hops(p_remote_sw, lid,
+				    osm_switch_set_hops(rem_u->sw, lid,
 							pn_rem,
 							current_min_hop + 1);
 				if(max_hops && current_min_hop + 1 > *max_hops) {
@@ -200,12 +227,14 @@ static int dnup_bfs_by_node(IN osm_log_t * p_log, IN osm_subn_t * p_subn,
 						set_hop_return_value);
 				}
 				/* Check if remote port has already been visited */
-				if (!rem_u->visited) {
-					/* Insert dnup_switch item into the list */
-					rem_u->dir = next_dir;
-					rem_u->visited = 1;
-					cl_qlist_insert_tail(&list,
-							     &rem_u->list);
+				if (!s->visited[l->node]) {
+					/* Insert dnup_switch item into the queue */
+					s->dir[l->node] = next_dir;
+					s->visited[l->node] = 1;
+					s->queue[tail] = l->node;
+					if (++tail == g->num_nodes)
+						tail = 0;
+					queued++;
 				}
 			}
 		}
@@ -215,6 +244,87 @@ static int dnup_bfs_by_node(IN osm_log_t * p_log, IN osm_subn_t * p_subn,
 	return 0;
 }
 
+static void dnup_bfs_work(IN void *context, IN unsigned item,
+			  IN unsigned worker)
+{
+	dnup_bfs_work_t *work = context;
+	dnup_bfs_scratch_t *s = &work->scratch[worker];
+
+	dnup_bfs_by_node(work->p_log, work->g, s, item, work->prune_weight,
+			 work->track_max_hops ? &s->max_hops : NULL);
+}
+
+static void dnup_graph_free(IN dnup_graph_t * g)
+{
+	free(g->nodes);
+	free(g->link_start);
+	free(g->links);
+	memset(g, 0, sizeof(*g));
+}
+
+/* Build the compact switch adjacency the min hop BFS runs on */
+static int dnup_graph_build(IN dnup_t * p_dnup, OUT dnup_graph_t * g)
+{
+	cl_qmap_t *p_sw_tbl = &p_dnup->p_osm->subn.sw_guid_tbl;
+	cl_map_item_t *item;
+	osm_node_t *p_remote_node;
+	struct dnup_node *u;
+	unsigned i, num_links = 0;
+	uint8_t pn, pn_rem;
+
+	memset(g, 0, sizeof(*g));
+	g->num_nodes = cl_qmap_count(p_sw_tbl);
+	if (!g->num_nodes)
+		return 0;
+
+	g->nodes = malloc(g->num_nodes * sizeof(g->nodes[0]));
+	g->link_start = malloc((g->num_nodes + 1) * sizeof(g->link_start[0]));
+	if (!g->nodes || !g->link_start)
+		goto Error;
+
+	for (i = 0, item = cl_qmap_head(p_sw_tbl); item != cl_qmap_end(p_sw_tbl);
+	     item = cl_qmap_next(item), i++) {
+		u = ((osm_switch_t *) item)->priv;
+		u->index = i;
+		g->nodes[i] = u;
+		for (pn = 1; pn < u->sw->num_ports; pn++) {
+			p_remote_node =
+			    osm_node_get_remote_node(u->sw->p_node, pn, &pn_rem);
+			if (p_remote_node && p_remote_node->sw)
+				num_links++;
+		}
+	}
+
+	g->links = malloc((num_links ? num_links : 1) * sizeof(g->links[0]));
+	if (!g->links)
+		goto Error;
+
+	num_links = 0;
+	for (i = 0; i < g->num_nodes; i++) {
+		u = g->nodes[i];
+		g->link_start[i] = num_links;
+		for (pn = 1; pn < u->sw->num_ports; pn++) {
+			p_remote_node =
+			    osm_node_get_remote_node(u->sw->p_node, pn, &pn_rem);
+			/* If no remote node OR remote node is not a SWITCH
+			   continue to next pn */
+			if (!p_remote_node || !p_remote_node->sw)
+				continue;
+			g->links[num_links].node =
+			    ((struct dnup_node *)p_remote_node->sw->priv)->index;
+			g->links[num_links].port_num = pn;
+			g->links[num_links].remote_port_num = pn_rem;
+			num_links++;
+		}
+	}
+	g->link_start[g->num_nodes] = num_links;
+	return 0;
+
+Error:
+	dnup_graph_free(g);
+	return -1;
+}
+
 /* NOTE : PLS check if we need to decide that the first */
 /*        rank is a SWITCH for BFS purpose */
 static int dnup_subn_rank(IN dnup_t * p_dnup)
@@ -296,10 +406,15 @@ static int dnup_set_min_hop_table(IN dnup_t * p_dnup)
 {
 	osm_subn_t *p_subn = &p_dnup->p_osm->subn;
 	osm_log_t *p_log = &p_dnup->p_osm->log;
+	osm_ucast_mgr_t *p_mgr = &p_dnup->p_osm->sm.ucast_mgr;
 	osm_switch_t *p_sw;
-	struct dnup_node *u;
 	cl_map_item_t *item;
 	uint8_t max_hops = 0;
+	dnup_graph_t g;
+	dnup_bfs_work_t work;
+	dnup_bfs_scratch_t *scratch = NULL;
+	unsigned i, num_workers;
+	int ret = -1;
 
 	OSM_LOG_ENTER(p_log);
 
@@ -319,16 +434,56 @@ static int dnup_set_min_hop_table(IN dnup_t * p_dnup)
 	OSM_LOG(p_log, OSM_LOG_VERBOSE,
 		"Init Min Hop Table of all switches ]\n");
 
+	if (dnup_graph_build(p_dnup, &g)) {
+		OSM_LOG(p_log, OSM_LOG_ERROR, "ERR AE03: "
+			"cannot allocate the switch graph\n");
+		goto _exit;
+	}
+
+	if (!g.num_nodes) {
+		/* no switches, nothing to route */
+		ret = 0;
+		goto _free;
+	}
+
+	num_workers = osm_ucast_mgr_num_workers(p_mgr);
+	if (num_workers > 1 && p_subn->opt.packed_lid_matrix) {
+		/* widening a packed matrix reallocates every row */
+		OSM_LOG(p_log, OSM_LOG_VERBOSE,
+			"Packed LID matrices in use, "
+			"running the DNUP BFS on a single thread\n");
+		num_workers = 1;
+	}
+	if (num_workers > g.num_nodes)
+		num_workers = g.num_nodes;
+
+	scratch = calloc(num_workers, sizeof(*scratch));
+	if (!scratch)
+		goto _no_mem;
+	for (i = 0; i < num_workers; i++) {
+		scratch[i].dir = malloc(g.num_nodes);
+		scratch[i].visited = calloc(g.num_nodes, 1);
+		scratch[i].queue = malloc(g.num_nodes *
+					  sizeof(scratch[i].queue[0]));
+		if (!scratch[i].dir || !scratch[i].visited || !scratch[i].queue)
+			goto _no_mem;
+	}
+
 	/* Now do the BFS for each port  in the subnet */
 	OSM_LOG(p_log, OSM_LOG_VERBOSE,
 		"BFS through all port guids in the subnet [\n");
 
-	for (item = cl_qmap_head(&p_dnup->p_osm->subn.sw_guid_tbl);
-	     item != cl_qmap_end(&p_dnup->p_osm->subn.sw_guid_tbl);
-	     item = cl_qmap_next(item)) {
-		p_sw = (osm_switch_t *)item;
-		dnup_bfs_by_node(p_log, p_subn, p_sw, 0, &max_hops);
-	}
+	work.p_log = p_log;
+	work.g = &g;
+	work.scratch = scratch;
+	work.prune_weight = 0;
+	work.track_max_hops = TRUE;
+	osm_ucast_mgr_parallel_for(p_mgr, g.num_nodes, num_workers,
+				   dnup_bfs_work, &work);
+	for (i = 0; i < num_workers; i++)
+		if (scratch[i].max_hops > max_hops)
+			max_hops = scratch[i].max_hops;
+
 	if(p_subn->opt.connect_roots) {
 		/*This is probably not necessary, by I am more comfortable
 		 * clearing any possible side effects from the previous
@@ -339,22 +494,34 @@ static int dnup_set_min_hop_table(IN dnup_t * p_dnup)
 		     item = cl_qmap_next(item)) {
 			p_sw = (osm_switch_t *)item;
 			osm_switch_clear_hops(p_sw);
-			u = (struct dnup_node *) p_sw->priv;
-			u->visited = 0;
-		}
-		for (item = cl_qmap_head(&p_dnup->p_osm->subn.sw_guid_tbl);
-		     item != cl_qmap_end(&p_dnup->p_osm->subn.sw_guid_tbl);
-		     item = cl_qmap_next(item)) {
-			p_sw = (osm_switch_t *)item;
-			dnup_bfs_by_node(p_log, p_subn, p_sw, max_hops + 1, NULL);
 		}
+		work.prune_weight = max_hops + 1;
+		work.track_max_hops = FALSE;
+		osm_ucast_mgr_parallel_for(p_mgr, g.num_nodes, num_workers,
+					   dnup_bfs_work, &work);
 	}
 
 	OSM_LOG(p_log, OSM_LOG_VERBOSE,
 		"BFS through all port guids in the subnet ]\n");
+	ret = 0;
+	goto _free;
+
+_no_mem:
+	OSM_LOG(p_log, OSM_LOG_ERROR, "ERR AE04: "
+		"cannot allocate the BFS state of %u threads\n", num_workers);
+_free:
 	/* Cleanup */
+	if (scratch)
+		for (i = 0; i < num_workers; i++) {
+			free(scratch[i].dir);
+			free(scratch[i].visited);
+			free(scratch[i].queue);
+		}
+	free(scratch);
+	dnup_graph_free(&g);
+_exit:
 	OSM_LOG_EXIT(p_log);
-	return 0;
+	return ret;
 }
 
 static int dnup_build_lid_matrices(IN dnup_t * p_dnup)
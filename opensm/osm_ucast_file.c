@@ -45,6 +45,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <iba/ib_types.h>
 #include <complib/cl_qmap.h>
@@ -54,6 +59,7 @@
 #include <opensm/osm_opensm.h>
 #include <opensm/osm_switch.h>
 #include <opensm/osm_log.h>
+#include <opensm/osm_crc32.h>
 
 static uint16_t remap_lid(osm_opensm_t * p_osm, uint16_t lid, ib_net64_t guid)
 {
@@ -77,14 +83,20 @@ static uint16_t remap_lid(osm_opensm_t * p_osm, uint16_t lid, ib_net64_t guid)
 	return min_lid + (lid & ((1 << lmc) - 1));
 }
 
-static void add_path(osm_opensm_t * p_osm,
-		     osm_switch_t * p_sw, uint16_t lid, uint8_t port_num,
+static void set_path(osm_opensm_t * p_osm, osm_switch_t * p_sw,
+		     uint16_t new_lid, uint16_t lid, uint8_t port_num,
 		     ib_net64_t port_guid)
 {
-	uint16_t new_lid;
 	uint8_t old_port;
 
-	new_lid = port_guid ? remap_lid(p_osm, lid, port_guid) : lid;
+	if (new_lid >= p_sw->lft_size) {
+		OSM_LOG(&p_osm->log, OSM_LOG_VERBOSE,
+			"LID %u is out of the LFT range of switch 0x%016"
+			PRIx64 ", skipping\n", new_lid,
+			cl_ntoh64(osm_node_get_node_guid(p_sw->p_node)));
+		return;
+	}
+
 	old_port = osm_switch_get_port_by_lid(p_sw, new_lid, OSM_LFT);
 	if (old_port != OSM_NO_PATH && old_port != port_num) {
 		OSM_LOG(&p_osm->log, OSM_LOG_VERBOSE,
@@ -106,6 +118,16 @@ static void add_path(osm_opensm_t * p_osm,
 		cl_ntoh64(osm_node_get_node_guid(p_sw->p_node)));
 }
 
+static void add_path(osm_opensm_t * p_osm,
+		     osm_switch_t * p_sw, uint16_t lid, uint8_t port_num,
+		     ib_net64_t port_guid)
+{
+	uint16_t new_lid;
+
+	new_lid = port_guid ? remap_lid(p_osm, lid, port_guid) : lid;
+	set_path(p_osm, p_sw, new_lid, lid, port_num, port_guid);
+}
+
 static void add_lid_hops(osm_opensm_t * p_osm, osm_switch_t * p_sw,
 			 uint16_t lid, ib_net64_t guid,
 			 uint8_t hops[], unsigned len)
@@ -119,11 +141,482 @@ static void add_lid_hops(osm_opensm_t * p_osm, osm_switch_t * p_sw,
 		osm_switch_set_hops(p_sw, lid, i, hops[i]);
 }
 
+/*
+ * Binary routing file (opensm-routing.bin)
+ *
+ * All fields are in network byte order and every block starts on an
+ * 8 byte boundary, so the file can be mapped and used in place:
+ *
+ *	header
+ *	port guid of every lid		ib_net64_t[max_lid + 1]
+ *	switch table			routing_bin_sw_t[num_switches]
+ *	per switch: LFT			uint8_t[sw max_lid + 1]
+ *	per switch: hop lids		ib_net16_t[num_hop_lids]
+ *	per switch: hop rows		uint8_t[num_hop_lids][num_ports]
+ *
+ * Only the lids with a path from the switch get a hop row, the same
+ * as in the text lid matrix dump. The CRC covers everything after
+ * the header.
+ */
+#define ROUTING_BIN_MAGIC	"OSMROUTE"
+#define ROUTING_BIN_VERSION	1
+#define ROUTING_BIN_ALIGN(x)	(((x) + 7) & ~(uint64_t) 7)
+
+typedef struct routing_bin_hdr {
+	char magic[8];
+	ib_net32_t version;
+	ib_net32_t hdr_size;
+	ib_net32_t num_switches;
+	ib_net32_t max_lid;
+	ib_net64_t file_size;
+	ib_net32_t crc32;
+	ib_net32_t reserved;
+} routing_bin_hdr_t;
+
+typedef struct routing_bin_sw {
+	ib_net64_t guid;
+	ib_net64_t lft_offset;
+	ib_net64_t hops_offset;
+	ib_net32_t num_hop_lids;
+	ib_net16_t max_lid;
+	uint8_t num_ports;
+	uint8_t reserved;
+} routing_bin_sw_t;
+
+typedef struct routing_bin {
+	const uint8_t *base;
+	size_t size;
+	unsigned max_lid;
+	unsigned num_switches;
+	const ib_net64_t *guids;
+	const routing_bin_sw_t *sws;
+} routing_bin_t;
+
+struct routing_bin_writer {
+	FILE *file;
+	uint64_t offset;
+	uint32_t crc;
+};
+
+static int routing_bin_write(struct routing_bin_writer *w, const void *buf,
+			     size_t len)
+{
+	if (len && fwrite(buf, len, 1, w->file) != 1)
+		return -1;
+	w->crc = osm_crc32(w->crc, buf, len);
+	w->offset += len;
+	return 0;
+}
+
+static int routing_bin_pad(struct routing_bin_writer *w)
+{
+	static const uint8_t zero[8];
+
+	return routing_bin_write(w, zero, ROUTING_BIN_ALIGN(w->offset) -
+				 w->offset);
+}
+
+static unsigned routing_bin_num_hop_lids(osm_switch_t * p_sw)
+{
+	unsigned lid, n = 0;
+
+	for (lid = 1; lid <= p_sw->max_lid_ho; lid++)
+		if (osm_switch_get_least_hops(p_sw, lid) != OSM_NO_PATH)
+			n++;
+	return n;
+}
+
+static int routing_bin_write_sw(struct routing_bin_writer *w,
+				osm_switch_t * p_sw, uint8_t * row)
+{
+	unsigned lid, max_lid = p_sw->max_lid_ho;
+	uint8_t port;
+	ib_net16_t lid_be;
+
+	for (lid = 0; lid <= max_lid; lid++) {
+		port = osm_switch_get_port_by_lid(p_sw, lid, OSM_NEW_LFT);
+		row[lid] = port < p_sw->num_ports ? port : OSM_NO_PATH;
+	}
+	if (routing_bin_write(w, row, max_lid + 1) || routing_bin_pad(w))
+		return -1;
+
+	for (lid = 1; lid <= max_lid; lid++) {
+		if (osm_switch_get_least_hops(p_sw, lid) == OSM_NO_PATH)
+			continue;
+		lid_be = cl_hton16((uint16_t) lid);
+		if (routing_bin_write(w, &lid_be, sizeof(lid_be)))
+			return -1;
+	}
+	if (routing_bin_pad(w))
+		return -1;
+
+	for (lid = 1; lid <= max_lid; lid++) {
+		if (osm_switch_get_least_hops(p_sw, lid) == OSM_NO_PATH)
+			continue;
+		for (port = 0; port < p_sw->num_ports; port++)
+			row[port] = osm_switch_get_hop_count(p_sw, lid, port);
+		if (routing_bin_write(w, row, p_sw->num_ports))
+			return -1;
+	}
+	return routing_bin_pad(w);
+}
+
+int osm_ucast_file_dump_bin(osm_opensm_t * p_osm, const char *file_name)
+{
+	char path[1024];
+	char path_tmp[1032];
+	struct routing_bin_writer w;
+	routing_bin_hdr_t hdr;
+	routing_bin_sw_t *sws = NULL;
+	cl_qmap_t *p_sw_tbl = &p_osm->subn.sw_guid_tbl;
+	cl_map_item_t *item;
+	osm_switch_t *p_sw;
+	osm_port_t *p_port;
+	ib_net64_t guid;
+	uint8_t *row = NULL;
+	unsigned num_switches, max_lid, lid, n, i;
+	uint64_t offset;
+	int fd, status = -1;
+
+	snprintf(path, sizeof(path), "%s/%s",
+		 p_osm->subn.opt.dump_files_dir, file_name);
+	snprintf(path_tmp, sizeof(path_tmp), "%s.tmp", path);
+
+	num_switches = cl_qmap_count(p_sw_tbl);
+	max_lid = p_osm->subn.max_ucast_lid_ho;
+	for (item = cl_qmap_head(p_sw_tbl); item != cl_qmap_end(p_sw_tbl);
+	     item = cl_qmap_next(item)) {
+		p_sw = (osm_switch_t *) item;
+		if (p_sw->max_lid_ho > max_lid)
+			max_lid = p_sw->max_lid_ho;
+	}
+
+	sws = calloc(num_switches ? num_switches : 1, sizeof(*sws));
+	row = malloc(max_lid + 1 > 256 ? max_lid + 1 : 256);
+	if (!sws || !row) {
+		OSM_LOG(&p_osm->log, OSM_LOG_ERROR, "ERR 6306: "
+			"cannot allocate memory for routing binary dump\n");
+		goto Exit;
+	}
+
+	/* lay the file out first, so the switch table can be streamed */
+	offset = ROUTING_BIN_ALIGN(sizeof(hdr));
+	offset = ROUTING_BIN_ALIGN(offset + (max_lid + 1) * sizeof(guid));
+	offset = ROUTING_BIN_ALIGN(offset + num_switches * sizeof(*sws));
+	for (item = cl_qmap_head(p_sw_tbl), i = 0;
+	     item != cl_qmap_end(p_sw_tbl); item = cl_qmap_next(item), i++) {
+		p_sw = (osm_switch_t *) item;
+		n = routing_bin_num_hop_lids(p_sw);
+		sws[i].guid = osm_node_get_node_guid(p_sw->p_node);
+		sws[i].max_lid = cl_hton16(p_sw->max_lid_ho);
+		sws[i].num_ports = p_sw->num_ports;
+		sws[i].num_hop_lids = cl_hton32(n);
+		sws[i].lft_offset = cl_hton64(offset);
+		offset = ROUTING_BIN_ALIGN(offset + p_sw->max_lid_ho + 1);
+		sws[i].hops_offset = cl_hton64(offset);
+		offset = ROUTING_BIN_ALIGN(offset + n * sizeof(ib_net16_t));
+		offset = ROUTING_BIN_ALIGN(offset + n * p_sw->num_ports);
+	}
+
+	w.file = fopen(path_tmp, "w");
+	if (!w.file) {
+		OSM_LOG(&p_osm->log, OSM_LOG_ERROR, "ERR 6307: "
+			"cannot open file \'%s\': %s\n",
+			path_tmp, strerror(errno));
+		goto Exit;
+	}
+	w.offset = 0;
+	w.crc = 0;
+
+	/* the header is rewritten once the CRC is known */
+	memset(&hdr, 0, sizeof(hdr));
+	if (routing_bin_write(&w, &hdr, sizeof(hdr)) || routing_bin_pad(&w))
+		goto Write_error;
+	w.crc = 0;
+
+	for (lid = 0; lid <= max_lid; lid++) {
+		p_port = osm_get_port_by_lid_ho(&p_osm->subn, lid);
+		guid = p_port ? osm_port_get_guid(p_port) : 0;
+		if (routing_bin_write(&w, &guid, sizeof(guid)))
+			goto Write_error;
+	}
+	if (routing_bin_pad(&w) ||
+	    routing_bin_write(&w, sws, num_switches * sizeof(*sws)) ||
+	    routing_bin_pad(&w))
+		goto Write_error;
+
+	for (item = cl_qmap_head(p_sw_tbl), i = 0;
+	     item != cl_qmap_end(p_sw_tbl); item = cl_qmap_next(item), i++) {
+		CL_ASSERT(w.offset == cl_ntoh64(sws[i].lft_offset));
+		if (routing_bin_write_sw(&w, (osm_switch_t *) item, row))
+			goto Write_error;
+	}
+	CL_ASSERT(w.offset == offset);
+
+	memcpy(hdr.magic, ROUTING_BIN_MAGIC, sizeof(hdr.magic));
+	hdr.version = cl_hton32(ROUTING_BIN_VERSION);
+	hdr.hdr_size = cl_hton32(sizeof(hdr));
+	hdr.num_switches = cl_hton32(num_switches);
+	hdr.max_lid = cl_hton32(max_lid);
+	hdr.file_size = cl_hton64(w.offset);
+	hdr.crc32 = cl_hton32(w.crc);
+	if (fseek(w.file, 0, SEEK_SET) ||
+	    fwrite(&hdr, sizeof(hdr), 1, w.file) != 1)
+		goto Write_error;
+
+	if (p_osm->subn.opt.fsync_high_avail_files) {
+		if (fflush(w.file) == 0) {
+			fd = fileno(w.file);
+			if (fd != -1 && fsync(fd) == -1)
+				OSM_LOG(&p_osm->log, OSM_LOG_ERROR,
+					"ERR 6308: fsync() failed (%s) for %s\n",
+					strerror(errno), path_tmp);
+		}
+	}
+
+	if (fclose(w.file)) {
+		w.file = NULL;
+		goto Write_error;
+	}
+	w.file = NULL;
+
+	status = rename(path_tmp, path);
+	if (status)
+		OSM_LOG(&p_osm->log, OSM_LOG_ERROR, "ERR 6309: "
+			"Failed to rename file:%s (err:%s)\n",
+			path_tmp, strerror(errno));
+	goto Exit;
+
+Write_error:
+	OSM_LOG(&p_osm->log, OSM_LOG_ERROR, "ERR 630A: "
+		"cannot write file \'%s\': %s\n", path_tmp, strerror(errno));
+	if (w.file)
+		fclose(w.file);
+	unlink(path_tmp);
+Exit:
+	free(row);
+	free(sws);
+	return status;
+}
+
+/*
+ * Maps file_name and validates it as a binary routing file.
+ * Returns 1 when the file is not a binary routing file, so the caller
+ * can fall back to the text parser.
+ */
+static int routing_bin_map(osm_opensm_t * p_osm, const char *file_name,
+			   routing_bin_t * bin)
+{
+	const routing_bin_hdr_t *hdr;
+	struct stat st;
+	uint64_t guids_offset, sws_offset;
+	uint32_t crc;
+	void *base;
+	int fd;
+
+	fd = open(file_name, O_RDONLY);
+	if (fd < 0)
+		return 1;
+	if (fstat(fd, &st) || (size_t) st.st_size < sizeof(*hdr)) {
+		close(fd);
+		return 1;
+	}
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED)
+		return 1;
+
+	hdr = base;
+	if (memcmp(hdr->magic, ROUTING_BIN_MAGIC, sizeof(hdr->magic))) {
+		munmap(base, st.st_size);
+		return 1;
+	}
+
+	bin->base = base;
+	bin->size = st.st_size;
+	bin->max_lid = cl_ntoh32(hdr->max_lid);
+	bin->num_switches = cl_ntoh32(hdr->num_switches);
+	guids_offset = ROUTING_BIN_ALIGN(sizeof(*hdr));
+	sws_offset = ROUTING_BIN_ALIGN(guids_offset +
+				       ((uint64_t) bin->max_lid + 1) *
+				       sizeof(ib_net64_t));
+	bin->guids = (const ib_net64_t *)(bin->base + guids_offset);
+	bin->sws = (const routing_bin_sw_t *)(bin->base + sws_offset);
+
+	if (cl_ntoh32(hdr->version) != ROUTING_BIN_VERSION ||
+	    cl_ntoh32(hdr->hdr_size) != sizeof(*hdr) ||
+	    cl_ntoh64(hdr->file_size) != bin->size ||
+	    bin->max_lid > IB_LID_UCAST_END_HO ||
+	    sws_offset + (uint64_t) bin->num_switches *
+	    sizeof(routing_bin_sw_t) > bin->size) {
+		OSM_LOG(&p_osm->log, OSM_LOG_ERROR, "ERR 630B: "
+			"unsupported or truncated routing file \'%s\'\n",
+			file_name);
+		goto Error;
+	}
+
+	crc = osm_crc32(0, bin->base + guids_offset,
+				bin->size - guids_offset);
+	if (crc != cl_ntoh32(hdr->crc32)) {
+		OSM_LOG(&p_osm->log, OSM_LOG_ERROR, "ERR 630C: "
+			"CRC mismatch in routing file \'%s\'\n", file_name);
+		goto Error;
+	}
+	return 0;
+
+Error:
+	munmap((void *)bin->base, bin->size);
+	return -1;
+}
+
+static void routing_bin_unmap(routing_bin_t * bin)
+{
+	munmap((void *)bin->base, bin->size);
+}
+
+/* Checks that the blocks of a switch table entry lie within the file */
+static int routing_bin_sw_valid(const routing_bin_t * bin,
+				const routing_bin_sw_t * e)
+{
+	uint64_t lft_offset = cl_ntoh64(e->lft_offset);
+	uint64_t hops_offset = cl_ntoh64(e->hops_offset);
+	uint64_t n = cl_ntoh32(e->num_hop_lids);
+	unsigned max_lid = cl_ntoh16(e->max_lid);
+	uint64_t hops_size = ROUTING_BIN_ALIGN(n * sizeof(ib_net16_t)) +
+	    n * e->num_ports;
+
+	/*
+	 * The offsets come from the file and may be anything, so compare
+	 * each block with the room left after its offset rather than adding
+	 * the two, which could wrap.  hops_size cannot wrap, n is 32 bits.
+	 */
+	return max_lid <= bin->max_lid && !(lft_offset & 7) &&
+	    !(hops_offset & 7) && lft_offset <= bin->size &&
+	    max_lid + 1 <= bin->size - lft_offset &&
+	    hops_offset <= bin->size && hops_size <= bin->size - hops_offset;
+}
+
+static int ucast_bin_load(osm_opensm_t * p_osm, const char *file_name,
+			  const routing_bin_t * bin)
+{
+	const routing_bin_sw_t *e;
+	const uint8_t *lft;
+	osm_switch_t *p_sw;
+	uint16_t *new_lids;
+	unsigned i, lid, max_lid, num_physp;
+
+	/*
+	 * Check the whole file before touching any switch, so a bad entry
+	 * leaves all LFTs as they were.
+	 */
+	for (i = 0; i < bin->num_switches; i++)
+		if (!routing_bin_sw_valid(bin, &bin->sws[i])) {
+			OSM_LOG(&p_osm->log, OSM_LOG_ERROR, "ERR 630E: "
+				"%s: bad switch entry %u\n", file_name, i);
+			return -1;
+		}
+
+	for (i = 0; i < bin->num_switches; i++) {
+		e = &bin->sws[i];
+		p_sw = osm_get_switch_by_guid(&p_osm->subn, e->guid);
+		if (!p_sw)
+			continue;
+
+		num_physp = osm_node_get_num_physp(p_sw->p_node);
+		lft = bin->base + cl_ntoh64(e->lft_offset);
+		max_lid = cl_ntoh16(e->max_lid);
+		for (lid = 0; lid <= max_lid; lid++)
+			if (lft[lid] != OSM_NO_PATH && lft[lid] >= num_physp) {
+				OSM_LOG(&p_osm->log, OSM_LOG_ERROR, "ERR 6310: "
+					"%s: invalid port %u for lid %u "
+					"on switch %016" PRIx64 "\n",
+					file_name, lft[lid], lid,
+					cl_ntoh64(e->guid));
+				return -1;
+			}
+	}
+
+	/* remap every lid once instead of once per switch */
+	new_lids = malloc((bin->max_lid + 1) * sizeof(*new_lids));
+	if (!new_lids) {
+		OSM_LOG(&p_osm->log, OSM_LOG_ERROR, "ERR 630D: "
+			"cannot allocate memory for lid remap table\n");
+		return -1;
+	}
+	for (lid = 0; lid <= bin->max_lid; lid++)
+		new_lids[lid] = bin->guids[lid] ?
+		    remap_lid(p_osm, lid, bin->guids[lid]) : lid;
+
+	for (i = 0; i < bin->num_switches; i++) {
+		e = &bin->sws[i];
+		p_sw = osm_get_switch_by_guid(&p_osm->subn, e->guid);
+		if (!p_sw) {
+			OSM_LOG(&p_osm->log, OSM_LOG_VERBOSE,
+				"cannot find switch %016" PRIx64 "\n",
+				cl_ntoh64(e->guid));
+			continue;
+		}
+		memset(p_sw->new_lft, OSM_NO_PATH, p_sw->lft_size);
+
+		lft = bin->base + cl_ntoh64(e->lft_offset);
+		max_lid = cl_ntoh16(e->max_lid);
+		for (lid = 0; lid <= max_lid; lid++)
+			if (lft[lid] != OSM_NO_PATH)
+				set_path(p_osm, p_sw, new_lids[lid], lid,
+					 lft[lid], bin->guids[lid]);
+	}
+
+	free(new_lids);
+	return 0;
+}
+
+static int lid_matrix_bin_load(osm_opensm_t * p_osm, const char *file_name,
+			       const routing_bin_t * bin)
+{
+	const routing_bin_sw_t *e;
+	const ib_net16_t *lids;
+	const uint8_t *row;
+	osm_switch_t *p_sw;
+	unsigned i, j, n, lid;
+
+	for (i = 0; i < bin->num_switches; i++)
+		if (!routing_bin_sw_valid(bin, &bin->sws[i])) {
+			OSM_LOG(&p_osm->log, OSM_LOG_ERROR, "ERR 630F: "
+				"%s: bad switch entry %u\n", file_name, i);
+			return -1;
+		}
+
+	for (i = 0; i < bin->num_switches; i++) {
+		e = &bin->sws[i];
+		p_sw = osm_get_switch_by_guid(&p_osm->subn, e->guid);
+		if (!p_sw) {
+			OSM_LOG(&p_osm->log, OSM_LOG_VERBOSE,
+				"cannot find switch %016" PRIx64 "\n",
+				cl_ntoh64(e->guid));
+			continue;
+		}
+
+		n = cl_ntoh32(e->num_hop_lids);
+		lids = (const ib_net16_t *)(bin->base +
+					    cl_ntoh64(e->hops_offset));
+		row = (const uint8_t *)lids +
+		    ROUTING_BIN_ALIGN(n * sizeof(ib_net16_t));
+		for (j = 0; j < n; j++, row += e->num_ports) {
+			lid = cl_ntoh16(lids[j]);
+			add_lid_hops(p_osm, p_sw, lid,
+				     lid <= bin->max_lid ? bin->guids[lid] : 0,
+				     (uint8_t *) row, e->num_ports);
+		}
+	}
+	return 0;
+}
+
 static int do_ucast_file_load(void *context)
 {
 	char line[1024];
 	char *file_name;
 	FILE *file;
+	routing_bin_t bin;
 	ib_net64_t sw_guid, port_guid;
 	osm_opensm_t *p_osm = context;
 	osm_switch_t *p_sw;
@@ -140,6 +633,16 @@ static int do_ucast_file_load(void *context)
 		return 1;
 	}
 
+	status = routing_bin_map(p_osm, file_name, &bin);
+	if (status <= 0) {
+		if (status == 0) {
+			status = ucast_bin_load(p_osm, file_name, &bin);
+			routing_bin_unmap(&bin);
+		}
+		return status;
+	}
+	status = -1;
+
 	file = fopen(file_name, "r");
 	if (!file) {
 		OSM_LOG(&p_osm->log, OSM_LOG_ERROR | OSM_LOG_SYS, "ERR 6302: "
@@ -266,6 +769,7 @@ static int do_lid_matrix_file_load(void *context)
 	uint8_t hops[256];
 	char *file_name;
 	FILE *file;
+	routing_bin_t bin;
 	ib_net64_t guid;
 	osm_opensm_t *p_osm = context;
 	osm_switch_t *p_sw;
@@ -281,6 +785,16 @@ static int do_lid_matrix_file_load(void *context)
 		return 1;
 	}
 
+	status = routing_bin_map(p_osm, file_name, &bin);
+	if (status <= 0) {
+		if (status == 0) {
+			status = lid_matrix_bin_load(p_osm, file_name, &bin);
+			routing_bin_unmap(&bin);
+		}
+		return status;
+	}
+	status = -1;
+
 	file = fopen(file_name, "r");
 	if (!file) {
 		OSM_LOG(&p_osm->log, OSM_LOG_ERROR | OSM_LOG_SYS, "ERR 6305: "
@@ -156,6 +156,7 @@ typedef struct ftree_port_group_t_ {
 	boolean_t is_io;	/* whether this port is an I/O node */
 	uint32_t counter_down;	/* number of allocated routes downwards */
 	uint32_t counter_up;	/* number of allocated routes upwards */
+	uint32_t load_idx;	/* index of the group in the load copies */
 } ftree_port_group_t;
 
 /***************************************************
@@ -181,6 +182,7 @@ typedef struct ftree_sw_t_ {
 	uint8_t *hops;
 	uint32_t min_counter_down;
 	boolean_t counter_up_changed;
+	uint32_t load_idx;	/* index of the switch in the load copies */
 } ftree_sw_t;
 
 /***************************************************
@@ -223,6 +225,51 @@ typedef struct ftree_fabric_t_ {
 	boolean_t fabric_built;
 } ftree_fabric_t;
 
+/***************************************************
+ **
+ **  ftree_load_t definition
+ **
+ ***************************************************/
+
+/* Private copy of the switches, port groups and ports of the fabric.
+   A routing thread routes leaf switches on it, starting from the port
+   counters of the batch, and accumulates the changes of the counters. */
+typedef struct ftree_load_t_ {
+	ftree_sw_t *sws;
+	ftree_port_group_t *groups;
+	ftree_port_t *ports;
+	ftree_port_group_t **group_ptrs;
+	uint32_t *port_delta_up;
+	uint32_t *port_delta_down;
+	uint32_t *group_delta_up;
+	uint32_t *group_delta_down;
+	unsigned *sw_delta_idx;
+} ftree_load_t;
+
+/***************************************************
+ **
+ **  ftree_batch_t definition
+ **
+ ***************************************************/
+
+typedef struct ftree_batch_t_ {
+	ftree_fabric_t *p_ftree;
+	uint32_t batch_size;
+	unsigned num_workers;
+	uint32_t sw_num;
+	uint32_t group_num;
+	uint32_t port_num;
+	ftree_sw_t **sws;	/* switches in load_idx order */
+	ftree_port_group_t **groups;	/* port groups in load_idx order */
+	ftree_port_t **ports;	/* ports of the groups, one group after another */
+	uint32_t *first_port;	/* index in ports of the first port of a group */
+	ftree_load_t base;	/* the real counters at the batch start */
+	ftree_load_t *loads;	/* one per worker */
+	uint32_t first_leaf;	/* first leaf switch of the current batch */
+	uint32_t leaf_stride;	/* distance between its leaf switches */
+	unsigned *routed_targets;	/* CNs routed on each leaf of the batch */
+} ftree_batch_t;
+
 static inline osm_subn_t *ftree_get_subnet(IN ftree_fabric_t * p_ftree)
 {
 	return p_ftree->p_subn;
@@ -2788,126 +2835,610 @@ fabric_route_downgoing_by_going_up(IN ftree_fabric_t * p_ftree,
 
 /*
  * Pseudo code:
- *    foreach leaf switch (in indexing order)
- *       for each compute node (in indexing order)
- *          obtain the LID of the compute node
- *          set local LFT(LID) of the port connecting to compute node
- *          call assign-down-going-port-by-ascending-up(TRUE,TRUE) on CURRENT switch
- *       for each MISSING compute node
- *          call assign-down-going-port-by-ascending-up(FALSE,TRUE) on CURRENT switch
+ *    for each compute node of the leaf switch (in indexing order)
+ *       obtain the LID of the compute node
+ *       set local LFT(LID) of the port connecting to compute node
+ *       call assign-down-going-port-by-ascending-up(TRUE,TRUE) on CURRENT switch
+ *
+ * Returns the number of compute nodes routed.
  */
 
-static void fabric_route_to_cns(IN ftree_fabric_t * p_ftree)
+static unsigned fabric_route_cns_of_leaf(IN ftree_fabric_t * p_ftree,
+					 IN ftree_sw_t * p_sw)
 {
-	ftree_sw_t *p_sw;
 	ftree_hca_t *p_hca;
 	ftree_port_group_t *p_leaf_port_group;
 	ftree_port_group_t *p_hca_port_group;
 	ftree_port_t *p_port;
-	unsigned int i, j;
+	unsigned int j;
 	uint16_t hca_lid;
-	unsigned routed_targets_on_leaf;
+	unsigned routed_targets_on_leaf = 0;
 
-	OSM_LOG_ENTER(&p_ftree->p_osm->log);
+	/* for each HCA connected to this switch */
+	for (j = 0; j < p_sw->down_port_groups_num; j++) {
+		p_leaf_port_group = p_sw->down_port_groups[j];
 
-	/* for each leaf switch (in indexing order) */
-	for (i = 0; i < p_ftree->leaf_switches_num; i++) {
-		p_sw = p_ftree->leaf_switches[i];
-		routed_targets_on_leaf = 0;
+		/* work with this port group only if the remote node is CA */
+		if (p_leaf_port_group->remote_node_type != IB_NODE_TYPE_CA)
+			continue;
 
-		/* for each HCA connected to this switch */
-		for (j = 0; j < p_sw->down_port_groups_num; j++) {
-			p_leaf_port_group = p_sw->down_port_groups[j];
+		p_hca = p_leaf_port_group->remote_hca_or_sw.p_hca;
 
-			/* work with this port group only if the remote node is CA */
-			if (p_leaf_port_group->remote_node_type !=
-			    IB_NODE_TYPE_CA)
-				continue;
+		/* work with this port group only if remote HCA has CNs */
+		if (!p_hca->cn_num)
+			continue;
 
-			p_hca = p_leaf_port_group->remote_hca_or_sw.p_hca;
+		p_hca_port_group =
+		    hca_get_port_group_by_lid(p_hca,
+					      p_leaf_port_group->remote_lid);
+		CL_ASSERT(p_hca_port_group);
 
-			/* work with this port group only if remote HCA has CNs */
-			if (!p_hca->cn_num)
-				continue;
+		/* work with this port group only if remote port is CN */
+		if (!p_hca_port_group->is_cn)
+			continue;
 
-			p_hca_port_group =
-			    hca_get_port_group_by_lid(p_hca,
-						      p_leaf_port_group->
-						      remote_lid);
-			CL_ASSERT(p_hca_port_group);
+		/* obtain the LID of HCA port */
+		hca_lid = p_leaf_port_group->remote_lid;
 
-			/* work with this port group only if remote port is CN */
-			if (!p_hca_port_group->is_cn)
-				continue;
+		/* set local LFT(LID) to the port that is connected to HCA */
+		cl_ptr_vector_at(&p_leaf_port_group->ports, 0, (void *)&p_port);
+		p_sw->p_osm_sw->new_lft[hca_lid] = p_port->port_num;
 
-			/* obtain the LID of HCA port */
-			hca_lid = p_leaf_port_group->remote_lid;
+		OSM_LOG(&p_ftree->p_osm->log, OSM_LOG_DEBUG,
+			"Switch %s: set path to CN LID %u through port %u\n",
+			tuple_to_str(p_sw->tuple), hca_lid, p_port->port_num);
 
-			/* set local LFT(LID) to the port that is connected to HCA */
-			cl_ptr_vector_at(&p_leaf_port_group->ports, 0,
-					 (void *)&p_port);
-			p_sw->p_osm_sw->new_lft[hca_lid] = p_port->port_num;
+		/* set local min hop table(LID) to route to the CA */
+		sw_set_hops(p_sw, hca_lid, p_port->port_num, 1, FALSE);
 
-			OSM_LOG(&p_ftree->p_osm->log, OSM_LOG_DEBUG,
-				"Switch %s: set path to CN LID %u through port %u\n",
-				tuple_to_str(p_sw->tuple),
-				hca_lid, p_port->port_num);
+		/* Assign downgoing ports by stepping up.
+		   Since we're routing here only CNs, we're routing it as REAL
+		   LID and updating fat-tree balancing counters. */
+		fabric_route_downgoing_by_going_up(p_ftree, p_sw,	/* local switch - used as a route-downgoing alg. start point */
+						   NULL,	/* prev. position switch */
+						   hca_lid,	/* LID that we're routing to */
+						   TRUE,	/* whether this path to HCA should by tracked by counters */
+						   FALSE,	/* whether target lid is a switch or not */
+						   0,	/* Number of reverse hops allowed */
+						   0,	/* Number of reverse hops done yet */
+						   1);	/* Number of hops done yet */
 
-			/* set local min hop table(LID) to route to the CA */
-			sw_set_hops(p_sw, hca_lid, p_port->port_num, 1, FALSE);
+		/* count how many real targets have been routed from this leaf switch */
+		routed_targets_on_leaf++;
+	}
 
-			/* Assign downgoing ports by stepping up.
-			   Since we're routing here only CNs, we're routing it as REAL
-			   LID and updating fat-tree balancing counters. */
-			fabric_route_downgoing_by_going_up(p_ftree, p_sw,	/* local switch - used as a route-downgoing alg. start point */
-							   NULL,	/* prev. position switch */
-							   hca_lid,	/* LID that we're routing to */
-							   TRUE,	/* whether this path to HCA should by tracked by counters */
-							   FALSE,	/* whether target lid is a switch or not */
-							   0,	/* Number of reverse hops allowed */
-							   0,	/* Number of reverse hops done yet */
-							   1);	/* Number of hops done yet */
+	return routed_targets_on_leaf;
+}				/* fabric_route_cns_of_leaf() */
 
-			/* count how many real targets have been routed from this leaf switch */
-			routed_targets_on_leaf++;
+/***************************************************/
+
+/*
+ * Pseudo code:
+ *    for each MISSING compute node of the leaf switch
+ *       call assign-down-going-port-by-ascending-up(FALSE,TRUE) on CURRENT switch
+ */
+
+static void fabric_route_dummies_of_leaf(IN ftree_fabric_t * p_ftree,
+					 IN ftree_sw_t * p_sw,
+					 IN unsigned routed_targets_on_leaf)
+{
+	ftree_sw_t *p_next_sw, *p_ftree_sw;
+	unsigned int j;
+
+	/* We're done with the real targets (all CNs) of this leaf switch.
+	   Now route the dummy HCAs that are missing or that are non-CNs.
+	   When routing to dummy HCAs we don't fill lid matrices. */
+	if (p_ftree->max_cn_per_leaf <= routed_targets_on_leaf)
+		return;
+
+	OSM_LOG(&p_ftree->p_osm->log, OSM_LOG_DEBUG,
+		"Routing %u dummy CAs\n",
+		p_ftree->max_cn_per_leaf - p_sw->down_port_groups_num);
+	for (j = 0; j < p_ftree->max_cn_per_leaf - routed_targets_on_leaf;
+	     j++) {
+		sw_set_hops(p_sw, 0, 0xFF, 1, FALSE);
+		/* assign downgoing ports by stepping up */
+		fabric_route_downgoing_by_going_up(p_ftree, p_sw,	/* local switch - used as a route-downgoing alg. start point */
+						   NULL,	/* prev. position switch */
+						   0,	/* LID that we're routing to - ignored for dummy HCA */
+						   TRUE,	/* whether this path to HCA should by tracked by counters */
+						   FALSE,	/* Whether the target LID is a switch or not */
+						   0,	/* Number of reverse hops allowed */
+						   0,	/* Number of reverse hops done yet */
+						   1);	/* Number of hops done yet */
+
+		p_next_sw = (ftree_sw_t *) cl_qmap_head(&p_ftree->sw_tbl);
+		/* need to clean the LID 0 hops for dummy node */
+		while (p_next_sw != (ftree_sw_t *) cl_qmap_end(&p_ftree->sw_tbl)) {
+			p_ftree_sw = p_next_sw;
+			p_next_sw = (ftree_sw_t *) cl_qmap_next(&p_ftree_sw->map_item);
+			p_ftree_sw->hops[0] = OSM_NO_PATH;
+			p_ftree_sw->p_osm_sw->new_lft[0] = OSM_NO_PATH;
 		}
+	}
+}				/* fabric_route_dummies_of_leaf() */
 
-		/* We're done with the real targets (all CNs) of this leaf switch.
-		   Now route the dummy HCAs that are missing or that are non-CNs.
-		   When routing to dummy HCAs we don't fill lid matrices. */
-		if (p_ftree->max_cn_per_leaf > routed_targets_on_leaf) {
-			OSM_LOG(&p_ftree->p_osm->log, OSM_LOG_DEBUG,
-				"Routing %u dummy CAs\n",
-				p_ftree->max_cn_per_leaf -
-				p_sw->down_port_groups_num);
-			for (j = 0; j <
-			     p_ftree->max_cn_per_leaf - routed_targets_on_leaf;
-			     j++) {
-				ftree_sw_t *p_next_sw, *p_ftree_sw;
-				sw_set_hops(p_sw, 0, 0xFF, 1, FALSE);
-				/* assign downgoing ports by stepping up */
-				fabric_route_downgoing_by_going_up(p_ftree, p_sw,	/* local switch - used as a route-downgoing alg. start point */
-								   NULL,	/* prev. position switch */
-								   0,	/* LID that we're routing to - ignored for dummy HCA */
-								   TRUE,	/* whether this path to HCA should by tracked by counters */
-								   FALSE,	/* Whether the target LID is a switch or not */
-								   0,	/* Number of reverse hops allowed */
-								   0,	/* Number of reverse hops done yet */
-								   1);	/* Number of hops done yet */
-
-				p_next_sw = (ftree_sw_t *) cl_qmap_head(&p_ftree->sw_tbl);
-				/* need to clean the LID 0 hops for dummy node */
-				while (p_next_sw != (ftree_sw_t *) cl_qmap_end(&p_ftree->sw_tbl)) {
-					p_ftree_sw = p_next_sw;
-					p_next_sw = (ftree_sw_t *) cl_qmap_next(&p_ftree_sw->map_item);
-					p_ftree_sw->hops[0] = OSM_NO_PATH;
-					p_ftree_sw->p_osm_sw->new_lft[0] = OSM_NO_PATH;
-				}
+/***************************************************
+ ***************************************************/
+
+/*
+ * Batched routing of the compute nodes.
+ *
+ * The leaf switches are routed ftree_batch_size at a time.  The port
+ * counters and group orders of the real fabric are copied to a base load
+ * copy (ftree_load_t) at the start of a batch.  Each leaf of the batch is
+ * routed by one of the routing threads on the thread's load copy, reset
+ * to the base first.  The copies share the LFTs and hop tables of the
+ * real switches, where each CN LID is written by one leaf only.  The
+ * changes made by each leaf are summed and added to the real counters
+ * when the batch is done, so the routing does not depend on the number
+ * of threads.
+ */
+
+static uint32_t sw_get_port_groups_num(IN ftree_sw_t * p_sw)
+{
+	return p_sw->down_port_groups_num + p_sw->sibling_port_groups_num +
+	    p_sw->up_port_groups_num;
+}
+
+/***************************************************/
+
+/* port group k of a switch, counting its down, sibling and up groups */
+static ftree_port_group_t *sw_get_port_group(IN ftree_sw_t * p_sw,
+					     IN uint32_t k)
+{
+	if (k < p_sw->down_port_groups_num)
+		return p_sw->down_port_groups[k];
+	k -= p_sw->down_port_groups_num;
+	if (k < p_sw->sibling_port_groups_num)
+		return p_sw->sibling_port_groups[k];
+	return p_sw->up_port_groups[k - p_sw->sibling_port_groups_num];
+}
+
+/***************************************************/
+
+static void fabric_batch_load_destroy(IN ftree_batch_t * p_batch,
+				      IN ftree_load_t * p_load)
+{
+	uint32_t g;
+
+	if (p_load->groups)
+		for (g = 0; g < p_batch->group_num; g++)
+			cl_ptr_vector_destroy(&p_load->groups[g].ports);
+	free(p_load->sws);
+	free(p_load->groups);
+	free(p_load->ports);
+	free(p_load->group_ptrs);
+	free(p_load->port_delta_up);
+	free(p_load->port_delta_down);
+	free(p_load->group_delta_up);
+	free(p_load->group_delta_down);
+	free(p_load->sw_delta_idx);
+	memset(p_load, 0, sizeof(*p_load));
+}
+
+/***************************************************/
+
+static int fabric_batch_load_init(IN ftree_batch_t * p_batch,
+				  IN ftree_load_t * p_load)
+{
+	ftree_sw_t *p_sw;
+	ftree_port_group_t *p_group;
+	ftree_port_group_t *p_orig_group;
+	uint32_t i, j, g, ports_num;
+
+	p_load->sws = malloc(p_batch->sw_num * sizeof(ftree_sw_t));
+	p_load->ports = malloc(p_batch->port_num * sizeof(ftree_port_t));
+	p_load->group_ptrs =
+	    malloc(p_batch->group_num * sizeof(ftree_port_group_t *));
+	p_load->port_delta_up = calloc(p_batch->port_num, sizeof(uint32_t));
+	p_load->port_delta_down = calloc(p_batch->port_num, sizeof(uint32_t));
+	p_load->group_delta_up = calloc(p_batch->group_num, sizeof(uint32_t));
+	p_load->group_delta_down =
+	    calloc(p_batch->group_num, sizeof(uint32_t));
+	p_load->sw_delta_idx = calloc(p_batch->sw_num, sizeof(unsigned));
+	if (!p_load->sws || !p_load->ports || !p_load->group_ptrs ||
+	    !p_load->port_delta_up || !p_load->port_delta_down ||
+	    !p_load->group_delta_up || !p_load->group_delta_down ||
+	    !p_load->sw_delta_idx)
+		return -1;
+
+	p_load->groups = malloc(p_batch->group_num * sizeof(ftree_port_group_t));
+	if (!p_load->groups)
+		return -1;
+	for (g = 0; g < p_batch->group_num; g++) {
+		p_load->groups[g] = *p_batch->groups[g];
+		cl_ptr_vector_construct(&p_load->groups[g].ports);
+	}
+
+	for (i = 0; i < p_batch->port_num; i++)
+		p_load->ports[i] = *p_batch->ports[i];
+
+	/* The groups of a switch are numbered one after the other, so are
+	   their pointers in the down, sibling and up arrays of the copy */
+	for (i = 0, g = 0; i < p_batch->sw_num; i++) {
+		p_sw = &p_load->sws[i];
+		*p_sw = *p_batch->sws[i];
+		p_sw->down_port_groups = &p_load->group_ptrs[g];
+		p_sw->sibling_port_groups =
+		    p_sw->down_port_groups + p_sw->down_port_groups_num;
+		p_sw->up_port_groups =
+		    p_sw->sibling_port_groups + p_sw->sibling_port_groups_num;
+		g += sw_get_port_groups_num(p_sw);
+	}
+
+	for (g = 0; g < p_batch->group_num; g++) {
+		p_orig_group = p_batch->groups[g];
+		p_group = &p_load->groups[g];
+		p_group->hca_or_sw.p_sw =
+		    &p_load->sws[p_orig_group->hca_or_sw.p_sw->load_idx];
+		if (p_group->remote_node_type == IB_NODE_TYPE_SWITCH)
+			p_group->remote_hca_or_sw.p_sw =
+			    &p_load->sws[p_orig_group->remote_hca_or_sw.p_sw->
+					 load_idx];
+
+		ports_num = (uint32_t) cl_ptr_vector_get_size(&p_orig_group->ports);
+		if (cl_ptr_vector_init(&p_group->ports, 0, 8) != CL_SUCCESS)
+			return -1;
+		for (j = 0; j < ports_num; j++)
+			cl_ptr_vector_insert(&p_group->ports,
+					     &p_load->ports[p_batch->first_port[g] + j],
+					     NULL);
+	}
+	return 0;
+}
+
+/***************************************************/
+
+static void fabric_batch_destroy(IN ftree_batch_t * p_batch)
+{
+	unsigned w;
+
+	if (p_batch->loads) {
+		for (w = 0; w < p_batch->num_workers; w++)
+			fabric_batch_load_destroy(p_batch, &p_batch->loads[w]);
+		free(p_batch->loads);
+	}
+	fabric_batch_load_destroy(p_batch, &p_batch->base);
+	free(p_batch->sws);
+	free(p_batch->groups);
+	free(p_batch->ports);
+	free(p_batch->first_port);
+	free(p_batch->routed_targets);
+	memset(p_batch, 0, sizeof(*p_batch));
+}
+
+/***************************************************/
+
+static int fabric_batch_init(IN ftree_batch_t * p_batch,
+			     IN ftree_fabric_t * p_ftree)
+{
+	ftree_sw_t *p_sw;
+	ftree_port_group_t *p_group;
+	uint32_t i, j, k, g, p, ports_num;
+	unsigned w;
+
+	memset(p_batch, 0, sizeof(*p_batch));
+	p_batch->p_ftree = p_ftree;
+	p_batch->batch_size = p_ftree->p_osm->subn.opt.ftree_batch_size;
+	p_batch->num_workers =
+	    osm_ucast_mgr_num_workers(&p_ftree->p_osm->sm.ucast_mgr);
+	if (p_batch->num_workers > p_batch->batch_size)
+		p_batch->num_workers = p_batch->batch_size;
+	/* tuple_to_str() returns static buffers */
+	if (OSM_LOG_IS_ACTIVE_V2(&p_ftree->p_osm->log, OSM_LOG_DEBUG))
+		p_batch->num_workers = 1;
+
+	/* count the switches, port groups and ports */
+	for (p_sw = (ftree_sw_t *) cl_qmap_head(&p_ftree->sw_tbl);
+	     p_sw != (ftree_sw_t *) cl_qmap_end(&p_ftree->sw_tbl);
+	     p_sw = (ftree_sw_t *) cl_qmap_next(&p_sw->map_item)) {
+		p_batch->sw_num++;
+		for (k = 0; k < sw_get_port_groups_num(p_sw); k++) {
+			p_group = sw_get_port_group(p_sw, k);
+			p_batch->group_num++;
+			p_batch->port_num +=
+			    (uint32_t) cl_ptr_vector_get_size(&p_group->ports);
+		}
+	}
+
+	p_batch->sws = malloc(p_batch->sw_num * sizeof(ftree_sw_t *));
+	p_batch->groups =
+	    malloc(p_batch->group_num * sizeof(ftree_port_group_t *));
+	p_batch->ports = malloc(p_batch->port_num * sizeof(ftree_port_t *));
+	p_batch->first_port = malloc(p_batch->group_num * sizeof(uint32_t));
+	p_batch->routed_targets =
+	    malloc(p_batch->batch_size * sizeof(unsigned));
+	p_batch->loads = calloc(p_batch->num_workers, sizeof(ftree_load_t));
+	if (!p_batch->sws || !p_batch->groups || !p_batch->ports ||
+	    !p_batch->first_port || !p_batch->routed_targets ||
+	    !p_batch->loads)
+		goto ERROR;
+
+	/* number them */
+	i = g = p = 0;
+	for (p_sw = (ftree_sw_t *) cl_qmap_head(&p_ftree->sw_tbl);
+	     p_sw != (ftree_sw_t *) cl_qmap_end(&p_ftree->sw_tbl);
+	     p_sw = (ftree_sw_t *) cl_qmap_next(&p_sw->map_item)) {
+		p_sw->load_idx = i;
+		p_batch->sws[i++] = p_sw;
+		for (k = 0; k < sw_get_port_groups_num(p_sw); k++) {
+			p_group = sw_get_port_group(p_sw, k);
+			p_group->load_idx = g;
+			p_batch->groups[g] = p_group;
+			p_batch->first_port[g++] = p;
+			ports_num =
+			    (uint32_t) cl_ptr_vector_get_size(&p_group->ports);
+			for (j = 0; j < ports_num; j++)
+				cl_ptr_vector_at(&p_group->ports, j,
+						 (void *)&p_batch->ports[p++]);
+		}
+	}
 
+	if (fabric_batch_load_init(p_batch, &p_batch->base))
+		goto ERROR;
+	for (w = 0; w < p_batch->num_workers; w++)
+		if (fabric_batch_load_init(p_batch, &p_batch->loads[w]))
+			goto ERROR;
+	return 0;
+
+ERROR:
+	OSM_LOG(&p_ftree->p_osm->log, OSM_LOG_ERROR, "ERR AB34: "
+		"Cannot allocate memory for batched routing - "
+		"routing the leaf switches one by one\n");
+	fabric_batch_destroy(p_batch);
+	return -1;
+}
+
+/***************************************************/
+
+/* reset the counters and the group orders of a load copy to the base */
+static void fabric_batch_load_sync(IN ftree_batch_t * p_batch,
+				   IN ftree_load_t * p_load)
+{
+	ftree_load_t *p_base = &p_batch->base;
+	uint32_t i;
+
+	for (i = 0; i < p_batch->sw_num; i++) {
+		p_load->sws[i].down_port_groups_idx =
+		    p_base->sws[i].down_port_groups_idx;
+		p_load->sws[i].min_counter_down =
+		    p_base->sws[i].min_counter_down;
+		p_load->sws[i].counter_up_changed =
+		    p_base->sws[i].counter_up_changed;
+	}
+	for (i = 0; i < p_batch->group_num; i++) {
+		p_load->group_ptrs[i] = p_load->groups +
+		    (p_base->group_ptrs[i] - p_base->groups);
+		p_load->groups[i].counter_up = p_base->groups[i].counter_up;
+		p_load->groups[i].counter_down = p_base->groups[i].counter_down;
+	}
+	for (i = 0; i < p_batch->port_num; i++) {
+		p_load->ports[i].counter_up = p_base->ports[i].counter_up;
+		p_load->ports[i].counter_down = p_base->ports[i].counter_down;
+	}
+}
+
+/***************************************************/
+
+/* copy the real counters and group orders to the base load copy, and
+   from there to the load copies of the workers */
+static void fabric_batch_snapshot(IN ftree_batch_t * p_batch)
+{
+	ftree_load_t *p_base = &p_batch->base;
+	ftree_sw_t *p_sw, *p_orig_sw;
+	uint32_t i, k;
+	unsigned w;
+
+	for (i = 0; i < p_batch->sw_num; i++) {
+		p_orig_sw = p_batch->sws[i];
+		p_sw = &p_base->sws[i];
+		p_sw->down_port_groups_idx = p_orig_sw->down_port_groups_idx;
+		p_sw->min_counter_down = p_orig_sw->min_counter_down;
+		p_sw->counter_up_changed = p_orig_sw->counter_up_changed;
+		for (k = 0; k < p_sw->down_port_groups_num; k++)
+			p_sw->down_port_groups[k] = &p_base->groups
+			    [p_orig_sw->down_port_groups[k]->load_idx];
+		for (k = 0; k < p_sw->sibling_port_groups_num; k++)
+			p_sw->sibling_port_groups[k] = &p_base->groups
+			    [p_orig_sw->sibling_port_groups[k]->load_idx];
+		for (k = 0; k < p_sw->up_port_groups_num; k++)
+			p_sw->up_port_groups[k] = &p_base->groups
+			    [p_orig_sw->up_port_groups[k]->load_idx];
+	}
+	for (i = 0; i < p_batch->group_num; i++) {
+		p_base->groups[i].counter_up = p_batch->groups[i]->counter_up;
+		p_base->groups[i].counter_down =
+		    p_batch->groups[i]->counter_down;
+	}
+	for (i = 0; i < p_batch->port_num; i++) {
+		p_base->ports[i].counter_up = p_batch->ports[i]->counter_up;
+		p_base->ports[i].counter_down = p_batch->ports[i]->counter_down;
+	}
+
+	for (w = 0; w < p_batch->num_workers; w++)
+		fabric_batch_load_sync(p_batch, &p_batch->loads[w]);
+}
+
+/***************************************************/
+
+/* add the changes made on a load copy to its deltas and reset it to
+   the base, in the same pass */
+static void fabric_batch_load_collect(IN ftree_batch_t * p_batch,
+				      IN ftree_load_t * p_load)
+{
+	ftree_load_t *p_base = &p_batch->base;
+	ftree_sw_t *p_sw, *p_base_sw;
+	ftree_port_group_t *p_group, *p_base_group;
+	ftree_port_t *p_port, *p_base_port;
+	uint32_t i, n;
+
+	for (i = 0; i < p_batch->sw_num; i++) {
+		p_sw = &p_load->sws[i];
+		p_base_sw = &p_base->sws[i];
+		n = p_sw->down_port_groups_num;
+		if (n)
+			p_load->sw_delta_idx[i] +=
+			    (p_sw->down_port_groups_idx + n -
+			     p_base_sw->down_port_groups_idx) % n;
+		p_sw->down_port_groups_idx = p_base_sw->down_port_groups_idx;
+		p_sw->min_counter_down = p_base_sw->min_counter_down;
+		p_sw->counter_up_changed = p_base_sw->counter_up_changed;
+	}
+	for (i = 0; i < p_batch->group_num; i++) {
+		p_group = &p_load->groups[i];
+		p_base_group = &p_base->groups[i];
+		p_load->group_delta_up[i] +=
+		    p_group->counter_up - p_base_group->counter_up;
+		p_load->group_delta_down[i] +=
+		    p_group->counter_down - p_base_group->counter_down;
+		p_group->counter_up = p_base_group->counter_up;
+		p_group->counter_down = p_base_group->counter_down;
+		p_load->group_ptrs[i] = p_load->groups +
+		    (p_base->group_ptrs[i] - p_base->groups);
+	}
+	for (i = 0; i < p_batch->port_num; i++) {
+		p_port = &p_load->ports[i];
+		p_base_port = &p_base->ports[i];
+		p_load->port_delta_up[i] +=
+		    p_port->counter_up - p_base_port->counter_up;
+		p_load->port_delta_down[i] +=
+		    p_port->counter_down - p_base_port->counter_down;
+		p_port->counter_up = p_base_port->counter_up;
+		p_port->counter_down = p_base_port->counter_down;
+	}
+}
+
+/***************************************************/
+
+static void fabric_batch_route_leaf(IN void *context, IN unsigned item,
+				    IN unsigned worker)
+{
+	ftree_batch_t *p_batch = (ftree_batch_t *) context;
+	ftree_load_t *p_load = &p_batch->loads[worker];
+	ftree_sw_t *p_sw =
+	    p_batch->p_ftree->leaf_switches[p_batch->first_leaf +
+					    item * p_batch->leaf_stride];
+
+	p_batch->routed_targets[item] =
+	    fabric_route_cns_of_leaf(p_batch->p_ftree,
+				     &p_load->sws[p_sw->load_idx]);
+	fabric_batch_load_collect(p_batch, p_load);
+}
+
+/***************************************************/
+
+/* add the deltas of all the load copies to the real counters */
+static void fabric_batch_merge(IN ftree_batch_t * p_batch)
+{
+	ftree_load_t *p_load;
+	ftree_sw_t *p_sw;
+	uint32_t i;
+	unsigned w;
+
+	for (w = 0; w < p_batch->num_workers; w++) {
+		p_load = &p_batch->loads[w];
+		for (i = 0; i < p_batch->sw_num; i++) {
+			p_sw = p_batch->sws[i];
+			if (p_sw->down_port_groups_num)
+				p_sw->down_port_groups_idx =
+				    (p_sw->down_port_groups_idx +
+				     p_load->sw_delta_idx[i]) %
+				    p_sw->down_port_groups_num;
+			p_load->sw_delta_idx[i] = 0;
+		}
+		for (i = 0; i < p_batch->group_num; i++) {
+			if (p_load->group_delta_up[i])
+				p_batch->groups[i]->hca_or_sw.p_sw->
+				    counter_up_changed = TRUE;
+			p_batch->groups[i]->counter_up +=
+			    p_load->group_delta_up[i];
+			p_batch->groups[i]->counter_down +=
+			    p_load->group_delta_down[i];
+			p_load->group_delta_up[i] = 0;
+			p_load->group_delta_down[i] = 0;
+		}
+		for (i = 0; i < p_batch->port_num; i++) {
+			p_batch->ports[i]->counter_up += p_load->port_delta_up[i];
+			p_batch->ports[i]->counter_down +=
+			    p_load->port_delta_down[i];
+			p_load->port_delta_up[i] = 0;
+			p_load->port_delta_down[i] = 0;
+		}
+	}
+
+	for (i = 0; i < p_batch->sw_num; i++) {
+		p_sw = p_batch->sws[i];
+		if (p_sw->down_port_groups_num)
+			recalculate_min_counter_down(p_sw);
+	}
+}
+
+/***************************************************/
+
+/*
+ * Pseudo code:
+ *    foreach leaf switch (in indexing order)
+ *       for each compute node (in indexing order)
+ *          obtain the LID of the compute node
+ *          set local LFT(LID) of the port connecting to compute node
+ *          call assign-down-going-port-by-ascending-up(TRUE,TRUE) on CURRENT switch
+ *       for each MISSING compute node
+ *          call assign-down-going-port-by-ascending-up(FALSE,TRUE) on CURRENT switch
+ *
+ * With ftree_batch_size > 1, the compute nodes of a batch of leaf switches
+ * are routed in parallel, then the missing ones of each leaf in turn.
+ */
+
+static void fabric_route_to_cns(IN ftree_fabric_t * p_ftree)
+{
+	ftree_batch_t batch;
+	ftree_sw_t *p_sw;
+	unsigned int i, n;
+	unsigned routed_targets_on_leaf;
+
+	OSM_LOG_ENTER(&p_ftree->p_osm->log);
+
+	if (p_ftree->p_osm->subn.opt.ftree_batch_size > 1 &&
+	    !fabric_batch_init(&batch, p_ftree)) {
+		OSM_LOG(&p_ftree->p_osm->log, OSM_LOG_VERBOSE,
+			"Routing batches of %u leaf switches on %u threads\n",
+			batch.batch_size, batch.num_workers);
+		/* consecutive leaf switches share the same upper switches
+		   and would pick the same ports on the same counters, so
+		   batch i takes every leaf_stride-th leaf starting at i */
+		batch.leaf_stride = (p_ftree->leaf_switches_num +
+				     batch.batch_size - 1) / batch.batch_size;
+		for (batch.first_leaf = 0;
+		     batch.first_leaf < batch.leaf_stride; batch.first_leaf++) {
+			n = (p_ftree->leaf_switches_num - batch.first_leaf +
+			     batch.leaf_stride - 1) / batch.leaf_stride;
+			fabric_batch_snapshot(&batch);
+			osm_ucast_mgr_parallel_for(&p_ftree->p_osm->sm.ucast_mgr,
+						   n, batch.num_workers,
+						   fabric_batch_route_leaf,
+						   &batch);
+			fabric_batch_merge(&batch);
+			for (i = 0; i < n; i++) {
+				p_sw = p_ftree->leaf_switches[batch.first_leaf +
+							      i * batch.leaf_stride];
+				fabric_route_dummies_of_leaf(p_ftree, p_sw,
+							     batch.routed_targets[i]);
 			}
 		}
+		fabric_batch_destroy(&batch);
+		goto Exit;
+	}
+
+	/* for each leaf switch (in indexing order) */
+	for (i = 0; i < p_ftree->leaf_switches_num; i++) {
+		p_sw = p_ftree->leaf_switches[i];
+		routed_targets_on_leaf = fabric_route_cns_of_leaf(p_ftree, p_sw);
+		fabric_route_dummies_of_leaf(p_ftree, p_sw,
+					     routed_targets_on_leaf);
 	}
 	/* done going through all the leaf switches */
+Exit:
 	OSM_LOG_EXIT(&p_ftree->p_osm->log);
 }				/* fabric_route_to_cns() */
 
@@ -126,46 +126,95 @@ static osm_switch_t *get_osm_switch_from_port(const osm_port_t * port)
 	return NULL;
 }
 
-static int cycle_exists(cdg_vertex_t * start, cdg_vertex_t * current,
-			cdg_vertex_t * prev, int visit_num)
+static inline cdg_vertex_t **get_cdg_vertex(lash_t * p_lash, int lane,
+					    int sw, int link)
 {
-	int i, new_visit_num;
-	int cycle_found = 0;
+	return &p_lash->cdg_vertex_matrix[lane * p_lash->num_channels +
+					  p_lash->switches[sw]->first_channel +
+					  link];
+}
 
-	if (current != NULL && current->visiting_number > 0) {
-		if (visit_num > current->visiting_number && current->seen == 0) {
-			cycle_found = 1;
-		}
-	} else {
-		if (current == NULL) {
-			current = start;
-			CL_ASSERT(prev == NULL);
-		}
+static void free_cdg_vertex(cdg_vertex_t * v)
+{
+	free(v->deps);
+	free(v);
+}
 
-		current->visiting_number = visit_num;
+/*
+ * Depth first search for a cycle reachable from start.  Vertices
+ * stamped with the current visit number were already explored in
+ * this round; a cycle exists if one of them is still on the path.
+ */
+static int cycle_exists(lash_t * p_lash, cdg_vertex_t * start)
+{
+	struct cdg_dfs_frame *stack = p_lash->cdg_stack;
+	unsigned visit = p_lash->cdg_visit;
+	cdg_vertex_t *v, *w;
+	int top = 0;
+
+	if (start->visit == visit)
+		return 0;
+
+	start->visit = visit;
+	start->on_path = 1;
+	stack[0].v = start;
+	stack[0].next_dep = 0;
+
+	while (top >= 0) {
+		v = stack[top].v;
+		if (stack[top].next_dep == v->num_deps) {
+			v->on_path = 0;
+			top--;
+			continue;
+		}
 
-		if (prev != NULL) {
-			prev->next = current;
-			CL_ASSERT(prev->to == current->from);
-			CL_ASSERT(prev->visiting_number > 0);
+		w = v->deps[stack[top].next_dep++].v;
+		CL_ASSERT(v->to == w->from);
+		if (w->visit == visit) {
+			if (w->on_path) {
+				for (; top >= 0; top--)
+					stack[top].v->on_path = 0;
+				return 1;
+			}
+			continue;
 		}
 
-		new_visit_num = visit_num + 1;
+		CL_ASSERT(top + 1 < p_lash->num_channels);
+		w->visit = visit;
+		w->on_path = 1;
+		top++;
+		stack[top].v = w;
+		stack[top].next_dep = 0;
+	}
 
-		for (i = 0; i < current->num_deps; i++) {
-			cycle_found =
-			    cycle_exists(start, current->deps[i].v, current,
-					 new_visit_num);
-			if (cycle_found == 1)
-				i = current->num_deps;
-		}
+	return 0;
+}
 
-		current->seen = 1;
-		if (prev != NULL)
-			prev->next = NULL;
+/*
+ * Check the CDG of lane for cycles created by the paths between
+ * sw1 and sw2 in both directions.
+ */
+static int lane_has_cycle(lash_t * p_lash, int sw1, int sw2, int lane)
+{
+	switch_t **switches = p_lash->switches;
+	cdg_vertex_t *v1, *v2;
+	int i;
+
+	if (++p_lash->cdg_visit == 0) {
+		for (i = 0; i < p_lash->vl_min * p_lash->num_channels; i++)
+			if (p_lash->cdg_vertex_matrix[i])
+				p_lash->cdg_vertex_matrix[i]->visit = 0;
+		p_lash->cdg_visit = 1;
 	}
 
-	return cycle_found;
+	v1 = *get_cdg_vertex(p_lash, lane, sw1,
+			     switches[sw1]->routing_table[sw2].out_link);
+	v2 = *get_cdg_vertex(p_lash, lane, sw2,
+			     switches[sw2]->routing_table[sw1].out_link);
+	CL_ASSERT(v1 != NULL);
+	CL_ASSERT(v2 != NULL);
+
+	return cycle_exists(p_lash, v1) || cycle_exists(p_lash, v2);
 }
 
 static inline int get_next_switch(lash_t *p_lash, int sw, int link)
@@ -177,36 +226,32 @@ static void remove_semipermanent_depend_for_sp(lash_t * p_lash, int sw,
 					       int dest_switch, int lane)
 {
 	switch_t **switches = p_lash->switches;
-	cdg_vertex_t ****cdg_vertex_matrix = p_lash->cdg_vertex_matrix;
-	int i_next_switch, output_link, i, next_link, i_next_next_switch,
-	    depend = 0;
-	cdg_vertex_t *v;
+	int i_next_switch, output_link, i, next_link, depend = 0;
+	cdg_vertex_t **slot, *v, *next_v;
 	int __attribute__((unused)) found;
 
-	output_link = switches[sw]->routing_table[dest_switch].out_link;
-	i_next_switch = get_next_switch(p_lash, sw, output_link);
-
 	while (sw != dest_switch) {
-		v = cdg_vertex_matrix[lane][sw][i_next_switch];
+		output_link = switches[sw]->routing_table[dest_switch].out_link;
+		i_next_switch = get_next_switch(p_lash, sw, output_link);
+		slot = get_cdg_vertex(p_lash, lane, sw, output_link);
+		v = *slot;
 		CL_ASSERT(v != NULL);
 
 		if (v->num_using_vertex == 1) {
-
-			cdg_vertex_matrix[lane][sw][i_next_switch] = NULL;
-
-			free(v);
+			*slot = NULL;
+			free_cdg_vertex(v);
 		} else {
 			v->num_using_vertex--;
 			if (i_next_switch != dest_switch) {
 				next_link =
 				    switches[i_next_switch]->routing_table[dest_switch].out_link;
-				i_next_next_switch = get_next_switch(p_lash, i_next_switch, next_link);
+				next_v = *get_cdg_vertex(p_lash, lane,
+							 i_next_switch,
+							 next_link);
 				found = 0;
 
 				for (i = 0; i < v->num_deps; i++)
-					if (v->deps[i].v ==
-					    cdg_vertex_matrix[lane][i_next_switch]
-					    [i_next_next_switch]) {
+					if (v->deps[i].v == next_v) {
 						found = 1;
 						depend = i;
 					}
@@ -228,10 +273,6 @@ static void remove_semipermanent_depend_for_sp(lash_t * p_lash, int sw,
 		}
 
 		sw = i_next_switch;
-		output_link = switches[sw]->routing_table[dest_switch].out_link;
-
-		if (sw != dest_switch)
-			i_next_switch = get_next_switch(p_lash, sw, output_link);
 	}
 }
 
@@ -324,30 +365,36 @@ static int generate_routing_func_for_mst(lash_t * p_lash, int sw_id,
 	return 0;
 }
 
+/*
+ * Add the channel dependencies of the path from sw to dest_switch to
+ * the CDG of lane.  new_deps is increased by the number of dependency
+ * edges that did not exist before; if there are none the CDG cannot
+ * have gained a cycle.
+ */
 static int generate_cdg_for_sp(lash_t * p_lash, int sw, int dest_switch,
-			       int lane)
+			       int lane, int *new_deps)
 {
-	unsigned num_switches = p_lash->num_switches;
 	switch_t **switches = p_lash->switches;
-	cdg_vertex_t ****cdg_vertex_matrix = p_lash->cdg_vertex_matrix;
 	int next_switch, output_link, j, exists;
-	cdg_vertex_t *v, *prev = NULL;
-
-	output_link = switches[sw]->routing_table[dest_switch].out_link;
-	next_switch = get_next_switch(p_lash, sw, output_link);
+	cdg_vertex_t **slot, *v, *prev = NULL;
+	struct vertex_deps *deps;
 
 	while (sw != dest_switch) {
+		output_link = switches[sw]->routing_table[dest_switch].out_link;
+		CL_ASSERT(output_link != NONE);
+		next_switch = get_next_switch(p_lash, sw, output_link);
 
-		if (cdg_vertex_matrix[lane][sw][next_switch] == NULL) {
-			v = calloc(1, sizeof(*v) + (num_switches - 1) * sizeof(v->deps[0]));
+		slot = get_cdg_vertex(p_lash, lane, sw, output_link);
+		if (*slot == NULL) {
+			v = calloc(1, sizeof(*v));
 			if (!v)
 				return -1;
 			v->from = sw;
 			v->to = next_switch;
 			v->temp = 1;
-			cdg_vertex_matrix[lane][sw][next_switch] = v;
+			*slot = v;
 		} else
-			v = cdg_vertex_matrix[lane][sw][next_switch];
+			v = *slot;
 
 		v->num_using_vertex++;
 
@@ -361,26 +408,27 @@ static int generate_cdg_for_sp(lash_t * p_lash, int sw, int dest_switch,
 				}
 
 			if (exists == 0) {
+				if (prev->num_deps == prev->max_deps) {
+					j = prev->max_deps ? 2 * prev->max_deps : 4;
+					deps = realloc(prev->deps,
+						       j * sizeof(*deps));
+					if (!deps)
+						return -1;
+					prev->deps = deps;
+					prev->max_deps = j;
+				}
 				prev->deps[prev->num_deps].v = v;
-				prev->deps[prev->num_deps].num_used++;
+				prev->deps[prev->num_deps].num_used = 1;
 				prev->num_deps++;
 
-				CL_ASSERT(prev->num_deps < (int)num_switches);
-
 				if (prev->temp == 0)
 					prev->num_temp_depend++;
 
+				(*new_deps)++;
 			}
 		}
 
 		sw = next_switch;
-		output_link = switches[sw]->routing_table[dest_switch].out_link;
-
-		if (sw != dest_switch) {
-			CL_ASSERT(output_link != NONE);
-			next_switch = get_next_switch(p_lash, sw, output_link);
-		}
-
 		prev = v;
 	}
 	return 0;
@@ -390,15 +438,12 @@ static void set_temp_depend_to_permanent_for_sp(lash_t * p_lash, int sw,
 						int dest_switch, int lane)
 {
 	switch_t **switches = p_lash->switches;
-	cdg_vertex_t ****cdg_vertex_matrix = p_lash->cdg_vertex_matrix;
-	int next_switch, output_link;
+	int output_link;
 	cdg_vertex_t *v;
 
-	output_link = switches[sw]->routing_table[dest_switch].out_link;
-	next_switch = get_next_switch(p_lash, sw, output_link);
-
 	while (sw != dest_switch) {
-		v = cdg_vertex_matrix[lane][sw][next_switch];
+		output_link = switches[sw]->routing_table[dest_switch].out_link;
+		v = *get_cdg_vertex(p_lash, lane, sw, output_link);
 		CL_ASSERT(v != NULL);
 
 		if (v->temp == 1)
@@ -406,11 +451,7 @@ static void set_temp_depend_to_permanent_for_sp(lash_t * p_lash, int sw,
 		else
 			v->num_temp_depend = 0;
 
-		sw = next_switch;
-		output_link = switches[sw]->routing_table[dest_switch].out_link;
-
-		if (sw != dest_switch)
-			next_switch = get_next_switch(p_lash, sw, output_link);
+		sw = get_next_switch(p_lash, sw, output_link);
 	}
 
 }
@@ -419,53 +460,52 @@ static void remove_temp_depend_for_sp(lash_t * p_lash, int sw, int dest_switch,
 				      int lane)
 {
 	switch_t **switches = p_lash->switches;
-	cdg_vertex_t ****cdg_vertex_matrix = p_lash->cdg_vertex_matrix;
-	int next_switch, output_link, i;
-	cdg_vertex_t *v;
-
-	output_link = switches[sw]->routing_table[dest_switch].out_link;
-	next_switch = get_next_switch(p_lash, sw, output_link);
+	int output_link;
+	cdg_vertex_t **slot, *v;
 
 	while (sw != dest_switch) {
-		v = cdg_vertex_matrix[lane][sw][next_switch];
+		output_link = switches[sw]->routing_table[dest_switch].out_link;
+		slot = get_cdg_vertex(p_lash, lane, sw, output_link);
+		v = *slot;
 		CL_ASSERT(v != NULL);
 
 		if (v->temp == 1) {
-			cdg_vertex_matrix[lane][sw][next_switch] = NULL;
-			free(v);
+			*slot = NULL;
+			free_cdg_vertex(v);
 		} else {
 			CL_ASSERT(v->num_temp_depend <= v->num_deps);
 			v->num_deps = v->num_deps - v->num_temp_depend;
 			v->num_temp_depend = 0;
 			v->num_using_vertex--;
-
-			for (i = v->num_deps; i < p_lash->num_switches - 1; i++)
-				v->deps[i].num_used = 0;
 		}
 
-		sw = next_switch;
-		output_link = switches[sw]->routing_table[dest_switch].out_link;
-
-		if (sw != dest_switch)
-			next_switch = get_next_switch(p_lash, sw, output_link);
-
+		sw = get_next_switch(p_lash, sw, output_link);
 	}
 }
 
+/*
+ * A pair can be moved out of lane if it is routed on it and no earlier
+ * attempt to move it out of lane failed since the lanes last changed.
+ */
+static inline int pair_in_lane(lash_t * p_lash, int src, int dest,
+			       unsigned lane)
+{
+	return p_lash->switches[src]->routing_table[dest].lane ==
+	    lane + p_lash->p_osm->subn.opt.lash_start_vl &&
+	    !p_lash->balance_tried[src * p_lash->num_switches + dest];
+}
+
 static int balance_virtual_lanes(lash_t * p_lash, unsigned lanes_needed)
 {
 	unsigned num_switches = p_lash->num_switches;
-	cdg_vertex_t ****cdg_vertex_matrix = p_lash->cdg_vertex_matrix;
 	int *num_mst_in_lane = p_lash->num_mst_in_lane;
-	int ***virtual_location = p_lash->virtual_location;
+	uint8_t *balance_tried = p_lash->balance_tried;
 	int min_filled_lane, max_filled_lane, trials;
 	int old_min_filled_lane, old_max_filled_lane, new_num_min_lane,
 	    new_num_max_lane;
-	unsigned int i, j;
-	int src, dest, start, next_switch, output_link;
-	int next_switch2, output_link2;
-	int stop = 0, cycle_found;
-	int cycle_found2;
+	unsigned int i;
+	int src, dest, start;
+	int stop = 0, cycle_found, new_deps;
 	unsigned start_vl = p_lash->p_osm->subn.opt.lash_start_vl;
 
 	max_filled_lane = 0;
@@ -479,7 +519,7 @@ static int balance_virtual_lanes(lash_t * p_lash, unsigned lanes_needed)
 		src = abs(rand()) % (num_switches);
 		dest = abs(rand()) % (num_switches);
 
-		while (virtual_location[src][dest][max_filled_lane] != 1) {
+		while (!pair_in_lane(p_lash, src, dest, max_filled_lane)) {
 			start = dest;
 			if (dest == num_switches - 1)
 				dest = 0;
@@ -487,15 +527,15 @@ static int balance_virtual_lanes(lash_t * p_lash, unsigned lanes_needed)
 				dest++;
 
 			while (dest != start
-			       && virtual_location[src][dest][max_filled_lane]
-			       != 1) {
+			       && !pair_in_lane(p_lash, src, dest,
+						max_filled_lane)) {
 				if (dest == num_switches - 1)
 					dest = 0;
 				else
 					dest++;
 			}
 
-			if (virtual_location[src][dest][max_filled_lane] != 1) {
+			if (!pair_in_lane(p_lash, src, dest, max_filled_lane)) {
 				if (src == num_switches - 1)
 					src = 0;
 				else
@@ -503,40 +543,22 @@ static int balance_virtual_lanes(lash_t * p_lash, unsigned lanes_needed)
 			}
 		}
 
-		if (generate_cdg_for_sp(p_lash, src, dest, min_filled_lane) ||
-		    generate_cdg_for_sp(p_lash, dest, src, min_filled_lane))
+		new_deps = 0;
+		if (generate_cdg_for_sp(p_lash, src, dest, min_filled_lane,
+					&new_deps) ||
+		    generate_cdg_for_sp(p_lash, dest, src, min_filled_lane,
+					&new_deps))
 			return -1;
 
-		output_link = p_lash->switches[src]->routing_table[dest].out_link;
-		next_switch = get_next_switch(p_lash, src, output_link);
+		cycle_found = new_deps &&
+		    lane_has_cycle(p_lash, src, dest, min_filled_lane);
 
-		output_link2 = p_lash->switches[dest]->routing_table[src].out_link;
-		next_switch2 = get_next_switch(p_lash, dest, output_link2);
-
-		CL_ASSERT(cdg_vertex_matrix[min_filled_lane][src][next_switch] != NULL);
-		CL_ASSERT(cdg_vertex_matrix[min_filled_lane][dest][next_switch2] != NULL);
-
-		cycle_found =
-		    cycle_exists(cdg_vertex_matrix[min_filled_lane][src][next_switch], NULL, NULL,
-				 1);
-		cycle_found2 =
-		    cycle_exists(cdg_vertex_matrix[min_filled_lane][dest][next_switch2], NULL, NULL,
-				 1);
-
-		for (i = 0; i < num_switches; i++)
-			for (j = 0; j < num_switches; j++)
-				if (cdg_vertex_matrix[min_filled_lane][i][j] != NULL) {
-					cdg_vertex_matrix[min_filled_lane][i][j]->visiting_number =
-					    0;
-					cdg_vertex_matrix[min_filled_lane][i][j]->seen = 0;
-				}
-
-		if (cycle_found == 1 || cycle_found2 == 1) {
+		if (cycle_found) {
 			remove_temp_depend_for_sp(p_lash, src, dest, min_filled_lane);
 			remove_temp_depend_for_sp(p_lash, dest, src, min_filled_lane);
 
-			virtual_location[src][dest][max_filled_lane] = 2;
-			virtual_location[dest][src][max_filled_lane] = 2;
+			balance_tried[src * num_switches + dest] = 1;
+			balance_tried[dest * num_switches + src] = 1;
 			trials--;
 			trials--;
 		} else {
@@ -550,10 +572,6 @@ static int balance_virtual_lanes(lash_t * p_lash, unsigned lanes_needed)
 
 			remove_semipermanent_depend_for_sp(p_lash, src, dest, max_filled_lane);
 			remove_semipermanent_depend_for_sp(p_lash, dest, src, max_filled_lane);
-			virtual_location[src][dest][max_filled_lane] = 0;
-			virtual_location[dest][src][max_filled_lane] = 0;
-			virtual_location[src][dest][min_filled_lane] = 1;
-			virtual_location[dest][src][min_filled_lane] = 1;
 			p_lash->switches[src]->routing_table[dest].lane = min_filled_lane + start_vl;
 			p_lash->switches[dest]->routing_table[src].lane = min_filled_lane + start_vl;
 		}
@@ -585,20 +603,14 @@ static int balance_virtual_lanes(lash_t * p_lash, unsigned lanes_needed)
 			}
 		}
 
-		if (old_min_filled_lane != min_filled_lane) {
-			trials = num_mst_in_lane[max_filled_lane];
-			for (i = 0; i < num_switches; i++)
-				for (j = 0; j < num_switches; j++)
-					if (virtual_location[i][j][max_filled_lane] == 2)
-						virtual_location[i][j][max_filled_lane] = 1;
-		}
-
-		if (old_max_filled_lane != max_filled_lane) {
+		/*
+		 * Failed attempts are only ever recorded for the fullest
+		 * lane, so all of them are stale once either lane changes.
+		 */
+		if (old_min_filled_lane != min_filled_lane ||
+		    old_max_filled_lane != max_filled_lane) {
 			trials = num_mst_in_lane[max_filled_lane];
-			for (i = 0; i < num_switches; i++)
-				for (j = 0; j < num_switches; j++)
-					if (virtual_location[i][j][old_max_filled_lane] == 2)
-						virtual_location[i][j][old_max_filled_lane] = 1;
+			memset(balance_tried, 0, num_switches * num_switches);
 		}
 	}
 	return 0;
@@ -660,8 +672,7 @@ static void delete_mesh_switches(lash_t *p_lash)
 
 static void free_lash_structures(lash_t * p_lash)
 {
-	unsigned int i, j, k;
-	unsigned num_switches = p_lash->num_switches;
+	int i;
 	osm_log_t *p_log = &p_lash->p_osm->log;
 
 	OSM_LOG_ENTER(p_log);
@@ -669,99 +680,61 @@ static void free_lash_structures(lash_t * p_lash)
 	delete_mesh_switches(p_lash);
 
 	/* free cdg_vertex_matrix */
-	for (i = 0; i < p_lash->vl_min; i++) {
-		for (j = 0; j < num_switches; j++) {
-			for (k = 0; k < num_switches; k++)
-				if (p_lash->cdg_vertex_matrix[i][j][k])
-					free(p_lash->cdg_vertex_matrix[i][j][k]);
-			if (p_lash->cdg_vertex_matrix[i][j])
-				free(p_lash->cdg_vertex_matrix[i][j]);
-		}
-		if (p_lash->cdg_vertex_matrix[i])
-			free(p_lash->cdg_vertex_matrix[i]);
-	}
-
-	if (p_lash->cdg_vertex_matrix)
+	if (p_lash->cdg_vertex_matrix) {
+		for (i = 0; i < p_lash->vl_min * p_lash->num_channels; i++)
+			if (p_lash->cdg_vertex_matrix[i])
+				free_cdg_vertex(p_lash->cdg_vertex_matrix[i]);
 		free(p_lash->cdg_vertex_matrix);
-
-	/* free virtual_location */
-	for (i = 0; i < num_switches; i++) {
-		for (j = 0; j < num_switches; j++) {
-			if (p_lash->virtual_location[i][j])
-				free(p_lash->virtual_location[i][j]);
-		}
-		if (p_lash->virtual_location[i])
-			free(p_lash->virtual_location[i]);
+		p_lash->cdg_vertex_matrix = NULL;
 	}
-	if (p_lash->virtual_location)
-		free(p_lash->virtual_location);
+
+	free(p_lash->cdg_stack);
+	p_lash->cdg_stack = NULL;
+	free(p_lash->balance_tried);
+	p_lash->balance_tried = NULL;
 
 	OSM_LOG_EXIT(p_log);
 }
 
+/*
+ * The CDG has one vertex per lane and switch to switch channel; the
+ * channels of a switch are its links and are numbered consecutively
+ * from first_channel on.  Must be called once the links are final,
+ * i.e. after the mesh analysis.
+ */
 static int init_lash_structures(lash_t * p_lash)
 {
 	unsigned vl_min = p_lash->vl_min;
 	unsigned num_switches = p_lash->num_switches;
 	osm_log_t *p_log = &p_lash->p_osm->log;
 	int status = 0;
-	unsigned int i, j, k;
+	unsigned int i;
 
 	OSM_LOG_ENTER(p_log);
 
-	/* initialise cdg_vertex_matrix[num_layers][num_switches][num_switches] */
+	p_lash->num_channels = 0;
+	for (i = 0; i < num_switches; i++) {
+		p_lash->switches[i]->first_channel = p_lash->num_channels;
+		p_lash->num_channels += p_lash->switches[i]->node->num_links;
+	}
+
+	/* initialise cdg_vertex_matrix[num_layers][num_channels] */
 	p_lash->cdg_vertex_matrix =
-	    (cdg_vertex_t ****) malloc(vl_min * sizeof(cdg_vertex_t ***));
+	    calloc(vl_min * p_lash->num_channels + 1,
+		   sizeof(p_lash->cdg_vertex_matrix[0]));
 	if (p_lash->cdg_vertex_matrix == NULL)
 		goto Exit_Mem_Error;
-	for (i = 0; i < vl_min; i++) {
-		p_lash->cdg_vertex_matrix[i] =
-		    (cdg_vertex_t ***) malloc(num_switches *
-					      sizeof(cdg_vertex_t **));
-
-		if (p_lash->cdg_vertex_matrix[i] == NULL)
-			goto Exit_Mem_Error;
-	}
 
-	for (i = 0; i < vl_min; i++) {
-		for (j = 0; j < num_switches; j++) {
-			p_lash->cdg_vertex_matrix[i][j] =
-			    (cdg_vertex_t **) malloc(num_switches *
-						     sizeof(cdg_vertex_t *));
-			if (p_lash->cdg_vertex_matrix[i][j] == NULL)
-				goto Exit_Mem_Error;
-
-			for (k = 0; k < num_switches; k++)
-				p_lash->cdg_vertex_matrix[i][j][k] = NULL;
-		}
-	}
-
-	/*
-	 * initialise virtual_location[num_switches][num_switches][num_layers],
-	 * default value = 0
-	 */
-	p_lash->virtual_location =
-	    (int ***)malloc(num_switches * sizeof(int ***));
-	if (p_lash->virtual_location == NULL)
+	p_lash->cdg_stack = malloc((p_lash->num_channels + 1) *
+				   sizeof(p_lash->cdg_stack[0]));
+	if (p_lash->cdg_stack == NULL)
 		goto Exit_Mem_Error;
+	p_lash->cdg_visit = 0;
 
-	for (i = 0; i < num_switches; i++) {
-		p_lash->virtual_location[i] =
-		    (int **)malloc(num_switches * sizeof(int **));
-		if (p_lash->virtual_location[i] == NULL)
-			goto Exit_Mem_Error;
-	}
-
-	for (i = 0; i < num_switches; i++) {
-		for (j = 0; j < num_switches; j++) {
-			p_lash->virtual_location[i][j] =
-			    (int *)malloc(vl_min * sizeof(int *));
-			if (p_lash->virtual_location[i][j] == NULL)
-				goto Exit_Mem_Error;
-			for (k = 0; k < vl_min; k++)
-				p_lash->virtual_location[i][j][k] = 0;
-		}
-	}
+	/* initialise balance_tried[num_switches][num_switches], default 0 */
+	p_lash->balance_tried = calloc(num_switches * num_switches + 1, 1);
+	if (p_lash->balance_tried == NULL)
+		goto Exit_Mem_Error;
 
 	/* initialise num_mst_in_lane[num_switches], default 0 */
 	memset(p_lash->num_mst_in_lane, 0,
@@ -786,24 +759,16 @@ static int lash_core(lash_t * p_lash)
 	unsigned num_switches = p_lash->num_switches;
 	switch_t **switches = p_lash->switches;
 	unsigned lanes_needed = 1;
-	unsigned int i, j, k, dest_switch = 0;
+	unsigned int i, j, dest_switch = 0;
 	reachable_dest_t *dests, *idest;
-	int cycle_found = 0;
+	int cycle_found = 0, new_deps;
 	unsigned v_lane;
-	int stop = 0, output_link, i_next_switch;
-	int output_link2, i_next_switch2;
-	int cycle_found2 = 0;
+	int stop = 0;
 	int status = -1;
-	int *switch_bitmap = NULL;	/* Bitmap to check if we have processed this pair */
 	unsigned start_vl = p_lash->p_osm->subn.opt.lash_start_vl;
 
 	OSM_LOG_ENTER(p_log);
 
-	if (p_lash->p_osm->subn.opt.do_mesh_analysis && osm_do_mesh_analysis(p_lash)) {
-		OSM_LOG(p_log, OSM_LOG_ERROR, "ERR 4D05: Mesh analysis failed\n");
-		goto Exit;
-	}
-
 	for (i = 0; i < num_switches; i++) {
 
 		shortest_path(p_lash, i);
@@ -826,64 +791,28 @@ static int lash_core(lash_t * p_lash)
 		}
 	}
 
-	switch_bitmap = calloc(num_switches * num_switches, sizeof(int));
-	if (!switch_bitmap) {
-		OSM_LOG(p_log, OSM_LOG_ERROR, "ERR 4D04: "
-			"Failed allocating switch_bitmap - out of memory\n");
-		goto Exit;
-	}
-
+	/* a pair is processed once its lane is set in both directions */
 	for (i = 0; i < num_switches; i++) {
 		for (dest_switch = 0; dest_switch < num_switches; dest_switch++)
-			if (dest_switch != i && switch_bitmap[i * num_switches + dest_switch] == 0) {
+			if (dest_switch != i &&
+			    switches[i]->routing_table[dest_switch].lane == NONE) {
 				v_lane = 0;
 				stop = 0;
 				while (v_lane < lanes_needed && stop == 0) {
-					if (generate_cdg_for_sp(p_lash, i, dest_switch, v_lane) ||
-					    generate_cdg_for_sp(p_lash, dest_switch, i, v_lane)) {
+					new_deps = 0;
+					if (generate_cdg_for_sp(p_lash, i, dest_switch, v_lane,
+								&new_deps) ||
+					    generate_cdg_for_sp(p_lash, dest_switch, i, v_lane,
+								&new_deps)) {
 						OSM_LOG(p_log, OSM_LOG_ERROR,
 							"ERR 4D07: generate_cdg_for_sp failed\n");
 						goto Exit;
 					}
 
-					output_link =
-					    switches[i]->routing_table[dest_switch].out_link;
-					output_link2 =
-					    switches[dest_switch]->routing_table[i].out_link;
-
-					i_next_switch = get_next_switch(p_lash, i, output_link);
-					i_next_switch2 = get_next_switch(p_lash, dest_switch, output_link2);
-
-					CL_ASSERT(p_lash->
-						  cdg_vertex_matrix[v_lane][i][i_next_switch] !=
-						  NULL);
-					CL_ASSERT(p_lash->
-						  cdg_vertex_matrix[v_lane][dest_switch]
-						  [i_next_switch2] != NULL);
-
-					cycle_found =
-					    cycle_exists(p_lash->
-							 cdg_vertex_matrix[v_lane][i]
-							 [i_next_switch], NULL, NULL, 1);
-					cycle_found2 =
-					    cycle_exists(p_lash->
-							 cdg_vertex_matrix[v_lane][dest_switch]
-							 [i_next_switch2], NULL, NULL, 1);
-
-					for (j = 0; j < num_switches; j++)
-						for (k = 0; k < num_switches; k++)
-							if (p_lash->
-							    cdg_vertex_matrix[v_lane][j][k] !=
-							    NULL) {
-								p_lash->
-								    cdg_vertex_matrix[v_lane][j]
-								    [k]->visiting_number = 0;
-								p_lash->
-								    cdg_vertex_matrix[v_lane][j]
-								    [k]->seen = 0;
-							}
-
-					if (cycle_found == 1 || cycle_found2 == 1) {
+					cycle_found = new_deps &&
+					    lane_has_cycle(p_lash, i, dest_switch, v_lane);
+
+					if (cycle_found) {
 						remove_temp_depend_for_sp(p_lash, i, dest_switch,
 									  v_lane);
 						remove_temp_depend_for_sp(p_lash, dest_switch, i,
@@ -905,12 +834,18 @@ static int lash_core(lash_t * p_lash)
 				switches[i]->routing_table[dest_switch].lane = v_lane + start_vl;
 				switches[dest_switch]->routing_table[i].lane = v_lane + start_vl;
 
-				if (cycle_found == 1 || cycle_found2 == 1) {
+				if (cycle_found) {
 					if (++lanes_needed > p_lash->vl_min)
 						goto Error_Not_Enough_Lanes;
 
-					if (generate_cdg_for_sp(p_lash, i, dest_switch, v_lane) ||
-					    generate_cdg_for_sp(p_lash, dest_switch, i, v_lane)) {
+					/*
+					 * The new lane is empty and the two paths
+					 * share no channel, so it stays acyclic.
+					 */
+					if (generate_cdg_for_sp(p_lash, i, dest_switch, v_lane,
+								&new_deps) ||
+					    generate_cdg_for_sp(p_lash, dest_switch, i, v_lane,
+								&new_deps)) {
 						OSM_LOG(p_log, OSM_LOG_ERROR,
 							"ERR 4D08: generate_cdg_for_sp failed\n");
 						goto Exit;
@@ -924,11 +859,6 @@ static int lash_core(lash_t * p_lash)
 					p_lash->num_mst_in_lane[v_lane]++;
 					p_lash->num_mst_in_lane[v_lane]++;
 				}
-				p_lash->virtual_location[i][dest_switch][v_lane] = 1;
-				p_lash->virtual_location[dest_switch][i][v_lane] = 1;
-
-				switch_bitmap[i * num_switches + dest_switch] = 1;
-				switch_bitmap[dest_switch * num_switches + i] = 1;
 			}
 	}
 
@@ -957,8 +887,6 @@ Error_Not_Enough_Lanes:
 		" with starting lane (%d)\n",
 		lanes_needed, p_lash->vl_min, start_vl);
 Exit:
-	if (switch_bitmap)
-		free(switch_bitmap);
 	OSM_LOG_EXIT(p_log);
 	return status;
 }
@@ -1230,12 +1158,19 @@ static int lash_process(void *context)
 	if (status)
 		goto Exit;
 
+	process_switches(p_lash);
+
+	if (p_lash->p_osm->subn.opt.do_mesh_analysis &&
+	    osm_do_mesh_analysis(p_lash)) {
+		OSM_LOG(p_log, OSM_LOG_ERROR, "ERR 4D05: Mesh analysis failed\n");
+		status = -1;
+		goto Exit;
+	}
+
 	status = init_lash_structures(p_lash);
 	if (status)
 		goto Exit;
 
-	process_switches(p_lash);
-
 	status = lash_core(p_lash);
 	if (status)
 		goto Exit;
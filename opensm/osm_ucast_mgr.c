@@ -51,6 +51,8 @@
 #include <complib/cl_qmap.h>
 #include <complib/cl_debug.h>
 #include <complib/cl_qlist.h>
+#include <complib/cl_thread.h>
+#include <complib/cl_atomic.h>
 #include <opensm/osm_file_ids.h>
 #define FILE_ID OSM_FILE_UCAST_MGR_C
 #include <opensm/osm_ucast_mgr.h>
@@ -67,6 +69,13 @@ void osm_ucast_mgr_construct(IN osm_ucast_mgr_t * p_mgr)
 	memset(p_mgr, 0, sizeof(*p_mgr));
 }
 
+static void ucast_mgr_free_dest_trees(IN osm_ucast_mgr_t * p_mgr)
+{
+	free(p_mgr->dest_trees.sw_idx);
+	free(p_mgr->dest_trees.paths);
+	memset(&p_mgr->dest_trees, 0, sizeof(p_mgr->dest_trees));
+}
+
 void osm_ucast_mgr_destroy(IN osm_ucast_mgr_t * p_mgr)
 {
 	CL_ASSERT(p_mgr);
@@ -76,6 +85,9 @@ void osm_ucast_mgr_destroy(IN osm_ucast_mgr_t * p_mgr)
 	if (p_mgr->cache_valid)
 		osm_ucast_cache_invalidate(p_mgr);
 
+	osm_ucast_mgr_incr_invalidate(p_mgr);
+	ucast_mgr_free_dest_trees(p_mgr);
+
 	OSM_LOG_EXIT(p_mgr->p_log);
 }
 
@@ -94,85 +106,408 @@ ib_api_status_t osm_ucast_mgr_init(IN osm_ucast_mgr_t * p_mgr, IN osm_sm_t * sm)
 
 	if (sm->p_subn->opt.use_ucast_cache)
 		cl_qmap_init(&p_mgr->cache_sw_tbl);
+	cl_qmap_init(&p_mgr->incr_sw_tbl);
 
 	OSM_LOG_EXIT(p_mgr->p_log);
 	return status;
 }
 
 /**********************************************************************
- Add each switch's own and neighbor LIDs to its LID matrix
+ Parallel routing steps
 **********************************************************************/
-static void ucast_mgr_process_hop_0_1(IN cl_map_item_t * p_map_item,
-				      IN void *context)
+typedef struct ucast_mgr_parallel {
+	osm_ucast_work_fn_t pfn_work;
+	void *context;
+	unsigned num_items;
+	atomic32_t next_item;
+} ucast_mgr_parallel_t;
+
+typedef struct ucast_mgr_worker {
+	ucast_mgr_parallel_t *p_par;
+	unsigned worker;
+	cl_thread_t thread;
+} ucast_mgr_worker_t;
+
+static void ucast_mgr_worker(IN void *context)
 {
-	osm_switch_t * p_sw = (osm_switch_t *) p_map_item;
-	osm_node_t *p_remote_node;
-	uint16_t lid, remote_lid;
-	uint8_t i;
-
-	lid = cl_ntoh16(osm_node_get_base_lid(p_sw->p_node, 0));
-	osm_switch_set_hops(p_sw, lid, 0, 0);
-
-	for (i = 1; i < p_sw->num_ports; i++) {
-		osm_physp_t *p = osm_node_get_physp_ptr(p_sw->p_node, i);
-		p_remote_node = (p && p->p_remote_physp) ?
-		    p->p_remote_physp->p_node : NULL;
-
-		if (p_remote_node && p_remote_node->sw &&
-		    p_remote_node != p_sw->p_node) {
-			remote_lid = osm_node_get_base_lid(p_remote_node, 0);
-			remote_lid = cl_ntoh16(remote_lid);
-			osm_switch_set_hops(p_sw, remote_lid, i, p->hop_wf);
+	ucast_mgr_worker_t *w = context;
+	ucast_mgr_parallel_t *p_par = w->p_par;
+	unsigned item;
+
+	while ((item = (unsigned)cl_atomic_inc(&p_par->next_item) - 1) <
+	       p_par->num_items)
+		p_par->pfn_work(p_par->context, item, w->worker);
+}
+
+unsigned osm_ucast_mgr_num_workers(IN const osm_ucast_mgr_t * p_mgr)
+{
+	unsigned num = p_mgr->p_subn->opt.routing_threads;
+
+	if (!num)
+		num = cl_proc_count();
+	return num ? num : 1;
+}
+
+void osm_ucast_mgr_parallel_for(IN osm_ucast_mgr_t * p_mgr,
+				IN unsigned num_items,
+				IN unsigned num_workers,
+				IN osm_ucast_work_fn_t pfn_work,
+				IN void *context)
+{
+	ucast_mgr_parallel_t par;
+	ucast_mgr_worker_t *workers = NULL;
+	unsigned i;
+
+	if (num_workers > num_items)
+		num_workers = num_items;
+	if (num_workers > 1)
+		workers = calloc(num_workers, sizeof(*workers));
+	if (!workers) {
+		for (i = 0; i < num_items; i++)
+			pfn_work(context, i, 0);
+		return;
+	}
+
+	par.pfn_work = pfn_work;
+	par.context = context;
+	par.num_items = num_items;
+	par.next_item = 0;
+
+	for (i = 0; i < num_workers; i++) {
+		workers[i].p_par = &par;
+		workers[i].worker = i;
+		cl_thread_construct(&workers[i].thread);
+	}
+
+	/* the calling thread is worker 0 */
+	for (i = 1; i < num_workers; i++) {
+		if (cl_thread_init(&workers[i].thread, ucast_mgr_worker,
+				   &workers[i], "opensm router") != CL_SUCCESS) {
+			OSM_LOG(p_mgr->p_log, OSM_LOG_ERROR, "ERR 3A13: "
+				"cannot start routing thread, "
+				"continuing with %u threads\n", i);
+			break;
 		}
 	}
+
+	ucast_mgr_worker(&workers[0]);
+
+	for (i = 1; i < num_workers; i++)
+		cl_thread_destroy(&workers[i].thread);
+	free(workers);
+}
+
+/**********************************************************************
+ Compact view of the switch graph used to build the LID matrices.
+ Links are grouped by the switch they lead to (CSR layout), so the
+ switches which can forward to a given switch are found directly.
+**********************************************************************/
+#define LID_MATRIX_NONE 0xFFFFFFFF
+
+typedef struct lid_matrix_link {
+	uint32_t sw_idx;
+	uint8_t port_num;
+	uint8_t hop_wf;
+	uint8_t healthy;
+} lid_matrix_link_t;
+
+typedef struct lid_matrix_graph {
+	unsigned num_sw;
+	osm_switch_t **sw;
+	uint32_t *in_start;
+	lid_matrix_link_t *in;
+} lid_matrix_graph_t;
+
+typedef struct lid_matrix_scratch {
+	uint32_t bucket[OSM_NO_PATH];
+	uint8_t *dist;
+	uint32_t *node;
+	uint32_t *next;
+} lid_matrix_scratch_t;
+
+typedef struct lid_matrix_work {
+	osm_ucast_mgr_t *p_mgr;
+	const lid_matrix_graph_t *g;
+	const uint32_t *dests;
+	lid_matrix_scratch_t *scratch;
+} lid_matrix_work_t;
+
+static int lid_matrix_sw_cmp(const void *a, const void *b)
+{
+	const osm_switch_t *sa = *(osm_switch_t * const *)a;
+	const osm_switch_t *sb = *(osm_switch_t * const *)b;
+
+	return sa < sb ? -1 : sa > sb ? 1 : 0;
 }
 
-static void ucast_mgr_process_neighbor(IN osm_ucast_mgr_t * p_mgr,
-				       IN osm_switch_t * p_this_sw,
-				       IN osm_switch_t * p_remote_sw,
-				       IN uint8_t port_num,
-				       IN uint8_t remote_port_num)
+static int lid_matrix_sw_idx(IN const lid_matrix_graph_t * g,
+			     IN osm_switch_t * p_sw)
 {
-	osm_switch_t *p_sw;
+	osm_switch_t **p;
+
+	p = bsearch(&p_sw, g->sw, g->num_sw, sizeof(g->sw[0]),
+		    lid_matrix_sw_cmp);
+	return p ? (int)(p - g->sw) : -1;
+}
+
+static osm_switch_t *lid_matrix_remote_sw(IN osm_switch_t * p_sw,
+					  IN uint8_t port_num)
+{
+	osm_node_t *p_remote_node;
+	uint8_t remote_port_num;
+
+	p_remote_node = osm_node_get_remote_node(p_sw->p_node, port_num,
+						 &remote_port_num);
+	if (!p_remote_node || !p_remote_node->sw ||
+	    p_remote_node == p_sw->p_node)
+		return NULL;
+	return p_remote_node->sw;
+}
+
+static void lid_matrix_graph_free(IN lid_matrix_graph_t * g)
+{
+	free(g->sw);
+	free(g->in_start);
+	free(g->in);
+	memset(g, 0, sizeof(*g));
+}
+
+static int lid_matrix_graph_build(IN osm_ucast_mgr_t * p_mgr,
+				  OUT lid_matrix_graph_t * g)
+{
+	cl_qmap_t *p_sw_tbl = &p_mgr->p_subn->sw_guid_tbl;
 	cl_map_item_t *item;
-	uint16_t lid_ho;
-	uint16_t hops;
+	osm_switch_t *p_sw, *p_remote_sw;
 	osm_physp_t *p;
+	unsigned i, num_links = 0;
+	uint32_t *fill = NULL;
+	uint8_t port_num;
+	int idx;
+
+	memset(g, 0, sizeof(*g));
+	g->num_sw = cl_qmap_count(p_sw_tbl);
+
+	g->sw = malloc(g->num_sw * sizeof(g->sw[0]));
+	g->in_start = calloc(g->num_sw + 1, sizeof(g->in_start[0]));
+	fill = calloc(g->num_sw, sizeof(fill[0]));
+	if (!g->sw || !g->in_start || !fill)
+		goto Error;
+
+	for (i = 0, item = cl_qmap_head(p_sw_tbl); item != cl_qmap_end(p_sw_tbl);
+	     item = cl_qmap_next(item))
+		g->sw[i++] = (osm_switch_t *) item;
+	qsort(g->sw, g->num_sw, sizeof(g->sw[0]), lid_matrix_sw_cmp);
+
+	/* count the links leading to each switch */
+	for (i = 0; i < g->num_sw; i++)
+		for (port_num = 1; port_num < g->sw[i]->num_ports; port_num++) {
+			p_remote_sw = lid_matrix_remote_sw(g->sw[i], port_num);
+			if (!p_remote_sw ||
+			    (idx = lid_matrix_sw_idx(g, p_remote_sw)) < 0)
+				continue;
+			g->in_start[idx + 1]++;
+			num_links++;
+		}
+	for (i = 0; i < g->num_sw; i++)
+		g->in_start[i + 1] += g->in_start[i];
+
+	g->in = malloc((num_links ? num_links : 1) * sizeof(g->in[0]));
+	if (!g->in)
+		goto Error;
+
+	for (i = 0; i < g->num_sw; i++) {
+		p_sw = g->sw[i];
+		for (port_num = 1; port_num < p_sw->num_ports; port_num++) {
+			p_remote_sw = lid_matrix_remote_sw(p_sw, port_num);
+			if (!p_remote_sw ||
+			    (idx = lid_matrix_sw_idx(g, p_remote_sw)) < 0)
+				continue;
+			p = osm_node_get_physp_ptr(p_sw->p_node, port_num);
+			g->in[g->in_start[idx] + fill[idx]].sw_idx = i;
+			g->in[g->in_start[idx] + fill[idx]].port_num = port_num;
+			g->in[g->in_start[idx] + fill[idx]].hop_wf = p->hop_wf;
+			g->in[g->in_start[idx] + fill[idx]].healthy =
+			    osm_link_is_healthy(p) ? 1 : 0;
+			fill[idx]++;
+		}
+	}
 
-	OSM_LOG_ENTER(p_mgr->p_log);
+	free(fill);
+	return 0;
 
-	OSM_LOG(p_mgr->p_log, OSM_LOG_DEBUG,
-		"Node 0x%" PRIx64 ", remote node 0x%" PRIx64
-		", port %u, remote port %u\n",
-		cl_ntoh64(osm_node_get_node_guid(p_this_sw->p_node)),
-		cl_ntoh64(osm_node_get_node_guid(p_remote_sw->p_node)),
-		port_num, remote_port_num);
+Error:
+	free(fill);
+	lid_matrix_graph_free(g);
+	return -1;
+}
 
-	p = osm_node_get_physp_ptr(p_this_sw->p_node, port_num);
+/**********************************************************************
+ Computes the least weighted hop count of every switch to the switch
+ dest_idx and fills the LID matrices for its base LID accordingly.
+ Hop weights are 1..255 and the counts are bounded by OSM_NO_PATH, so
+ a bucket queue (Dial's algorithm) is used, which reduces to a plain
+ BFS with the default weights.
+ As with the neighbor based propagation this replaces, unhealthy links
+ are only used to reach directly attached destinations.
+**********************************************************************/
+static void lid_matrix_process_dest(IN osm_ucast_mgr_t * p_mgr,
+				    IN const lid_matrix_graph_t * g,
+				    IN unsigned dest_idx,
+				    IN lid_matrix_scratch_t * scratch)
+{
+	osm_switch_t *p_dest_sw = g->sw[dest_idx];
+	uint32_t *bucket = scratch->bucket, *node = scratch->node;
+	uint32_t *next = scratch->next;
+	uint8_t *dist = scratch->dist;
+	const lid_matrix_link_t *l;
+	uint16_t lid_ho;
+	unsigned d, i, j, hops, num_ent = 0;
+	uint32_t ent, u;
 
-	for (item = cl_qmap_head(&p_mgr->p_subn->sw_guid_tbl);
-	     item != cl_qmap_end(&p_mgr->p_subn->sw_guid_tbl);
-	     item = cl_qmap_next(item)) {
-		p_sw = (osm_switch_t *) item;
-		lid_ho = cl_ntoh16(osm_node_get_base_lid(p_sw->p_node, 0));
-		hops = osm_switch_get_least_hops(p_remote_sw, lid_ho);
-		if (hops == OSM_NO_PATH)
+	lid_ho = cl_ntoh16(osm_node_get_base_lid(p_dest_sw->p_node, 0));
+	if (!lid_ho)
+		return;
+
+	memset(dist, OSM_NO_PATH, g->num_sw);
+	for (d = 0; d < OSM_NO_PATH; d++)
+		bucket[d] = LID_MATRIX_NONE;
+
+	dist[dest_idx] = 0;
+	node[num_ent] = dest_idx;
+	next[num_ent] = bucket[0];
+	bucket[0] = num_ent++;
+
+	for (d = 0; d < OSM_NO_PATH; d++)
+		while ((ent = bucket[d]) != LID_MATRIX_NONE) {
+			bucket[d] = next[ent];
+			u = node[ent];
+			if (dist[u] != d)
+				continue;
+			for (j = g->in_start[u]; j < g->in_start[u + 1]; j++) {
+				l = &g->in[j];
+				if (!l->healthy && u != dest_idx)
+					continue;
+				hops = d + l->hop_wf;
+				if (hops >= dist[l->sw_idx])
+					continue;
+				dist[l->sw_idx] = (uint8_t) hops;
+				node[num_ent] = l->sw_idx;
+				next[num_ent] = bucket[hops];
+				bucket[hops] = num_ent++;
+			}
+		}
+
+	osm_switch_set_hops(p_dest_sw, lid_ho, 0, 0);
+
+	for (i = 0; i < g->num_sw; i++) {
+		if (dist[i] == OSM_NO_PATH)
 			continue;
-		hops += p->hop_wf;
-		if (hops <
-		    osm_switch_get_hop_count(p_this_sw, lid_ho, port_num)) {
-			if (osm_switch_set_hops
-			    (p_this_sw, lid_ho, port_num, (uint8_t) hops) != 0)
+		for (j = g->in_start[i]; j < g->in_start[i + 1]; j++) {
+			l = &g->in[j];
+			if (!l->healthy && i != dest_idx)
+				continue;
+			hops = dist[i] + l->hop_wf;
+			if (hops >= OSM_NO_PATH)
+				continue;
+			if (osm_switch_set_hops(g->sw[l->sw_idx], lid_ho,
+						l->port_num, (uint8_t) hops))
 				OSM_LOG(p_mgr->p_log, OSM_LOG_ERROR, "ERR 3A03: "
 					"cannot set hops for lid %u at switch 0x%"
 					PRIx64 "\n", lid_ho,
 					cl_ntoh64(osm_node_get_node_guid
-						  (p_this_sw->p_node)));
-			p_mgr->some_hop_count_set = TRUE;
+						  (g->sw[l->sw_idx]->p_node)));
 		}
 	}
+}
 
-	OSM_LOG_EXIT(p_mgr->p_log);
+static void lid_matrix_work(IN void *context, IN unsigned item,
+			    IN unsigned worker)
+{
+	lid_matrix_work_t *work = context;
+	const lid_matrix_graph_t *g = work->g;
+	uint16_t lid_ho;
+	unsigned i;
+
+	if (work->dests) {
+		/* recomputed destinations start from empty rows */
+		item = work->dests[item];
+		lid_ho = cl_ntoh16(osm_node_get_base_lid(g->sw[item]->p_node,
+							  0));
+		for (i = 0; i < g->num_sw; i++)
+			osm_switch_clear_lid_hops(g->sw[i], lid_ho);
+	}
+
+	lid_matrix_process_dest(work->p_mgr, g, item, &work->scratch[worker]);
+}
+
+/**********************************************************************
+ Fills the LID matrices for the destination switches dests (all the
+ switches of the graph if NULL), using up to routing_threads threads.
+**********************************************************************/
+static int lid_matrix_process_dests(IN osm_ucast_mgr_t * p_mgr,
+				    IN const lid_matrix_graph_t * g,
+				    IN const uint32_t * dests,
+				    IN unsigned num_dests)
+{
+	lid_matrix_work_t work;
+	lid_matrix_scratch_t *scratch;
+	unsigned i, num_ent, num_workers;
+	int ret = -1;
+
+	num_workers = osm_ucast_mgr_num_workers(p_mgr);
+	if (num_workers > 1 && p_mgr->p_subn->opt.packed_lid_matrix) {
+		/* widening a packed matrix reallocates every row */
+		OSM_LOG(p_mgr->p_log, OSM_LOG_VERBOSE,
+			"Packed LID matrices in use, "
+			"computing min-hop tables on a single thread\n");
+		num_workers = 1;
+	}
+	if (num_workers > num_dests)
+		num_workers = num_dests;
+	if (!num_workers)
+		return 0;
+	scratch = calloc(num_workers, sizeof(*scratch));
+	if (!scratch)
+		return -1;
+
+	/*
+	   One bucket queue entry per relaxed link, plus the destination.
+	 */
+	num_ent = g->in_start[g->num_sw] + 1;
+	for (i = 0; i < num_workers; i++) {
+		scratch[i].dist = malloc(g->num_sw);
+		scratch[i].node = malloc(num_ent * sizeof(scratch[i].node[0]));
+		scratch[i].next = malloc(num_ent * sizeof(scratch[i].next[0]));
+		if (!scratch[i].dist || !scratch[i].node || !scratch[i].next)
+			goto Exit;
+	}
+
+	/*
+	   Fill the matrices of every switch with the hop counts to
+	   each switch's own port 0 LID, one destination at a time.
+	   Destinations only touch their own LID rows, so they are
+	   processed in parallel.
+	 */
+	work.p_mgr = p_mgr;
+	work.g = g;
+	work.dests = dests;
+	work.scratch = scratch;
+	osm_ucast_mgr_parallel_for(p_mgr, num_dests, num_workers,
+				   lid_matrix_work, &work);
+
+	OSM_LOG(p_mgr->p_log, OSM_LOG_DEBUG,
+		"Min-hop tables built for %u of %u switches and %u links "
+		"by %u threads\n", num_dests, g->num_sw,
+		g->in_start[g->num_sw], num_workers);
+	ret = 0;
+Exit:
+	for (i = 0; i < num_workers; i++) {
+		free(scratch[i].dist);
+		free(scratch[i].node);
+		free(scratch[i].next);
+	}
+	free(scratch);
+	return ret;
 }
 
 static struct osm_remote_node *find_and_add_remote_sys(osm_switch_t * sw,
@@ -372,7 +707,12 @@ static void ucast_mgr_process_tbl(IN cl_map_item_t * p_map_item,
 	/* Initialize LIDs in buffer to invalid port number. */
 	memset(p_sw->new_lft, OSM_NO_PATH, p_sw->max_lid_ho + 1);
 
-	alloc_ports_priv(p_mgr);
+	/*
+	   Remote systems are only tracked (and the tracking is only
+	   used) by the LMC aware path selection.
+	 */
+	if (p_mgr->p_subn->opt.lmc)
+		alloc_ports_priv(p_mgr);
 
 	/*
 	   Iterate through every port setting LID routes for each
@@ -389,59 +729,23 @@ static void ucast_mgr_process_tbl(IN cl_map_item_t * p_map_item,
 		}
 	}
 
-	free_ports_priv(p_mgr);
+	if (p_mgr->p_subn->opt.lmc)
+		free_ports_priv(p_mgr);
 
 	OSM_LOG_EXIT(p_mgr->p_log);
 }
 
-static void ucast_mgr_process_neighbors(IN cl_map_item_t * p_map_item,
-					IN void *context)
-{
-	osm_switch_t * p_sw = (osm_switch_t *) p_map_item;
-	osm_ucast_mgr_t * p_mgr = context;
-	osm_node_t *p_node;
-	osm_node_t *p_remote_node;
-	uint32_t port_num;
-	uint8_t remote_port_num;
-	uint32_t num_ports;
-	osm_physp_t *p_physp;
-
-	OSM_LOG_ENTER(p_mgr->p_log);
-
-	p_node = p_sw->p_node;
-
-	CL_ASSERT(p_node);
-	CL_ASSERT(osm_node_get_type(p_node) == IB_NODE_TYPE_SWITCH);
-
-	OSM_LOG(p_mgr->p_log, OSM_LOG_DEBUG,
-		"Processing switch with GUID 0x%" PRIx64 "\n",
-		cl_ntoh64(osm_node_get_node_guid(p_node)));
-
-	num_ports = osm_node_get_num_physp(p_node);
-
-	/*
-	   Start with port 1 to skip the switch's management port.
-	 */
-	for (port_num = 1; port_num < num_ports; port_num++) {
-		p_remote_node = osm_node_get_remote_node(p_node,
-							 (uint8_t) port_num,
-							 &remote_port_num);
-		if (p_remote_node && p_remote_node->sw
-		    && (p_remote_node != p_node)) {
-			/* make sure the link is healthy. If it is not - don't
-			   propagate through it. */
-			p_physp = osm_node_get_physp_ptr(p_node, port_num);
-			if (!p_physp || !osm_link_is_healthy(p_physp))
-				continue;
+typedef struct ucast_mgr_lft_work {
+	osm_ucast_mgr_t *p_mgr;
+	cl_map_item_t **sw;
+} ucast_mgr_lft_work_t;
 
-			ucast_mgr_process_neighbor(p_mgr, p_sw,
-						   p_remote_node->sw,
-						   (uint8_t) port_num,
-						   remote_port_num);
-		}
-	}
+static void ucast_mgr_lft_work(IN void *context, IN unsigned item,
+			       IN unsigned worker)
+{
+	ucast_mgr_lft_work_t *work = context;
 
-	OSM_LOG_EXIT(p_mgr->p_log);
+	ucast_mgr_process_tbl(work->sw[item], work->p_mgr);
 }
 
 static int set_hop_wf(void *ctx, uint64_t guid, char *p)
@@ -595,9 +899,9 @@ static int set_search_ordering_ports(void *ctx, uint64_t guid, char *p)
 
 int osm_ucast_mgr_build_lid_matrices(IN osm_ucast_mgr_t * p_mgr)
 {
-	uint32_t i;
-	uint32_t iteration_max;
+	lid_matrix_graph_t g;
 	cl_qmap_t *p_sw_guid_tbl;
+	int ret = 0;
 
 	p_sw_guid_tbl = &p_mgr->p_subn->sw_guid_tbl;
 
@@ -621,75 +925,63 @@ int osm_ucast_mgr_build_lid_matrices(IN osm_ucast_mgr_t * p_mgr)
 	}
 
 	/*
-	   Set the switch matrices for each switch's own port 0 LID(s)
-	   then set the lid matrices for the each switch's leaf nodes.
-	 */
-	cl_qmap_apply_func(p_sw_guid_tbl, ucast_mgr_process_hop_0_1, p_mgr);
-
-	/*
-	   Get the switch matrices for each switch's neighbors.
-	   This process requires a number of iterations equal to
-	   the number of switches in the subnet minus 1.
-
-	   In each iteration, a switch learns the lid/port/hop
-	   information (as contained by a switch's lid matrix) from
-	   its immediate neighbors.  After each iteration, a switch
-	   (and it's neighbors) know more routing information than
-	   it did on the previous iteration.
-	   Thus, by repeatedly absorbing the routing information of
-	   neighbor switches, every switch eventually learns how to
-	   route all LIDs on the subnet.
-
 	   Note that there may not be any switches in the subnet if
 	   we are in simple p2p configuration.
 	 */
-	iteration_max = cl_qmap_count(p_sw_guid_tbl);
-
-	/*
-	   If there are switches in the subnet, iterate until the lid
-	   matrix has been constructed.  Otherwise, just immediately
-	   indicate we're done if no switches exist.
-	 */
-	if (iteration_max) {
-		iteration_max--;
+	if (!cl_qmap_count(p_sw_guid_tbl))
+		return 0;
 
-		/*
-		   we need to find out when the propagation of
-		   hop counts has relaxed. So this global variable
-		   is preset to 0 on each iteration and if
-		   if non of the switches was set will exit the
-		   while loop
-		 */
-		p_mgr->some_hop_count_set = TRUE;
-		for (i = 0; (i < iteration_max) && p_mgr->some_hop_count_set;
-		     i++) {
-			p_mgr->some_hop_count_set = FALSE;
-			cl_qmap_apply_func(p_sw_guid_tbl,
-					   ucast_mgr_process_neighbors, p_mgr);
-		}
-		OSM_LOG(p_mgr->p_log, OSM_LOG_DEBUG,
-			"Min-hop propagated in %d steps\n", i);
+	if (lid_matrix_graph_build(p_mgr, &g) ||
+	    lid_matrix_process_dests(p_mgr, &g, NULL, g.num_sw)) {
+		OSM_LOG(p_mgr->p_log, OSM_LOG_ERROR, "ERR 3A12: "
+			"cannot allocate memory for min-hop tables "
+			"calculation\n");
+		ret = -1;
 	}
 
-	return 0;
+	lid_matrix_graph_free(&g);
+	return ret;
 }
 
 static int ucast_mgr_setup_all_switches(osm_subn_t * p_subn)
 {
 	osm_switch_t *p_sw;
-	uint16_t lids;
+	uint16_t *sw_lids;
+	uint16_t lids, num_sw_lids = 0;
 
 	lids = (uint16_t) cl_ptr_vector_get_size(&p_subn->port_lid_tbl);
 	lids = lids ? lids - 1 : 0;
 
+	/*
+	   Min-hop tables hold the switch LIDs only (CA LIDs are routed
+	   through the LID of their switch), so only these get a LID
+	   matrix row up front.  Engines which store hop counts to other
+	   LIDs add rows as they go.
+	 */
+	sw_lids = malloc((cl_qmap_count(&p_subn->sw_guid_tbl) + 1) *
+			 sizeof(sw_lids[0]));
+	if (!sw_lids) {
+		OSM_LOG(&p_subn->p_osm->log, OSM_LOG_ERROR, "ERR 3A16: "
+			"cannot allocate switch LID list\n");
+		return -1;
+	}
+	for (p_sw = (osm_switch_t *) cl_qmap_head(&p_subn->sw_guid_tbl);
+	     p_sw != (osm_switch_t *) cl_qmap_end(&p_subn->sw_guid_tbl);
+	     p_sw = (osm_switch_t *) cl_qmap_next(&p_sw->map_item))
+		sw_lids[num_sw_lids++] =
+		    cl_ntoh16(osm_node_get_base_lid(p_sw->p_node, 0));
+
 	for (p_sw = (osm_switch_t *) cl_qmap_head(&p_subn->sw_guid_tbl);
 	     p_sw != (osm_switch_t *) cl_qmap_end(&p_subn->sw_guid_tbl);
 	     p_sw = (osm_switch_t *) cl_qmap_next(&p_sw->map_item)) {
-		if (osm_switch_prepare_path_rebuild(p_sw, lids)) {
+		if (osm_switch_prepare_path_rebuild(p_sw, lids,
+						    p_subn->opt.packed_lid_matrix,
+						    sw_lids, num_sw_lids)) {
 			OSM_LOG(&p_subn->p_osm->log, OSM_LOG_ERROR, "ERR 3A0B: "
 				"cannot setup switch 0x%016" PRIx64 "\n",
 				cl_ntoh64(osm_node_get_node_guid
 					  (p_sw->p_node)));
+			free(sw_lids);
 			return -1;
 		}
 		if (p_sw->search_ordering_ports) {
@@ -697,6 +989,7 @@ static int ucast_mgr_setup_all_switches(osm_subn_t * p_subn)
 			p_sw->search_ordering_ports = NULL;
 		}
 	}
+	free(sw_lids);
 
 	if (p_subn->opt.port_search_ordering_file) {
 		OSM_LOG(&p_subn->p_osm->log, OSM_LOG_DEBUG,
@@ -857,6 +1150,46 @@ static void sort_ports_by_switch_load(osm_ucast_mgr_t * m)
 	free(s);
 }
 
+/**********************************************************************
+ Each switch selects its ports from its own LID matrix, port profiles
+ and LFT only, so switches can be processed in parallel with the same
+ result. The exceptions are LMC aware routing, which tracks remote
+ systems per end port, and scatter_ports, which draws from the global
+ random() sequence.
+**********************************************************************/
+static void ucast_mgr_process_tbls(IN osm_ucast_mgr_t * p_mgr)
+{
+	cl_qmap_t *p_sw_tbl = &p_mgr->p_subn->sw_guid_tbl;
+	ucast_mgr_lft_work_t work;
+	cl_map_item_t *item;
+	unsigned i, num_sw, num_workers;
+
+	num_workers = osm_ucast_mgr_num_workers(p_mgr);
+	if (num_workers > 1 &&
+	    (p_mgr->p_subn->opt.lmc || p_mgr->p_subn->opt.scatter_ports)) {
+		OSM_LOG(p_mgr->p_log, OSM_LOG_VERBOSE,
+			"LMC or scatter_ports in use, "
+			"computing LFTs on a single thread\n");
+		num_workers = 1;
+	}
+
+	num_sw = cl_qmap_count(p_sw_tbl);
+	if (num_workers <= 1 || num_sw <= 1 ||
+	    !(work.sw = malloc(num_sw * sizeof(work.sw[0])))) {
+		cl_qmap_apply_func(p_sw_tbl, ucast_mgr_process_tbl, p_mgr);
+		return;
+	}
+
+	for (i = 0, item = cl_qmap_head(p_sw_tbl); item != cl_qmap_end(p_sw_tbl);
+	     item = cl_qmap_next(item))
+		work.sw[i++] = item;
+	work.p_mgr = p_mgr;
+
+	osm_ucast_mgr_parallel_for(p_mgr, num_sw, num_workers,
+				   ucast_mgr_lft_work, &work);
+	free(work.sw);
+}
+
 static int ucast_mgr_build_lfts(osm_ucast_mgr_t * p_mgr)
 {
 	cl_qlist_init(&p_mgr->port_order_list);
@@ -888,8 +1221,7 @@ static int ucast_mgr_build_lfts(osm_ucast_mgr_t * p_mgr)
 	cl_qmap_apply_func(&p_mgr->p_subn->port_guid_tbl,
 			   add_port_to_order_list, p_mgr);
 
-	cl_qmap_apply_func(&p_mgr->p_subn->sw_guid_tbl, ucast_mgr_process_tbl,
-			   p_mgr);
+	ucast_mgr_process_tbls(p_mgr);
 
 	cl_qlist_remove_all(&p_mgr->port_order_list);
 
@@ -1057,6 +1389,790 @@ void osm_ucast_mgr_set_fwd_tables(osm_ucast_mgr_t * p_mgr)
 	ucast_mgr_pipeline_fwd_tbl(p_mgr);
 }
 
+#define DEST_TREE_MAX_HOPS 64
+
+enum dest_tree_state {
+	DEST_TREE_UNKNOWN = 0,
+	DEST_TREE_VISITING,
+	DEST_TREE_DONE
+};
+
+static int dest_tree_p0_extended(IN const osm_node_t * p_node)
+{
+	const osm_physp_t *p_physp0;
+
+	p_physp0 = osm_node_get_physp_ptr((osm_node_t *) p_node, 0);
+	return p_physp0->port_info.capability_mask & IB_PORT_CAP_HAS_EXT_SPEEDS;
+}
+
+/*
+  Accounts a port in the path MTU and rate. Switch ports use the extended
+  speeds capability of their switch port 0, end ports use their own.
+ */
+static void dest_tree_add_port(IN const osm_physp_t * p_physp,
+			       IN int extended, IN OUT uint8_t * p_mtu,
+			       IN OUT uint8_t * p_rate)
+{
+	const ib_port_info_t *p_pi = &p_physp->port_info;
+	uint8_t rate;
+
+	if (*p_mtu > ib_port_info_get_mtu_cap(p_pi))
+		*p_mtu = ib_port_info_get_mtu_cap(p_pi);
+	rate = ib_port_info_compute_rate(p_pi, extended);
+	if (ib_path_compare_rates(*p_rate, rate) > 0)
+		*p_rate = rate;
+}
+
+static void dest_tree_add_end_port(IN const osm_physp_t * p_physp,
+				   IN OUT uint8_t * p_mtu,
+				   IN OUT uint8_t * p_rate)
+{
+	dest_tree_add_port(p_physp, p_physp->port_info.capability_mask &
+			   IB_PORT_CAP_HAS_EXT_SPEEDS, p_mtu, p_rate);
+}
+
+static void dest_tree_set_end_port(IN const osm_physp_t * p_physp,
+				   OUT uint8_t * p_mtu, OUT uint8_t * p_rate)
+{
+	const ib_port_info_t *p_pi = &p_physp->port_info;
+
+	*p_mtu = ib_port_info_get_mtu_cap(p_pi);
+	*p_rate = ib_port_info_compute_rate(p_pi, p_pi->capability_mask &
+					    IB_PORT_CAP_HAS_EXT_SPEEDS);
+}
+
+static unsigned dest_tree_sw_idx(IN const osm_ucast_dest_trees_t * p_trees,
+				 IN const osm_node_t * p_node)
+{
+	uint16_t lid_ho = cl_ntoh16(osm_node_get_base_lid(p_node, 0));
+
+	if (!p_node->sw || lid_ho > p_trees->max_lid_ho)
+		return 0xFFFF;
+	return p_trees->sw_idx[lid_ho];
+}
+
+/*
+  Computes the path from a switch to the destination from the path of the
+  next switch on the route, which must be known already.
+ */
+static void dest_tree_set_path(IN const osm_ucast_dest_trees_t * p_trees,
+			       IN osm_ucast_dest_path_t * row,
+			       IN const osm_switch_t * p_sw,
+			       IN unsigned sw_idx,
+			       IN ib_net16_t dest_lid,
+			       IN const osm_physp_t * p_dest_physp)
+{
+	osm_ucast_dest_path_t *p_path = &row[sw_idx];
+	const osm_physp_t *p_egress, *p_remote;
+	const osm_switch_t *p_next_sw;
+	const osm_ucast_dest_path_t *p_next;
+	unsigned idx;
+	int extended;
+
+	p_path->hops = OSM_NO_PATH;
+
+	p_egress = osm_switch_get_route_by_lid(p_sw, dest_lid);
+	if (!p_egress)
+		return;
+
+	/* the destination is this switch */
+	if (p_egress == p_dest_physp) {
+		dest_tree_set_end_port(p_egress, &p_path->mtu, &p_path->rate);
+		p_path->hops = 0;
+		return;
+	}
+
+	p_remote = osm_physp_get_remote(p_egress);
+	if (!p_remote)
+		return;
+
+	if (p_remote == p_dest_physp) {
+		dest_tree_set_end_port(p_remote, &p_path->mtu, &p_path->rate);
+		p_path->hops = 1;
+		return;
+	}
+
+	p_next_sw = p_remote->p_node->sw;
+	if (!p_next_sw)
+		return;
+
+	idx = dest_tree_sw_idx(p_trees, p_remote->p_node);
+	if (idx == 0xFFFF)
+		return;
+
+	p_next = &row[idx];
+	if (p_next->hops == OSM_NO_PATH || p_next->hops >= DEST_TREE_MAX_HOPS)
+		return;
+
+	p_egress = osm_switch_get_route_by_lid(p_next_sw, dest_lid);
+	if (!p_egress)
+		return;
+
+	extended = dest_tree_p0_extended(p_remote->p_node);
+	p_path->mtu = p_next->mtu;
+	p_path->rate = p_next->rate;
+	dest_tree_add_port(p_remote, extended, &p_path->mtu, &p_path->rate);
+	dest_tree_add_port(p_egress, extended, &p_path->mtu, &p_path->rate);
+	p_path->hops = p_next->hops + 1;
+}
+
+/*
+  Returns the index of the next switch on the route to the destination,
+  or 0xFFFF when the route ends (or breaks) at this switch.
+ */
+static unsigned dest_tree_next_sw(IN const osm_ucast_dest_trees_t * p_trees,
+				  IN const osm_switch_t * p_sw,
+				  IN ib_net16_t dest_lid,
+				  IN const osm_physp_t * p_dest_physp)
+{
+	const osm_physp_t *p_egress, *p_remote;
+
+	p_egress = osm_switch_get_route_by_lid(p_sw, dest_lid);
+	if (!p_egress || p_egress == p_dest_physp)
+		return 0xFFFF;
+
+	p_remote = osm_physp_get_remote(p_egress);
+	if (!p_remote || p_remote == p_dest_physp)
+		return 0xFFFF;
+
+	return dest_tree_sw_idx(p_trees, p_remote->p_node);
+}
+
+void osm_ucast_mgr_build_dest_trees(IN osm_ucast_mgr_t * p_mgr)
+{
+	osm_ucast_dest_trees_t *p_trees = &p_mgr->dest_trees;
+	cl_qmap_t *p_sw_tbl = &p_mgr->p_subn->sw_guid_tbl;
+	osm_switch_t **sws = NULL, *p_sw;
+	osm_ucast_dest_path_t *row;
+	const osm_port_t *p_port;
+	uint8_t *state = NULL;
+	uint16_t *stack = NULL;
+	unsigned num_sw, i, n, depth;
+	uint16_t max_lid_ho, lid_ho;
+	size_t num_paths;
+	boolean_t loop;
+
+	ucast_mgr_free_dest_trees(p_mgr);
+
+	if (!p_mgr->p_subn->opt.sa_pr_dest_trees)
+		return;
+
+	OSM_LOG_ENTER(p_mgr->p_log);
+
+	num_sw = cl_qmap_count(p_sw_tbl);
+	max_lid_ho = cl_ptr_vector_get_size(&p_mgr->p_subn->port_lid_tbl);
+	if (!num_sw || !max_lid_ho)
+		goto Exit;
+	max_lid_ho--;
+
+	num_paths = (size_t) (max_lid_ho + 1) * num_sw;
+	sws = malloc(num_sw * sizeof(*sws));
+	state = malloc(num_sw);
+	stack = malloc(num_sw * sizeof(*stack));
+	p_trees->sw_idx = malloc((max_lid_ho + 1) * sizeof(*p_trees->sw_idx));
+	p_trees->paths = malloc(num_paths * sizeof(*p_trees->paths));
+	if (!sws || !state || !stack || !p_trees->sw_idx || !p_trees->paths) {
+		OSM_LOG(p_mgr->p_log, OSM_LOG_ERROR, "ERR 3A11: "
+			"Cannot allocate path trees for %u switches and "
+			"%u LIDs\n", num_sw, max_lid_ho + 1);
+		ucast_mgr_free_dest_trees(p_mgr);
+		goto Exit;
+	}
+
+	p_trees->max_lid_ho = max_lid_ho;
+	p_trees->num_sw = num_sw;
+	memset(p_trees->sw_idx, 0xFF, (max_lid_ho + 1) * sizeof(*p_trees->sw_idx));
+
+	i = 0;
+	for (p_sw = (osm_switch_t *) cl_qmap_head(p_sw_tbl);
+	     p_sw != (osm_switch_t *) cl_qmap_end(p_sw_tbl);
+	     p_sw = (osm_switch_t *) cl_qmap_next(&p_sw->map_item)) {
+		lid_ho = cl_ntoh16(osm_node_get_base_lid(p_sw->p_node, 0));
+		if (!lid_ho || lid_ho > max_lid_ho)
+			continue;
+		p_trees->sw_idx[lid_ho] = i;
+		sws[i++] = p_sw;
+	}
+	num_sw = i;
+
+	for (lid_ho = 0; lid_ho <= max_lid_ho; lid_ho++) {
+		row = &p_trees->paths[(size_t) lid_ho * p_trees->num_sw];
+		for (i = 0; i < p_trees->num_sw; i++)
+			row[i].hops = OSM_NO_PATH;
+
+		p_port = osm_get_port_by_lid_ho(p_mgr->p_subn, lid_ho);
+		if (!p_port)
+			continue;
+
+		/*
+		   Follow the route from every switch until a switch whose
+		   path is known, then set the paths back along the route.
+		 */
+		memset(state, DEST_TREE_UNKNOWN, num_sw);
+		for (i = 0; i < num_sw; i++) {
+			depth = 0;
+			n = i;
+			while (n != 0xFFFF && state[n] == DEST_TREE_UNKNOWN) {
+				state[n] = DEST_TREE_VISITING;
+				stack[depth++] = n;
+				n = dest_tree_next_sw(p_trees, sws[n],
+						      cl_hton16(lid_ho),
+						      p_port->p_physp);
+			}
+			/* a routing loop leaves the paths unset (no path) */
+			loop = (n != 0xFFFF && state[n] == DEST_TREE_VISITING);
+			while (depth--) {
+				if (!loop)
+					dest_tree_set_path(p_trees, row,
+							   sws[stack[depth]],
+							   stack[depth],
+							   cl_hton16(lid_ho),
+							   p_port->p_physp);
+				state[stack[depth]] = DEST_TREE_DONE;
+			}
+		}
+	}
+
+	OSM_LOG(p_mgr->p_log, OSM_LOG_VERBOSE,
+		"Path trees built for %u switches and %u LIDs\n",
+		num_sw, max_lid_ho + 1);
+Exit:
+	free(sws);
+	free(state);
+	free(stack);
+	OSM_LOG_EXIT(p_mgr->p_log);
+}
+
+ib_api_status_t osm_ucast_mgr_get_dest_path(IN const osm_ucast_mgr_t * p_mgr,
+					    IN const osm_physp_t * p_src_physp,
+					    IN uint16_t dest_lid_ho,
+					    OUT uint8_t * p_mtu,
+					    OUT uint8_t * p_rate,
+					    OUT unsigned *p_hops)
+{
+	const osm_ucast_dest_trees_t *p_trees = &p_mgr->dest_trees;
+	const osm_ucast_dest_path_t *p_path;
+	const osm_physp_t *p_remote, *p_egress;
+	const osm_port_t *p_dest_port;
+	uint8_t mtu, rate;
+	unsigned idx, hops = 0;
+	int extended;
+
+	if (!p_trees->paths || dest_lid_ho > p_trees->max_lid_ho)
+		return IB_NOT_FOUND;
+
+	dest_tree_set_end_port(p_src_physp, &mtu, &rate);
+
+	if (p_src_physp->p_node->sw)
+		idx = dest_tree_sw_idx(p_trees, p_src_physp->p_node);
+	else {
+		/* the source is attached to the switch its link leads to */
+		p_remote = osm_physp_get_remote(p_src_physp);
+		p_dest_port = osm_get_port_by_lid_ho(p_mgr->p_subn,
+						     dest_lid_ho);
+		if (!p_remote || !p_dest_port)
+			return IB_NOT_FOUND;
+
+		hops = 1;
+		if (p_remote == p_dest_port->p_physp) {
+			dest_tree_add_end_port(p_remote, &mtu, &rate);
+			goto Exit;
+		}
+
+		if (!p_remote->p_node->sw)
+			return IB_NOT_FOUND;
+
+		p_egress = osm_switch_get_route_by_lid(p_remote->p_node->sw,
+						       cl_hton16(dest_lid_ho));
+		if (!p_egress)
+			return IB_NOT_FOUND;
+
+		extended = dest_tree_p0_extended(p_remote->p_node);
+		dest_tree_add_port(p_remote, extended, &mtu, &rate);
+		dest_tree_add_port(p_egress, extended, &mtu, &rate);
+		idx = dest_tree_sw_idx(p_trees, p_remote->p_node);
+	}
+
+	if (idx == 0xFFFF)
+		return IB_NOT_FOUND;
+
+	p_path = &p_trees->paths[(size_t) dest_lid_ho * p_trees->num_sw + idx];
+	if (p_path->hops == OSM_NO_PATH)
+		return IB_NOT_FOUND;
+
+	if (mtu > p_path->mtu)
+		mtu = p_path->mtu;
+	if (ib_path_compare_rates(rate, p_path->rate) > 0)
+		rate = p_path->rate;
+	hops += p_path->hops;
+Exit:
+	*p_mtu = mtu;
+	*p_rate = rate;
+	*p_hops = hops;
+	return IB_SUCCESS;
+}
+
+/**********************************************************************
+ Incremental rerouting.
+ The links of every switch are recorded after each min-hop routing.
+ When the only changes found at the next routing are failed links and
+ dropped switches or end ports, only the destination switches which a
+ failed link led to on a least hop path get their LID matrix rows
+ recomputed, and only the LFT entries of their LIDs are revisited.
+ Routes that are still least hop ones are kept, so only the LFT blocks
+ of the rerouted LIDs are sent to the switches.
+**********************************************************************/
+typedef struct ucast_incr_port {
+	ib_net64_t remote_guid;
+	uint16_t remote_lid_ho;
+	uint8_t remote_port_num;
+	uint8_t remote_is_sw;
+	uint8_t healthy;
+} ucast_incr_port_t;
+
+typedef struct ucast_incr_sw {
+	cl_map_item_t map_item;
+	uint16_t lid_ho;
+	uint8_t num_ports;
+	boolean_t found;
+	ucast_incr_port_t ports[0];
+} ucast_incr_sw_t;
+
+typedef struct ucast_incr_link {
+	osm_switch_t *p_sw;
+	uint8_t port_num;
+} ucast_incr_link_t;
+
+#define UCAST_INCR_DROPPED_PORT	1
+#define UCAST_INCR_DROPPED_SW	2
+
+static void ucast_mgr_incr_free(IN osm_ucast_mgr_t * p_mgr)
+{
+	cl_map_item_t *item;
+
+	while ((item = cl_qmap_head(&p_mgr->incr_sw_tbl)) !=
+	       cl_qmap_end(&p_mgr->incr_sw_tbl)) {
+		cl_qmap_remove_item(&p_mgr->incr_sw_tbl, item);
+		free(item);
+	}
+	p_mgr->incr_valid = FALSE;
+}
+
+void osm_ucast_mgr_incr_invalidate(IN osm_ucast_mgr_t * p_mgr)
+{
+	if (!p_mgr->incr_valid)
+		return;
+
+	OSM_LOG(p_mgr->p_log, OSM_LOG_DEBUG,
+		"Invalidating incremental routing\n");
+	ucast_mgr_incr_free(p_mgr);
+}
+
+static void ucast_mgr_incr_get_port(IN osm_switch_t * p_sw,
+				    IN uint8_t port_num,
+				    OUT ucast_incr_port_t * p_rec)
+{
+	osm_physp_t *p, *p_rem;
+
+	memset(p_rec, 0, sizeof(*p_rec));
+
+	p = osm_node_get_physp_ptr(p_sw->p_node, port_num);
+	if (!p || !(p_rem = osm_physp_get_remote(p)))
+		return;
+
+	p_rec->remote_guid = osm_node_get_node_guid(p_rem->p_node);
+	p_rec->remote_port_num = p_rem->port_num;
+	p_rec->healthy = osm_link_is_healthy(p) ? 1 : 0;
+	if (p_rem->p_node->sw) {
+		p_rec->remote_is_sw = 1;
+		p_rec->remote_lid_ho =
+		    cl_ntoh16(osm_node_get_base_lid(p_rem->p_node, 0));
+	} else
+		p_rec->remote_lid_ho = cl_ntoh16(osm_physp_get_base_lid(p_rem));
+}
+
+static void ucast_mgr_incr_save(IN osm_ucast_mgr_t * p_mgr)
+{
+	cl_qmap_t *p_sw_tbl = &p_mgr->p_subn->sw_guid_tbl;
+	cl_map_item_t *item;
+	ucast_incr_sw_t *rec;
+	osm_switch_t *p_sw;
+	uint8_t port_num;
+
+	osm_ucast_mgr_incr_invalidate(p_mgr);
+
+	for (item = cl_qmap_head(p_sw_tbl); item != cl_qmap_end(p_sw_tbl);
+	     item = cl_qmap_next(item)) {
+		p_sw = (osm_switch_t *) item;
+		rec = calloc(1, sizeof(*rec) +
+			     p_sw->num_ports * sizeof(rec->ports[0]));
+		if (!rec) {
+			OSM_LOG(p_mgr->p_log, OSM_LOG_ERROR, "ERR 3A14: "
+				"cannot allocate memory for incremental "
+				"routing\n");
+			ucast_mgr_incr_free(p_mgr);
+			return;
+		}
+		rec->lid_ho = cl_ntoh16(osm_node_get_base_lid(p_sw->p_node, 0));
+		rec->num_ports = p_sw->num_ports;
+		for (port_num = 1; port_num < p_sw->num_ports; port_num++)
+			ucast_mgr_incr_get_port(p_sw, port_num,
+						&rec->ports[port_num]);
+		cl_qmap_insert(&p_mgr->incr_sw_tbl,
+			       osm_node_get_node_guid(p_sw->p_node),
+			       &rec->map_item);
+	}
+
+	p_mgr->incr_valid = TRUE;
+}
+
+/*
+ * Mirrors the port profile accounting of ucast_mgr_process_port()
+ */
+static boolean_t ucast_mgr_incr_prof_ignored(IN osm_ucast_mgr_t * p_mgr,
+					     IN osm_switch_t * p_sw,
+					     IN uint8_t port_num,
+					     IN boolean_t dest_is_sw)
+{
+	osm_physp_t *p;
+
+	if (port_num >= p_sw->num_ports ||
+	    (dest_is_sw && !p_mgr->p_subn->opt.port_profile_switch_nodes))
+		return TRUE;
+
+	p = osm_node_get_physp_ptr(p_sw->p_node, port_num);
+	return p && p->is_prof_ignored;
+}
+
+/*
+ * Whether a switch still has a live port with the given hop count to
+ * a switch LID, the failed links being already unlinked
+ */
+static boolean_t ucast_mgr_incr_has_path(IN osm_switch_t * p_sw,
+					 IN uint16_t lid_ho, IN uint8_t hops)
+{
+	osm_physp_t *p;
+	uint8_t port_num;
+
+	for (port_num = 1; port_num < p_sw->num_ports; port_num++) {
+		if (osm_switch_get_hop_count(p_sw, lid_ho, port_num) != hops)
+			continue;
+		p = osm_node_get_physp_ptr(p_sw->p_node, port_num);
+		if (p && osm_physp_get_remote(p))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+static unsigned ucast_mgr_incr_route_port(IN osm_ucast_mgr_t * p_mgr,
+					  IN osm_switch_t ** sw,
+					  IN unsigned num_sw,
+					  IN osm_port_t * p_port)
+{
+	osm_switch_t *p_sw;
+	boolean_t dest_is_sw = p_port->p_node->sw ? TRUE : FALSE;
+	uint16_t lid_ho = cl_ntoh16(osm_port_get_base_lid(p_port));
+	uint8_t port, old_port;
+	unsigned i, changed = 0;
+
+	if (!lid_ho)
+		return 0;
+
+	for (i = 0; i < num_sw; i++) {
+		p_sw = sw[i];
+		old_port = p_sw->new_lft[lid_ho];
+		/* the current route is kept when it is still least hop */
+		port = osm_switch_recommend_path(p_sw, p_port, lid_ho, 1,
+						 FALSE, FALSE, FALSE,
+						 p_mgr->p_subn->opt.port_shifting,
+						 p_port->use_scatter,
+						 OSM_NEW_LFT);
+		if (port == old_port)
+			continue;
+
+		if (old_port != OSM_NO_PATH &&
+		    !ucast_mgr_incr_prof_ignored(p_mgr, p_sw, old_port,
+						 dest_is_sw))
+			osm_switch_uncount_path(p_sw, old_port);
+		p_sw->new_lft[lid_ho] = port;
+		if (port != OSM_NO_PATH &&
+		    !ucast_mgr_incr_prof_ignored(p_mgr, p_sw, port, dest_is_sw))
+			osm_switch_count_path(p_sw, port);
+		changed++;
+	}
+
+	return changed;
+}
+
+static unsigned ucast_mgr_incr_route_dest(IN osm_ucast_mgr_t * p_mgr,
+					  IN osm_switch_t ** sw,
+					  IN unsigned num_sw,
+					  IN osm_switch_t * p_dest_sw)
+{
+	osm_physp_t *p, *p_rem;
+	osm_port_t *p_port;
+	uint16_t lid_ho;
+	uint8_t port_num;
+	unsigned changed = 0;
+
+	lid_ho = cl_ntoh16(osm_node_get_base_lid(p_dest_sw->p_node, 0));
+	p_port = osm_get_port_by_lid_ho(p_mgr->p_subn, lid_ho);
+	if (p_port)
+		changed += ucast_mgr_incr_route_port(p_mgr, sw, num_sw,
+						     p_port);
+
+	/* the end ports are reached through their switch's LID row */
+	for (port_num = 1; port_num < p_dest_sw->num_ports; port_num++) {
+		p = osm_node_get_physp_ptr(p_dest_sw->p_node, port_num);
+		if (!p || !(p_rem = osm_physp_get_remote(p)) ||
+		    p_rem->p_node->sw)
+			continue;
+		lid_ho = cl_ntoh16(osm_physp_get_base_lid(p_rem));
+		p_port = osm_get_port_by_lid_ho(p_mgr->p_subn, lid_ho);
+		if (p_port && p_port->p_physp == p_rem)
+			changed += ucast_mgr_incr_route_port(p_mgr, sw, num_sw,
+							     p_port);
+	}
+
+	return changed;
+}
+
+static unsigned ucast_mgr_incr_drop_lid(IN osm_ucast_mgr_t * p_mgr,
+					IN const lid_matrix_graph_t * g,
+					IN uint16_t lid_ho,
+					IN boolean_t dest_is_sw)
+{
+	osm_switch_t *p_sw;
+	uint8_t old_port;
+	unsigned i, changed = 0;
+
+	for (i = 0; i < g->num_sw; i++) {
+		p_sw = g->sw[i];
+		osm_switch_clear_lid_hops(p_sw, lid_ho);
+		old_port = p_sw->new_lft[lid_ho];
+		if (old_port == OSM_NO_PATH)
+			continue;
+		if (!ucast_mgr_incr_prof_ignored(p_mgr, p_sw, old_port,
+						 dest_is_sw))
+			osm_switch_uncount_path(p_sw, old_port);
+		p_sw->new_lft[lid_ho] = OSM_NO_PATH;
+		changed++;
+	}
+
+	return changed;
+}
+
+/**********************************************************************
+ Returns 0 when the routing was updated and the forwarding tables set,
+ and non zero when a full routing is needed. Nothing is modified
+ before the subnet is found to only have lost links and nodes.
+**********************************************************************/
+static int ucast_mgr_incr_route(IN osm_ucast_mgr_t * p_mgr)
+{
+	osm_subn_t *p_subn = p_mgr->p_subn;
+	cl_qmap_t *p_sw_tbl = &p_subn->sw_guid_tbl;
+	cl_qmap_t *p_incr_tbl = &p_mgr->incr_sw_tbl;
+	lid_matrix_graph_t g;
+	ucast_incr_link_t *failed = NULL;
+	osm_switch_t **failed_sw = NULL;
+	ucast_incr_port_t cur, *p_rec;
+	ucast_incr_sw_t *rec;
+	osm_switch_t *p_sw;
+	cl_map_item_t *item;
+	uint32_t *dests = NULL;
+	uint8_t *dropped = NULL, *local = NULL;
+	unsigned i, j, num_ports = 0, num_failed = 0, num_failed_sw = 0;
+	unsigned num_dropped = 0, num_dests = 0, num_local = 0, changed = 0;
+	boolean_t used;
+	uint16_t lid_ho, lids;
+	uint8_t port_num, hops;
+	int ret = 1;
+
+	memset(&g, 0, sizeof(g));
+
+	if (!p_subn->opt.incremental_reroute || !p_mgr->incr_valid ||
+	    p_subn->opt.lmc)
+		return 1;
+
+	lids = (uint16_t) cl_ptr_vector_get_size(&p_subn->port_lid_tbl);
+	lids = lids ? lids - 1 : 0;
+
+	for (item = cl_qmap_head(p_incr_tbl); item != cl_qmap_end(p_incr_tbl);
+	     item = cl_qmap_next(item))
+		((ucast_incr_sw_t *) item)->found = FALSE;
+
+	for (item = cl_qmap_head(p_sw_tbl); item != cl_qmap_end(p_sw_tbl);
+	     item = cl_qmap_next(item)) {
+		p_sw = (osm_switch_t *) item;
+		rec = (ucast_incr_sw_t *)
+		    cl_qmap_get(p_incr_tbl, osm_node_get_node_guid(p_sw->p_node));
+		if (rec == (ucast_incr_sw_t *) cl_qmap_end(p_incr_tbl) ||
+		    rec->num_ports != p_sw->num_ports ||
+		    rec->lid_ho !=
+		    cl_ntoh16(osm_node_get_base_lid(p_sw->p_node, 0)) ||
+		    p_sw->max_lid_ho < lids || !p_sw->hops || !p_sw->new_lft) {
+			OSM_LOG(p_mgr->p_log, OSM_LOG_VERBOSE,
+				"Switch 0x%016" PRIx64 " is new or changed\n",
+				cl_ntoh64(osm_node_get_node_guid(p_sw->p_node)));
+			goto Exit;
+		}
+		rec->found = TRUE;
+		num_ports += p_sw->num_ports;
+	}
+
+	failed = malloc(num_ports * sizeof(failed[0]));
+	failed_sw = malloc(cl_qmap_count(p_sw_tbl) * sizeof(failed_sw[0]));
+	dropped = calloc(IB_LID_UCAST_END_HO + 1, sizeof(dropped[0]));
+	if (!failed || !failed_sw || !dropped) {
+		ret = -1;
+		goto Exit;
+	}
+
+	/* any link which is not a failed one requires a full routing */
+	for (item = cl_qmap_head(p_sw_tbl); item != cl_qmap_end(p_sw_tbl);
+	     item = cl_qmap_next(item)) {
+		p_sw = (osm_switch_t *) item;
+		rec = (ucast_incr_sw_t *)
+		    cl_qmap_get(p_incr_tbl, osm_node_get_node_guid(p_sw->p_node));
+		for (port_num = 1; port_num < p_sw->num_ports; port_num++) {
+			ucast_mgr_incr_get_port(p_sw, port_num, &cur);
+			p_rec = &rec->ports[port_num];
+			if (!memcmp(&cur, p_rec, sizeof(cur)))
+				continue;
+			if (cur.remote_guid || !p_rec->remote_guid) {
+				OSM_LOG(p_mgr->p_log, OSM_LOG_VERBOSE,
+					"Port %u of switch 0x%016" PRIx64
+					" has a new or changed link\n",
+					port_num,
+					cl_ntoh64(osm_node_get_node_guid
+						  (p_sw->p_node)));
+				goto Exit;
+			}
+			if (p_rec->remote_is_sw) {
+				if (!num_failed ||
+				    failed[num_failed - 1].p_sw != p_sw)
+					failed_sw[num_failed_sw++] = p_sw;
+				failed[num_failed].p_sw = p_sw;
+				failed[num_failed++].port_num = port_num;
+			} else
+				dropped[p_rec->remote_lid_ho] =
+				    UCAST_INCR_DROPPED_PORT;
+		}
+	}
+
+	for (item = cl_qmap_head(p_incr_tbl); item != cl_qmap_end(p_incr_tbl);
+	     item = cl_qmap_next(item)) {
+		rec = (ucast_incr_sw_t *) item;
+		if (rec->found)
+			continue;
+		dropped[rec->lid_ho] = UCAST_INCR_DROPPED_SW;
+		for (port_num = 1; port_num < rec->num_ports; port_num++)
+			if (rec->ports[port_num].remote_guid &&
+			    !rec->ports[port_num].remote_is_sw)
+				dropped[rec->ports[port_num].remote_lid_ho] =
+				    UCAST_INCR_DROPPED_PORT;
+	}
+
+	for (lid_ho = 1; lid_ho <= IB_LID_UCAST_END_HO; lid_ho++) {
+		if (!dropped[lid_ho])
+			continue;
+		if (osm_get_port_by_lid_ho(p_subn, lid_ho)) {
+			OSM_LOG(p_mgr->p_log, OSM_LOG_VERBOSE,
+				"LID %u was reassigned\n", lid_ho);
+			goto Exit;
+		}
+		num_dropped++;
+	}
+
+	if (lid_matrix_graph_build(p_mgr, &g) ||
+	    !(dests = malloc(g.num_sw * sizeof(dests[0]))) ||
+	    !(local = calloc(g.num_sw, sizeof(local[0])))) {
+		ret = -1;
+		goto Exit;
+	}
+
+	/*
+	   A failed link only matters for the destinations it was on
+	   a least hop path to.  When the switches at its ends still have
+	   another least hop port to such a destination, the distances to
+	   it are unchanged and only these switches need to be rerouted.
+	   Otherwise the destination's LID matrix rows are recomputed and
+	   all the switches revisited.
+	 */
+	for (i = 0; i < g.num_sw; i++) {
+		lid_ho = cl_ntoh16(osm_node_get_base_lid(g.sw[i]->p_node, 0));
+		if (!lid_ho)
+			continue;
+		used = FALSE;
+		for (j = 0; j < num_failed; j++) {
+			hops = osm_switch_get_hop_count(failed[j].p_sw, lid_ho,
+							failed[j].port_num);
+			if (hops == OSM_NO_PATH ||
+			    hops != osm_switch_get_least_hops(failed[j].p_sw,
+							      lid_ho))
+				continue;
+			used = TRUE;
+			if (!ucast_mgr_incr_has_path(failed[j].p_sw, lid_ho,
+						     hops))
+				break;
+		}
+		if (j < num_failed) {
+			dests[num_dests++] = i;
+			continue;
+		}
+		for (j = 0; j < num_failed; j++)
+			osm_switch_set_hops(failed[j].p_sw, lid_ho,
+					    failed[j].port_num, OSM_NO_PATH);
+		if (used) {
+			local[i] = 1;
+			num_local++;
+		}
+	}
+
+	if (lid_matrix_process_dests(p_mgr, &g, dests, num_dests)) {
+		ret = -1;
+		goto Exit;
+	}
+
+	for (lid_ho = 1; lid_ho <= IB_LID_UCAST_END_HO; lid_ho++)
+		if (dropped[lid_ho])
+			changed += ucast_mgr_incr_drop_lid(p_mgr, &g, lid_ho,
+							   dropped[lid_ho] ==
+							   UCAST_INCR_DROPPED_SW);
+
+	for (i = 0; i < num_dests; i++)
+		changed += ucast_mgr_incr_route_dest(p_mgr, g.sw, g.num_sw,
+						     g.sw[dests[i]]);
+	for (i = 0; i < g.num_sw; i++)
+		if (local[i])
+			changed += ucast_mgr_incr_route_dest(p_mgr, failed_sw,
+							     num_failed_sw,
+							     g.sw[i]);
+
+	OSM_LOG(p_mgr->p_log, OSM_LOG_INFO,
+		"Incremental reroute of %u failed links and %u dropped LIDs: "
+		"%u of %u destination switches recomputed, %u rerouted "
+		"locally, %u LFT entries changed\n", num_failed, num_dropped,
+		num_dests, g.num_sw, num_local, changed);
+
+	osm_ucast_mgr_set_fwd_tables(p_mgr);
+	osm_ucast_mgr_build_dest_trees(p_mgr);
+	ret = 0;
+
+Exit:
+	if (ret < 0)
+		OSM_LOG(p_mgr->p_log, OSM_LOG_ERROR, "ERR 3A15: "
+			"cannot allocate memory for incremental routing\n");
+	lid_matrix_graph_free(&g);
+	free(local);
+	free(dests);
+	free(dropped);
+	free(failed_sw);
+	free(failed);
+	return ret;
+}
+
 static int ucast_mgr_route(struct osm_routing_engine *r, osm_opensm_t * osm)
 {
 	int ret;
@@ -1110,6 +2226,14 @@ int osm_ucast_mgr_process(IN osm_ucast_mgr_t * p_mgr)
 
 	CL_PLOCK_EXCL_ACQUIRE(p_mgr->p_lock);
 
+	if (cl_qmap_count(p_sw_guid_tbl) && !ucast_mgr_incr_route(p_mgr)) {
+		if (p_mgr->p_subn->opt.use_ucast_cache)
+			p_mgr->cache_valid = TRUE;
+		ucast_mgr_incr_save(p_mgr);
+		goto Exit;
+	}
+	osm_ucast_mgr_incr_invalidate(p_mgr);
+
 	/*
 	   If there are no switches in the subnet, we are done.
 	 */
@@ -1140,7 +2264,16 @@ int osm_ucast_mgr_process(IN osm_ucast_mgr_t * p_mgr)
 
 		if (p_mgr->p_subn->opt.use_ucast_cache)
 			p_mgr->cache_valid = TRUE;
+
+		if (p_mgr->p_subn->opt.incremental_reroute &&
+		    !p_mgr->p_subn->opt.lmc &&
+		    p_osm->routing_engine_used->type ==
+		    OSM_ROUTING_ENGINE_TYPE_MINHOP)
+			ucast_mgr_incr_save(p_mgr);
+
+		osm_ucast_mgr_build_dest_trees(p_mgr);
 	} else {
+		ucast_mgr_free_dest_trees(p_mgr);
 		p_mgr->p_subn->subnet_initialization_error = TRUE;
 		OSM_LOG(p_mgr->p_log, OSM_LOG_ERROR,
 			"No routing engine able to successfully configure "
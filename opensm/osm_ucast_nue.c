@@ -60,6 +60,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <search.h>
+#include <complib/cl_atomic.h>
 #include <complib/cl_heap.h>
 #include <opensm/osm_file_ids.h>
 #define FILE_ID OSM_FILE_UCAST_NUE_C
@@ -75,6 +76,9 @@
 /*! \def Macro for "infinity" to initialize distance in Dijkstra's algorithm. */
 #define INFINITY      0x7FFFFFFF
 
+/*! \def Number of cCDG nodes connected by one work item of a routing thread. */
+#define CCDG_CONNECT_CHUNK 1024
+
 /*! \enum Enum to identify node status in search for cycles. */
 enum {
 	WHITE = 0,	/*!< White color for undiscovered nodes. */
@@ -215,6 +219,17 @@ typedef struct backtracking_candidate {
 	ccdg_node_t *orig_used_ccdg_node_for_adj_netw_node;
 } backtracking_candidate_t;
 
+/*! \struct ccdg_build
+ *  \brief Shared state of the workers which construct the complete CDG.
+ */
+typedef struct ccdg_build {
+	const osm_ucast_mgr_t *mgr;	/*!< Pointer to osm management object. */
+	const network_t *network;	/*!< Network object storing fabric copy. */
+	ccdg_t *ccdg;		/*!< Complete CDG object under construction. */
+	uint32_t *first_ccdg_node;	/*!< First cCDG node of each switch. */
+	atomic32_t num_failed;	/*!< Number of workers which failed. */
+} ccdg_build_t;
+
 /*! \struct nue_context
  *  \brief Primary structure for Nue (storing graph, cCDG, destinations, etc).
  */
@@ -230,6 +245,9 @@ typedef struct nue_context {
 	uint8_t max_vl;		/*!< Highest common #VL supported by all. */
 	uint8_t max_lmc;	/*!< Highest supported LMC across fabric. */
 	uint8_t *dlid_to_vl_mapping;	/*!< Store VLs to serve path_sl requ. */
+#if defined (ENABLE_METIS_FOR_NUE)
+	struct metis_context *metis_cache;	/*!< Last METIS in-/output. */
+#endif
 } nue_context_t;
 
 #if defined (ENABLE_METIS_FOR_NUE)
@@ -359,6 +377,22 @@ attempt_shortcut_discovery(const osm_ucast_mgr_t *,
 			   const ccdg_node_t *,
 			   const int32_t color);
 
+/*! \fn build_ccdg_nodes_of_switch(void *,
+ *                                 unsigned,
+ *                                 unsigned)
+ *  \brief Work item of build_complete_cdg: creates the fake channel and the
+ *         real channels (with their edges) of one switch of the network.
+ *
+ *  \param[in,out] context Pointer to the ccdg_build_t object.
+ *  \param[in]     item    Index of the switch in the network node array.
+ *  \param[in]     worker  Index of the routing thread (unused).
+ *  \return NONE
+ */
+static void
+build_ccdg_nodes_of_switch(void *,
+			   unsigned,
+			   unsigned);
+
 /*! \fn build_complete_cdg(const osm_ucast_mgr_t *,
  *                         const network_t *,
  *                         ccdg_t *,
@@ -373,7 +407,8 @@ attempt_shortcut_discovery(const osm_ucast_mgr_t *,
  *  used by a path from source to target. However, the complete CDG (cCDG) does
  *  not require actual paths (or assumes every possible path) and connects all
  *  pairs of cCDG vertices when the corresponding two links are attached to the
- *  same network switch.
+ *  same network switch. The vertices of different switches are created and
+ *  connected by up to routing_threads threads.
  *
  *  \param[in]     mgr     The management object of OpenSM.
  *  \param[in]     network Nue's network object storing the subnet.
@@ -518,6 +553,23 @@ static int
 compare_two_channel_id(const void *,
 		       const void *);
 
+/*! \fn connect_ccdg_nodes(void *,
+ *                         unsigned,
+ *                         unsigned)
+ *  \brief Work item of build_complete_cdg: resolves the tail vertices of the
+ *         edges of CCDG_CONNECT_CHUNK cCDG nodes of the sorted node array,
+ *         and links these nodes with their corresponding network links.
+ *
+ *  \param[in,out] context Pointer to the ccdg_build_t object.
+ *  \param[in]     item    Index of the chunk of cCDG nodes.
+ *  \param[in]     worker  Index of the routing thread (unused).
+ *  \return NONE
+ */
+static void
+connect_ccdg_nodes(void *,
+		   unsigned,
+		   unsigned);
+
 /*! \fn construct_ccdg(ccdg_t *)
  *  \brief Set all ccdg_t struct parameters to 0, and call cl_heap_construct
  *         for the heap element in the struct afterwards.
@@ -1190,6 +1242,22 @@ init_network_node(network_node_t *,
 		  network_link_t *,
 		  osm_switch_t *);
 
+#if defined (ENABLE_METIS_FOR_NUE)
+/*! \fn is_metis_input_unchanged(const metis_context_t *,
+ *                               const metis_context_t *)
+ *  \brief Checks if METIS would get the same graph to partition as in the
+ *         previous routing run, so that the cached partitioning can be reused.
+ *
+ *  \param[in] metis_cache The METIS in- and output of the previous run, or NULL.
+ *  \param[in] metis_ctx   The filled METIS input for the current run.
+ *  \return TRUE if the number of parts and the graph are identical, or FALSE
+ *          otherwise.
+ */
+static boolean_t
+is_metis_input_unchanged(const metis_context_t *,
+			 const metis_context_t *);
+#endif
+
 /*! \fn mark_escape_paths(const osm_ucast_mgr_t *,
  *                        network_t *,
  *                        const ccdg_t *,
@@ -2169,6 +2237,30 @@ static inline void destroy_metis_context(metis_context_t * metis_ctx)
 		metis_ctx->part = NULL;
 	}
 }
+
+static boolean_t is_metis_input_unchanged(const metis_context_t * metis_cache,
+					  const metis_context_t * metis_ctx)
+{
+	idx_t nvtxs = 0;
+
+	CL_ASSERT(metis_ctx);
+
+	if (!metis_cache || !metis_cache->part)
+		return FALSE;
+	nvtxs = *(metis_ctx->nvtxs);
+	if (*(metis_cache->nvtxs) != nvtxs
+	    || *(metis_cache->nparts) != *(metis_ctx->nparts))
+		return FALSE;
+	if (memcmp(metis_cache->xadj, metis_ctx->xadj,
+		   (nvtxs + 1) * sizeof(idx_t)))
+		return FALSE;
+	if (metis_ctx->xadj[nvtxs]
+	    && memcmp(metis_cache->adjncy, metis_ctx->adjncy,
+		      metis_ctx->xadj[nvtxs] * sizeof(idx_t)))
+		return FALSE;
+
+	return TRUE;
+}
 #endif
 
 /**********************************************************************
@@ -3131,9 +3223,11 @@ static int create_context(nue_context_t * nue_ctx)
 		return -1;
 	}
 
-	/* and an array for the mapping of src/dest path to VL */
+	/* and an array for the mapping of src/dest path to VL (indexed by
+	   the dlid, so max_lid_ho itself needs an entry)
+	 */
 	nue_ctx->dlid_to_vl_mapping =
-	    (uint8_t *) malloc(max_lid_ho * sizeof(uint8_t));
+	    (uint8_t *) malloc((max_lid_ho + 1) * sizeof(uint8_t));
 	if (!nue_ctx->dlid_to_vl_mapping) {
 		OSM_LOG(nue_ctx->mgr->p_log, OSM_LOG_ERROR,
 			"ERR NUE06: cannot allocate dlid_to_vl_mapping\n");
@@ -3141,7 +3235,7 @@ static int create_context(nue_context_t * nue_ctx)
 		return -1;
 	}
 	memset(nue_ctx->dlid_to_vl_mapping, OSM_DEFAULT_SL,
-	       max_lid_ho * sizeof(uint8_t));
+	       (max_lid_ho + 1) * sizeof(uint8_t));
 
 	return 0;
 }
@@ -3161,6 +3255,9 @@ static nue_context_t *nue_create_context(const osm_opensm_t * osm,
 		/* set initial values with stuff provided by caller */
 		nue_ctx->routing_type = routing_type;
 		nue_ctx->mgr = (osm_ucast_mgr_t *) & (osm->sm.ucast_mgr);
+#if defined (ENABLE_METIS_FOR_NUE)
+		nue_ctx->metis_cache = NULL;
+#endif
 		err = create_context(nue_ctx);
 		if (err) {
 			free(nue_ctx);
@@ -3231,134 +3328,116 @@ static uint64_t get_base_lids_and_number_of_lids(nue_context_t * nue_ctx)
 	return total_num_destination_lids;
 }
 
-static int build_complete_cdg(const osm_ucast_mgr_t * mgr,
-			      const network_t * network, ccdg_t * ccdg,
-			      const uint32_t total_num_sw_to_sw_links)
+static void build_ccdg_nodes_of_switch(void *context, unsigned item,
+				       unsigned worker)
 {
-	uint64_t i = 0, j = 0, k = 0;
+	ccdg_build_t *build = (ccdg_build_t *) context;
+	const osm_ucast_mgr_t *mgr = build->mgr;
+	uint64_t j = 0, k = 0;
 	channel_t channel_id;
 	network_node_t *adj_netw_node = NULL, *netw_node_iter = NULL;
 	network_link_t *link = NULL, *netw_link_iter = NULL;
 	ccdg_node_t *ccdg_node_iter = NULL;
-	ccdg_edge_t *ccdg_edge = NULL, *ccdg_edges = NULL;
-	ccdg_edge_t *ccdg_edge_iter = NULL;
+	ccdg_edge_t *ccdg_edges = NULL, *ccdg_edge_iter = NULL;
 	ib_net16_t l_lid = 0, r_lid = 0;
 	uint8_t l_port = 0, r_port = 0, num_edges = 0;
 
-	CL_ASSERT(mgr && network && ccdg);
-	OSM_LOG_ENTER(mgr->p_log);
+	netw_node_iter = &(build->network->nodes[item]);
+	ccdg_node_iter = &(build->ccdg->nodes[build->first_ccdg_node[item]]);
 
-	OSM_LOG(mgr->p_log, OSM_LOG_INFO,
-		"Building complete channel dependency graph for nue routing\n");
+	/* first we add the fake channel */
+	channel_id.local_lid = netw_node_iter->lid;
+	channel_id.local_port = 0;
+	channel_id.remote_lid = netw_node_iter->lid;
+	channel_id.remote_port = 0;
 
-	/* we have two types of ccdg nodes, real channels and fake entries,
-	   the fake entries are needed as source ccdg node for the routing
-	 */
-	ccdg->num_nodes = total_num_sw_to_sw_links + network->num_nodes;
-	ccdg->nodes =
-	    (ccdg_node_t *) malloc(ccdg->num_nodes * sizeof(ccdg_node_t));
-	if (!ccdg->nodes) {
+	/* the fake channel connects to all real channels of this node */
+	num_edges = netw_node_iter->num_links;
+	ccdg_edges = (ccdg_edge_t *) malloc(num_edges * sizeof(ccdg_edge_t));
+	if (num_edges && !ccdg_edges) {
 		OSM_LOG(mgr->p_log, OSM_LOG_ERROR,
-			"ERR NUE05: can't allocate memory for ccdg nodes\n");
-		return -1;
+			"ERR NUE35: cannot allocate memory for"
+			" ccdg edges of fake channel\n");
+		cl_atomic_inc(&build->num_failed);
+		return;
+	}
+	for (k = 0, ccdg_edge_iter = ccdg_edges; k < num_edges;
+	     k++, ccdg_edge_iter++)
+		construct_ccdg_edge(ccdg_edge_iter);
+
+	/* init ccdg edges for this fake ccdg node */
+	for (k = 0, ccdg_edge_iter = ccdg_edges; k < num_edges;
+	     k++, ccdg_edge_iter++) {
+		link = (network_link_t *) & (netw_node_iter->links[k]);
+		init_ccdg_edge(ccdg_edge_iter, link->link_info);
 	}
-	for (i = 0, ccdg_node_iter = ccdg->nodes; i < ccdg->num_nodes;
-	     i++, ccdg_node_iter++)
-		construct_ccdg_node(ccdg_node_iter);
 
-	ccdg_node_iter = (ccdg_node_t *) ccdg->nodes;
-	for (i = 0, netw_node_iter = network->nodes; i < network->num_nodes;
-	     i++, netw_node_iter++) {
-		/* first we add the fake channel */
-		channel_id.local_lid = netw_node_iter->lid;
-		channel_id.local_port = 0;
-		channel_id.remote_lid = netw_node_iter->lid;
-		channel_id.remote_port = 0;
-
-		/* the fake channel connects to all real channels of
-		   this node
-		 */
-		num_edges = netw_node_iter->num_links;
+	init_ccdg_node(ccdg_node_iter++, channel_id, num_edges, ccdg_edges,
+		       NULL);
+
+	/* and afterwards the real channels */
+	for (j = 0, netw_link_iter = netw_node_iter->links;
+	     j < netw_node_iter->num_links;
+	     j++, netw_link_iter++, ccdg_node_iter++) {
+		channel_id = netw_link_iter->link_info;
+		l_lid = channel_id.local_lid;
+		l_port = channel_id.local_port;
+		adj_netw_node = netw_link_iter->to_network_node;
+		CL_ASSERT(adj_netw_node && adj_netw_node->num_links);
+
+		/* we can ignore reverse path, so it is #links - 1 */
+		num_edges = adj_netw_node->num_links - 1;
 		ccdg_edges =
 		    (ccdg_edge_t *) malloc(num_edges * sizeof(ccdg_edge_t));
-		if (num_edges && !ccdg_edges) {
+		if (!ccdg_edges) {
 			OSM_LOG(mgr->p_log, OSM_LOG_ERROR,
-				"ERR NUE35: cannot allocate memory for"
-				" ccdg edges of fake channel\n");
-			return -1;
+				"ERR NUE08: can't allocate memory for"
+				" ccdg edges\n");
+			cl_atomic_inc(&build->num_failed);
+			return;
 		}
 		for (k = 0, ccdg_edge_iter = ccdg_edges; k < num_edges;
 		     k++, ccdg_edge_iter++)
 			construct_ccdg_edge(ccdg_edge_iter);
 
-		/* init ccdg edges for this fake ccdg node */
-		for (k = 0, ccdg_edge_iter = ccdg_edges; k < num_edges;
-		     k++, ccdg_edge_iter++) {
-			link = (network_link_t *) & (netw_node_iter->links[k]);
-			init_ccdg_edge(ccdg_edge_iter, link->link_info);
-		}
-
-		init_ccdg_node(ccdg_node_iter++, channel_id, num_edges,
-			       ccdg_edges, NULL);
-
-		/* and afterwards the real channels */
-		for (j = 0, netw_link_iter = netw_node_iter->links;
-		     j < netw_node_iter->num_links;
-		     j++, netw_link_iter++, ccdg_node_iter++) {
-			channel_id = netw_link_iter->link_info;
-			l_lid = channel_id.local_lid;
-			l_port = channel_id.local_port;
-			adj_netw_node = netw_link_iter->to_network_node;
-			CL_ASSERT(adj_netw_node && adj_netw_node->num_links);
-
-			/* we can ignore reverse path, so it is #links - 1 */
-			num_edges = adj_netw_node->num_links - 1;
-			ccdg_edges =
-			    (ccdg_edge_t *) malloc(num_edges *
-						   sizeof(ccdg_edge_t));
-			if (!ccdg_edges) {
-				OSM_LOG(mgr->p_log, OSM_LOG_ERROR,
-					"ERR NUE08: can't allocate memory for"
-					" ccdg edges\n");
-				return -1;
-			}
-			for (k = 0, ccdg_edge_iter = ccdg_edges; k < num_edges;
-			     k++, ccdg_edge_iter++)
-				construct_ccdg_edge(ccdg_edge_iter);
-
-			/* init ccdg edges for this ccdg node */
-			for (k = 0, ccdg_edge_iter = ccdg_edges;
-			     k < adj_netw_node->num_links; k++) {
-				/* filter the reverse path */
-				link =
-				    (network_link_t *) & (adj_netw_node->
-							  links[k]);
-				r_lid = link->link_info.remote_lid;
-				r_port = link->link_info.remote_port;
-				/* theoretically, we could ignore every reverse
-				   path (for multigraphs), not only the one with
-				   the same port => room for future optimization
-				 */
-				if (l_lid == r_lid && l_port == r_port)
-					continue;
-
-				init_ccdg_edge(ccdg_edge_iter++,
-					       link->link_info);
-			}
+		/* init ccdg edges for this ccdg node */
+		for (k = 0, ccdg_edge_iter = ccdg_edges;
+		     k < adj_netw_node->num_links; k++) {
+			/* filter the reverse path */
+			link = (network_link_t *) & (adj_netw_node->links[k]);
+			r_lid = link->link_info.remote_lid;
+			r_port = link->link_info.remote_port;
+			/* theoretically, we could ignore every reverse
+			   path (for multigraphs), not only the one with
+			   the same port => room for future optimization
+			 */
+			if (l_lid == r_lid && l_port == r_port)
+				continue;
 
-			init_ccdg_node(ccdg_node_iter, channel_id, num_edges,
-				       ccdg_edges, netw_link_iter);
+			init_ccdg_edge(ccdg_edge_iter++, link->link_info);
 		}
+
+		init_ccdg_node(ccdg_node_iter, channel_id, num_edges,
+			       ccdg_edges, netw_link_iter);
 	}
+}
 
-	/* sort the node array to find individual nodes easier with bsearch */
-	sort_ccdg_nodes_by_channel_id(ccdg);
+static void connect_ccdg_nodes(void *context, unsigned item, unsigned worker)
+{
+	ccdg_build_t *build = (ccdg_build_t *) context;
+	const ccdg_t *ccdg = build->ccdg;
+	uint64_t i = 0, j = 0, end = 0;
+	channel_t channel_id;
+	ccdg_node_t *ccdg_node_iter = NULL;
+	ccdg_edge_t *ccdg_edge = NULL;
 
-	/* now we need to add the last piece of information to the ccdg edge
-	   and connect the ccdg_nodes and corresponding network links
-	 */
-	ccdg_node_iter = (ccdg_node_t *) ccdg->nodes;
-	for (i = 0; i < ccdg->num_nodes; i++, ccdg_node_iter++) {
+	i = (uint64_t) item * CCDG_CONNECT_CHUNK;
+	end = i + CCDG_CONNECT_CHUNK;
+	if (end > ccdg->num_nodes)
+		end = ccdg->num_nodes;
+
+	for (ccdg_node_iter = &(ccdg->nodes[i]); i < end;
+	     i++, ccdg_node_iter++) {
 		for (j = 0; j < ccdg_node_iter->num_edges; j++) {
 			ccdg_edge =
 			    (ccdg_edge_t *) & (ccdg_node_iter->edges[j]);
@@ -3381,6 +3460,79 @@ static int build_complete_cdg(const osm_ucast_mgr_t * mgr,
 				       remote_port)));
 		}
 	}
+}
+
+static int build_complete_cdg(const osm_ucast_mgr_t * mgr,
+			      const network_t * network, ccdg_t * ccdg,
+			      const uint32_t total_num_sw_to_sw_links)
+{
+	uint64_t i = 0;
+	uint32_t first = 0;
+	network_node_t *netw_node_iter = NULL;
+	ccdg_node_t *ccdg_node_iter = NULL;
+	ccdg_build_t build;
+	unsigned num_workers = 0;
+
+	CL_ASSERT(mgr && network && ccdg);
+	OSM_LOG_ENTER(mgr->p_log);
+
+	OSM_LOG(mgr->p_log, OSM_LOG_INFO,
+		"Building complete channel dependency graph for nue routing\n");
+
+	/* we have two types of ccdg nodes, real channels and fake entries,
+	   the fake entries are needed as source ccdg node for the routing
+	 */
+	ccdg->num_nodes = total_num_sw_to_sw_links + network->num_nodes;
+	ccdg->nodes =
+	    (ccdg_node_t *) malloc(ccdg->num_nodes * sizeof(ccdg_node_t));
+	if (!ccdg->nodes) {
+		OSM_LOG(mgr->p_log, OSM_LOG_ERROR,
+			"ERR NUE05: can't allocate memory for ccdg nodes\n");
+		return -1;
+	}
+	for (i = 0, ccdg_node_iter = ccdg->nodes; i < ccdg->num_nodes;
+	     i++, ccdg_node_iter++)
+		construct_ccdg_node(ccdg_node_iter);
+
+	/* each switch owns a fake channel followed by its real channels,
+	   so the switches can fill their part of the array independently
+	 */
+	build.mgr = mgr;
+	build.network = network;
+	build.ccdg = ccdg;
+	build.num_failed = 0;
+	build.first_ccdg_node =
+	    (uint32_t *) malloc(network->num_nodes * sizeof(uint32_t));
+	if (network->num_nodes && !build.first_ccdg_node) {
+		OSM_LOG(mgr->p_log, OSM_LOG_ERROR,
+			"ERR NUE49: can't allocate memory for ccdg offsets\n");
+		return -1;
+	}
+	for (i = 0, netw_node_iter = network->nodes; i < network->num_nodes;
+	     i++, netw_node_iter++) {
+		build.first_ccdg_node[i] = first;
+		first += 1 + netw_node_iter->num_links;
+	}
+	CL_ASSERT(first == ccdg->num_nodes);
+
+	num_workers = osm_ucast_mgr_num_workers(mgr);
+	osm_ucast_mgr_parallel_for((osm_ucast_mgr_t *) mgr,
+				   network->num_nodes, num_workers,
+				   build_ccdg_nodes_of_switch, &build);
+	free(build.first_ccdg_node);
+	if (build.num_failed)
+		return -1;
+
+	/* sort the node array to find individual nodes easier with bsearch */
+	sort_ccdg_nodes_by_channel_id(ccdg);
+
+	/* now we need to add the last piece of information to the ccdg edge
+	   and connect the ccdg_nodes and corresponding network links
+	 */
+	osm_ucast_mgr_parallel_for((osm_ucast_mgr_t *) mgr,
+				   (ccdg->num_nodes + CCDG_CONNECT_CHUNK -
+				    1) / CCDG_CONNECT_CHUNK, num_workers,
+				   connect_ccdg_nodes, &build);
 
 	OSM_LOG_EXIT(mgr->p_log);
 	return 0;
@@ -3743,8 +3895,16 @@ static int distribute_lids_with_metis(nue_context_t * nue_ctx,
 		}
 	}
 
-	/* metis doesnt like nparts == 1 so we fake it if needed */
-	if (*(metis_ctx.nparts) == 1)
+	/* a reroute of an unchanged fabric yields the same input for METIS,
+	   so we can skip the partitioning and reuse the previous result;
+	   metis doesnt like nparts == 1 so we fake it if needed
+	 */
+	if (is_metis_input_unchanged(nue_ctx->metis_cache, &metis_ctx)) {
+		OSM_LOG(nue_ctx->mgr->p_log, OSM_LOG_VERBOSE,
+			"Fabric unchanged; reusing previous metis partition\n");
+		memcpy(metis_ctx.part, nue_ctx->metis_cache->part,
+		       *(metis_ctx.nvtxs) * sizeof(idx_t));
+	} else if (*(metis_ctx.nparts) == 1)
 		memset(metis_ctx.part, 0, *(metis_ctx.nvtxs) * sizeof(idx_t));
 	else
 		ret =
@@ -3795,7 +3955,17 @@ static int distribute_lids_with_metis(nue_context_t * nue_ctx,
 		nue_ctx->num_destinations[partition]++;
 	}
 
-	destroy_metis_context(&metis_ctx);
+	/* keep METIS in- and output for the next reroute */
+	if (!nue_ctx->metis_cache)
+		nue_ctx->metis_cache =
+		    (metis_context_t *) calloc(1, sizeof(metis_context_t));
+	if (nue_ctx->metis_cache) {
+		destroy_metis_context(nue_ctx->metis_cache);
+		memcpy(nue_ctx->metis_cache, &metis_ctx,
+		       sizeof(metis_context_t));
+	} else
+		destroy_metis_context(&metis_ctx);
+
 	free(desti_arr);
 	return 0;
 }
@@ -6709,6 +6879,12 @@ static void nue_destroy_context(void *context)
 	if (!nue_ctx)
 		return;
 	destroy_context(nue_ctx);
+#if defined (ENABLE_METIS_FOR_NUE)
+	if (nue_ctx->metis_cache) {
+		destroy_metis_context(nue_ctx->metis_cache);
+		free(nue_ctx->metis_cache);
+	}
+#endif
 	free(context);
 }
 
@@ -74,11 +74,37 @@ struct updn_node {
 	cl_list_item_t list;
 	osm_switch_t *sw;
 	uint64_t id;
-	updn_switch_dir_t dir;
 	unsigned rank;
-	unsigned visited;
+	unsigned index;
 };
 
+/* switch to switch links, grouped by the switch they leave (CSR layout) */
+typedef struct updn_link {
+	uint32_t node;
+	uint8_t port_num;
+	uint8_t remote_port_num;
+} updn_link_t;
+
+typedef struct updn_graph {
+	unsigned num_nodes;
+	struct updn_node **nodes;
+	uint32_t *link_start;
+	updn_link_t *links;
+} updn_graph_t;
+
+/* per thread BFS state */
+typedef struct updn_bfs_scratch {
+	uint8_t *dir;
+	uint8_t *visited;
+	uint32_t *queue;
+} updn_bfs_scratch_t;
+
+typedef struct updn_bfs_work {
+	osm_log_t *p_log;
+	const updn_graph_t *g;
+	updn_bfs_scratch_t *scratch;
+} updn_bfs_work_t;
+
 /* This function returns direction based on rank and guid info of current &
    remote ports */
 static updn_switch_dir_t updn_get_dir(unsigned cur_rank, unsigned rem_rank,
@@ -107,56 +133,54 @@ static updn_switch_dir_t updn_get_dir(unsigned cur_rank, unsigned rem_rank,
 /**********************************************************************
  * This function does the bfs of min hop table calculation by guid index
  * as a starting point.
+ * Only the LID matrix rows of the starting switch's LID are touched, so
+ * the BFS of different switches can run concurrently.
  **********************************************************************/
-static int updn_bfs_by_node(IN osm_log_t * p_log, IN osm_subn_t * p_subn,
-			    IN osm_switch_t * p_sw)
+static int updn_bfs_by_node(IN osm_log_t * p_log, IN const updn_graph_t * g,
+			    IN updn_bfs_scratch_t * s, IN unsigned start)
 {
-	uint8_t pn, pn_rem;
-	cl_qlist_t list;
+	uint8_t pn_rem;
 	uint16_t lid;
-	struct updn_node *u;
+	struct updn_node *u, *rem_u;
 	updn_switch_dir_t next_dir, current_dir;
+	const updn_link_t *l;
+	unsigned head = 0, tail, queued, i, j;
 
 	OSM_LOG_ENTER(p_log);
 
-	lid = osm_node_get_base_lid(p_sw->p_node, 0);
+	u = g->nodes[start];
+	lid = osm_node_get_base_lid(u->sw->p_node, 0);
 	lid = cl_ntoh16(lid);
-	osm_switch_set_hops(p_sw, lid, 0, 0);
+	osm_switch_set_hops(u->sw, lid, 0, 0);
 
 	OSM_LOG(p_log, OSM_LOG_DEBUG,
 		"Starting from switch - port GUID 0x%" PRIx64 " lid %u\n",
-		cl_ntoh64(p_sw->p_node->node_info.port_guid), lid);
-
-	u = p_sw->priv;
-	u->dir = UP;
-
-	/* Update list with the new element */
-	cl_qlist_init(&list);
-	cl_qlist_insert_tail(&list, &u->list);
-
-	/* BFS the list till no next element */
-	while (!cl_is_qlist_empty(&list)) {
-		u = (struct updn_node *)cl_qlist_remove_head(&list);
-		u->visited = 0;	/* cleanup */
-		current_dir = u->dir;
-		/* Go over all ports of the switch and find unvisited remote nodes */
-		for (pn = 1; pn < u->sw->num_ports; pn++) {
-			osm_node_t *p_remote_node;
-			struct updn_node *rem_u;
+		cl_ntoh64(u->sw->p_node->node_info.port_guid), lid);
+
+	s->dir[start] = UP;
+
+	/* Update queue with the new element; a switch is queued at most once */
+	s->queue[0] = start;
+	tail = g->num_nodes > 1 ? 1 : 0;
+	queued = 1;
+
+	/* BFS the queue till no next element */
+	while (queued) {
+		i = s->queue[head];
+		if (++head == g->num_nodes)
+			head = 0;
+		queued--;
+		u = g->nodes[i];
+		s->visited[i] = 0;	/* cleanup */
+		current_dir = s->dir[i];
+		/* Go over all the switch links and find unvisited remote nodes */
+		for (j = g->link_start[i]; j < g->link_start[i + 1]; j++) {
 			uint8_t current_min_hop, remote_min_hop,
 			    set_hop_return_value;
-			osm_switch_t *p_remote_sw;
 
-			p_remote_node =
-			    osm_node_get_remote_node(u->sw->p_node, pn,
-						     &pn_rem);
-			/* If no remote node OR remote node is not a SWITCH
-			   continue to next pn */
-			if (!p_remote_node || !p_remote_node->sw)
-				continue;
-			/* Fetch remote guid only after validation of remote node */
-			p_remote_sw = p_remote_node->sw;
-			rem_u = p_remote_sw->priv;
+			l = &g->links[j];
+			rem_u = g->nodes[l->node];
+			pn_rem = l->remote_port_num;
 			/* Decide which direction to mark it (UP/DOWN) */
 			next_dir = updn_get_dir(u->rank, rem_u->rank,
 						u->id, rem_u->id);
@@ -168,19 +192,19 @@ static int updn_bfs_by_node(IN osm_log_t * p_log, IN osm_subn_t * p_subn,
 					"Avoiding move from 0x%016" PRIx64
 					" to 0x%016" PRIx64 "\n",
 					cl_ntoh64(osm_node_get_node_guid(u->sw->p_node)),
-					cl_ntoh64(osm_node_get_node_guid(p_remote_node)));
+					cl_ntoh64(osm_node_get_node_guid(rem_u->sw->p_node)));
 				/* Illegal step */
 				continue;
 			}
 			/* Set MinHop value for the current lid */
 			current_min_hop = osm_switch_get_least_hops(u->sw, lid);
-			/* Check hop count if better insert into list && update
+			/* Check hop count if better insert into queue && update
 			   the remote node Min Hop Table */
 			remote_min_hop =
-			    osm_switch_get_hop_count(p_remote_sw, lid, pn_rem);
+			    osm_switch_get_hop_count(rem_u->sw, lid, pn_rem);
 			if (current_min_hop + 1 < remote_min_hop) {
 				set_hop_return_value =
-				    osm_switch_set_hops(p_remote_sw, lid,
+				    osm_switch_set_hops(rem_u->sw, lid,
 							pn_rem,
 							current_min_hop + 1);
 				if (set_hop_return_value) {
@@ -189,12 +213,14 @@ static int updn_bfs_by_node(IN osm_log_t * p_log, IN osm_subn_t * p_subn,
 						set_hop_return_value);
 				}
 				/* Check if remote port has already been visited */
-				if (!rem_u->visited) {
-					/* Insert updn_switch item into the list */
-					rem_u->dir = next_dir;
-					rem_u->visited = 1;
-					cl_qlist_insert_tail(&list,
-							     &rem_u->list);
+				if (!s->visited[l->node]) {
+					/* Insert updn_switch item into the queue */
+					s->dir[l->node] = next_dir;
+					s->visited[l->node] = 1;
+					s->queue[tail] = l->node;
+					if (++tail == g->num_nodes)
+						tail = 0;
+					queued++;
 				}
 			}
 		}
@@ -204,6 +230,85 @@ static int updn_bfs_by_node(IN osm_log_t * p_log, IN osm_subn_t * p_subn,
 	return 0;
 }
 
+static void updn_bfs_work(IN void *context, IN unsigned item,
+			  IN unsigned worker)
+{
+	updn_bfs_work_t *work = context;
+
+	updn_bfs_by_node(work->p_log, work->g, &work->scratch[worker], item);
+}
+
+static void updn_graph_free(IN updn_graph_t * g)
+{
+	free(g->nodes);
+	free(g->link_start);
+	free(g->links);
+	memset(g, 0, sizeof(*g));
+}
+
+/* Build the compact switch adjacency the min hop BFS runs on */
+static int updn_graph_build(IN updn_t * p_updn, OUT updn_graph_t * g)
+{
+	cl_qmap_t *p_sw_tbl = &p_updn->p_osm->subn.sw_guid_tbl;
+	cl_map_item_t *item;
+	osm_node_t *p_remote_node;
+	struct updn_node *u;
+	unsigned i, num_links = 0;
+	uint8_t pn, pn_rem;
+
+	memset(g, 0, sizeof(*g));
+	g->num_nodes = cl_qmap_count(p_sw_tbl);
+	if (!g->num_nodes)
+		return 0;
+
+	g->nodes = malloc(g->num_nodes * sizeof(g->nodes[0]));
+	g->link_start = malloc((g->num_nodes + 1) * sizeof(g->link_start[0]));
+	if (!g->nodes || !g->link_start)
+		goto Error;
+
+	for (i = 0, item = cl_qmap_head(p_sw_tbl); item != cl_qmap_end(p_sw_tbl);
+	     item = cl_qmap_next(item), i++) {
+		u = ((osm_switch_t *) item)->priv;
+		u->index = i;
+		g->nodes[i] = u;
+		for (pn = 1; pn < u->sw->num_ports; pn++) {
+			p_remote_node =
+			    osm_node_get_remote_node(u->sw->p_node, pn, &pn_rem);
+			if (p_remote_node && p_remote_node->sw)
+				num_links++;
+		}
+	}
+
+	g->links = malloc((num_links ? num_links : 1) * sizeof(g->links[0]));
+	if (!g->links)
+		goto Error;
+
+	num_links = 0;
+	for (i = 0; i < g->num_nodes; i++) {
+		u = g->nodes[i];
+		g->link_start[i] = num_links;
+		for (pn = 1; pn < u->sw->num_ports; pn++) {
+			p_remote_node =
+			    osm_node_get_remote_node(u->sw->p_node, pn, &pn_rem);
+			/* If no remote node OR remote node is not a SWITCH
+			   continue to next pn */
+			if (!p_remote_node || !p_remote_node->sw)
+				continue;
+			g->links[num_links].node =
+			    ((struct updn_node *)p_remote_node->sw->priv)->index;
+			g->links[num_links].port_num = pn;
+			g->links[num_links].remote_port_num = pn_rem;
+			num_links++;
+		}
+	}
+	g->link_start[g->num_nodes] = num_links;
+	return 0;
+
+Error:
+	updn_graph_free(g);
+	return -1;
+}
+
 /* NOTE : PLS check if we need to decide that the first */
 /*        rank is a SWITCH for BFS purpose */
 static int updn_subn_rank(IN updn_t * p_updn)
@@ -288,12 +393,12 @@ static void updn_clear_non_root_hops(updn_t * updn, osm_switch_t * sw)
 	unsigned i;
 
 	for (i = 0; i < sw->num_hops; i++)
-		if (sw->hops[i]) {
+		if (osm_switch_get_least_hops(sw, i) != OSM_NO_PATH) {
 			port = osm_get_port_by_lid_ho(&updn->p_osm->subn, i);
 			if (!port || !port->p_node->sw
 			    || ((struct updn_node *)port->p_node->sw->priv)->
 			    rank != 0)
-				memset(sw->hops[i], 0xff, sw->num_ports);
+				osm_switch_clear_lid_hops(sw, i);
 		}
 }
 
@@ -301,8 +406,14 @@ static int updn_set_min_hop_table(IN updn_t * p_updn)
 {
 	osm_subn_t *p_subn = &p_updn->p_osm->subn;
 	osm_log_t *p_log = &p_updn->p_osm->log;
+	osm_ucast_mgr_t *p_mgr = &p_updn->p_osm->sm.ucast_mgr;
 	osm_switch_t *p_sw;
 	cl_map_item_t *item;
+	updn_graph_t g;
+	updn_bfs_work_t work;
+	updn_bfs_scratch_t *scratch = NULL;
+	unsigned i, num_workers;
+	int ret = -1;
 
 	OSM_LOG_ENTER(p_log);
 
@@ -325,22 +436,72 @@ static int updn_set_min_hop_table(IN updn_t * p_updn)
 	OSM_LOG(p_log, OSM_LOG_VERBOSE,
 		"Init Min Hop Table of all switches ]\n");
 
+	if (updn_graph_build(p_updn, &g)) {
+		OSM_LOG(p_log, OSM_LOG_ERROR, "ERR AA15: "
+			"cannot allocate the switch graph\n");
+		goto _exit;
+	}
+
+	if (!g.num_nodes) {
+		/* no switches, nothing to route */
+		ret = 0;
+		goto _free;
+	}
+
+	num_workers = osm_ucast_mgr_num_workers(p_mgr);
+	if (num_workers > 1 && p_subn->opt.packed_lid_matrix) {
+		/* widening a packed matrix reallocates every row */
+		OSM_LOG(p_log, OSM_LOG_VERBOSE,
+			"Packed LID matrices in use, "
+			"running the UPDN BFS on a single thread\n");
+		num_workers = 1;
+	}
+	if (num_workers > g.num_nodes)
+		num_workers = g.num_nodes;
+
+	scratch = calloc(num_workers, sizeof(*scratch));
+	if (!scratch)
+		goto _no_mem;
+	for (i = 0; i < num_workers; i++) {
+		scratch[i].dir = malloc(g.num_nodes);
+		scratch[i].visited = calloc(g.num_nodes, 1);
+		scratch[i].queue = malloc(g.num_nodes *
+					  sizeof(scratch[i].queue[0]));
+		if (!scratch[i].dir || !scratch[i].visited || !scratch[i].queue)
+			goto _no_mem;
+	}
+
 	/* Now do the BFS for each port  in the subnet */
 	OSM_LOG(p_log, OSM_LOG_VERBOSE,
 		"BFS through all port guids in the subnet [\n");
 
-	for (item = cl_qmap_head(&p_updn->p_osm->subn.sw_guid_tbl);
-	     item != cl_qmap_end(&p_updn->p_osm->subn.sw_guid_tbl);
-	     item = cl_qmap_next(item)) {
-		p_sw = (osm_switch_t *)item;
-		updn_bfs_by_node(p_log, p_subn, p_sw);
-	}
+	work.p_log = p_log;
+	work.g = &g;
+	work.scratch = scratch;
+	osm_ucast_mgr_parallel_for(p_mgr, g.num_nodes, num_workers,
+				   updn_bfs_work, &work);
 
 	OSM_LOG(p_log, OSM_LOG_VERBOSE,
 		"BFS through all port guids in the subnet ]\n");
+	ret = 0;
+	goto _free;
+
+_no_mem:
+	OSM_LOG(p_log, OSM_LOG_ERROR, "ERR AA16: "
+		"cannot allocate the BFS state of %u threads\n", num_workers);
+_free:
 	/* Cleanup */
+	if (scratch)
+		for (i = 0; i < num_workers; i++) {
+			free(scratch[i].dir);
+			free(scratch[i].visited);
+			free(scratch[i].queue);
+		}
+	free(scratch);
+	updn_graph_free(&g);
+_exit:
 	OSM_LOG_EXIT(p_log);
-	return 0;
+	return ret;
 }
 
 static int updn_build_lid_matrices(IN updn_t * p_updn)